@@ -0,0 +1,307 @@
+/*
+AutoTuner.cpp - - Speed and acceleration tuning from the StallGuard margin - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the AutoTuner library.
+
+AutoTuner library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AutoTuner library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AutoTuner library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "AutoTuner.h"
+
+//------------------------------------------------------------------------------
+// Constructors
+AutoTuner::AutoTuner(StepperControl *motor)
+{
+  this->motor = motor;
+  this->driver = NULL;
+  this->state = AT_IDLE;
+  this->level = 0;
+  this->minimumResult = AT_DEFAULT_MIN_RESULT;
+  this->minimumPosition = AT_DEFAULT_MIN_POSITION;
+  this->maximumPosition = AT_DEFAULT_MAX_POSITION;
+  this->testSpeed = 0;
+  this->testAcceleration = 0;
+  this->testDistance = 0;
+  this->testDirection = 1;
+  this->rampSteps = 0;
+  this->startPosition = 0;
+  this->passedSpeed = 0;
+  this->passedAcceleration = 0;
+  this->speedLimit = 0;
+  this->acceleration = 0;
+  this->savedTargetSpeed = 0;
+  this->savedAcceleration = 0;
+  this->savedSpeedLimit = 0;
+  this->savedAccelerationLimit = 0;
+  this->savedMoveMode = SC_MOVEMODE_SMOOTH;
+  this->savedSlewStepMode = SC_NO_STEP_MODE;
+  this->savedStealthChopMaxSpeed = 0;
+  this->pollTimestamp = 0;
+  this->stallGuardTimestamp = 0;
+  this->stallDetector.setThreshold(AT_STALL_THRESHOLD);
+}
+
+//------------------------------------------------------------------------------
+// Setters
+
+// Lowest StallGuard reading accepted during a test move.
+// Higher values give more margin for heavy loads.
+void AutoTuner::setMinimumResult(uint16_t minimumResult)
+{
+  this->minimumResult = minimumResult;
+}
+
+// Positions the test moves should not leave
+void AutoTuner::setTravelRange(long minimumPosition, long maximumPosition)
+{
+  this->minimumPosition = minimumPosition;
+  this->maximumPosition = maximumPosition;
+}
+
+//------------------------------------------------------------------------------
+// Getters
+
+int AutoTuner::getState()
+{
+  return this->state;
+}
+
+int AutoTuner::getLevel()
+{
+  return this->level;
+}
+
+// Result of the last tuning in full steps per second
+unsigned long AutoTuner::getSpeedLimit()
+{
+  return this->speedLimit;
+}
+
+// Result of the last tuning in full steps per second every 50ms
+unsigned long AutoTuner::getAcceleration()
+{
+  return this->acceleration;
+}
+
+//------------------------------------------------------------------------------
+// Other public members
+
+bool AutoTuner::start()
+{
+  this->driver = this->motor->getDriver();
+  if (this->driver == NULL || this->isRunning() || this->motor->isInMove())
+  {
+    return false;
+  }
+
+  this->savedTargetSpeed = this->motor->getRequestedSpeed();
+  this->savedAcceleration = this->motor->getAcceleration();
+  this->savedSpeedLimit = this->motor->getSpeedLimit();
+  this->savedAccelerationLimit = this->motor->getAccelerationLimit();
+  this->savedMoveMode = this->motor->getMoveMode();
+  this->savedSlewStepMode = this->motor->getSlewStepMode();
+  this->savedStealthChopMaxSpeed = this->driver->getStealthChopMaxSpeed();
+
+  // StallGuard is only available in StealthChop
+  this->driver->setStealthChopMaxSpeed(0);
+  this->driver->setStallGuardThreshold(0);
+  this->motor->setSpeedLimit(0);
+  this->motor->setAccelerationLimit(0);
+  this->motor->setMoveMode(SC_MOVEMODE_SMOOTH);
+  // The limits are measured in the step mode in use
+  this->motor->setSlewStepMode(SC_NO_STEP_MODE);
+
+  this->startPosition = this->motor->getCurrentPosition();
+  this->passedSpeed = 0;
+  this->passedAcceleration = 0;
+  this->level = 0;
+  this->startLevel();
+  return true;
+}
+
+void AutoTuner::abort()
+{
+  if (this->isRunning())
+  {
+    this->motor->stopMovement();
+    this->finish(AT_FAILED);
+  }
+}
+
+bool AutoTuner::isRunning()
+{
+  return this->state == AT_MOVE_OUT || this->state == AT_MOVE_BACK;
+}
+
+void AutoTuner::Manage()
+{
+  // This procedure should be called regularly.
+  if (!this->isRunning())
+  {
+    return;
+  }
+
+  this->pollStallGuard();
+  if (this->stallDetector.isStalled())
+  {
+    // The position is lost, the limits of the previous level are kept
+    this->motor->stopMovement();
+    this->motor->invalidatePosition();
+    this->finish(this->level > 0 ? AT_DONE : AT_FAILED);
+    return;
+  }
+
+  if (this->motor->isInMove())
+  {
+    return;
+  }
+
+  if (this->state == AT_MOVE_OUT)
+  {
+    this->state = AT_MOVE_BACK;
+    this->startTestMove(this->startPosition);
+    return;
+  }
+
+  if (this->stallDetector.getMinimumResult() == SD_NO_RESULT ||
+      this->stallDetector.getMinimumResult() < this->minimumResult)
+  {
+    this->finish(this->level > 0 ? AT_DONE : AT_FAILED);
+    return;
+  }
+
+  this->passedSpeed = this->testSpeed / StepperControl::getMicrosteps(this->motor->getStepMode());
+  this->passedAcceleration = this->testAcceleration / StepperControl::getMicrosteps(this->motor->getStepMode());
+  this->level++;
+  if (this->level >= AT_LEVEL_COUNT)
+  {
+    this->finish(AT_DONE);
+    return;
+  }
+  this->startLevel();
+}
+
+//------------------------------------------------------------------------------
+// Private
+
+void AutoTuner::startLevel()
+{
+  float factor;
+  long room;
+  unsigned int microsteps = StepperControl::getMicrosteps(this->motor->getStepMode());
+
+  // The speeds inside a resonance band are never cruised, they are not tested
+  while (this->motor->isInResonanceBand((unsigned int)(AT_START_SPEED * pow(AT_LEVEL_FACTOR, this->level)) * microsteps))
+  {
+    this->level++;
+  }
+  factor = pow(AT_LEVEL_FACTOR, this->level);
+  this->testSpeed = (unsigned int)(AT_START_SPEED * factor) * microsteps;
+  this->testAcceleration = this->testSpeed / AT_RAMP_INCREMENTS;
+  this->motor->setSpeed(this->testSpeed);
+  this->motor->setAcceleration(this->testAcceleration);
+  if (this->motor->getTargetSpeed() < this->testSpeed)
+  {
+    // Maximum speed of the step mode reached
+    this->finish(this->level > 0 ? AT_DONE : AT_FAILED);
+    return;
+  }
+
+  // The ramp takes AT_RAMP_INCREMENTS * 50ms, the readings are ignored there.
+  // StallGuard is only active above the CoolStep threshold.
+  this->rampSteps = (long)this->testSpeed * AT_RAMP_INCREMENTS * 50 / 2000;
+  this->testDistance = 2 * this->rampSteps + (long)this->testSpeed * AT_CRUISE_TIME / 1000;
+
+  // The test move goes where the travel leaves the most room, shortened if needed
+  room = this->maximumPosition - this->startPosition;
+  this->testDirection = 1;
+  if (room < this->testDistance && this->startPosition - this->minimumPosition > room)
+  {
+    room = this->startPosition - this->minimumPosition;
+    this->testDirection = -1;
+  }
+  if (room < 2 * this->rampSteps + (long)this->testSpeed * AT_MIN_CRUISE_TIME / 1000)
+  {
+    this->finish(this->level > 0 ? AT_DONE : AT_FAILED);
+    return;
+  }
+  this->testDistance = min(this->testDistance, room);
+
+  this->stallDetector.setBlankingSteps(this->rampSteps);
+  this->driver->setCoolStepMinSpeed(this->testSpeed / 2 / microsteps);
+
+  this->state = AT_MOVE_OUT;
+  this->startTestMove(this->startPosition + this->testDirection * this->testDistance);
+}
+
+void AutoTuner::startTestMove(long position)
+{
+  this->stallDetector.reset();
+  this->stallGuardTimestamp = this->driver->getStatusTimestamp(TMC2209_STATUS_SG_RESULT);
+  this->pollTimestamp = millis();
+  this->motor->startAutomaticMove(position);
+}
+
+void AutoTuner::pollStallGuard()
+{
+  long distance;
+
+  if (this->driver->getStatusTimestamp(TMC2209_STATUS_SG_RESULT) != this->stallGuardTimestamp)
+  {
+    this->stallGuardTimestamp = this->driver->getStatusTimestamp(TMC2209_STATUS_SG_RESULT);
+    // Only the cruise part is measured: the end of the move is blanked too
+    distance = abs(this->motor->getTargetPosition() - this->motor->getCurrentPosition());
+    if (this->motor->isInMove() && distance > this->rampSteps)
+    {
+      this->stallDetector.update(this->driver->getStatusRegister(TMC2209_STATUS_SG_RESULT),
+                                 this->testDistance - distance);
+    }
+  }
+  if (this->motor->isInMove() && this->driver->isBusIdle() &&
+      (millis() - this->pollTimestamp) >= AT_POLL_INTERVAL)
+  {
+    this->driver->requestRead(TMC2209_REG_SG_RESULT);
+    this->pollTimestamp = millis();
+  }
+}
+
+void AutoTuner::finish(int state)
+{
+  this->driver->setStealthChopMaxSpeed(this->savedStealthChopMaxSpeed);
+  this->driver->setCoolStepMinSpeed(0);
+  this->motor->setMoveMode(this->savedMoveMode);
+  this->motor->setSlewStepMode(this->savedSlewStepMode);
+
+  if (state == AT_DONE)
+  {
+    this->speedLimit = (unsigned long)(this->passedSpeed * AT_SAFETY_FACTOR);
+    this->acceleration = max((unsigned long)(this->passedAcceleration * AT_SAFETY_FACTOR), 1UL);
+    this->motor->setSpeedLimit(this->speedLimit);
+    this->motor->setAccelerationLimit(this->acceleration);
+    this->motor->setAcceleration(this->acceleration * StepperControl::getMicrosteps(this->motor->getStepMode()));
+  }
+  else
+  {
+    this->motor->setSpeedLimit(this->savedSpeedLimit);
+    this->motor->setAccelerationLimit(this->savedAccelerationLimit);
+    this->motor->setAcceleration(this->savedAcceleration);
+  }
+  this->motor->setSpeed(this->savedTargetSpeed);
+  this->state = state;
+}
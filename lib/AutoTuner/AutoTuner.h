@@ -0,0 +1,133 @@
+/*
+AutoTuner.h - - Speed and acceleration tuning from the StallGuard margin - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+The tuning runs a series of test moves (out and back) with a rising top
+speed and acceleration. During the cruise part of each move the StallGuard
+result of the TMC2209 is polled: the lower it is, the closer the motor is
+to a stall. A level passes if the lowest reading stays above
+AT_DEFAULT_MIN_RESULT. The tuning stops at the first level which fails,
+and the limits of the last level passed, reduced by AT_SAFETY_FACTOR,
+become the limits of the focuser.
+
+StallGuard only works in StealthChop, the switch to SpreadCycle is
+disabled during the tuning. The test moves stay inside the travel range:
+they go outward, or inward when the room is missing, and are shortened
+down to AT_MIN_CRUISE_TIME of cruise. A stall loses the position, the
+focuser should then be homed again (SC_HOMING_LOST).
+
+The limits found are both in full steps, so they stay valid when the step
+mode changes.
+
+This file is part of the AutoTuner library.
+
+AutoTuner library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+AutoTuner library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AutoTuner library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef AutoTuner_h
+#define AutoTuner_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include "StepperControl.h"
+#include "StallDetector.h"
+
+#define AT_IDLE 0
+#define AT_MOVE_OUT 1
+#define AT_MOVE_BACK 2
+#define AT_DONE 3
+#define AT_FAILED 4
+
+#define AT_START_SPEED 100          // full steps per second
+#define AT_LEVEL_FACTOR 1.25        // speed and acceleration increase per level
+#define AT_LEVEL_COUNT 12
+#define AT_RAMP_INCREMENTS 10       // acceleration increments to reach the top speed
+#define AT_CRUISE_TIME 250          // ms at top speed per test move
+#define AT_MIN_CRUISE_TIME 50       // ms, shortest cruise when the travel is short
+#define AT_DEFAULT_MIN_POSITION 0
+#define AT_DEFAULT_MAX_POSITION 0xFFFF // Moonlite positions have 4 hex digits
+#define AT_DEFAULT_MIN_RESULT 100   // lowest StallGuard reading accepted
+#define AT_STALL_THRESHOLD 10       // SG_RESULT <= 20 is a stall
+#define AT_SAFETY_FACTOR 0.8
+#define AT_POLL_INTERVAL 2          // ms between two StallGuard readings
+
+class AutoTuner
+{
+ public:
+  // Constructors:
+  AutoTuner(StepperControl *motor);
+
+  // Setters:
+  void setMinimumResult(uint16_t minimumResult);
+  void setTravelRange(long minimumPosition, long maximumPosition);
+
+  // Getters:
+  int getState();
+  int getLevel();
+  unsigned long getSpeedLimit();
+  unsigned long getAcceleration();
+
+  // Other public members
+  bool start();
+  void abort();
+  bool isRunning();
+  void Manage();
+
+ private:
+  StepperControl *motor;
+  TMC2209 *driver;
+  StallDetector stallDetector;
+  int state;
+  int level;
+  uint16_t minimumResult;
+  long minimumPosition;
+  long maximumPosition;
+
+  unsigned int testSpeed;         // microsteps per second
+  unsigned int testAcceleration;
+  long testDistance;
+  int testDirection;              // 1 outward, -1 inward
+  long rampSteps;
+  long startPosition;
+  unsigned long passedSpeed;      // full steps per second
+  unsigned long passedAcceleration; // full steps per second every 50ms
+  unsigned long speedLimit;
+  unsigned long acceleration;
+
+  unsigned int savedTargetSpeed;
+  unsigned int savedAcceleration;
+  unsigned long savedSpeedLimit;
+  unsigned long savedAccelerationLimit;
+  int savedMoveMode;
+  int savedSlewStepMode;
+  unsigned long savedStealthChopMaxSpeed;
+
+  unsigned long pollTimestamp;
+  unsigned long stallGuardTimestamp;
+
+  void startLevel();
+  void startTestMove(long position);
+  void pollStallGuard();
+  void finish(int state);
+};
+
+#endif //AutoTuner_h
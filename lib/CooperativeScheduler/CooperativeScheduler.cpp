@@ -0,0 +1,276 @@
+/*
+CooperativeScheduler.cpp - - Static cooperative task scheduler - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the CooperativeScheduler library.
+
+CooperativeScheduler library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CooperativeScheduler library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CooperativeScheduler library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "CooperativeScheduler.h"
+
+//-----------------------------------------------------------------------------
+// Constructors
+
+CooperativeScheduler::CooperativeScheduler()
+{
+  this->taskCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Getters
+
+int CooperativeScheduler::getTaskCount()
+{
+  return this->taskCount;
+}
+
+const char *CooperativeScheduler::getTaskName(int task)
+{
+  CooperativeTask_t *t = this->getTask(task);
+  return t == NULL ? NULL : t->name;
+}
+
+unsigned long CooperativeScheduler::getRunCount(int task)
+{
+  CooperativeTask_t *t = this->getTask(task);
+  return t == NULL ? 0 : t->runCount;
+}
+
+// Number of runs longer than the budget
+unsigned long CooperativeScheduler::getOverrunCount(int task)
+{
+  CooperativeTask_t *t = this->getTask(task);
+  return t == NULL ? 0 : t->overrunCount;
+}
+
+unsigned long CooperativeScheduler::getMaxExecutionTime(int task)
+{
+  CooperativeTask_t *t = this->getTask(task);
+  return t == NULL ? 0 : t->maxExecutionTime;
+}
+
+// Highest delay between the deadline and the start of a run
+unsigned long CooperativeScheduler::getMaxLateness(int task)
+{
+  CooperativeTask_t *t = this->getTask(task);
+  return t == NULL ? 0 : t->maxLateness;
+}
+
+// Time in us until the first scheduled one-shot task is due,
+// CS_NO_DEADLINE when none is scheduled. The periodic tasks poll, they do
+// not need the CPU awake.
+unsigned long CooperativeScheduler::getTimeToNextOneShotTask()
+{
+  unsigned long now = micros();
+  unsigned long timeToDeadline = CS_NO_DEADLINE;
+  int i;
+
+  for (i = 0; i < this->taskCount; i++)
+  {
+    if (!this->tasks[i].isOneShot || !this->tasks[i].isActive)
+    {
+      continue;
+    }
+    if ((long)(now - this->tasks[i].deadline) >= 0)
+    {
+      return 0;
+    }
+    timeToDeadline = min(timeToDeadline, this->tasks[i].deadline - now);
+  }
+  return timeToDeadline;
+}
+
+//-----------------------------------------------------------------------------
+// Other public members
+
+// Return the id of the task or CS_NO_TASK if the table is full.
+// The period and the budget are in us. The first run is due now.
+int CooperativeScheduler::addPeriodicTask(const char *name, CooperativeTaskCallback_t callback,
+                                          unsigned long period, int priority, unsigned long budget)
+{
+  return this->addTask(name, callback, period, priority, budget, false);
+}
+
+// The task only runs once schedule() is called
+int CooperativeScheduler::addOneShotTask(const char *name, CooperativeTaskCallback_t callback,
+                                         int priority, unsigned long budget)
+{
+  return this->addTask(name, callback, 0, priority, budget, true);
+}
+
+// Run the task once delay us from now (one-shot), or restart the period
+// from now + delay (periodic)
+void CooperativeScheduler::schedule(int task, unsigned long delay)
+{
+  CooperativeTask_t *t = this->getTask(task);
+
+  if (t == NULL)
+  {
+    return;
+  }
+  t->deadline = micros() + delay;
+  t->isActive = true;
+}
+
+void CooperativeScheduler::cancel(int task)
+{
+  CooperativeTask_t *t = this->getTask(task);
+
+  if (t != NULL)
+  {
+    t->isActive = false;
+  }
+}
+
+bool CooperativeScheduler::isScheduled(int task)
+{
+  CooperativeTask_t *t = this->getTask(task);
+  return t != NULL && t->isActive;
+}
+
+void CooperativeScheduler::resetStatistics()
+{
+  int i;
+
+  for (i = 0; i < this->taskCount; i++)
+  {
+    this->tasks[i].runCount = 0;
+    this->tasks[i].overrunCount = 0;
+    this->tasks[i].maxExecutionTime = 0;
+    this->tasks[i].maxLateness = 0;
+  }
+}
+
+void CooperativeScheduler::Manage()
+{
+  // This procedure should be called regularly (it is the body of loop()).
+  // Every due task runs once, the highest priority first.
+  unsigned long now;
+  int i;
+
+  for (i = 0; i < this->taskCount; i++)
+  {
+    if (!this->tasks[i].isActive)
+    {
+      continue;
+    }
+    now = micros();
+    if ((long)(now - this->tasks[i].deadline) >= 0)
+    {
+      this->runTask(&this->tasks[i], now);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Private
+
+int CooperativeScheduler::addTask(const char *name, CooperativeTaskCallback_t callback,
+                                  unsigned long period, int priority, unsigned long budget, bool isOneShot)
+{
+  int position;
+  int id;
+  int i;
+
+  if (this->taskCount >= CS_MAX_TASKS || callback == NULL)
+  {
+    return CS_NO_TASK;
+  }
+
+  // Keep the table sorted by priority, in order of insertion for the
+  // same priority
+  position = this->taskCount;
+  while (position > 0 && this->tasks[position - 1].priority < priority)
+  {
+    this->tasks[position] = this->tasks[position - 1];
+    position--;
+  }
+  id = this->taskCount;
+  for (i = 0; i < id; i++)
+  {
+    if (this->taskIds[i] >= position)
+    {
+      this->taskIds[i]++;
+    }
+  }
+  this->taskIds[id] = position;
+  this->taskCount++;
+
+  this->tasks[position].name = name;
+  this->tasks[position].callback = callback;
+  this->tasks[position].priority = priority;
+  this->tasks[position].period = period;
+  this->tasks[position].budget = budget;
+  this->tasks[position].deadline = micros();
+  this->tasks[position].isOneShot = isOneShot;
+  this->tasks[position].isActive = !isOneShot;
+  this->tasks[position].runCount = 0;
+  this->tasks[position].overrunCount = 0;
+  this->tasks[position].maxExecutionTime = 0;
+  this->tasks[position].maxLateness = 0;
+  return id;
+}
+
+CooperativeTask_t *CooperativeScheduler::getTask(int task)
+{
+  if (task < 0 || task >= this->taskCount)
+  {
+    return NULL;
+  }
+  return &this->tasks[this->taskIds[task]];
+}
+
+void CooperativeScheduler::runTask(CooperativeTask_t *task, unsigned long now)
+{
+  unsigned long lateness = now - task->deadline;
+  unsigned long executionTime;
+
+  if (task->isOneShot)
+  {
+    task->isActive = false;
+  }
+  else if (task->period == 0 || lateness >= task->period)
+  {
+    // Continuous task, or a whole period was missed
+    task->deadline = now + task->period;
+  }
+  else
+  {
+    // Keep the phase of the period
+    task->deadline += task->period;
+  }
+
+  task->callback();
+
+  executionTime = micros() - now;
+  task->runCount++;
+  if (executionTime > task->budget)
+  {
+    task->overrunCount++;
+  }
+  if (executionTime > task->maxExecutionTime)
+  {
+    task->maxExecutionTime = executionTime;
+  }
+  // A continuous task is always due, its lateness has no meaning
+  if (task->period != 0 && lateness > task->maxLateness)
+  {
+    task->maxLateness = lateness;
+  }
+}
@@ -0,0 +1,114 @@
+/*
+CooperativeScheduler.h - - Static cooperative task scheduler - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+The tasks are plain functions called from Manage(). Nothing is preempted:
+a task must return quickly and keep its state between two calls.
+
+A periodic task runs every period (0: on every Manage()). A one-shot task
+runs once after its delay and can be scheduled again. The tasks are kept
+sorted by priority, the highest first: each Manage() runs every due task
+once in that order.
+
+Each task has an execution time budget. A run longer than the budget is
+counted as an overrun. The lateness of a run is the time between its
+deadline and its start. A periodic task which missed a whole period (e.g.
+during a light sleep) starts again from the current time instead of
+running several times in a row.
+
+The table is static (CS_MAX_TASKS entries), no memory is allocated.
+
+This file is part of the CooperativeScheduler library.
+
+CooperativeScheduler library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+CooperativeScheduler library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with CooperativeScheduler library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef CooperativeScheduler_h
+#define CooperativeScheduler_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#define CS_MAX_TASKS 12
+#define CS_NO_TASK -1
+#define CS_NO_DEADLINE 0xFFFFFFFF
+
+#define CS_PRIORITY_LOW 0
+#define CS_PRIORITY_NORMAL 1
+#define CS_PRIORITY_HIGH 2
+#define CS_PRIORITY_REALTIME 3
+
+typedef void (*CooperativeTaskCallback_t)();
+
+typedef struct CooperativeTask_s
+{
+  const char *name;
+  CooperativeTaskCallback_t callback;
+  int priority;
+  unsigned long period;           // us, 0 for every Manage()
+  unsigned long budget;           // us
+  unsigned long deadline;         // micros() of the next run
+  bool isOneShot;
+  bool isActive;
+  unsigned long runCount;
+  unsigned long overrunCount;
+  unsigned long maxExecutionTime; // us
+  unsigned long maxLateness;      // us
+} CooperativeTask_t;
+
+class CooperativeScheduler
+{
+ public:
+  // Constructors:
+  CooperativeScheduler();
+
+  // Getters:
+  int getTaskCount();
+  const char *getTaskName(int task);
+  unsigned long getRunCount(int task);
+  unsigned long getOverrunCount(int task);
+  unsigned long getMaxExecutionTime(int task);
+  unsigned long getMaxLateness(int task);
+  unsigned long getTimeToNextOneShotTask();
+
+  // Other public members
+  int addPeriodicTask(const char *name, CooperativeTaskCallback_t callback,
+                      unsigned long period, int priority, unsigned long budget);
+  int addOneShotTask(const char *name, CooperativeTaskCallback_t callback,
+                     int priority, unsigned long budget);
+  void schedule(int task, unsigned long delay);
+  void cancel(int task);
+  bool isScheduled(int task);
+  void resetStatistics();
+  void Manage();
+
+ private:
+  CooperativeTask_t tasks[CS_MAX_TASKS];
+  int taskCount;
+  int taskIds[CS_MAX_TASKS]; // Position in tasks[] of each task id
+
+  int addTask(const char *name, CooperativeTaskCallback_t callback,
+              unsigned long period, int priority, unsigned long budget, bool isOneShot);
+  CooperativeTask_t *getTask(int task);
+  void runTask(CooperativeTask_t *task, unsigned long now);
+};
+
+#endif //CooperativeScheduler_h
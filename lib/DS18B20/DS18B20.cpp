@@ -0,0 +1,167 @@
+/*
+DS18B20.cpp - - DS18B20 1-Wire temperature sensor library - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the DS18B20 library.
+
+DS18B20 library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DS18B20 library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with DS18B20 library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "DS18B20.h"
+
+//-----------------------------------------------------------------------------
+// Constructors
+
+DS18B20::DS18B20(int dataPin) : TemperatureSensor(), bus(dataPin)
+{
+  this->resolution = DS18B20_RESOLUTION_12BIT;
+  this->sensorIsPresent = false;
+  this->conversionStart = 0;
+  this->transferStep = DS18B20_TRANSFER_NONE;
+  this->scratchpadIndex = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Setters
+
+// Should be called before init()
+void DS18B20::setResolution(int resolution)
+{
+  this->resolution = constrain(resolution, DS18B20_RESOLUTION_9BIT, DS18B20_RESOLUTION_12BIT);
+}
+
+//-----------------------------------------------------------------------------
+// Getters
+
+int DS18B20::getResolution()
+{
+  return this->resolution;
+}
+
+//-----------------------------------------------------------------------------
+// Public Members
+
+bool DS18B20::init()
+{
+  this->sensorIsPresent = this->bus.reset();
+  if (!this->sensorIsPresent)
+  {
+    return false;
+  }
+
+  // Alarm registers are not used, only the configuration register is written
+  this->bus.skip();
+  this->bus.write(DS18B20_CMD_WRITE_SCRATCHPAD);
+  this->bus.write(0x00);
+  this->bus.write(0x00);
+  this->bus.write(((this->resolution - DS18B20_RESOLUTION_9BIT) << 5) | 0x1F);
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Protected
+
+// Called on every Manage(): one step of the bus transfer per call
+void DS18B20::sample()
+{
+  int count;
+
+  switch (this->transferStep)
+  {
+    case DS18B20_TRANSFER_CONVERT_RESET:
+      this->sensorIsPresent = this->bus.reset();
+      this->transferStep = this->sensorIsPresent ? DS18B20_TRANSFER_CONVERT_COMMAND : DS18B20_TRANSFER_DONE;
+      break;
+    case DS18B20_TRANSFER_CONVERT_COMMAND:
+      this->bus.skip();
+      this->bus.write(DS18B20_CMD_CONVERT_T);
+      this->conversionStart = millis();
+      this->transferStep = DS18B20_TRANSFER_WAIT;
+      break;
+    case DS18B20_TRANSFER_WAIT:
+      if ((millis() - this->conversionStart) >= this->getConversionTime())
+      {
+        this->transferStep = DS18B20_TRANSFER_READ_RESET;
+      }
+      break;
+    case DS18B20_TRANSFER_READ_RESET:
+      this->sensorIsPresent = this->bus.reset();
+      this->transferStep = this->sensorIsPresent ? DS18B20_TRANSFER_READ_COMMAND : DS18B20_TRANSFER_DONE;
+      break;
+    case DS18B20_TRANSFER_READ_COMMAND:
+      this->bus.skip();
+      this->bus.write(DS18B20_CMD_READ_SCRATCHPAD);
+      this->scratchpadIndex = 0;
+      this->transferStep = DS18B20_TRANSFER_READ_DATA;
+      break;
+    case DS18B20_TRANSFER_READ_DATA:
+      for (count = 0; count < DS18B20_BYTES_PER_CALL && this->scratchpadIndex < DS18B20_SCRATCHPAD_SIZE; count++)
+      {
+        this->scratchpad[this->scratchpadIndex++] = this->bus.read();
+      }
+      if (this->scratchpadIndex >= DS18B20_SCRATCHPAD_SIZE)
+      {
+        this->transferStep = DS18B20_TRANSFER_DONE;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void DS18B20::beginConversion()
+{
+  // The Convert T command is sent by the next Manage()
+  this->scratchpadIndex = 0;
+  this->transferStep = DS18B20_TRANSFER_CONVERT_RESET;
+}
+
+bool DS18B20::isConversionDone()
+{
+  // A missing sensor is reported by readConversion()
+  return this->transferStep == DS18B20_TRANSFER_DONE;
+}
+
+// The scratchpad is already read, nothing is sent on the bus
+bool DS18B20::readConversion(float *temperature)
+{
+  this->transferStep = DS18B20_TRANSFER_NONE;
+  if (!this->sensorIsPresent || this->scratchpadIndex < DS18B20_SCRATCHPAD_SIZE)
+  {
+    return false;
+  }
+  if (OneWire::crc8(this->scratchpad, DS18B20_SCRATCHPAD_SIZE - 1) != this->scratchpad[DS18B20_SCRATCHPAD_SIZE - 1])
+  {
+    return false;
+  }
+
+  // 1/16 C° per LSB, the unused low bits are undefined for lower resolutions
+  int16_t raw = (int16_t)((this->scratchpad[1] << 8) | this->scratchpad[0]);
+  raw &= ~((1 << (DS18B20_RESOLUTION_12BIT - this->resolution)) - 1);
+  *temperature = raw / 16.0;
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+// Private
+
+unsigned long DS18B20::getConversionTime()
+{
+  // The conversion time is halved for each bit of resolution removed
+  return DS18B20_CONVERSION_TIME_12BIT >> (DS18B20_RESOLUTION_12BIT - this->resolution);
+}
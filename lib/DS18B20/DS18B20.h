@@ -0,0 +1,104 @@
+/*
+DS18B20.h - - DS18B20 1-Wire temperature sensor library - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+Only one sensor is expected on the bus (the ROM is skipped). A conversion
+takes up to 750ms at 12 bit resolution. The bus transfers are split over
+the Manage() calls: one reset or DS18B20_BYTES_PER_CALL bytes per call, so
+a call never blocks for more than about 1ms. The scratchpad is read once
+the conversion time is elapsed.
+
+The 1-Wire bit slots are timed with the interrupts off: pause the sensor
+(setPaused()) while the motors move.
+
+This file is part of the DS18B20 library.
+
+DS18B20 library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DS18B20 library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with DS18B20 library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef DS18B20_h
+#define DS18B20_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include <OneWire.h>
+#include "TemperatureSensor.h"
+
+#define DS18B20_CMD_CONVERT_T 0x44
+#define DS18B20_CMD_READ_SCRATCHPAD 0xBE
+#define DS18B20_CMD_WRITE_SCRATCHPAD 0x4E
+
+#define DS18B20_SCRATCHPAD_SIZE 9
+
+#define DS18B20_RESOLUTION_9BIT 9
+#define DS18B20_RESOLUTION_10BIT 10
+#define DS18B20_RESOLUTION_11BIT 11
+#define DS18B20_RESOLUTION_12BIT 12
+
+#define DS18B20_CONVERSION_TIME_12BIT 750 // ms
+
+#define DS18B20_BYTES_PER_CALL 2 // Bytes read by one Manage() call (~0.6ms each)
+
+// Bus transfer of the running conversion, one step per Manage() call
+#define DS18B20_TRANSFER_NONE 0
+#define DS18B20_TRANSFER_CONVERT_RESET 1
+#define DS18B20_TRANSFER_CONVERT_COMMAND 2
+#define DS18B20_TRANSFER_WAIT 3
+#define DS18B20_TRANSFER_READ_RESET 4
+#define DS18B20_TRANSFER_READ_COMMAND 5
+#define DS18B20_TRANSFER_READ_DATA 6
+#define DS18B20_TRANSFER_DONE 7
+
+class DS18B20 : public TemperatureSensor
+{
+ public:
+  // Constructors:
+  DS18B20(int dataPin);
+
+  // Setters:
+  void setResolution(int resolution);
+
+  // Getters:
+  int getResolution();
+
+  // Other Public Members
+  bool init();
+
+ protected:
+  void sample();
+  void beginConversion();
+  bool isConversionDone();
+  bool readConversion(float *temperature);
+
+ private:
+  OneWire bus;
+  int resolution;
+  bool sensorIsPresent;
+  unsigned long conversionStart;
+  int transferStep;
+  uint8_t scratchpad[DS18B20_SCRATCHPAD_SIZE];
+  int scratchpadIndex;
+
+  unsigned long getConversionTime();
+};
+
+#endif //DS18B20_h
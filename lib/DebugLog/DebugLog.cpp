@@ -0,0 +1,165 @@
+/*
+DebugLog.cpp - - Binary debug log drained in the idle time - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the DebugLog library.
+
+DebugLog library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DebugLog library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with DebugLog library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "DebugLog.h"
+
+//------------------------------------------------------------------------------
+// Constructors
+
+DebugLog::DebugLog()
+{
+  int i;
+
+  for (i = 0; i < DL_SIZE; i++)
+  {
+    this->records[i].sequence.store(0);
+  }
+  this->writeIndex.store(0);
+  this->readIndex.store(0);
+  this->lostCount.store(0);
+  this->reportedLostCount = 0;
+  this->logIsEnabled = false;
+}
+
+//------------------------------------------------------------------------------
+// Setters
+
+// A disabled log drops the records without counting them
+void DebugLog::setEnabled(bool enabled)
+{
+  this->logIsEnabled = enabled;
+}
+
+//------------------------------------------------------------------------------
+// Getters
+
+bool DebugLog::isEnabled()
+{
+  return this->logIsEnabled;
+}
+
+// Records reserved and not drained yet
+int DebugLog::getCount()
+{
+  return (int)(this->writeIndex.load() - this->readIndex.load());
+}
+
+unsigned long DebugLog::getLostCount()
+{
+  return this->lostCount.load();
+}
+
+//------------------------------------------------------------------------------
+// Other public members
+
+// Add a record. Return false if the ring is full. Safe from an interrupt.
+bool IRAM_ATTR DebugLog::write(uint16_t event, int32_t argument1, int32_t argument2)
+{
+  uint32_t index;
+  DebugRecord_t *record;
+
+  if (!this->logIsEnabled)
+  {
+    return false;
+  }
+
+  // Reserve a slot, an interrupt may reserve one in between
+  index = this->writeIndex.load(std::memory_order_relaxed);
+  do
+  {
+    if (index - this->readIndex.load(std::memory_order_acquire) >= DL_SIZE)
+    {
+      this->lostCount.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  } while (!this->writeIndex.compare_exchange_weak(index, index + 1, std::memory_order_acq_rel));
+
+  record = &this->records[index & (DL_SIZE - 1)];
+  record->timestamp = micros();
+  record->event = event;
+  record->arguments[0] = argument1;
+  record->arguments[1] = argument2;
+  // Publish the record for drain()
+  record->sequence.store(index + 1, std::memory_order_release);
+  return true;
+}
+
+// Send at most maxRecords records, and never more than the UART buffer
+// accepts. Only called from the main loop. Return the number of records sent.
+int DebugLog::drain(HardwareSerial *port, int maxRecords)
+{
+  uint8_t frame[DL_FRAME_SIZE];
+  uint32_t index = this->readIndex.load(std::memory_order_relaxed);
+  uint32_t lostCount = this->lostCount.load(std::memory_order_relaxed);
+  DebugRecord_t *record;
+  int sentRecords = 0;
+
+  if (lostCount != this->reportedLostCount && port->availableForWrite() >= DL_FRAME_SIZE)
+  {
+    encodeFrame(DL_EVENT_LOST, micros(), (int32_t)(lostCount - this->reportedLostCount), 0, frame);
+    port->write(frame, DL_FRAME_SIZE);
+    this->reportedLostCount = lostCount;
+  }
+
+  while (sentRecords < maxRecords && port->availableForWrite() >= DL_FRAME_SIZE)
+  {
+    record = &this->records[index & (DL_SIZE - 1)];
+    // A reserved record may not be written yet
+    if (record->sequence.load(std::memory_order_acquire) != index + 1)
+    {
+      break;
+    }
+    encodeFrame(record->event, record->timestamp, record->arguments[0], record->arguments[1], frame);
+    index++;
+    this->readIndex.store(index, std::memory_order_release);
+    port->write(frame, DL_FRAME_SIZE);
+    sentRecords++;
+  }
+  return sentRecords;
+}
+
+//------------------------------------------------------------------------------
+// Private
+
+void DebugLog::encodeFrame(uint16_t event, uint32_t timestamp, int32_t argument1, int32_t argument2,
+                           uint8_t *frame)
+{
+  uint8_t sum = 0;
+  int i;
+
+  frame[0] = DL_FRAME_SYNC;
+  frame[1] = event & 0xFF;
+  frame[2] = event >> 8;
+  for (i = 0; i < 4; i++)
+  {
+    frame[3 + i] = (timestamp >> (8 * i)) & 0xFF;
+    frame[7 + i] = ((uint32_t)argument1 >> (8 * i)) & 0xFF;
+    frame[11 + i] = ((uint32_t)argument2 >> (8 * i)) & 0xFF;
+  }
+  for (i = 1; i < DL_FRAME_SIZE - 1; i++)
+  {
+    sum += frame[i];
+  }
+  frame[DL_FRAME_SIZE - 1] = sum;
+}
@@ -0,0 +1,105 @@
+/*
+DebugLog.h - - Binary debug log drained in the idle time - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+A print on the debug port blocks as soon as the UART buffer is full, which
+delays the steps. Here an event is a fixed size binary record (event id,
+time in us and two arguments) written in a ring buffer. write() never
+blocks and takes no lock: a slot is reserved with a compare and swap on
+the write index and published with its sequence number, so it can be
+called from the main loop and from the interrupts. When the ring is full
+the record is dropped and counted as lost.
+
+drain() sends the records as frames on a serial port, only as many as
+the UART buffer accepts without waiting. The caller decides when there is
+time for it (motion idle or slack). tools/decode_log.py turns the frames
+into a readable log.
+
+Frame (16 bytes, little endian): 0xA5, event (2), time in us (4),
+argument 1 (4), argument 2 (4), sum of the bytes 1 to 14 (1).
+
+This file is part of the DebugLog library.
+
+DebugLog library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+DebugLog library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with DebugLog library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef DebugLog_h
+#define DebugLog_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include <atomic>
+
+#define DL_SIZE 256 // Records, a power of 2
+#define DL_FRAME_SIZE 16
+#define DL_FRAME_SYNC 0xA5
+
+// Events, keep tools/decode_log.py in sync
+#define DL_EVENT_BOOT 1       // no argument
+#define DL_EVENT_LOST 2       // records lost since the last frame
+#define DL_EVENT_COMMAND 3    // command id, client
+#define DL_EVENT_MOVE_START 4 // device, target position
+#define DL_EVENT_MOVE_END 5   // device, position
+#define DL_EVENT_STALL 6      // device, position
+#define DL_EVENT_STEP_LOSS 7  // error, measured position
+#define DL_EVENT_WAYPOINT 8   // device, waypoints reached
+#define DL_EVENT_SLEEP 9      // time slept in ms, on wake up
+
+typedef struct
+{
+  std::atomic<uint32_t> sequence; // Index of the record + 1 once written
+  uint32_t timestamp;             // us
+  uint16_t event;
+  int32_t arguments[2];
+} DebugRecord_t;
+
+class DebugLog
+{
+ public:
+  // Constructors:
+  DebugLog();
+
+  // Setters:
+  void setEnabled(bool enabled);
+
+  // Getters:
+  bool isEnabled();
+  int getCount();
+  unsigned long getLostCount();
+
+  // Other public members
+  bool write(uint16_t event, int32_t argument1 = 0, int32_t argument2 = 0);
+  int drain(HardwareSerial *port, int maxRecords);
+
+ private:
+  DebugRecord_t records[DL_SIZE];
+  std::atomic<uint32_t> writeIndex;
+  std::atomic<uint32_t> readIndex;
+  std::atomic<uint32_t> lostCount;
+  uint32_t reportedLostCount;
+  bool logIsEnabled;
+
+  static void encodeFrame(uint16_t event, uint32_t timestamp, int32_t argument1, int32_t argument2,
+                          uint8_t *frame);
+};
+
+#endif //DebugLog_h
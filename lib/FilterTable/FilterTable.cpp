@@ -0,0 +1,208 @@
+/*
+FilterTable.cpp - - Focus offsets of the filters - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the FilterTable library.
+
+FilterTable library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+FilterTable library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with FilterTable library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "FilterTable.h"
+
+//-----------------------------------------------------------------------------
+// Constructors
+
+FilterTable::FilterTable()
+{
+  this->referenceTemperature = FT_DEFAULT_REFERENCE_TEMPERATURE;
+  this->reset();
+}
+
+//-----------------------------------------------------------------------------
+// Setters
+
+// Add or replace the offset of a filter.
+// Return false if the filter number is not valid or the table is full.
+bool FilterTable::setFilter(int filter, long offset, float slope)
+{
+  FilterOffset_t *entry = NULL;
+  int i;
+
+  if (filter < 0 || filter > FT_MAX_FILTER)
+  {
+    return false;
+  }
+
+  // Same filter first, else the first free entry
+  for (i = 0; i < FT_MAX_FILTERS && entry == NULL; i++)
+  {
+    if (this->filters[i].filter == filter)
+    {
+      entry = &this->filters[i];
+    }
+  }
+  for (i = 0; i < FT_MAX_FILTERS && entry == NULL; i++)
+  {
+    if (this->filters[i].filter == FT_NO_FILTER)
+    {
+      entry = &this->filters[i];
+    }
+  }
+  if (entry == NULL)
+  {
+    return false;
+  }
+
+  entry->filter = filter;
+  entry->offset = offset;
+  entry->slope = slope;
+  return true;
+}
+
+// Replace the whole table (FT_MAX_FILTERS entries), e.g. from the settings
+void FilterTable::setFilters(const FilterOffset_t *filters)
+{
+  int i;
+
+  this->reset();
+  for (i = 0; i < FT_MAX_FILTERS; i++)
+  {
+    if (filters[i].filter != FT_NO_FILTER)
+    {
+      this->setFilter(filters[i].filter, filters[i].offset, filters[i].slope);
+    }
+  }
+}
+
+// Temperature at which the offsets were measured
+void FilterTable::setReferenceTemperature(float temperature)
+{
+  this->referenceTemperature = temperature;
+}
+
+// Filter in the light path, without move (e.g. after a restart)
+void FilterTable::setCurrentFilter(int filter)
+{
+  this->currentFilter = filter;
+}
+
+//-----------------------------------------------------------------------------
+// Getters
+
+// Return NULL if the filter is not in the table
+const FilterOffset_t *FilterTable::getFilter(int filter)
+{
+  int i;
+
+  if (filter == FT_NO_FILTER)
+  {
+    return NULL;
+  }
+  for (i = 0; i < FT_MAX_FILTERS; i++)
+  {
+    if (this->filters[i].filter == filter)
+    {
+      return &this->filters[i];
+    }
+  }
+  return NULL;
+}
+
+// The FT_MAX_FILTERS entries, the free ones have the number FT_NO_FILTER
+const FilterOffset_t *FilterTable::getFilters()
+{
+  return this->filters;
+}
+
+float FilterTable::getReferenceTemperature()
+{
+  return this->referenceTemperature;
+}
+
+int FilterTable::getCurrentFilter()
+{
+  return this->currentFilter;
+}
+
+// Offset of the filter at the temperature, 0 for an unknown filter
+long FilterTable::getOffset(int filter, float temperature)
+{
+  const FilterOffset_t *entry = this->getFilter(filter);
+
+  if (entry == NULL)
+  {
+    return 0;
+  }
+  return entry->offset + lround(entry->slope * (temperature - this->referenceTemperature));
+}
+
+//-----------------------------------------------------------------------------
+// Other public members
+
+bool FilterTable::removeFilter(int filter)
+{
+  FilterOffset_t *entry = (FilterOffset_t *)this->getFilter(filter);
+
+  if (entry == NULL)
+  {
+    return false;
+  }
+  entry->filter = FT_NO_FILTER;
+  entry->offset = 0;
+  entry->slope = 0;
+  return true;
+}
+
+// Empty table, no filter in use
+void FilterTable::reset()
+{
+  int i;
+
+  for (i = 0; i < FT_MAX_FILTERS; i++)
+  {
+    this->filters[i].filter = FT_NO_FILTER;
+    this->filters[i].offset = 0;
+    this->filters[i].slope = 0;
+  }
+  this->currentFilter = FT_NO_FILTER;
+}
+
+// Move to the focus of the filter at the temperature in one move.
+// Return false if the motor is busy or the filter is not in the table.
+bool FilterTable::select(int filter, float temperature, StepperControl *motor)
+{
+  FocusModel *model = motor->getFocusModel();
+  long position = motor->getCurrentPosition();
+  long offset;
+
+  if (this->getFilter(filter) == NULL || motor->isInMove() || motor->isHoming() || motor->isQueueRunning())
+  {
+    return false;
+  }
+
+  offset = this->getOffset(filter, temperature) - this->getOffset(this->currentFilter, temperature);
+  // The pending temperature correction is part of the same move
+  if (motor->isTemperatureCompensationEnabled() && model->hasReference())
+  {
+    position = model->getFocusPosition(temperature);
+  }
+  model->shiftPositions(offset);
+  this->currentFilter = filter;
+  motor->startAutomaticMove(position + offset);
+  return true;
+}
@@ -0,0 +1,93 @@
+/*
+FilterTable.h - - Focus offsets of the filters - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+Each filter of the wheel has a focus offset in steps, measured at the
+reference temperature of the table, and a slope in steps per C° which
+corrects the offset for the chromatic change with the temperature. The
+offset of a filter at any temperature is interpolated linearly from
+these two values.
+
+select() changes the filter with one move: the target is the position in
+focus at the current temperature (from the focus model of the motor when
+the temperature compensation runs) plus the offset of the new filter
+minus the offset of the old one. The focus model is shifted by the same
+offset so it keeps following the new filter.
+
+The entries are plain fixed size structures so they can be stored with
+the settings.
+
+This file is part of the FilterTable library.
+
+FilterTable library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+FilterTable library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with FilterTable library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef FilterTable_h
+#define FilterTable_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include "StepperControl.h"
+
+#define FT_MAX_FILTERS 8
+#define FT_NO_FILTER -1                 // Number of a free entry
+#define FT_MAX_FILTER 0xFF
+#define FT_DEFAULT_REFERENCE_TEMPERATURE 20.0 // C°
+
+typedef struct FilterOffset_s
+{
+  int32_t filter;
+  int32_t offset; // steps at the reference temperature
+  float slope;    // steps per C°
+} FilterOffset_t;
+
+class FilterTable
+{
+ public:
+  // Constructors:
+  FilterTable();
+
+  // Setters:
+  bool setFilter(int filter, long offset, float slope);
+  void setFilters(const FilterOffset_t *filters);
+  void setReferenceTemperature(float temperature);
+  void setCurrentFilter(int filter);
+
+  // Getters:
+  const FilterOffset_t *getFilter(int filter);
+  const FilterOffset_t *getFilters();
+  float getReferenceTemperature();
+  int getCurrentFilter();
+  long getOffset(int filter, float temperature);
+
+  // Other public members
+  bool removeFilter(int filter);
+  void reset();
+  bool select(int filter, float temperature, StepperControl *motor);
+
+ private:
+  FilterOffset_t filters[FT_MAX_FILTERS];
+  float referenceTemperature;
+  int currentFilter;
+};
+
+#endif //FilterTable_h
@@ -0,0 +1,231 @@
+/*
+FocusModel.cpp - - Temperature to focus position model - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the FocusModel library.
+
+FocusModel library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+FocusModel library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with FocusModel library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "FocusModel.h"
+
+//------------------------------------------------------------------------------------
+// Constructors:
+FocusModel::FocusModel()
+{
+  this->defaultSlope = 0;
+  this->forgettingFactor = FM_DEFAULT_FORGETTING_FACTOR;
+  this->hysteresis = FM_DEFAULT_HYSTERESIS;
+  this->maxCorrection = FM_DEFAULT_MAX_CORRECTION;
+  this->correctionInterval = FM_DEFAULT_CORRECTION_INTERVAL;
+  this->lastCorrectionTimestamp = 0;
+  this->reset();
+}
+
+//------------------------------------------------------------------------------------
+// Setters
+
+// Slope in steps per C° used as long as the model is not fitted
+void FocusModel::setDefaultSlope(float slope)
+{
+  this->defaultSlope = slope;
+}
+
+void FocusModel::setForgettingFactor(float forgettingFactor)
+{
+  this->forgettingFactor = constrain(forgettingFactor, 0.5, 1.0);
+}
+
+void FocusModel::setHysteresis(long hysteresis)
+{
+  this->hysteresis = hysteresis > 1 ? hysteresis : 1;
+}
+
+void FocusModel::setMaxCorrection(long maxCorrection)
+{
+  this->maxCorrection = maxCorrection > 1 ? maxCorrection : 1;
+}
+
+void FocusModel::setCorrectionInterval(unsigned long interval)
+{
+  this->correctionInterval = interval;
+}
+
+// Position in focus at the given temperature. The corrections are relative to it.
+void FocusModel::setReference(float temperature, long position)
+{
+  this->referenceTemperature = temperature;
+  this->referencePosition = position;
+  this->referenceIsSet = true;
+  this->correctionIsRunning = false;
+}
+
+//------------------------------------------------------------------------------------
+// Getters
+
+// Slope in steps per C° used for the corrections
+float FocusModel::getSlope()
+{
+  return this->slopeIsFitted ? this->fittedSlope : this->defaultSlope;
+}
+
+float FocusModel::getDefaultSlope()
+{
+  return this->defaultSlope;
+}
+
+float FocusModel::getSampleWeight()
+{
+  return this->sumWeight;
+}
+
+bool FocusModel::isFitted()
+{
+  return this->slopeIsFitted;
+}
+
+bool FocusModel::hasReference()
+{
+  return this->referenceIsSet;
+}
+
+// Position in focus at the temperature, from the reference and the slope.
+// Only valid if the model has a reference.
+long FocusModel::getFocusPosition(float temperature)
+{
+  return this->referencePosition
+       + (long)(this->getSlope() * (temperature - this->referenceTemperature));
+}
+
+//------------------------------------------------------------------------------------
+// Other public members
+
+// Add a settled focus position. It also becomes the new reference.
+void FocusModel::addSample(float temperature, long position)
+{
+  float t;
+  float p;
+
+  if (!this->originIsSet)
+  {
+    this->originTemperature = temperature;
+    this->originPosition = position;
+    this->originIsSet = true;
+  }
+  t = temperature - this->originTemperature;
+  p = (float)(position - this->originPosition);
+
+  this->sumWeight = this->sumWeight * this->forgettingFactor + 1;
+  this->sumT = this->sumT * this->forgettingFactor + t;
+  this->sumP = this->sumP * this->forgettingFactor + p;
+  this->sumTT = this->sumTT * this->forgettingFactor + t * t;
+  this->sumTP = this->sumTP * this->forgettingFactor + t * p;
+
+  this->updateSlope();
+  this->setReference(temperature, position);
+}
+
+// The position counter was synced: move all the positions by offset steps
+void FocusModel::shiftPositions(long offset)
+{
+  this->originPosition += offset;
+  this->referencePosition += offset;
+}
+
+// Return the number of steps to move now (0 if no correction is needed)
+long FocusModel::getCorrection(float temperature, long position, unsigned long now)
+{
+  long error;
+  long absError;
+
+  if (!this->referenceIsSet)
+  {
+    return 0;
+  }
+
+  error = this->getFocusPosition(temperature) - position;
+  absError = error < 0 ? -error : error;
+
+  if (!this->correctionIsRunning)
+  {
+    if (absError < this->hysteresis)
+    {
+      return 0;
+    }
+    this->correctionIsRunning = true;
+  }
+  else if (absError <= this->hysteresis / 2)
+  {
+    this->correctionIsRunning = false;
+    return 0;
+  }
+
+  if ((now - this->lastCorrectionTimestamp) < this->correctionInterval)
+  {
+    return 0;
+  }
+  this->lastCorrectionTimestamp = now;
+
+  return constrain(error, -this->maxCorrection, this->maxCorrection);
+}
+
+// Forget all the samples and the reference
+void FocusModel::reset()
+{
+  this->fittedSlope = 0;
+  this->slopeIsFitted = false;
+  this->originIsSet = false;
+  this->originTemperature = 0;
+  this->originPosition = 0;
+  this->sumWeight = 0;
+  this->sumT = 0;
+  this->sumP = 0;
+  this->sumTT = 0;
+  this->sumTP = 0;
+  this->referenceIsSet = false;
+  this->referenceTemperature = 0;
+  this->referencePosition = 0;
+  this->correctionIsRunning = false;
+}
+
+//------------------------------------------------------------------------------------
+// Privates
+void FocusModel::updateSlope()
+{
+  float meanT;
+  float varianceT;
+
+  if (this->sumWeight < FM_MIN_SAMPLE_WEIGHT)
+  {
+    this->slopeIsFitted = false;
+    return;
+  }
+
+  meanT = this->sumT / this->sumWeight;
+  varianceT = this->sumTT / this->sumWeight - meanT * meanT;
+  if (varianceT < FM_MIN_TEMPERATURE_VARIANCE)
+  {
+    // All the samples were taken at about the same temperature
+    this->slopeIsFitted = false;
+    return;
+  }
+
+  this->fittedSlope = (this->sumWeight * this->sumTP - this->sumT * this->sumP)
+                    / (this->sumWeight * this->sumTT - this->sumT * this->sumT);
+  this->slopeIsFitted = true;
+}
@@ -0,0 +1,111 @@
+/*
+FocusModel.h - - Temperature to focus position model - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+The model fits position = a + slope * temperature by least squares on the
+positions where the focus was settled by the user or by an autofocus run.
+The fit is updated incrementally and older samples are weighted down by a
+forgetting factor, so the model follows the optics through the night.
+
+Until enough samples with a significant temperature spread are collected,
+the default slope (from the Moonlite temperature coefficient) is used.
+
+The corrections are computed relative to the last settled position. They
+start once the error reaches the hysteresis, stop when the error is back
+under half of it, and are limited in size and rate so the exposures are
+not disturbed by big jumps.
+
+This file is part of the FocusModel library.
+
+FocusModel library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+FocusModel library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with FocusModel library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef FocusModel_h
+#define FocusModel_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#define FM_DEFAULT_FORGETTING_FACTOR 0.95
+#define FM_MIN_SAMPLE_WEIGHT 3.0        // Effective number of samples for a fit
+#define FM_MIN_TEMPERATURE_VARIANCE 0.25 // C°^2, spread needed for a fit
+#define FM_DEFAULT_HYSTERESIS 4          // steps
+#define FM_DEFAULT_MAX_CORRECTION 16     // steps per correction
+#define FM_DEFAULT_CORRECTION_INTERVAL 2000 // ms between corrections
+
+class FocusModel
+{
+ public:
+  // Constructors:
+  FocusModel();
+
+  // Setters:
+  void setDefaultSlope(float slope);
+  void setForgettingFactor(float forgettingFactor);
+  void setHysteresis(long hysteresis);
+  void setMaxCorrection(long maxCorrection);
+  void setCorrectionInterval(unsigned long interval);
+  void setReference(float temperature, long position);
+
+  // Getters:
+  float getSlope();
+  float getDefaultSlope();
+  float getSampleWeight();
+  bool isFitted();
+  bool hasReference();
+  long getFocusPosition(float temperature);
+
+  // Other public members
+  void addSample(float temperature, long position);
+  void shiftPositions(long offset);
+  long getCorrection(float temperature, long position, unsigned long now);
+  void reset();
+
+ private:
+  float defaultSlope;     // steps per C°
+  float fittedSlope;      // steps per C°
+  bool slopeIsFitted;
+  float forgettingFactor;
+
+  // Weighted sums, centered on the first sample to keep the float precision
+  bool originIsSet;
+  float originTemperature;
+  long originPosition;
+  float sumWeight;
+  float sumT;
+  float sumP;
+  float sumTT;
+  float sumTP;
+
+  bool referenceIsSet;
+  float referenceTemperature;
+  long referencePosition;
+
+  long hysteresis;
+  long maxCorrection;
+  unsigned long correctionInterval;
+  unsigned long lastCorrectionTimestamp;
+  bool correctionIsRunning;
+
+  void updateSlope();
+};
+
+#endif //FocusModel_h
@@ -0,0 +1,195 @@
+/*
+FocusSweep.cpp - - Focus sweep run by the firmware - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the FocusSweep library.
+
+FocusSweep library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+FocusSweep library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with FocusSweep library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "FocusSweep.h"
+
+//-----------------------------------------------------------------------------
+// Constructors
+
+FocusSweep::FocusSweep(StepperControl *motor)
+{
+  this->motor = motor;
+  this->state = FS_IDLE;
+  this->triggerPin = FS_NO_PIN;
+  this->triggerWidth = FS_DEFAULT_TRIGGER_WIDTH;
+  this->dwellTime = FS_DEFAULT_DWELL_TIME;
+  this->triggerIsActive = false;
+  this->startPosition = 0;
+  this->step = 0;
+  this->count = 0;
+  this->pointIndex = 0;
+  this->dwellTimestamp = 0;
+  this->pointCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Setters
+
+// The trigger pin is active high
+void FocusSweep::setTriggerPin(int pin)
+{
+  this->triggerPin = pin;
+  if (pin != FS_NO_PIN)
+  {
+    pinMode(pin, OUTPUT);
+    digitalWrite(pin, LOW);
+  }
+}
+
+void FocusSweep::setTriggerWidth(unsigned long triggerWidth)
+{
+  this->triggerWidth = triggerWidth;
+}
+
+void FocusSweep::setDwellTime(unsigned long dwellTime)
+{
+  this->dwellTime = dwellTime;
+}
+
+//-----------------------------------------------------------------------------
+// Getters
+
+int FocusSweep::getState()
+{
+  return this->state;
+}
+
+unsigned long FocusSweep::getDwellTime()
+{
+  return this->dwellTime;
+}
+
+// Number of points logged by the last sweep
+int FocusSweep::getPointCount()
+{
+  return this->pointCount;
+}
+
+// Return NULL if the point is not logged
+const FocusSweepPoint_t *FocusSweep::getPoint(int point)
+{
+  if (point < 0 || point >= this->pointCount)
+  {
+    return NULL;
+  }
+  return &this->points[point];
+}
+
+//-----------------------------------------------------------------------------
+// Other public members
+
+// The log of the previous sweep is cleared.
+// Return false if a sweep is running or count is not in 1..FS_MAX_POINTS.
+bool FocusSweep::start(long startPosition, long step, int count)
+{
+  if (this->isRunning() || count <= 0 || count > FS_MAX_POINTS)
+  {
+    return false;
+  }
+  this->startPosition = startPosition;
+  this->step = step;
+  this->count = count;
+  this->pointIndex = 0;
+  this->pointCount = 0;
+  this->startPoint();
+  return true;
+}
+
+// The points already logged are kept
+void FocusSweep::abort()
+{
+  if (this->isRunning())
+  {
+    this->motor->stopMovement();
+    this->setTrigger(false);
+    this->state = FS_ABORTED;
+  }
+}
+
+bool FocusSweep::isRunning()
+{
+  return this->state == FS_MOVING || this->state == FS_DWELL;
+}
+
+void FocusSweep::Manage()
+{
+  // This procedure should be called regularly.
+  switch (this->state)
+  {
+    case FS_MOVING:
+      if (this->motor->isInMove())
+      {
+        break;
+      }
+      // Settled on the point
+      this->points[this->pointCount].position = this->motor->getCurrentPosition();
+      this->points[this->pointCount].timestamp = millis();
+      this->pointCount++;
+      this->setTrigger(true);
+      this->dwellTimestamp = millis();
+      this->state = FS_DWELL;
+      break;
+    case FS_DWELL:
+      if (this->triggerIsActive && (millis() - this->dwellTimestamp) >= this->triggerWidth)
+      {
+        this->setTrigger(false);
+      }
+      if ((millis() - this->dwellTimestamp) < this->dwellTime ||
+          (millis() - this->dwellTimestamp) < this->triggerWidth)
+      {
+        break;
+      }
+      this->pointIndex++;
+      if (this->pointIndex >= this->count)
+      {
+        this->setTrigger(false);
+        this->state = FS_DONE;
+      }
+      else
+      {
+        this->startPoint();
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Private
+
+void FocusSweep::startPoint()
+{
+  this->motor->startAutomaticMove(this->startPosition + this->pointIndex * this->step);
+  this->state = FS_MOVING;
+}
+
+void FocusSweep::setTrigger(bool isActive)
+{
+  this->triggerIsActive = isActive;
+  if (this->triggerPin != FS_NO_PIN)
+  {
+    digitalWrite(this->triggerPin, isActive ? HIGH : LOW);
+  }
+}
@@ -0,0 +1,105 @@
+/*
+FocusSweep.h - - Focus sweep run by the firmware - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+The sweep replaces the host loop of an autofocus (SN, FG, poll GI, take an
+image) with one command. The focuser goes to count points, from start by
+step. At each point, once the move is done:
+ - the point (position and time) is logged,
+ - the camera trigger pin (if any) is pulsed,
+ - the focuser dwells for the dwell time (exposure of the camera).
+The host downloads the log once the sweep is done.
+
+This file is part of the FocusSweep library.
+
+FocusSweep library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+FocusSweep library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with FocusSweep library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef FocusSweep_h
+#define FocusSweep_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include "StepperControl.h"
+
+#define FS_IDLE 0
+#define FS_MOVING 1
+#define FS_DWELL 2
+#define FS_DONE 3
+#define FS_ABORTED 4
+
+#define FS_MAX_POINTS 64
+#define FS_NO_PIN -1
+#define FS_DEFAULT_DWELL_TIME 1000   // ms
+#define FS_DEFAULT_TRIGGER_WIDTH 100 // ms
+
+typedef struct FocusSweepPoint_s
+{
+  long position;
+  unsigned long timestamp; // ms
+} FocusSweepPoint_t;
+
+class FocusSweep
+{
+ public:
+  // Constructors:
+  FocusSweep(StepperControl *motor);
+
+  // Setters:
+  void setTriggerPin(int pin);
+  void setTriggerWidth(unsigned long triggerWidth);
+  void setDwellTime(unsigned long dwellTime);
+
+  // Getters:
+  int getState();
+  unsigned long getDwellTime();
+  int getPointCount();
+  const FocusSweepPoint_t *getPoint(int point);
+
+  // Other public members
+  bool start(long startPosition, long step, int count);
+  void abort();
+  bool isRunning();
+  void Manage();
+
+ private:
+  StepperControl *motor;
+  int state;
+  int triggerPin;
+  unsigned long triggerWidth;
+  unsigned long dwellTime;
+  bool triggerIsActive;
+
+  long startPosition;
+  long step;
+  int count;
+  int pointIndex;
+  unsigned long dwellTimestamp;
+
+  FocusSweepPoint_t points[FS_MAX_POINTS];
+  int pointCount;
+
+  void startPoint();
+  void setTrigger(bool isActive);
+};
+
+#endif //FocusSweep_h
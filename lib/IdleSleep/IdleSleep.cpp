@@ -0,0 +1,213 @@
+/*
+IdleSleep.cpp - - Light sleep of the ESP32 while the focuser is idle - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the IdleSleep library.
+
+IdleSleep library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+IdleSleep library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with IdleSleep library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "IdleSleep.h"
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
+
+//-----------------------------------------------------------------------------
+// Constructors
+
+IdleSleep::IdleSleep()
+{
+  this->sleepIsEnabled = false;
+  this->uartNumber = IS_DEFAULT_UART;
+  this->wakePinCount = 0;
+  this->minimumSleepTime = IS_DEFAULT_MIN_SLEEP_TIME;
+  this->maximumSleepTime = IS_DEFAULT_MAX_SLEEP_TIME;
+  this->idleDelay = IS_DEFAULT_IDLE_DELAY;
+  this->activityTimestamp = 0;
+  this->wakeTimestamp = 0;
+  this->wakeLatencyIsPending = false;
+  this->sleepCount = 0;
+  this->sleepTime = 0;
+  this->lastSleepTime = 0;
+  this->lastWakeLatency = 0;
+  this->maxWakeLatency = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Setters
+
+void IdleSleep::setEnabled(bool enabled)
+{
+  this->sleepIsEnabled = enabled;
+  this->activityTimestamp = millis();
+}
+
+void IdleSleep::setUart(int uartNumber)
+{
+  this->uartNumber = uartNumber;
+}
+
+bool IdleSleep::addWakePin(int pin)
+{
+  if (this->wakePinCount >= IS_MAX_WAKE_PINS)
+  {
+    return false;
+  }
+  this->wakePins[this->wakePinCount] = pin;
+  this->wakePinCount++;
+  return true;
+}
+
+void IdleSleep::setMinimumSleepTime(unsigned long minimumSleepTime)
+{
+  this->minimumSleepTime = minimumSleepTime;
+}
+
+void IdleSleep::setMaximumSleepTime(unsigned long maximumSleepTime)
+{
+  this->maximumSleepTime = maximumSleepTime;
+}
+
+// Time the loop has to stay idle before the first sleep, so a client
+// polling the focuser does not pay the wake up on each command
+void IdleSleep::setIdleDelay(unsigned long idleDelay)
+{
+  this->idleDelay = idleDelay;
+}
+
+//-----------------------------------------------------------------------------
+// Getters
+
+bool IdleSleep::isEnabled()
+{
+  return this->sleepIsEnabled;
+}
+
+unsigned long IdleSleep::getSleepCount()
+{
+  return this->sleepCount;
+}
+
+// Total time spent in light sleep in ms
+unsigned long IdleSleep::getSleepTime()
+{
+  return this->sleepTime;
+}
+
+// Time of the last light sleep in ms, at most the maximum sleep time
+unsigned long IdleSleep::getLastSleepTime()
+{
+  return this->lastSleepTime;
+}
+
+// Time between the last wake up and the first step of a move in us
+unsigned long IdleSleep::getLastWakeLatency()
+{
+  return this->lastWakeLatency;
+}
+
+unsigned long IdleSleep::getMaxWakeLatency()
+{
+  return this->maxWakeLatency;
+}
+
+//-----------------------------------------------------------------------------
+// Other public members
+
+// Something happened (command, move...): the idle delay starts again
+void IdleSleep::notifyActivity()
+{
+  this->activityTimestamp = millis();
+}
+
+// A step was pulsed at stepTimestamp (micros). The first step after a
+// wake up gives the wake latency.
+void IdleSleep::notifyStep(unsigned long stepTimestamp)
+{
+  this->activityTimestamp = millis();
+  if (!this->wakeLatencyIsPending)
+  {
+    return;
+  }
+  this->wakeLatencyIsPending = false;
+  this->lastWakeLatency = stepTimestamp - this->wakeTimestamp;
+  if (this->lastWakeLatency > this->maxWakeLatency)
+  {
+    this->maxWakeLatency = this->lastWakeLatency;
+  }
+}
+
+// Sleep until a wake up event or the deadline (ms from now).
+// The caller checks that nothing is running.
+// Return true if the ESP32 slept.
+bool IdleSleep::sleepUntil(unsigned long timeToDeadline)
+{
+  unsigned long sleepStart;
+  int i;
+
+  if (!this->sleepIsEnabled ||
+      (millis() - this->activityTimestamp) < this->idleDelay ||
+      timeToDeadline < this->minimumSleepTime)
+  {
+    return false;
+  }
+  if (timeToDeadline > this->maximumSleepTime)
+  {
+    timeToDeadline = this->maximumSleepTime;
+  }
+
+  // The answers still in the UART would be cut
+  uart_wait_tx_idle_polling((uart_port_t)this->uartNumber);
+
+  esp_sleep_enable_timer_wakeup((uint64_t)timeToDeadline * 1000);
+  uart_set_wakeup_threshold((uart_port_t)this->uartNumber, IS_UART_WAKE_THRESHOLD);
+  esp_sleep_enable_uart_wakeup(this->uartNumber);
+  // The GPIO wake up is on a level: wake up when the pin leaves its
+  // current level
+  for (i = 0; i < this->wakePinCount; i++)
+  {
+    gpio_wakeup_enable((gpio_num_t)this->wakePins[i],
+                       gpio_get_level((gpio_num_t)this->wakePins[i]) ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+  }
+  if (this->wakePinCount > 0)
+  {
+    esp_sleep_enable_gpio_wakeup();
+  }
+
+  sleepStart = millis();
+  esp_light_sleep_start();
+  this->wakeTimestamp = micros();
+
+  for (i = 0; i < this->wakePinCount; i++)
+  {
+    gpio_wakeup_disable((gpio_num_t)this->wakePins[i]);
+  }
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+
+  this->sleepCount++;
+  this->lastSleepTime = millis() - sleepStart;
+  this->sleepTime += this->lastSleepTime;
+  this->wakeLatencyIsPending = true;
+  // Stay awake for the idle delay after an event (the knob keeps turning,
+  // the rest of the command arrives...)
+  if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER)
+  {
+    this->activityTimestamp = millis();
+  }
+  return true;
+}
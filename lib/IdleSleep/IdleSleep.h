@@ -0,0 +1,103 @@
+/*
+IdleSleep.h - - Light sleep of the ESP32 while the focuser is idle - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+When nothing moves the main loop only waits for events. sleepUntil() puts
+the ESP32 in light sleep until one of these events:
+ - a caracter on the UART of the Moonlite serial port. The caracters which
+   wake the UART up are lost: the ':' of the first command is usually
+   missing, the parser has to accept a command without it.
+ - a level change on one of the wake pins (the hand controller encoder).
+   The pulse counter is stopped during the sleep, the first pulses of the
+   knob are not counted.
+ - the next deadline of the caller (temperature conversion...).
+
+Light sleep keeps the RAM and the CPU state: the loop continues where it
+stopped. The WiFi cannot stay connected during light sleep, do not sleep
+while the network is in use.
+
+Instrumentation: number and total time of the sleeps, and the latency
+between the wake up and the first step of a move started after it.
+
+This file is part of the IdleSleep library.
+
+IdleSleep library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+IdleSleep library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with IdleSleep library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef IdleSleep_h
+#define IdleSleep_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#define IS_MAX_WAKE_PINS 2
+#define IS_DEFAULT_UART 0
+#define IS_UART_WAKE_THRESHOLD 3       // Edges on RX to wake up (min 3)
+#define IS_DEFAULT_MIN_SLEEP_TIME 5    // ms, shorter sleeps are not worth it
+#define IS_DEFAULT_MAX_SLEEP_TIME 1000 // ms, upper bound of one sleep
+#define IS_DEFAULT_IDLE_DELAY 100      // ms of idle loop before the first sleep
+
+class IdleSleep
+{
+ public:
+  // Constructors:
+  IdleSleep();
+
+  // Setters:
+  void setEnabled(bool enabled);
+  void setUart(int uartNumber);
+  bool addWakePin(int pin);
+  void setMinimumSleepTime(unsigned long minimumSleepTime);
+  void setMaximumSleepTime(unsigned long maximumSleepTime);
+  void setIdleDelay(unsigned long idleDelay);
+
+  // Getters:
+  bool isEnabled();
+  unsigned long getSleepCount();
+  unsigned long getSleepTime();
+  unsigned long getLastSleepTime();
+  unsigned long getLastWakeLatency();
+  unsigned long getMaxWakeLatency();
+
+  // Other public members
+  void notifyActivity();
+  void notifyStep(unsigned long stepTimestamp);
+  bool sleepUntil(unsigned long timeToDeadline);
+
+ private:
+  bool sleepIsEnabled;
+  int uartNumber;
+  int wakePins[IS_MAX_WAKE_PINS];
+  int wakePinCount;
+  unsigned long minimumSleepTime;
+  unsigned long maximumSleepTime;
+  unsigned long idleDelay;
+  unsigned long activityTimestamp; // ms
+  unsigned long wakeTimestamp;     // us
+  bool wakeLatencyIsPending;
+  unsigned long sleepCount;
+  unsigned long sleepTime;         // ms
+  unsigned long lastSleepTime;     // ms
+  unsigned long lastWakeLatency;   // us
+  unsigned long maxWakeLatency;    // us
+};
+
+#endif //IdleSleep_h
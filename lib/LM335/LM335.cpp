@@ -23,80 +23,185 @@ along with LM335 library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
 #include "LM335.h"
+#include <driver/adc.h>
 
 //-----------------------------------------------------------------------------
 // Constructors
 
-LM335::LM335(int aquisitionPin)
+LM335::LM335(int aquisitionPin) : TemperatureSensor()
 {
   this->aquisitionPin = aquisitionPin;
-  this->integrationLoop = LM335_DEFAULT_INTEGRATION_LOOP;
-  this->integrationLoopNumber = 0;
-  this->temperature = -65535;
-  this->integratedTemperature = 0;
-  this->temperatureCompensationValue = 0;
+  this->adcChannel = -1;
+  this->adcIsRunning = false;
+  this->filterShift = LM335_DEFAULT_FILTER_SHIFT;
+  this->dividerRatio = 1;
+  this->filteredSample = 0;
+  this->filterIsInit = false;
 }
 
 //-----------------------------------------------------------------------------
 // Setters
 
-void LM335::setNumberOfIntegration(unsigned long integrationLoop)
+// Set the time constant of the filter as a power of 2 of samples
+void LM335::setFilterShift(unsigned int filterShift)
 {
-  this->integrationLoop = integrationLoop;
+  if (filterShift > LM335_MAX_FILTER_SHIFT)
+  {
+    filterShift = LM335_MAX_FILTER_SHIFT;
+  }
+  this->filterShift = filterShift;
 }
 
-// Set the offset of the temperature in C
-void LM335::setCompensationValue(float compensationValue)
+// Resistors of the divider between the sensor and the pin, in ohms: top
+// from the sensor to the pin, bottom from the pin to the ground. A bottom
+// of 0 means no divider (the sensor is wired to the pin).
+void LM335::setDivider(unsigned long topResistance, unsigned long bottomResistance)
 {
-   this->temperatureCompensationValue = compensationValue;
+  if (bottomResistance == 0)
+  {
+    this->dividerRatio = 1;
+    return;
+  }
+  this->dividerRatio = (float)(topResistance + bottomResistance) / bottomResistance;
 }
 
 //-----------------------------------------------------------------------------
 // Getters
 
-// Get the temperature in C
-float LM335::getTemperature()
+unsigned int LM335::getFilterShift()
 {
-  return this->temperature;
+  return this->filterShift;
 }
 
-unsigned long LM335::getNumberOfIntegrationLoop()
+float LM335::getDividerRatio()
 {
-  return this->integrationLoop;
+  return this->dividerRatio;
 }
 
-float LM335::getCompensationValue()
+//-----------------------------------------------------------------------------
+// Public Members
+
+// Start the continuous sampling. Only the ADC1 channels can be used
+// in continuous mode (ADC2 is shared with the WiFi).
+bool LM335::init()
 {
-   return this->temperatureCompensationValue;
+  adc_digi_init_config_t initConfig;
+  adc_digi_configuration_t digiConfig;
+  adc_digi_pattern_config_t pattern;
+
+  this->adcChannel = digitalPinToAnalogChannel(this->aquisitionPin);
+  if (this->adcChannel < 0 || this->adcChannel > 7)
+  {
+    return false;
+  }
+
+  esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12,
+                           LM335_DEFAULT_VREF, &this->adcCharacteristics);
+
+  memset(&initConfig, 0, sizeof(initConfig));
+  initConfig.max_store_buf_size = LM335_DMA_BUFFER_SIZE;
+  initConfig.conv_num_each_intr = LM335_DMA_FRAME_SIZE;
+  initConfig.adc1_chan_mask = BIT(this->adcChannel);
+  initConfig.adc2_chan_mask = 0;
+
+  memset(&pattern, 0, sizeof(pattern));
+  pattern.atten = ADC_ATTEN_DB_11;
+  pattern.channel = this->adcChannel;
+  pattern.unit = 0;
+  pattern.bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+
+  memset(&digiConfig, 0, sizeof(digiConfig));
+  digiConfig.conv_limit_en = true;
+  digiConfig.conv_limit_num = 250;
+  digiConfig.pattern_num = 1;
+  digiConfig.adc_pattern = &pattern;
+  digiConfig.sample_freq_hz = LM335_SAMPLE_FREQUENCY;
+  digiConfig.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  digiConfig.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+
+  if (adc_digi_initialize(&initConfig) != ESP_OK ||
+      adc_digi_controller_configure(&digiConfig) != ESP_OK ||
+      adc_digi_start() != ESP_OK)
+  {
+    return false;
+  }
+  this->adcIsRunning = true;
+  return true;
 }
 
 //-----------------------------------------------------------------------------
-// Public Members
-void LM335::integrateTemperature()
+// Protected
+
+void LM335::sample()
 {
-  this->integratedTemperature += this->readTemperature();
-  this->integrationLoopNumber ++;
-  if (this->integrationLoopNumber >= this->integrationLoop)
+  // Called on every Manage().
+  // It never waits: only the samples already stored by the DMA are read,
+  // and at most LM335_READ_CHUNK_SIZE bytes are processed per call.
+  uint32_t length = 0;
+  uint32_t i;
+  adc_digi_output_data_t *data;
+
+  if (!this->adcIsRunning)
+  {
+    return;
+  }
+
+  if (adc_digi_read_bytes(this->dmaBuffer, LM335_READ_CHUNK_SIZE, &length, 0) != ESP_OK)
+  {
+    return;
+  }
+
+  for (i = 0; i + sizeof(adc_digi_output_data_t) <= length; i += sizeof(adc_digi_output_data_t))
+  {
+    data = (adc_digi_output_data_t *)&this->dmaBuffer[i];
+    if (data->type1.channel == this->adcChannel)
     {
-      temperature = (this->integratedTemperature / this->integrationLoop)
-			+ this->temperatureCompensationValue;
-      this->integratedTemperature = 0;
-      this->integrationLoopNumber = 0;
+      this->filterSample(data->type1.data);
     }
+  }
 }
 
-void LM335::Manage()
+void LM335::beginConversion()
 {
-  if(temperature<-65000)
+  // The ADC samples continuously, nothing to trigger
+}
+
+bool LM335::isConversionDone()
+{
+  return this->filterIsInit;
+}
+
+bool LM335::readConversion(float *temperature)
+{
+  uint32_t milliVolts;
+
+  // Calibrated by the eFuse values
+  milliVolts = esp_adc_cal_raw_to_voltage(this->filteredSample >> LM335_FILTER_FRACTION_BITS,
+                                          &this->adcCharacteristics);
+  // Out of the linear range of the ADC (no divider or a wrong one)
+  if (milliVolts > LM335_MAX_PIN_VOLTAGE)
   {
-     this->temperature = this->readTemperature();
+    return false;
   }
-  this->integrateTemperature();
+  // The LM335 output is 10mV/K
+  *temperature = (milliVolts * this->dividerRatio / 10.0) - 273.15;
+  return true;
 }
 
 //-----------------------------------------------------------------------------
 // Private
-float LM335::readTemperature()
+
+// Single pole IIR low pass: y += (x - y) / 2^filterShift
+void LM335::filterSample(int32_t sample)
 {
-  return (500.0*analogRead(this->aquisitionPin)/1024.0) - 273.15;
+  sample <<= LM335_FILTER_FRACTION_BITS;
+  if (!this->filterIsInit)
+  {
+    this->filteredSample = sample;
+    this->filterIsInit = true;
+  }
+  else
+  {
+    this->filteredSample += (sample - this->filteredSample) >> this->filterShift;
+  }
 }
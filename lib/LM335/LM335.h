@@ -5,6 +5,16 @@ History:
 Version 1.0 - Author Jean-Philippe Bonnet
    First release
 
+The sensor is sampled by the ESP32 ADC in continuous (DMA) mode. Manage() only
+drains the samples already collected by the DMA and feeds them through a fixed
+point IIR filter, so it never waits for the ADC. A conversion started with
+startConversion() completes on the next Manage() with the filtered value.
+
+The ADC at 11 dB is only linear up to about 2450 mV, and the LM335 gives
+2.7 V to 3.1 V between 0 C and 40 C. Its output should reach the pin
+through a divider (setDivider()), e.g. two 10k resistors give 1.35 V to
+1.55 V. A pin voltage above LM335_MAX_PIN_VOLTAGE is a conversion error.
+
 This file is part of the LM335 library.
 
 StepperControl library is free software: you can redistribute it and/or modify
@@ -22,42 +32,65 @@ along with LM335 library.  If not, see <http://www.gnu.org/licenses/>.
 
  */
 
+#ifndef LM335_h
+#define LM335_h
+
 #if ARDUINO < 100
 #include <Wprogram.h>
 #else
 #include <Arduino.h>
 #endif
 
-#define LM335_DEFAULT_INTEGRATION_LOOP 5000
+#include <esp_adc_cal.h>
+#include "TemperatureSensor.h"
+
+#define LM335_SAMPLE_FREQUENCY 20000   // ADC conversions per second
+#define LM335_DMA_BUFFER_SIZE 1024     // Bytes stored by the DMA between two Manage()
+#define LM335_DMA_FRAME_SIZE 256       // Bytes per DMA transfer
+#define LM335_READ_CHUNK_SIZE 128      // Bytes drained by one Manage() call
+
+#define LM335_FILTER_FRACTION_BITS 16  // Fixed point fraction of the filter
+#define LM335_DEFAULT_FILTER_SHIFT 10  // Time constant of 2^10 samples (~50ms)
+#define LM335_MAX_FILTER_SHIFT 16
 
-class LM335
+#define LM335_DEFAULT_VREF 1100        // Used if the eFuse has no calibration
+#define LM335_MAX_PIN_VOLTAGE 2450     // mV, top of the linear range at 11 dB
+
+class LM335 : public TemperatureSensor
 {
  public:
   // Constructors:
   LM335(int aquisistionPin);
 
   // Setters:
-  void setNumberOfIntegration(unsigned long integrationLoop);
-  void setCompensationValue(float compensationValue);
+  void setFilterShift(unsigned int filterShift);
+  void setDivider(unsigned long topResistance, unsigned long bottomResistance);
 
   // Getter:
-  float getTemperature();
-  unsigned long getNumberOfIntegrationLoop();
-  float getCompensationValue();
+  unsigned int getFilterShift();
+  float getDividerRatio();
 
   // Other Public Members
-  void Manage();
-
- private:
-  float readTemperature();
+  bool init();
 
-  float temperature; // Temperature in C
-  float integratedTemperature;
+ protected:
+  void sample();
+  void beginConversion();
+  bool isConversionDone();
+  bool readConversion(float *temperature);
 
-  unsigned long integrationLoop;
-  unsigned long integrationLoopNumber;
+ private:
+  int32_t filteredSample; // Raw ADC value with LM335_FILTER_FRACTION_BITS fraction
+  bool filterIsInit;
+  unsigned int filterShift;
+  float dividerRatio; // Sensor voltage / pin voltage
   int aquisitionPin;
-  float temperatureCompensationValue;
+  int adcChannel;
+  bool adcIsRunning;
+  esp_adc_cal_characteristics_t adcCharacteristics;
+  uint8_t dmaBuffer[LM335_READ_CHUNK_SIZE];
 
-  void integrateTemperature();
+  void filterSample(int32_t sample);
 };
+
+#endif //LM335_h
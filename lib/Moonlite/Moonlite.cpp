@@ -29,6 +29,47 @@ const int Moonlite::HexTable[16] = {'0', '1', '2', '3', '4',
                                     'A', 'B', 'C', 'D', 'E',
                                     'F'};
 
+const MoonliteExtendedCommand_t Moonlite::ExtendedCommands[] = {
+  {{'H', 'M'}, ML_XHM},
+  {{'H', 'S'}, ML_XHS},
+  {{'A', 'T'}, ML_XAT},
+  {{'A', 'S'}, ML_XAS},
+  {{'A', 'R'}, ML_XAR},
+  {{'P', 'E'}, ML_XPE},
+  {{'P', 'S'}, ML_XPS},
+  {{'T', 'S'}, ML_XTS},
+  {{'R', 'D'}, ML_XRD},
+  {{'R', 'G'}, ML_XRG},
+  {{'R', 'R'}, ML_XRR},
+  {{'M', 'E'}, ML_XME},
+  {{'M', 'P'}, ML_XMP},
+  {{'N', 'E'}, ML_XNE},
+  {{'N', 'T'}, ML_XNT},
+  {{'S', 'T'}, ML_XST},
+  {{'S', 'W'}, ML_XSW},
+  {{'S', 'S'}, ML_XSS},
+  {{'S', 'D'}, ML_XSD},
+  {{'L', 'C'}, ML_XLC},
+  {{'L', 'S'}, ML_XLS},
+  {{'L', 'D'}, ML_XLD},
+  {{'Q', 'A'}, ML_XQA},
+  {{'Q', 'C'}, ML_XQC},
+  {{'Q', 'S'}, ML_XQS},
+  {{'F', 'D'}, ML_XFD},
+  {{'F', 'G'}, ML_XFG},
+  {{'F', 'R'}, ML_XFR},
+  {{'F', 'T'}, ML_XFT},
+  {{'F', 'S'}, ML_XFS},
+  {{'F', 'C'}, ML_XFC},
+  {{'S', 'M'}, ML_XSM},
+  {{'S', 'G'}, ML_XSG},
+  {{'E', 'C'}, ML_XEC},
+  {{'E', 'S'}, ML_XES},
+  {{'B', 'A'}, ML_XBA},
+  {{'B', 'C'}, ML_XBC},
+  {{'B', 'G'}, ML_XBG},
+  {{0, 0}, 0}};
+
 //------------------------------------------------------------------------------
 // Constructors
 Moonlite::Moonlite()
@@ -36,13 +77,19 @@ Moonlite::Moonlite()
   int i;
 
   this->newCommandIsAvailable = false;
-  for (i = 0; i < ML_INPUT_BUFFER_SIZE; i++)
-    this->currentAsciiCommand[i] = 0;
-  this->currentAsciiIndex = 0;
+  this->currentAsciiCommand = NULL;
   for (i = 0; i < ML_OUTPUT_BUFFER_SIZE; i++)
     this->AsciiAnswer[i] = 0;
   this->currentCommand.commandID = 0;
   this->currentCommand.parameter = 0;
+  this->currentCommand.parameterCount = 0;
+  for (i = 0; i < ML_MAX_PARAMETERS; i++)
+    this->currentCommand.parameters[i] = 0;
+  this->currentCommand.device = 0;
+  this->currentCommand.client = ML_NO_CLIENT;
+  this->transportCount = 0;
+  this->nextClient = 0;
+  this->replyTransport = &Serial;
 }
 
 //------------------------------------------------------------------------------
@@ -66,16 +113,43 @@ void Moonlite::setAnswer(int nbChar, long answer)
   for (i = 0; i < ML_OUTPUT_BUFFER_SIZE; i++)
     this->AsciiAnswer[i] = 0;
 
+  if (nbChar > ML_OUTPUT_BUFFER_SIZE - 1)
+    nbChar = ML_OUTPUT_BUFFER_SIZE - 1;
+
   convertLongToChar(answer, nbChar, AsciiAnswer);
 
   if (!unknownFormat)
   {
-    // Send the answer
-    for (i = 0; i < nbChar; i++)
-      Serial.write(AsciiAnswer[i]);
     // the last caracter should be a hash
-    Serial.write('#');
+    AsciiAnswer[nbChar] = '#';
+    // Send the answer in one write (one TCP segment on the network)
+    this->replyTransport->write((const uint8_t *)AsciiAnswer, nbChar + 1);
+  }
+}
+
+// Answer of the extended commands: the values are separated by ','
+void Moonlite::setAnswer(int nbChar, const long *answers, int nbAnswers)
+{
+  int j;
+
+  if (nbChar > ML_OUTPUT_BUFFER_SIZE - 1)
+    nbChar = ML_OUTPUT_BUFFER_SIZE - 1;
+
+  for (j = 0; j < nbAnswers; j++)
+  {
+    convertLongToChar(answers[j], nbChar, AsciiAnswer);
+    // Each value is followed by ',' and the last one by '#'
+    AsciiAnswer[nbChar] = (j == nbAnswers - 1) ? '#' : ',';
+    this->replyTransport->write((const uint8_t *)AsciiAnswer, nbChar + 1);
   }
+  if (nbAnswers <= 0)
+    this->replyTransport->write('#');
+}
+
+// Answer already encoded (e.g. the status frame), '#' included
+void Moonlite::setAnswer(const char *frame, int length)
+{
+  this->replyTransport->write((const uint8_t *)frame, length);
 }
 
 //------------------------------------------------------------------------------
@@ -84,6 +158,136 @@ void Moonlite::init(int baudRate)
 {
   // Set the baudrate of the Serial port
   Serial.begin(baudRate);
+  this->addTransport(&Serial);
+}
+
+// Add a byte stream (e.g. a TCP client) speaking the Moonlite protocol.
+// The answer of a command is sent on the transport it came from, and
+// the index of the transport is the client of the command.
+bool Moonlite::addTransport(Stream *transport)
+{
+  MoonliteClient_t *client;
+
+  if (this->transportCount >= ML_MAX_TRANSPORTS)
+  {
+    return false;
+  }
+  client = &this->clients[this->transportCount];
+  client->transport = transport;
+  this->transportCount++;
+  this->resetClient(this->transportCount - 1);
+  return true;
+}
+
+// A new client uses the transport (e.g. a new TCP connection): the input
+// buffer is cleared and the notifications are off
+void Moonlite::resetClient(int client)
+{
+  int i;
+
+  if (client < 0 || client >= this->transportCount)
+  {
+    return;
+  }
+  for (i = 0; i < ML_INPUT_BUFFER_SIZE; i++)
+    this->clients[client].asciiCommand[i] = 0;
+  this->clients[client].asciiIndex = 0;
+  this->clients[client].notificationMask = 0;
+  this->clients[client].temperatureThreshold = ML_DEFAULT_TEMPERATURE_THRESHOLD;
+  this->clients[client].notifiedTemperature = 0;
+  this->clients[client].temperatureIsNotified = false;
+}
+
+void Moonlite::setNotificationMask(int client, int mask)
+{
+  if (client >= 0 && client < this->transportCount)
+  {
+    this->clients[client].notificationMask = mask;
+  }
+}
+
+int Moonlite::getNotificationMask(int client)
+{
+  if (client < 0 || client >= this->transportCount)
+  {
+    return 0;
+  }
+  return this->clients[client].notificationMask;
+}
+
+// Temperature change notified to the client in half degrees, 0 for the
+// default
+void Moonlite::setTemperatureThreshold(int client, long threshold)
+{
+  if (client >= 0 && client < this->transportCount)
+  {
+    this->clients[client].temperatureThreshold = threshold > 0 ? threshold : ML_DEFAULT_TEMPERATURE_THRESHOLD;
+  }
+}
+
+long Moonlite::getTemperatureThreshold(int client)
+{
+  if (client < 0 || client >= this->transportCount)
+  {
+    return 0;
+  }
+  return this->clients[client].temperatureThreshold;
+}
+
+// Encode the status frame (ML_STATUS_FRAME_SIZE caracters) once, so a
+// status request is only a copy of the frame
+void Moonlite::encodeStatusFrame(long position, long targetPosition, long isMoving,
+                                 long temperature, long profile, char *frame)
+{
+  convertLongToChar(position, 4, &frame[0]);
+  convertLongToChar(targetPosition, 4, &frame[4]);
+  convertLongToChar(isMoving, 2, &frame[8]);
+  convertLongToChar(temperature, 4, &frame[10]);
+  convertLongToChar(profile, 2, &frame[14]);
+  frame[16] = '#';
+}
+
+// Send the notification to the clients which selected the event
+void Moonlite::notify(int event, int device, long value)
+{
+  char frame[ML_NOTIFICATION_SIZE];
+  int length = this->encodeNotification(event, device, value, frame);
+  int i;
+
+  if (length == 0)
+  {
+    return;
+  }
+  for (i = 0; i < this->transportCount; i++)
+  {
+    if (this->clients[i].notificationMask & event)
+    {
+      this->clients[i].transport->write((const uint8_t *)frame, length);
+    }
+  }
+}
+
+// Send the temperature (like GT) to the clients which selected it, once it
+// changed by their threshold since the last one they got
+void Moonlite::notifyTemperature(long temperature)
+{
+  char frame[ML_NOTIFICATION_SIZE];
+  int length = this->encodeNotification(ML_NOTIFY_TEMPERATURE, 0, temperature, frame);
+  MoonliteClient_t *client;
+  int i;
+
+  for (i = 0; i < this->transportCount; i++)
+  {
+    client = &this->clients[i];
+    if ((client->notificationMask & ML_NOTIFY_TEMPERATURE) &&
+        (!client->temperatureIsNotified ||
+         labs(temperature - client->notifiedTemperature) >= client->temperatureThreshold))
+    {
+      client->transport->write((const uint8_t *)frame, length);
+      client->notifiedTemperature = temperature;
+      client->temperatureIsNotified = true;
+    }
+  }
 }
 
 int Moonlite::isNewCommandAvailable()
@@ -95,29 +299,91 @@ int Moonlite::isNewCommandAvailable()
 void Moonlite::Manage()
 {
   // This procedure should be called regularly.
-  // It fills the input buffer with the caracter recived from the Serial port
-  // On caracter is read every loop.
+  // Each transport has its own input buffer. The transports are read in
+  // turn until one command is complete, at most ML_MAX_READ_PER_MANAGE
+  // caracters per call. The caracters left after a complete command stay
+  // in the transport until the next call.
+  int count = 0;
+  int i = 0;
+
+  // The last command is not processed yet
+  if (this->newCommandIsAvailable)
+  {
+    return;
+  }
 
-  if (Serial.available() > 0)
+  while (i < this->transportCount && count < ML_MAX_READ_PER_MANAGE)
   {
-    readNewAscii();
+    if (this->clients[this->nextClient].transport->available() > 0)
+    {
+      count++;
+      if (readNewAscii(this->nextClient))
+      {
+        // The next call starts with the next transport
+        this->nextClient = (this->nextClient + 1) % this->transportCount;
+        return;
+      }
+    }
+    else
+    {
+      this->nextClient = (this->nextClient + 1) % this->transportCount;
+      i++;
+    }
   }
 }
 
 //------------------------------------------------------------------------------
-void Moonlite::readNewAscii()
+// Frame of a notification, return its length or 0 for an unknown event
+int Moonlite::encodeNotification(int event, int device, long value, char *frame)
+{
+  int length = 0;
+
+  frame[length++] = '!';
+  if (device > 0)
+  {
+    frame[length++] = '1' + device;
+  }
+  switch (event)
+  {
+  case ML_NOTIFY_MOVE:
+    frame[length++] = 'M';
+    break;
+  case ML_NOTIFY_STALL:
+    frame[length++] = 'S';
+    break;
+  case ML_NOTIFY_TEMPERATURE:
+    frame[length++] = 'T';
+    break;
+  case ML_NOTIFY_WAYPOINT:
+    frame[length++] = 'W';
+    break;
+  case ML_NOTIFY_STEP_LOSS:
+    frame[length++] = 'L';
+    break;
+  default:
+    return 0;
+  }
+  convertLongToChar(value, 8, &frame[length]);
+  length += 8;
+  frame[length++] = '#';
+  return length;
+}
+
+// Return true if a command was decoded
+bool Moonlite::readNewAscii(int clientIndex)
 {
   int i;
   char incomingByte = 0;
+  MoonliteClient_t *client = &this->clients[clientIndex];
 
-  incomingByte = Serial.read();
+  // The caracter goes straight from the transport to the input buffer
+  incomingByte = client->transport->read();
   // The ':' caracter signalizes the begining of the message
   if (incomingByte == ':')
   {
-    newCommandIsAvailable = false;
     for (i = 0; i < ML_INPUT_BUFFER_SIZE; i++)
-      currentAsciiCommand[i] = 0;
-    currentAsciiIndex = 0;
+      client->asciiCommand[i] = 0;
+    client->asciiIndex = 0;
   }
   else
   {
@@ -125,25 +391,51 @@ void Moonlite::readNewAscii()
     // if '#' is received the message can be decoded
     if (incomingByte == '#')
     {
+      this->currentAsciiCommand = client->asciiCommand;
+      this->replyTransport = client->transport;
       decodeCommand();
+      this->currentCommand.client = clientIndex;
+      // The next command starts here even if its ':' is lost (e.g. the
+      // caracter which wakes the UART up from light sleep)
+      for (i = 0; i < ML_INPUT_BUFFER_SIZE; i++)
+        client->asciiCommand[i] = 0;
+      client->asciiIndex = 0;
+      return true;
     }
     else
     {
       // If the end of the command is not reach
-      // the next caracter is added to the inout buffer
-      if (currentAsciiIndex < ML_INPUT_BUFFER_SIZE)
+      // the next caracter is added to the inout buffer.
+      // The last caracter of the buffer always stays 0.
+      if (client->asciiIndex < ML_INPUT_BUFFER_SIZE - 1)
       {
-        currentAsciiCommand[currentAsciiIndex] = incomingByte;
-        currentAsciiIndex++;
+        client->asciiCommand[client->asciiIndex] = incomingByte;
+        client->asciiIndex++;
       }
     }
   }
+  return false;
 }
 
 void Moonlite::decodeCommand()
 {
+  int i;
+
   currentCommand.commandID = 0;
   currentCommand.parameter = 0;
+  currentCommand.parameterCount = 0;
+  currentCommand.device = 0;
+  for (i = 0; i < ML_MAX_PARAMETERS; i++)
+    currentCommand.parameters[i] = 0;
+
+  // An optional leading digit selects the device: ":2GP#" reads the
+  // position of the second focuser. Without it the first one is used.
+  if (currentAsciiCommand[0] >= '1' && currentAsciiCommand[0] <= '9')
+  {
+    currentCommand.device = currentAsciiCommand[0] - '1';
+    for (i = 0; i < ML_INPUT_BUFFER_SIZE - 1; i++)
+      currentAsciiCommand[i] = currentAsciiCommand[i + 1];
+  }
   
   // The command is decoded caracter per caracter and the parameter added if needed.
   switch (currentAsciiCommand[0])
@@ -240,6 +532,9 @@ void Moonlite::decodeCommand()
     currentCommand.commandID = ML_PO;
     currentCommand.parameter = convert2CharToSignedLong(currentAsciiCommand[2], currentAsciiCommand[3]);
     break;
+  case 'X':
+    decodeExtendedCommand();
+    break;
   default:
     currentCommand.commandID = ML_UNKNOWN_COMMAND;
     break;
@@ -247,6 +542,40 @@ void Moonlite::decodeCommand()
   newCommandIsAvailable = true;
 }
 
+void Moonlite::decodeExtendedCommand()
+{
+  int i;
+  int length;
+  int index = 3;
+
+  currentCommand.commandID = ML_UNKNOWN_COMMAND;
+  for (i = 0; ExtendedCommands[i].commandID != 0; i++)
+  {
+    if (ExtendedCommands[i].code[0] == currentAsciiCommand[1] &&
+        ExtendedCommands[i].code[1] == currentAsciiCommand[2])
+    {
+      currentCommand.commandID = ExtendedCommands[i].commandID;
+      break;
+    }
+  }
+  if (currentCommand.commandID == 0)
+    return;
+
+  // The parameters are separated by ','
+  while (index < ML_INPUT_BUFFER_SIZE && currentAsciiCommand[index] != 0 &&
+         currentCommand.parameterCount < ML_MAX_PARAMETERS)
+  {
+    length = convertHexToLong(&currentAsciiCommand[index], &currentCommand.parameters[currentCommand.parameterCount]);
+    if (length == 0)
+      break;
+    currentCommand.parameterCount++;
+    index += length;
+    if (index < ML_INPUT_BUFFER_SIZE && currentAsciiCommand[index] == ',')
+      index++;
+  }
+  currentCommand.parameter = currentCommand.parameters[0];
+}
+
 long Moonlite::convert4CharToLong(char c1, char c2, char c3, char c4)
 {
   long value = 0;
@@ -312,6 +641,38 @@ long Moonlite::convert2CharToSignedLong(char c1, char c2)
   return value;
 }
 
+// Read a hex value with an optional '-' sign. Return the number of caracters used.
+int Moonlite::convertHexToLong(const char *text, long *value)
+{
+  int length = 0;
+  int digit;
+  int sign = 1;
+  const char *start;
+
+  *value = 0;
+  if (*text == '-')
+  {
+    sign = -1;
+    text++;
+    length++;
+  }
+  start = text;
+  while (*text != 0 && *text != ',' && (text - start) < 8)
+  {
+    for (digit = 0; digit < 16 && HexTable[digit] != *text; digit++)
+      ;
+    if (digit == 16)
+      break;
+    *value = (*value << 4) | digit;
+    text++;
+    length++;
+  }
+  if (text == start)
+    return 0;
+  *value *= sign;
+  return length;
+}
+
 void Moonlite::convertLongToChar(long value, int nbChar, char *buffer)
 {
   // This function convert signed and unsigned values
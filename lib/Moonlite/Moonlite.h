@@ -55,15 +55,103 @@ along with Moonlite library.  If not, see <http://www.gnu.org/licenses/>.
 #define ML_PO 50  // Set the temperature calibration offset
 #define ML_GB 60 // Get the baklight LED value
 
-#define ML_INPUT_BUFFER_SIZE 8 // Buffer size for the incomming command.
-#define ML_OUTPUT_BUFFER_SIZE 5 // Buffer size for the answer message.
+// Extended commands (not part of the Moonlite protocol)
+// Format: ":X<2 letters>[<hex>[,<hex>...]]#", the hex values may be negative.
+#define ML_XHM 100 // Start the sensorless homing (parameter: 0 inward, 1 outward)
+#define ML_XHS 101 // Return the homing state (see SC_HOMING_*)
+#define ML_XAT 110 // Start the speed and acceleration auto-tuning
+#define ML_XAS 111 // Return the auto-tuning state and level (see AT_*)
+#define ML_XAR 112 // Return the speed limit and the acceleration limit (full steps/s, every 50ms)
+#define ML_XPE 120 // Enable the light sleep when idle (parameter: 0 off, 1 on)
+#define ML_XPS 121 // Return the sleep count, sleep time (ms), uptime (ms),
+                   // last and max wake to first step latency (us)
+#define ML_XTS 130 // Return the run count, overrun count, max execution time
+                   // and max lateness (us) of a task (parameter: task id)
+#define ML_XRD 140 // Define a profile (parameters: SD code, speed, acceleration, step mode)
+#define ML_XRG 141 // Return the speed, acceleration and step mode of a profile
+#define ML_XRR 142 // Remove a profile (parameter: SD code)
+#define ML_XME 150 // Return the remaining time (ms) and distance of the current move
+#define ML_XMP 151 // Return the predicted time (ms) and distance of a move to a position
+#define ML_XNE 160 // Select the notifications of the client (parameter: ML_NOTIFY_* mask)
+#define ML_XNT 161 // Set the temperature change notified to the client (parameter: half degrees)
+#define ML_XST 170 // Return the status frame (see ML_STATUS_FRAME_SIZE)
+#define ML_XSW 180 // Start a focus sweep (parameters: start, step, count, dwell time in ms)
+#define ML_XSS 181 // Return the sweep state (see FS_*) and the number of points logged
+#define ML_XSD 182 // Return a page of the sweep log (parameters: first point, max count):
+                   // position and time (ms) of each point, 7 points at most
+#define ML_XLC 190 // Set the telemetry interval in ms (0: off) and the on change mode (0/1)
+#define ML_XLS 191 // Return the telemetry samples waiting, lost, and the interval
+#define ML_XLD 192 // Return and remove the oldest telemetry samples (parameter: max count):
+                   // time (ms), position and temperature (1/100 C) of each sample,
+                   // 4 samples at most
+#define ML_XQA 200 // Queue a move (parameters: position, dwell time in ms)
+#define ML_XQC 201 // Drop the queued moves not reached yet
+#define ML_XQS 202 // Return the queued moves waiting and the waypoints reached
+#define ML_XFD 210 // Define a filter (parameters: filter, offset, slope in 1/100 steps per C)
+#define ML_XFG 211 // Return the offset and the slope of a filter (parameter: filter)
+#define ML_XFR 212 // Remove a filter (parameter: filter)
+#define ML_XFT 213 // Set the temperature of the offsets (parameter: half degrees)
+#define ML_XFS 214 // Move to the focus of a filter (parameter: filter)
+#define ML_XFC 215 // Return the filter in use and its offset at the current temperature
+#define ML_XSM 220 // Set the slew step mode (parameters: SC_*_STEP or -1 for none,
+                   // approach distance in full steps)
+#define ML_XSG 221 // Return the slew step mode and the approach distance
+#define ML_XEC 230 // Set the step loss tolerance in positions
+#define ML_XES 231 // Return the measured position, the error, the max error and the losses
+#define ML_XBA 240 // Add a resonance band (parameters: low and high speed in full steps/s)
+#define ML_XBC 241 // Remove all the resonance bands
+#define ML_XBG 242 // Return the low and high speed of a resonance band (parameter: index)
+
+#define ML_INPUT_BUFFER_SIZE 32 // Buffer size for the incomming command.
+#define ML_OUTPUT_BUFFER_SIZE 9 // Buffer size for the answer message.
+#define ML_MAX_PARAMETERS 4 // Number of parameters of an extended command
+#define ML_MAX_TRANSPORTS 4 // Serial port and network clients
+#define ML_MAX_READ_PER_MANAGE 64 // Caracters read by one Manage() call
+#define ML_NO_CLIENT -1
+
+// Notifications sent without request to the clients which selected them
+// with XNE. Frame: "!<device><event><8 hex>#", the device digit is only
+// present for the second focuser and above (like the commands).
+#define ML_NOTIFY_MOVE 0x01        // 'M' end of move, value: position
+#define ML_NOTIFY_STALL 0x02       // 'S' stall detected, value: position
+#define ML_NOTIFY_TEMPERATURE 0x04 // 'T' temperature change, value: like GT
+#define ML_NOTIFY_WAYPOINT 0x08    // 'W' queued move reached, value: waypoints reached
+#define ML_NOTIFY_STEP_LOSS 0x10   // 'L' step loss corrected, value: measured minus commanded
+#define ML_NOTIFICATION_SIZE 12
+#define ML_DEFAULT_TEMPERATURE_THRESHOLD 1 // half degrees
+
+// Status frame: the answers of GP (4), GN (4), GI (2), GT (4) and GD (2)
+// one after the other, then '#'
+#define ML_STATUS_FRAME_SIZE 17
 
 typedef struct MoonliteCommand_s
  {
    int commandID;
    long parameter;
+   long parameters[ML_MAX_PARAMETERS];
+   int parameterCount;
+   int device; // 0 for the first focuser
+   int client; // Index of the transport the command came from
 } MoonliteCommand_t;
 
+// Parser context of one transport
+typedef struct MoonliteClient_s
+{
+  Stream *transport;
+  char asciiCommand[ML_INPUT_BUFFER_SIZE];
+  int asciiIndex;
+  int notificationMask; // ML_NOTIFY_*, 0 for a plain Moonlite client
+  long temperatureThreshold; // half degrees
+  long notifiedTemperature;  // Last one sent, like GT
+  bool temperatureIsNotified;
+} MoonliteClient_t;
+
+typedef struct MoonliteExtendedCommand_s
+{
+  char code[2];
+  int commandID;
+} MoonliteExtendedCommand_t;
+
 class Moonlite
 {
  public:
@@ -75,25 +163,44 @@ class Moonlite
 
   // Setters:
   void setAnswer(int nbChar, long answer);
+  void setAnswer(int nbChar, const long *answers, int nbAnswers);
+  void setAnswer(const char *frame, int length);
 
   // Other public members
   void init(int baudRate);
+  bool addTransport(Stream *transport);
+  void resetClient(int client);
+  void setNotificationMask(int client, int mask);
+  int getNotificationMask(int client);
+  void setTemperatureThreshold(int client, long threshold);
+  long getTemperatureThreshold(int client);
+  void notify(int event, int device, long value);
+  void notifyTemperature(long temperature);
+  void encodeStatusFrame(long position, long targetPosition, long isMoving,
+                         long temperature, long profile, char *frame);
   int isNewCommandAvailable();
   void Manage();
 
  private:
   MoonliteCommand_t currentCommand;
   int newCommandIsAvailable;
-  char currentAsciiCommand[ML_INPUT_BUFFER_SIZE];
+  char *currentAsciiCommand; // Input buffer of the command being decoded
   char AsciiAnswer[ML_OUTPUT_BUFFER_SIZE];
-  int currentAsciiIndex;
+  MoonliteClient_t clients[ML_MAX_TRANSPORTS];
+  int transportCount;
+  int nextClient;
+  Stream *replyTransport; // Transport of the last decoded command
   void decodeCommand();
+  void decodeExtendedCommand();
   static const int HexTable[16];
+  static const MoonliteExtendedCommand_t ExtendedCommands[];
 
-  void readNewAscii();
+  bool readNewAscii(int clientIndex);
+  int encodeNotification(int event, int device, long value, char *frame);
   long convert4CharToLong(char c1, char c2, char c3, char c4);
   long convert2CharToLong(char c1, char c2);
   long convert2CharToSignedLong(char c1, char c2);
+  int convertHexToLong(const char *text, long *value);
 
   void convertLongToChar(long value, int nbChar, char *buffer);
 };
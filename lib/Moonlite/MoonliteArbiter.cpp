@@ -0,0 +1,152 @@
+/*
+MoonliteArbiter.cpp - - Motion ownership of the Moonlite clients - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the Moonlite library.
+
+Moonlite library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Moonlite library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Moonlite library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "MoonliteArbiter.h"
+
+//------------------------------------------------------------------------------
+// Constructors
+MoonliteArbiter::MoonliteArbiter()
+{
+  int i;
+
+  for (i = 0; i < MLA_MAX_DEVICES; i++)
+  {
+    this->owners[i] = ML_NO_CLIENT;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Getters
+
+// Client which owns the focuser, ML_NO_CLIENT if none
+int MoonliteArbiter::getOwner(int device)
+{
+  if (device < 0 || device >= MLA_MAX_DEVICES)
+  {
+    return ML_NO_CLIENT;
+  }
+  return this->owners[device];
+}
+
+//------------------------------------------------------------------------------
+// Other public members
+
+// Return true if the command should be processed. deviceIsBusy tells if a
+// move (homing, tuning, queue...) of the focuser still runs: the ownership
+// ends with it.
+bool MoonliteArbiter::accept(const MoonliteCommand_t *command, bool deviceIsBusy)
+{
+  int device = command->device;
+
+  if (device < 0 || device >= MLA_MAX_DEVICES)
+  {
+    return false;
+  }
+  if (!deviceIsBusy)
+  {
+    this->owners[device] = ML_NO_CLIENT;
+  }
+  if (isReadOnlyCommand(command->commandID) || command->commandID == ML_FQ)
+  {
+    return true;
+  }
+  if (this->owners[device] != ML_NO_CLIENT && this->owners[device] != command->client)
+  {
+    return false;
+  }
+  if (isMoveCommand(command->commandID))
+  {
+    this->owners[device] = command->client;
+  }
+  return true;
+}
+
+// The client is gone (e.g. TCP disconnection): its moves can be overridden
+void MoonliteArbiter::release(int device)
+{
+  if (device >= 0 && device < MLA_MAX_DEVICES)
+  {
+    this->owners[device] = ML_NO_CLIENT;
+  }
+}
+
+// Commands which change neither the motion nor the configuration of the
+// focuser. XNE and XNT are kept per client, so they only concern the
+// client itself. XLD is not there: it removes the samples it returns.
+bool MoonliteArbiter::isReadOnlyCommand(int commandID)
+{
+  switch (commandID)
+  {
+    case ML_C:
+    case ML_GB:
+    case ML_GC:
+    case ML_GD:
+    case ML_GH:
+    case ML_GI:
+    case ML_GN:
+    case ML_GP:
+    case ML_GT:
+    case ML_GV:
+    case ML_XHS:
+    case ML_XAS:
+    case ML_XAR:
+    case ML_XPS:
+    case ML_XTS:
+    case ML_XRG:
+    case ML_XME:
+    case ML_XMP:
+    case ML_XNE:
+    case ML_XNT:
+    case ML_XST:
+    case ML_XSS:
+    case ML_XSD:
+    case ML_XLS:
+    case ML_XQS:
+    case ML_XFG:
+    case ML_XFC:
+    case ML_XSG:
+    case ML_XES:
+    case ML_XBG:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Commands which start a move and give the focuser to their client
+bool MoonliteArbiter::isMoveCommand(int commandID)
+{
+  switch (commandID)
+  {
+    case ML_FG:
+    case ML_XHM:
+    case ML_XAT:
+    case ML_XSW:
+    case ML_XQA:
+    case ML_XFS:
+      return true;
+    default:
+      return false;
+  }
+}
@@ -0,0 +1,61 @@
+/*
+MoonliteArbiter.h - - Motion ownership of the Moonlite clients - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+The client which starts a move (FG, homing, tuning, sweep, queue, filter)
+owns the focuser until the move ends. In the meantime only the read-only
+commands and FQ of the other clients are accepted: every other command
+(target, position, speed, configuration...) is dropped. The read-only
+commands are a whitelist, so a new extended command is protected until it
+is listed there.
+
+Each focuser (device prefix) has its own owner.
+
+This file is part of the Moonlite library.
+
+Moonlite library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Moonlite library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Moonlite library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef MoonliteArbiter_h
+#define MoonliteArbiter_h
+
+#include "Moonlite.h"
+
+#define MLA_MAX_DEVICES 9 // Device prefixes '1' to '9'
+
+class MoonliteArbiter
+{
+ public:
+  // Constructors:
+  MoonliteArbiter();
+
+  // Getters:
+  int getOwner(int device);
+
+  // Other public members
+  bool accept(const MoonliteCommand_t *command, bool deviceIsBusy);
+  void release(int device);
+
+  static bool isReadOnlyCommand(int commandID);
+  static bool isMoveCommand(int commandID);
+
+ private:
+  int owners[MLA_MAX_DEVICES];
+};
+
+#endif //MoonliteArbiter_h
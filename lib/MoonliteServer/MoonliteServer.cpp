@@ -0,0 +1,144 @@
+/*
+MoonliteServer.cpp - - TCP transport for the Moonlite protocol - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the MoonliteServer library.
+
+MoonliteServer library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+MoonliteServer library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with MoonliteServer library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "MoonliteServer.h"
+
+//-----------------------------------------------------------------------------
+// Constructors
+
+MoonliteServer::MoonliteServer(uint16_t port) : server(port)
+{
+  int i;
+
+  this->isStarted = false;
+  this->serverIsListening = false;
+  for (i = 0; i < MLS_MAX_CLIENTS; i++)
+  {
+    this->connectionCounts[i] = 0;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Getters
+
+// The client objects are kept for the whole life of the server, a new
+// connection is assigned to a free one. The pointers can be given once
+// to the parser.
+Stream *MoonliteServer::getClient(int client)
+{
+  if (client < 0 || client >= MLS_MAX_CLIENTS)
+  {
+    return NULL;
+  }
+  return &this->clients[client];
+}
+
+bool MoonliteServer::isClientConnected(int client)
+{
+  if (client < 0 || client >= MLS_MAX_CLIENTS)
+  {
+    return false;
+  }
+  return this->clients[client].connected();
+}
+
+// Number of connections accepted in the slot: a change means that a new
+// client uses it
+unsigned long MoonliteServer::getConnectionCount(int client)
+{
+  if (client < 0 || client >= MLS_MAX_CLIENTS)
+  {
+    return 0;
+  }
+  return this->connectionCounts[client];
+}
+
+int MoonliteServer::getConnectedClientCount()
+{
+  int count = 0;
+  int i;
+
+  for (i = 0; i < MLS_MAX_CLIENTS; i++)
+  {
+    if (this->clients[i].connected())
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+bool MoonliteServer::isNetworkConnected()
+{
+  return WiFi.status() == WL_CONNECTED;
+}
+
+//-----------------------------------------------------------------------------
+// Other public members
+
+// Start the connection to the network, it completes in the background
+void MoonliteServer::begin(const char *ssid, const char *password)
+{
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(true);
+  WiFi.begin(ssid, password);
+  this->isStarted = true;
+}
+
+void MoonliteServer::Manage()
+{
+  WiFiClient newClient;
+  int i;
+
+  if (!this->isStarted || !this->isNetworkConnected())
+  {
+    return;
+  }
+
+  if (!this->serverIsListening)
+  {
+    this->server.begin();
+    // The answers are small, send them without waiting for more data
+    this->server.setNoDelay(true);
+    this->serverIsListening = true;
+  }
+
+  if (this->server.hasClient())
+  {
+    newClient = this->server.available();
+    for (i = 0; i < MLS_MAX_CLIENTS; i++)
+    {
+      if (!this->clients[i].connected())
+      {
+        this->clients[i].stop();
+        this->clients[i] = newClient;
+        this->clients[i].setNoDelay(true);
+        this->connectionCounts[i]++;
+        return;
+      }
+    }
+    // No free slot
+    newClient.stop();
+  }
+}
@@ -0,0 +1,74 @@
+/*
+MoonliteServer.h - - TCP transport for the Moonlite protocol - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+The server joins a WiFi network and listens for Moonlite clients on a
+TCP port. Each client is a Stream: it is added once to the Moonlite parser
+with addTransport(getClient(i)) and its bytes are parsed like the ones of
+the serial port. Nothing blocks: the WiFi connection, the reconnection and
+the accept of a new client are all handled by Manage().
+
+Up to MLS_MAX_CLIENTS network clients are served at the same time. A new
+connection takes the slot of a client which is no longer connected and is
+refused if all the slots are in use.
+
+This file is part of the MoonliteServer library.
+
+MoonliteServer library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+MoonliteServer library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with MoonliteServer library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef MoonliteServer_h
+#define MoonliteServer_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include <WiFi.h>
+
+#define MLS_DEFAULT_PORT 10000
+#define MLS_MAX_CLIENTS 3
+
+class MoonliteServer
+{
+ public:
+  // Constructors:
+  MoonliteServer(uint16_t port);
+
+  // Getters:
+  Stream *getClient(int client);
+  bool isClientConnected(int client);
+  int getConnectedClientCount();
+  unsigned long getConnectionCount(int client);
+  bool isNetworkConnected();
+
+  // Other public members
+  void begin(const char *ssid, const char *password);
+  void Manage();
+
+ private:
+  WiFiServer server;
+  WiFiClient clients[MLS_MAX_CLIENTS];
+  unsigned long connectionCounts[MLS_MAX_CLIENTS];
+  bool isStarted;
+  bool serverIsListening;
+};
+
+#endif //MoonliteServer_h
@@ -0,0 +1,145 @@
+/*
+MotionScheduler.cpp - - Step generation for several focusers - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the MotionScheduler library.
+
+MotionScheduler library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+MotionScheduler library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with MotionScheduler library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "MotionScheduler.h"
+
+//-----------------------------------------------------------------------------
+// Constructors
+
+MotionScheduler::MotionScheduler()
+{
+  this->axisCount = 0;
+  this->lastStepTimestamp = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Getters
+
+int MotionScheduler::getAxisCount()
+{
+  return this->axisCount;
+}
+
+// Return NULL if the axis does not exist
+StepperControl *MotionScheduler::getAxis(int axis)
+{
+  if (axis < 0 || axis >= this->axisCount)
+  {
+    return NULL;
+  }
+  return this->axes[axis];
+}
+
+// Highest delay of a step compared to its ideal timing in us
+unsigned long MotionScheduler::getMaxLateness(int axis)
+{
+  if (axis < 0 || axis >= this->axisCount)
+  {
+    return 0;
+  }
+  return this->axes[axis]->getMaxStepLateness();
+}
+
+// Time (micros) of the last step pulse of any axis
+unsigned long MotionScheduler::getLastStepTimestamp()
+{
+  return this->lastStepTimestamp;
+}
+
+// True while one of the axes moves (homing included)
+bool MotionScheduler::isInMove()
+{
+  int i;
+
+  for (i = 0; i < this->axisCount; i++)
+  {
+    if (this->axes[i]->isInMove())
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+//-----------------------------------------------------------------------------
+// Other public members
+
+bool MotionScheduler::addAxis(StepperControl *axis)
+{
+  if (this->axisCount >= MS_MAX_AXES)
+  {
+    return false;
+  }
+  this->axes[this->axisCount] = axis;
+  this->axisCount++;
+  return true;
+}
+
+void MotionScheduler::resetLateness()
+{
+  int i;
+
+  for (i = 0; i < this->axisCount; i++)
+  {
+    this->axes[i]->resetMaxStepLateness();
+  }
+}
+
+void MotionScheduler::Manage()
+{
+  bool stepIsDue[MS_MAX_AXES];
+  bool oneStepIsDue = false;
+  unsigned long now = micros();
+  int i;
+
+  for (i = 0; i < this->axisCount; i++)
+  {
+    stepIsDue[i] = this->axes[i]->Manage(now);
+    oneStepIsDue = oneStepIsDue || stepIsDue[i];
+  }
+
+  if (!oneStepIsDue)
+  {
+    return;
+  }
+
+  // All the direction pins are set, pulse the due steps together
+  delayMicroseconds(SC_DIRECTION_SETUP_TIME);
+  this->lastStepTimestamp = micros();
+  for (i = 0; i < this->axisCount; i++)
+  {
+    if (stepIsDue[i])
+    {
+      digitalWrite(this->axes[i]->getStepPin(), HIGH);
+    }
+  }
+  delayMicroseconds(SC_STEP_PULSE_WIDTH);
+  for (i = 0; i < this->axisCount; i++)
+  {
+    if (stepIsDue[i])
+    {
+      digitalWrite(this->axes[i]->getStepPin(), LOW);
+    }
+  }
+}
@@ -0,0 +1,68 @@
+/*
+MotionScheduler.h - - Step generation for several focusers - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+Several StepperControl axes share one time base: Manage() reads micros()
+once, lets every axis decide whether a step is due at that time, and then
+pulses the step pins of all the due axes together. The direction setup
+time and the step pulse width are paid once per Manage() instead of once
+per axis, so adding an axis does not delay the steps of the others.
+
+This file is part of the MotionScheduler library.
+
+MotionScheduler library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+MotionScheduler library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with MotionScheduler library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef MotionScheduler_h
+#define MotionScheduler_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include "StepperControl.h"
+
+#define MS_MAX_AXES 3
+
+class MotionScheduler
+{
+ public:
+  // Constructors:
+  MotionScheduler();
+
+  // Getters:
+  int getAxisCount();
+  StepperControl *getAxis(int axis);
+  unsigned long getMaxLateness(int axis);
+  unsigned long getLastStepTimestamp();
+  bool isInMove();
+
+  // Other public members
+  bool addAxis(StepperControl *axis);
+  void resetLateness();
+  void Manage();
+
+ private:
+  StepperControl *axes[MS_MAX_AXES];
+  int axisCount;
+  unsigned long lastStepTimestamp; // us
+};
+
+#endif //MotionScheduler_h
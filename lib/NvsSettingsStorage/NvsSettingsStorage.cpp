@@ -0,0 +1,58 @@
+/*
+NvsSettingsStorage.cpp - - Focuser settings stored in the ESP32 NVS - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the NvsSettingsStorage library.
+
+NvsSettingsStorage library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+NvsSettingsStorage library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with NvsSettingsStorage library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "NvsSettingsStorage.h"
+
+//------------------------------------------------------------------------------
+// Constructors
+NvsSettingsStorage::NvsSettingsStorage()
+{
+  this->isOpen = false;
+}
+
+//------------------------------------------------------------------------------
+// Other public members
+bool NvsSettingsStorage::begin()
+{
+  this->isOpen = this->preferences.begin(NVS_SETTINGS_NAMESPACE, false);
+  return this->isOpen;
+}
+
+bool NvsSettingsStorage::read(void *data, size_t size)
+{
+  if (!this->isOpen || this->preferences.getBytesLength(NVS_SETTINGS_KEY) != size)
+  {
+    return false;
+  }
+  return this->preferences.getBytes(NVS_SETTINGS_KEY, data, size) == size;
+}
+
+bool NvsSettingsStorage::write(const void *data, size_t size)
+{
+  if (!this->isOpen)
+  {
+    return false;
+  }
+  return this->preferences.putBytes(NVS_SETTINGS_KEY, data, size) == size;
+}
@@ -0,0 +1,56 @@
+/*
+NvsSettingsStorage.h - - Focuser settings stored in the ESP32 NVS - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the NvsSettingsStorage library.
+
+NvsSettingsStorage library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+NvsSettingsStorage library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with NvsSettingsStorage library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef NvsSettingsStorage_h
+#define NvsSettingsStorage_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include <Preferences.h>
+#include "SettingsStorage.h"
+
+#define NVS_SETTINGS_NAMESPACE "focuser"
+#define NVS_SETTINGS_KEY "settings"
+
+class NvsSettingsStorage : public SettingsStorage
+{
+ public:
+  // Constructors:
+  NvsSettingsStorage();
+
+  // Other public members
+  bool begin();
+  bool read(void *data, size_t size);
+  bool write(const void *data, size_t size);
+
+ private:
+  Preferences preferences;
+  bool isOpen;
+};
+
+#endif //NvsSettingsStorage_h
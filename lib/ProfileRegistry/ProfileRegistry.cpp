@@ -0,0 +1,180 @@
+/*
+ProfileRegistry.cpp - - Motion profiles selected by the Moonlite SD codes - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the ProfileRegistry library.
+
+ProfileRegistry library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+ProfileRegistry library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with ProfileRegistry library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "ProfileRegistry.h"
+
+//-----------------------------------------------------------------------------
+// Constructors
+
+ProfileRegistry::ProfileRegistry()
+{
+  this->reset();
+}
+
+//-----------------------------------------------------------------------------
+// Setters
+
+// Add or replace the profile of a code.
+// Return false if the values are not valid or the registry is full.
+bool ProfileRegistry::setProfile(int code, unsigned long speed, unsigned long acceleration, int stepMode)
+{
+  MotionProfile_t *profile = NULL;
+  int i;
+
+  if (code < 0 || code > PR_MAX_CODE || speed == 0 || speed > SC_MAX_SPEED ||
+      stepMode < PR_KEEP_STEP_MODE || stepMode > SC_256TH_STEP)
+  {
+    return false;
+  }
+
+  // Same code first, else the first free entry
+  for (i = 0; i < PR_MAX_PROFILES && profile == NULL; i++)
+  {
+    if (this->profiles[i].code == code)
+    {
+      profile = &this->profiles[i];
+    }
+  }
+  for (i = 0; i < PR_MAX_PROFILES && profile == NULL; i++)
+  {
+    if (this->profiles[i].code == PR_NO_PROFILE)
+    {
+      profile = &this->profiles[i];
+    }
+  }
+  if (profile == NULL)
+  {
+    return false;
+  }
+
+  profile->code = code;
+  profile->speed = speed;
+  profile->acceleration = acceleration;
+  profile->stepMode = stepMode;
+  return true;
+}
+
+// Replace the whole table (PR_MAX_PROFILES entries), e.g. from the settings
+void ProfileRegistry::setProfiles(const MotionProfile_t *profiles)
+{
+  int i;
+
+  this->reset();
+  for (i = 0; i < PR_MAX_PROFILES; i++)
+  {
+    if (profiles[i].code != PR_NO_PROFILE)
+    {
+      this->setProfile(profiles[i].code, profiles[i].speed,
+                       profiles[i].acceleration, profiles[i].stepMode);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Getters
+
+// Return NULL if no profile has this code
+const MotionProfile_t *ProfileRegistry::getProfile(int code)
+{
+  int i;
+
+  if (code == PR_NO_PROFILE)
+  {
+    return NULL;
+  }
+  for (i = 0; i < PR_MAX_PROFILES; i++)
+  {
+    if (this->profiles[i].code == code)
+    {
+      return &this->profiles[i];
+    }
+  }
+  return NULL;
+}
+
+// The PR_MAX_PROFILES entries, the free ones have the code PR_NO_PROFILE
+const MotionProfile_t *ProfileRegistry::getProfiles()
+{
+  return this->profiles;
+}
+
+//-----------------------------------------------------------------------------
+// Other public members
+
+bool ProfileRegistry::removeProfile(int code)
+{
+  MotionProfile_t *profile = (MotionProfile_t *)this->getProfile(code);
+
+  if (profile == NULL)
+  {
+    return false;
+  }
+  profile->code = PR_NO_PROFILE;
+  profile->speed = 0;
+  profile->acceleration = PR_KEEP_ACCELERATION;
+  profile->stepMode = PR_KEEP_STEP_MODE;
+  return true;
+}
+
+// Back to the five speeds of the Moonlite protocol
+void ProfileRegistry::reset()
+{
+  int i;
+
+  for (i = 0; i < PR_MAX_PROFILES; i++)
+  {
+    this->profiles[i].code = PR_NO_PROFILE;
+    this->profiles[i].speed = 0;
+    this->profiles[i].acceleration = PR_KEEP_ACCELERATION;
+    this->profiles[i].stepMode = PR_KEEP_STEP_MODE;
+  }
+  this->setProfile(0x02, 7000, PR_KEEP_ACCELERATION, PR_KEEP_STEP_MODE);
+  this->setProfile(0x04, 5000, PR_KEEP_ACCELERATION, PR_KEEP_STEP_MODE);
+  this->setProfile(0x08, 3000, PR_KEEP_ACCELERATION, PR_KEEP_STEP_MODE);
+  this->setProfile(0x10, 1000, PR_KEEP_ACCELERATION, PR_KEEP_STEP_MODE);
+  this->setProfile(0x20, 500, PR_KEEP_ACCELERATION, PR_KEEP_STEP_MODE);
+}
+
+// Set the step mode, the speed and the acceleration of the profile.
+// Return false if no profile has this code.
+bool ProfileRegistry::apply(int code, StepperControl *motor)
+{
+  const MotionProfile_t *profile = this->getProfile(code);
+
+  if (profile == NULL)
+  {
+    return false;
+  }
+  // The step mode first: it bounds the speed
+  if (profile->stepMode != PR_KEEP_STEP_MODE)
+  {
+    motor->setStepMode(profile->stepMode);
+  }
+  motor->setSpeed(profile->speed);
+  if (profile->acceleration != PR_KEEP_ACCELERATION)
+  {
+    motor->setAcceleration(profile->acceleration);
+  }
+  return true;
+}
@@ -0,0 +1,84 @@
+/*
+ProfileRegistry.h - - Motion profiles selected by the Moonlite SD codes - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+A profile is a speed, an acceleration and a step mode. The Moonlite SD
+command selects a profile by its code, GD returns the code of the profile
+in use. The registry starts with the five speeds of the Moonlite protocol
+(codes 02, 04, 08, 10 and 20) which keep the acceleration and the step
+mode in use. Profiles can be added or replaced for any code from 00 to FF,
+e.g. a fast slew and a slow fine approach tuned for an optical train.
+
+The profiles are plain fixed size structures so they can be stored with
+the settings.
+
+This file is part of the ProfileRegistry library.
+
+ProfileRegistry library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+ProfileRegistry library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with ProfileRegistry library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef ProfileRegistry_h
+#define ProfileRegistry_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include "StepperControl.h"
+
+#define PR_MAX_PROFILES 8
+#define PR_NO_PROFILE -1         // Code of a free entry
+#define PR_MAX_CODE 0xFF         // The SD codes are two hex digits
+#define PR_KEEP_ACCELERATION 0   // The profile does not change the acceleration
+#define PR_KEEP_STEP_MODE -1     // The profile does not change the step mode
+#define PR_DEFAULT_PROFILE 0x02  // Fastest Moonlite speed
+
+typedef struct MotionProfile_s
+{
+  int32_t code;
+  uint32_t speed;        // Steps per second
+  uint32_t acceleration; // See StepperControl::setAcceleration()
+  int32_t stepMode;      // SC_*_STEP
+} MotionProfile_t;
+
+class ProfileRegistry
+{
+ public:
+  // Constructors:
+  ProfileRegistry();
+
+  // Setters:
+  bool setProfile(int code, unsigned long speed, unsigned long acceleration, int stepMode);
+  void setProfiles(const MotionProfile_t *profiles);
+
+  // Getters:
+  const MotionProfile_t *getProfile(int code);
+  const MotionProfile_t *getProfiles();
+
+  // Other public members
+  bool removeProfile(int code);
+  void reset();
+  bool apply(int code, StepperControl *motor);
+
+ private:
+  MotionProfile_t profiles[PR_MAX_PROFILES];
+};
+
+#endif //ProfileRegistry_h
@@ -0,0 +1,45 @@
+/*
+SettingsStorage.h - - Storage backend of the focuser settings - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+A storage keeps a single binary blob. The SettingsStore only uses this
+interface, so the backend can be replaced (NVS on the ESP32, a file on a
+host build).
+
+This file is part of the Settings library.
+
+Settings library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Settings library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Settings library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef SettingsStorage_h
+#define SettingsStorage_h
+
+#include <stddef.h>
+
+class SettingsStorage
+{
+ public:
+  virtual ~SettingsStorage() {}
+
+  virtual bool begin() = 0;
+  // Return false if no blob of exactly this size is stored
+  virtual bool read(void *data, size_t size) = 0;
+  virtual bool write(const void *data, size_t size) = 0;
+};
+
+#endif //SettingsStorage_h
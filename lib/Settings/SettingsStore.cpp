@@ -0,0 +1,180 @@
+/*
+SettingsStore.cpp - - Persistent settings of the focuser - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the Settings library.
+
+Settings library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Settings library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Settings library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "SettingsStore.h"
+
+//------------------------------------------------------------------------------
+// Constructors
+SettingsStore::SettingsStore(SettingsStorage *storage)
+{
+  this->storage = storage;
+  memset(&this->settings, 0, sizeof(this->settings));
+  this->settingsAreDirty = false;
+  this->positionIsDirty = false;
+  this->storageIsReady = false;
+  this->writeWasAttempted = false;
+  this->writeHasFailed = false;
+  this->changeTimestamp = 0;
+  this->positionTimestamp = 0;
+  this->writeTimestamp = 0;
+  this->writeCount = 0;
+}
+
+//------------------------------------------------------------------------------
+// Getters
+
+// The settings loaded at boot or last updated
+const FocuserSettings_t *SettingsStore::getSettings()
+{
+  return &this->settings;
+}
+
+unsigned long SettingsStore::getWriteCount()
+{
+  return this->writeCount;
+}
+
+//------------------------------------------------------------------------------
+// Other public members
+
+// Return true if valid settings were read from the storage
+bool SettingsStore::load()
+{
+  FocuserSettings_t stored;
+
+  this->storageIsReady = this->storage->begin();
+  if (!this->storageIsReady || !this->storage->read(&stored, sizeof(stored)))
+  {
+    return false;
+  }
+  if (stored.magic != SETTINGS_MAGIC || stored.version != SETTINGS_VERSION ||
+      stored.checksum != computeChecksum(&stored))
+  {
+    return false;
+  }
+  this->settings = stored;
+  this->settingsAreDirty = false;
+  this->positionIsDirty = false;
+  return true;
+}
+
+// Take a snapshot of the current settings. Nothing is written here.
+void SettingsStore::update(const FocuserSettings_t *settings)
+{
+  FocuserSettings_t snapshot = *settings;
+
+  snapshot.magic = SETTINGS_MAGIC;
+  snapshot.version = SETTINGS_VERSION;
+  // The position is compared apart, it is not held by the minimum interval
+  snapshot.currentPosition = this->settings.currentPosition;
+  snapshot.checksum = computeChecksum(&snapshot);
+  if (memcmp(&snapshot, &this->settings, sizeof(snapshot)) != 0)
+  {
+    this->settingsAreDirty = true;
+    this->changeTimestamp = millis();
+  }
+  if (settings->currentPosition != this->settings.currentPosition)
+  {
+    this->positionIsDirty = true;
+    this->positionTimestamp = millis();
+  }
+
+  snapshot.currentPosition = settings->currentPosition;
+  snapshot.checksum = computeChecksum(&snapshot);
+  this->settings = snapshot;
+}
+
+// True if settings other than the position wait for a write
+bool SettingsStore::isDirty()
+{
+  return this->settingsAreDirty;
+}
+
+bool SettingsStore::isPositionDirty()
+{
+  return this->positionIsDirty;
+}
+
+void SettingsStore::Manage()
+{
+  // This procedure should be called regularly while nothing moves.
+  if (this->settingsAreDirty &&
+      (millis() - this->changeTimestamp) >= SETTINGS_DEBOUNCE_TIME &&
+      (!this->writeWasAttempted || (millis() - this->writeTimestamp) >= SETTINGS_MIN_WRITE_INTERVAL))
+  {
+    this->flush();
+  }
+  else if (this->positionIsDirty &&
+           (millis() - this->positionTimestamp) >= SETTINGS_DEBOUNCE_TIME &&
+           (!this->settingsAreDirty || (millis() - this->changeTimestamp) >= SETTINGS_DEBOUNCE_TIME) &&
+           (!this->writeHasFailed || (millis() - this->writeTimestamp) >= SETTINGS_MIN_WRITE_INTERVAL))
+  {
+    // The settings waiting for the minimum interval go with the position,
+    // a burst of settings changes is still coalesced
+    this->flush();
+  }
+}
+
+// Write the settings and the position now if they changed
+bool SettingsStore::flush()
+{
+  if (!this->settingsAreDirty && !this->positionIsDirty)
+  {
+    return true;
+  }
+  if (!this->storageIsReady)
+  {
+    return false;
+  }
+  this->writeTimestamp = millis();
+  this->writeWasAttempted = true;
+  this->writeHasFailed = !this->storage->write(&this->settings, sizeof(this->settings));
+  if (this->writeHasFailed)
+  {
+    // Retried after SETTINGS_MIN_WRITE_INTERVAL
+    return false;
+  }
+  this->writeCount++;
+  this->settingsAreDirty = false;
+  this->positionIsDirty = false;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Private
+
+// FNV-1a over all the fields but the checksum
+uint32_t SettingsStore::computeChecksum(const FocuserSettings_t *settings)
+{
+  const uint8_t *data = (const uint8_t *)settings;
+  uint32_t hash = 2166136261UL;
+  size_t i;
+
+  for (i = 0; i < offsetof(FocuserSettings_t, checksum); i++)
+  {
+    hash ^= data[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
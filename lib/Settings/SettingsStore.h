@@ -0,0 +1,119 @@
+/*
+SettingsStore.h - - Persistent settings of the focuser - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+The settings are kept in RAM and written to the storage only when they
+changed. The writes are coalesced: a write happens once the settings did
+not change for SETTINGS_DEBOUNCE_TIME, and not more often than every
+SETTINGS_MIN_WRITE_INTERVAL, which keeps the flash wear low while the
+focuser is moved often. Manage() should only be called while nothing
+moves, the flash write blocks for some milliseconds.
+
+The position changes with each move, so it does not make the settings
+dirty: it is written SETTINGS_DEBOUNCE_TIME after the end of the last
+move, without the minimum interval, so a power cut after a move still
+gives a warm start at the right position. A series of moves (e.g. an
+autofocus run) gives a single write, and the NVS wear levelling spreads
+the writes over its pages.
+
+A checksum and a version number protect against corrupted or outdated
+blobs: in that case the defaults of the firmware are kept.
+
+This file is part of the Settings library.
+
+Settings library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Settings library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Settings library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef SettingsStore_h
+#define SettingsStore_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include "SettingsStorage.h"
+#include "ProfileRegistry.h"
+#include "FilterTable.h"
+
+#define SETTINGS_MAGIC 0x46434653 // "FCFS"
+#define SETTINGS_VERSION 7
+
+#define SETTINGS_DEBOUNCE_TIME 2000        // ms
+#define SETTINGS_MIN_WRITE_INTERVAL 10000  // ms
+
+typedef struct FocuserSettings_s
+{
+  uint32_t magic;
+  uint32_t version;
+  int32_t currentPosition;
+  uint32_t speed;
+  int32_t stepMode;
+  int32_t temperatureCompensationCoefficient;
+  int32_t temperatureCompensationIsEnabled;
+  float temperatureCompensationValue;
+  uint32_t speedLimit;
+  uint32_t acceleration;
+  MotionProfile_t profiles[PR_MAX_PROFILES];
+  int32_t profile; // SD code in use
+  FilterOffset_t filters[FT_MAX_FILTERS];
+  float filterReferenceTemperature;
+  int32_t filter; // Filter in use
+  int32_t slewStepMode;
+  uint32_t approachDistance; // full steps
+  ResonanceBand_t resonanceBands[SC_MAX_RESONANCE_BANDS];
+  uint32_t accelerationLimit; // full steps per second every 50ms
+  uint32_t checksum; // Should stay the last field
+} FocuserSettings_t;
+
+class SettingsStore
+{
+ public:
+  // Constructors:
+  SettingsStore(SettingsStorage *storage);
+
+  // Getters:
+  const FocuserSettings_t *getSettings();
+  unsigned long getWriteCount();
+
+  // Other public members
+  bool load();
+  void update(const FocuserSettings_t *settings);
+  bool isDirty();
+  bool isPositionDirty();
+  void Manage();
+  bool flush();
+
+ private:
+  SettingsStorage *storage;
+  FocuserSettings_t settings;
+  bool settingsAreDirty;
+  bool positionIsDirty;
+  bool storageIsReady;
+  bool writeWasAttempted;
+  bool writeHasFailed;
+  unsigned long changeTimestamp;
+  unsigned long positionTimestamp;
+  unsigned long writeTimestamp;
+  unsigned long writeCount;
+
+  static uint32_t computeChecksum(const FocuserSettings_t *settings);
+};
+
+#endif //SettingsStore_h
@@ -0,0 +1,221 @@
+/*
+StatusDisplay.cpp - - Status display refreshed in small slices - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the StatusDisplay library.
+
+StatusDisplay library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StatusDisplay library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StatusDisplay library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "StatusDisplay.h"
+
+//------------------------------------------------------------------------------
+// Constructors
+
+StatusDisplay::StatusDisplay(U8G2 *display)
+{
+  int i;
+
+  this->display = display;
+  this->fieldCount = 0;
+  this->tileColumns = 0;
+  this->tileRows = 0;
+  this->budget = DSP_DEFAULT_BUDGET;
+  this->tileTime = 0;
+  for (i = 0; i < DSP_MAX_TILE_ROWS; i++)
+  {
+    this->dirtyTiles[i] = 0;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Setters
+
+// Time in us that Manage() may use to send tiles
+void StatusDisplay::setBudget(unsigned long budget)
+{
+  this->budget = budget;
+}
+
+// Draw the text in the buffer if it changed. It is sent by Manage().
+void StatusDisplay::setField(int field, const char *text)
+{
+  DisplayField_t *entry;
+
+  if (field < 0 || field >= this->fieldCount)
+  {
+    return;
+  }
+  entry = &this->fields[field];
+  if (strncmp(entry->text, text, DSP_MAX_TEXT) == 0)
+  {
+    return;
+  }
+  strncpy(entry->text, text, DSP_MAX_TEXT);
+  entry->text[DSP_MAX_TEXT] = 0;
+
+  // The text cannot overwrite the other fields
+  this->display->setClipWindow(entry->x, entry->y, entry->x + entry->width, entry->y + entry->height);
+  this->display->setDrawColor(0);
+  this->display->drawBox(entry->x, entry->y, entry->width, entry->height);
+  this->display->setDrawColor(1);
+  this->display->drawStr(entry->x, entry->y, entry->text);
+  this->display->setMaxClipWindow();
+  this->markDirty(entry->x, entry->y, entry->width, entry->height);
+}
+
+//------------------------------------------------------------------------------
+// Getters
+
+unsigned long StatusDisplay::getBudget()
+{
+  return this->budget;
+}
+
+// Last measured time to send one tile in us
+unsigned long StatusDisplay::getTileTime()
+{
+  return this->tileTime;
+}
+
+// True while some tiles are not sent
+bool StatusDisplay::isDirty()
+{
+  int i;
+
+  for (i = 0; i < this->tileRows; i++)
+  {
+    if (this->dirtyTiles[i] != 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// Other public members
+
+// Clear the screen. The only full transfer, it should be done in setup().
+void StatusDisplay::begin(const uint8_t *font, uint8_t contrast)
+{
+  this->display->begin();
+  this->display->setContrast(contrast);
+  this->display->setFont(font);
+  // The fields are given by their top left corner
+  this->display->setFontPosTop();
+  this->display->clearBuffer();
+  this->display->sendBuffer();
+
+  this->tileColumns = min(this->display->getBufferTileWidth(), DSP_MAX_TILE_COLUMNS);
+  this->tileRows = min(this->display->getBufferTileHeight(), DSP_MAX_TILE_ROWS);
+}
+
+// Return the number of the field, DSP_NO_FIELD if the table is full.
+// The fields aligned on the tiles (multiples of 8 pixels) send less data.
+int StatusDisplay::addField(int x, int y, int width, int height)
+{
+  DisplayField_t *entry;
+
+  if (this->fieldCount >= DSP_MAX_FIELDS)
+  {
+    return DSP_NO_FIELD;
+  }
+  entry = &this->fields[this->fieldCount];
+  entry->x = x;
+  entry->y = y;
+  entry->width = width;
+  entry->height = height;
+  entry->text[0] = 0;
+  return this->fieldCount++;
+}
+
+// Send the dirty tiles within the budget. The consecutive tiles of a row
+// are sent with one transfer.
+void StatusDisplay::Manage()
+{
+  unsigned long startTimestamp = micros();
+  unsigned long transferTimestamp;
+  unsigned long elapsedTime;
+  int sentTiles = 0;
+  int maxTiles;
+  int row;
+  int column;
+  int count;
+
+  for (row = 0; row < this->tileRows; row++)
+  {
+    column = 0;
+    while (this->dirtyTiles[row] != 0 && column < this->tileColumns)
+    {
+      if (!(this->dirtyTiles[row] & (1 << column)))
+      {
+        column++;
+        continue;
+      }
+
+      // Tiles which still fit in the budget, at least one per call
+      elapsedTime = micros() - startTimestamp;
+      maxTiles = 1;
+      if (this->tileTime > 0)
+      {
+        maxTiles = elapsedTime < this->budget ? (this->budget - elapsedTime) / this->tileTime : 0;
+      }
+      if (maxTiles == 0)
+      {
+        if (sentTiles > 0)
+        {
+          return;
+        }
+        maxTiles = 1;
+      }
+
+      for (count = 0; column + count < this->tileColumns && count < maxTiles &&
+                      (this->dirtyTiles[row] & (1 << (column + count))); count++)
+        ;
+
+      transferTimestamp = micros();
+      this->display->updateDisplayArea(column, row, count, 1);
+      this->tileTime = (micros() - transferTimestamp) / count;
+      this->dirtyTiles[row] &= ~(((1 << count) - 1) << column);
+      sentTiles += count;
+      column += count;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// Private
+
+void StatusDisplay::markDirty(int x, int y, int width, int height)
+{
+  int firstColumn = max(x / DSP_TILE_SIZE, 0);
+  int lastColumn = min((x + width - 1) / DSP_TILE_SIZE, this->tileColumns - 1);
+  int firstRow = max(y / DSP_TILE_SIZE, 0);
+  int lastRow = min((y + height - 1) / DSP_TILE_SIZE, this->tileRows - 1);
+  int row;
+  int column;
+
+  for (row = firstRow; row <= lastRow; row++)
+  {
+    for (column = firstColumn; column <= lastColumn; column++)
+    {
+      this->dirtyTiles[row] |= 1 << column;
+    }
+  }
+}
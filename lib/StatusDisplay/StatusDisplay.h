@@ -0,0 +1,95 @@
+/*
+StatusDisplay.h - - Status display refreshed in small slices - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+The page loop of U8g2 (firstPage()/nextPage()) sends the whole screen in
+one go, which blocks the main loop for tens of milliseconds. Here the
+display runs in full buffer mode and the screen is split in text fields.
+A field is drawn again in the buffer only when its text changed, and the
+tiles (8x8 pixels) it covers are marked dirty. Manage() only sends dirty
+tiles, with updateDisplayArea(), and stops before its time budget is
+exceeded. The time of a tile is measured on each transfer. At least one
+tile is sent per call so the screen always catches up.
+
+This file is part of the StatusDisplay library.
+
+StatusDisplay library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StatusDisplay library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StatusDisplay library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef StatusDisplay_h
+#define StatusDisplay_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#include <U8g2lib.h>
+
+#define DSP_MAX_FIELDS 4
+#define DSP_MAX_TEXT 16        // Caracters of a field
+#define DSP_MAX_TILE_COLUMNS 16 // 128 pixels
+#define DSP_MAX_TILE_ROWS 8     // 64 pixels
+#define DSP_TILE_SIZE 8         // pixels
+#define DSP_DEFAULT_BUDGET 1000 // us per Manage()
+#define DSP_NO_FIELD -1
+
+typedef struct
+{
+  int x;
+  int y;
+  int width;
+  int height;
+  char text[DSP_MAX_TEXT + 1];
+} DisplayField_t;
+
+class StatusDisplay
+{
+ public:
+  // Constructors:
+  StatusDisplay(U8G2 *display);
+
+  // Setters:
+  void setBudget(unsigned long budget);
+  void setField(int field, const char *text);
+
+  // Getters:
+  unsigned long getBudget();
+  unsigned long getTileTime();
+  bool isDirty();
+
+  // Other public members
+  void begin(const uint8_t *font, uint8_t contrast);
+  int addField(int x, int y, int width, int height);
+  void Manage();
+
+ private:
+  U8G2 *display;
+  DisplayField_t fields[DSP_MAX_FIELDS];
+  int fieldCount;
+  uint16_t dirtyTiles[DSP_MAX_TILE_ROWS]; // One bit per tile column
+  int tileColumns;
+  int tileRows;
+  unsigned long budget;   // us
+  unsigned long tileTime; // us to send one tile
+
+  void markDirty(int x, int y, int width, int height);
+};
+
+#endif //StatusDisplay_h
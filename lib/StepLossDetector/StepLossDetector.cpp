@@ -0,0 +1,152 @@
+/*
+StepLossDetector.cpp - - Step loss detection from a motor encoder - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the StepLossDetector library.
+
+StepLossDetector library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StepLossDetector library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StepLossDetector library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "StepLossDetector.h"
+
+//------------------------------------------------------------------------------
+// Constructors
+
+StepLossDetector::StepLossDetector()
+{
+  this->scalePositions = 1;
+  this->scaleCounts = 1;
+  this->tolerance = SLD_DEFAULT_TOLERANCE;
+  this->confirmationCount = SLD_DEFAULT_CONFIRMATION_COUNT;
+  this->lossCount = 0;
+  this->reset();
+}
+
+//------------------------------------------------------------------------------
+// Setters
+
+// The encoder moves by counts when the motor moves by positions, e.g.
+// 200 * 32 positions for 4000 counts. A negative value inverts the encoder.
+// A new scale takes a new reference.
+void StepLossDetector::setScale(long positions, long counts)
+{
+  if (counts == 0 || (positions == this->scalePositions && counts == this->scaleCounts))
+  {
+    return;
+  }
+  this->scalePositions = positions;
+  this->scaleCounts = counts;
+  this->reset();
+}
+
+// Error in positions accepted without loss (backlash, encoder resolution)
+void StepLossDetector::setTolerance(long tolerance)
+{
+  this->tolerance = tolerance > 1 ? tolerance : 1;
+}
+
+// Number of consecutive updates above the tolerance before a loss is reported
+void StepLossDetector::setConfirmationCount(int confirmationCount)
+{
+  this->confirmationCount = confirmationCount > 1 ? confirmationCount : 1;
+}
+
+//------------------------------------------------------------------------------
+// Getters
+
+long StepLossDetector::getTolerance()
+{
+  return this->tolerance;
+}
+
+// Position given by the encoder on the last update
+long StepLossDetector::getMeasuredPosition()
+{
+  return this->measuredPosition;
+}
+
+// Measured minus commanded position on the last update
+long StepLossDetector::getError()
+{
+  return this->error;
+}
+
+// Highest error (absolute value) since the reset
+long StepLossDetector::getMaxError()
+{
+  return this->maxError;
+}
+
+// Losses reported since the start
+unsigned long StepLossDetector::getLossCount()
+{
+  return this->lossCount;
+}
+
+//------------------------------------------------------------------------------
+// Other public members
+
+// The next update takes the reference. Should be called when the position
+// counter is set (sync, homing).
+void StepLossDetector::reset()
+{
+  this->referenceIsSet = false;
+  this->referencePosition = 0;
+  this->referenceCount = 0;
+  this->measuredPosition = 0;
+  this->error = 0;
+  this->maxError = 0;
+  this->errorCount = 0;
+}
+
+// Return true when a loss is detected: the caller should take
+// getMeasuredPosition() as the real position.
+bool StepLossDetector::update(long commandedPosition, long encoderCount)
+{
+  long absError;
+
+  if (!this->referenceIsSet)
+  {
+    this->referencePosition = commandedPosition;
+    this->referenceCount = encoderCount;
+    this->referenceIsSet = true;
+  }
+
+  this->measuredPosition = this->referencePosition +
+    (long)((int64_t)(encoderCount - this->referenceCount) * this->scalePositions / this->scaleCounts);
+  this->error = this->measuredPosition - commandedPosition;
+  absError = this->error < 0 ? -this->error : this->error;
+  if (absError > this->maxError)
+  {
+    this->maxError = absError;
+  }
+
+  if (absError <= this->tolerance)
+  {
+    this->errorCount = 0;
+    return false;
+  }
+  this->errorCount++;
+  if (this->errorCount < this->confirmationCount)
+  {
+    return false;
+  }
+  this->errorCount = 0;
+  this->lossCount++;
+  return true;
+}
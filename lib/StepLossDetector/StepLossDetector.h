@@ -0,0 +1,90 @@
+/*
+StepLossDetector.h - - Step loss detection from a motor encoder - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+The position commanded to the motor is compared to the position measured
+by an encoder on the motor shaft or the drawtube. The encoder counts are
+converted to positions by a ratio (positions moved for a number of
+counts), relative to the reference taken on the first update after a
+reset.
+
+A loss is reported when the error stays above the tolerance for several
+consecutive updates, which filters the backlash and the lag of the
+mechanics during the ramps. The reference is kept: once the caller has
+corrected the commanded position to the measured one, the error is back
+to zero.
+
+The class only works on the values passed to update(), it can be fed with
+simulated counts.
+
+This file is part of the StepLossDetector library.
+
+StepLossDetector library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StepLossDetector library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StepLossDetector library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef StepLossDetector_h
+#define StepLossDetector_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#define SLD_DEFAULT_TOLERANCE 64          // positions
+#define SLD_DEFAULT_CONFIRMATION_COUNT 3
+
+class StepLossDetector
+{
+ public:
+  // Constructors:
+  StepLossDetector();
+
+  // Setters:
+  void setScale(long positions, long counts);
+  void setTolerance(long tolerance);
+  void setConfirmationCount(int confirmationCount);
+
+  // Getters:
+  long getTolerance();
+  long getMeasuredPosition();
+  long getError();
+  long getMaxError();
+  unsigned long getLossCount();
+
+  // Other public members
+  void reset();
+  bool update(long commandedPosition, long encoderCount);
+
+ private:
+  long scalePositions;
+  long scaleCounts;
+  long tolerance;
+  int confirmationCount;
+
+  bool referenceIsSet;
+  long referencePosition;
+  long referenceCount;
+  long measuredPosition;
+  long error;
+  long maxError;
+  int errorCount; // Consecutive updates above the tolerance
+  unsigned long lossCount;
+};
+
+#endif //StepLossDetector_h
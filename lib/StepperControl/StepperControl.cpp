@@ -46,20 +46,20 @@ StepperControl::StepperControl(int stepPin,
 
   pinMode(stepPin, OUTPUT);
   pinMode(directionPin, OUTPUT);
-  pinMode(stepModePin1, OUTPUT);
-  pinMode(stepModePin2, OUTPUT);
-  pinMode(stepModePin3, OUTPUT);
-  pinMode(enablePin, OUTPUT);
-  pinMode(sleepPin, OUTPUT);
-  pinMode(resetPin, OUTPUT);
+  this->setupPin(stepModePin1);
+  this->setupPin(stepModePin2);
+  this->setupPin(stepModePin3);
+  this->setupPin(enablePin);
+  this->setupPin(sleepPin);
+  this->setupPin(resetPin);
 
   digitalWrite(directionPin, LOW);
   digitalWrite(stepPin, LOW);
 
-  digitalWrite(sleepPin, HIGH);
-  digitalWrite(resetPin, HIGH);
+  this->writePin(sleepPin, HIGH);
+  this->writePin(resetPin, HIGH);
 
-  digitalWrite(enablePin, HIGH);
+  this->writePin(enablePin, HIGH);
 
   this->direction = SC_CLOCKWISE;
   this->inMove = false;
@@ -68,17 +68,56 @@ StepperControl::StepperControl(int stepPin,
   this->targetPosition = 0;
   this->moveMode = SC_MOVEMODE_PER_STEP;
   this->acceleration = SC_DEFAULT_ACCEL;
+  this->speedLimit = 0;
+  this->accelerationLimit = 0;
+  this->slewStepMode = SC_NO_STEP_MODE;
+  this->approachDistance = SC_DEFAULT_APPROACH;
+  this->stepRatio = 1;
+  this->stepModeIsPending = false;
+  this->stepModeIsSending = false;
+  this->stepModeTimestamp = 0;
   this->speed = 0;
+  this->requestedSpeed = 0;
+  this->targetSpeed = 0;
   this->lastMovementTimestamp = 0;
+  this->stepLateness = 0;
+  this->maxStepLateness = 0;
   this->accelTimestamp = 0;
   this->targetSpeedReached = false;
   this->positionTargetSpeedReached = 0;
-  this->lastCompensatedTemperature = 0;
   this->temperatureCompensationIsInit = false;
   this->temperatureCompensationIsEnabled = false;
   this->temperatureCompensationCoefficient = 0;
+  this->userMoveIsRunning = false;
   this->currentTemperature = 0;
+  this->currentTemperatureIsKnown = false;
+  this->settledPositionIsPending = false;
+  this->moveEndTimestamp = 0;
+  this->driver = NULL;
+  this->homingState = SC_HOMING_IDLE;
+  this->positionIsValid = true;
+  this->homingDirection = SC_HOMING_INWARD;
+  this->homingSpeed = SC_HOMING_DEFAULT_SPEED;
+  this->homingBackoff = SC_HOMING_DEFAULT_BACKOFF;
+  this->homingMaxTravel = SC_HOMING_DEFAULT_MAX_TRAVEL;
+  this->savedTargetSpeed = 0;
+  this->savedMoveMode = SC_MOVEMODE_PER_STEP;
+  this->homingPollTimestamp = 0;
+  this->stallGuardTimestamp = 0;
+  this->telemetryInterval = 0;
+  this->telemetryOnChange = false;
+  this->telemetryTimestamp = 0;
+  this->telemetryPosition = 0;
+  this->telemetryTemperature = TB_NO_TEMPERATURE;
+  this->queueHead = 0;
+  this->queueCount = 0;
+  this->queueBlendCount = 0;
+  this->queueDirection = 0;
+  this->dwellIsRunning = false;
+  this->dwellEndTimestamp = 0;
+  this->reachedWaypointCount = 0;
   this->setStepMode(SC_8TH_STEP);
+  this->clearResonanceBands();
 }
 
 //------------------------------------------------------------------------------------
@@ -90,7 +129,9 @@ void StepperControl::setTargetPosition(long position)
 
 void StepperControl::setCurrentPosition(long position)
 {
+  this->focusModel.shiftPositions(position - this->currentPosition);
   this->currentPosition = position;
+  this->positionIsValid = true;
 }
 
 void StepperControl::setDirection(int direction)
@@ -100,10 +141,12 @@ void StepperControl::setDirection(int direction)
 
 void StepperControl::setStepMode(int stepMode)
 {
+  if (this->isSlewing())
+  {
+    this->endSlew();
+  }
   this->stepMode = stepMode;
-  digitalWrite(stepModePin1, this->stepMode & 0x04);
-  digitalWrite(stepModePin2, this->stepMode & 0x02);
-  digitalWrite(stepModePin3, this->stepMode & 0x01);
+  this->applyStepMode(stepMode);
 }
 
 void StepperControl::setMoveMode(int moveMode)
@@ -111,45 +154,131 @@ void StepperControl::setMoveMode(int moveMode)
   this->moveMode = moveMode;
 }
 
+// The speed is kept as requested, the moves cruise at it within the limits
+// and out of the resonance bands
 void StepperControl::setSpeed(unsigned int speed)
 {
-  if (this->stepMode == SC_8TH_STEP && speed >= SC_MAX_SPEED_8TH_STEP)
-  {
-    this->targetSpeed = SC_MAX_SPEED_8TH_STEP;
-  }
-  else if (this->stepMode == SC_16TH_STEP && speed >= SC_MAX_SPEED_16TH_STEP)
-  {
-    this->targetSpeed = SC_MAX_SPEED_16TH_STEP;
-  }
-  else if (this->stepMode == SC_32TH_STEP && speed >= SC_MAX_SPEED_32TH_STEP)
-  {
-    this->targetSpeed = SC_MAX_SPEED_32TH_STEP;
-  }
-  else if (this->stepMode == SC_64TH_STEP && speed >= SC_MAX_SPEED_64TH_STEP)
-  {
-    this->targetSpeed = SC_MAX_SPEED_64TH_STEP;
-  }
-  else
+  this->requestedSpeed = speed;
+  this->targetSpeed = speed < getMaxSpeed(this->stepMode) ? speed : getMaxSpeed(this->stepMode);
+
+  // Limit of the mechanics, found by the auto-tuning
+  if (this->speedLimit != 0 && this->targetSpeed > this->speedLimit * getMicrosteps(this->stepMode))
   {
-    this->targetSpeed = speed;
+    this->targetSpeed = this->speedLimit * getMicrosteps(this->stepMode);
   }
+  this->targetSpeed = this->avoidResonance(this->targetSpeed);
 }
 
 void StepperControl::setTemperatureCompensationCoefficient(int coef)
 {
   this->temperatureCompensationCoefficient = coef;
+  // The coefficient is the number of steps to move in for each degree of increase
+  this->focusModel.setDefaultSlope(-(float)coef);
 }
 
 void StepperControl::setCurrentTemperature(float curTemp)
 {
   this->currentTemperature = curTemp;
+  this->currentTemperatureIsKnown = true;
   if (!this->temperatureCompensationIsInit)
   {
-    this->lastCompensatedTemperature = this->currentTemperature;
+    this->focusModel.setReference(this->currentTemperature, this->currentPosition);
     this->temperatureCompensationIsInit = true;
   }
 }
 
+// Drive the TMC2209 through its UART interface instead of the mode pins
+void StepperControl::setDriver(TMC2209 *driver)
+{
+  this->driver = driver;
+  this->setStepMode(this->stepMode);
+}
+
+// The StallGuard readings are only valid in StealthChop: the homing speed
+// should stay under the StealthChop limit of the driver.
+void StepperControl::setHomingSpeed(unsigned int speed)
+{
+  this->homingSpeed = speed;
+}
+
+// Speed increment every 50ms during the ramps (smooth move mode)
+void StepperControl::setAcceleration(unsigned int acceleration)
+{
+  this->acceleration = acceleration > 0 ? acceleration : 1;
+
+  // Limit of the mechanics, found by the auto-tuning
+  if (this->accelerationLimit != 0 && this->acceleration > this->accelerationLimit * getMicrosteps(this->stepMode))
+  {
+    this->acceleration = this->accelerationLimit * getMicrosteps(this->stepMode);
+  }
+}
+
+// Highest safe speed of the focuser. It is given in full steps so it stays
+// valid when the step mode changes. 0 removes the limit.
+void StepperControl::setSpeedLimit(unsigned long fullStepsPerSecond)
+{
+  this->speedLimit = fullStepsPerSecond;
+  this->setSpeed(this->requestedSpeed);
+}
+
+// Highest safe speed increment every 50ms, in full steps like the speed
+// limit. 0 removes the limit.
+void StepperControl::setAccelerationLimit(unsigned long fullStepsPerSecond)
+{
+  this->accelerationLimit = fullStepsPerSecond;
+  this->setAcceleration(this->acceleration);
+}
+
+// Time between two telemetry samples in ms, 0 to stop the recording
+void StepperControl::setTelemetryInterval(unsigned long interval)
+{
+  this->telemetryInterval = interval;
+}
+
+// Only record the samples which differ from the previous one
+void StepperControl::setTelemetryOnChange(bool onChange)
+{
+  this->telemetryOnChange = onChange;
+}
+
+// Step mode of the long moves (coarser than the step mode), SC_NO_STEP_MODE
+// to run the whole move in the step mode
+void StepperControl::setSlewStepMode(int stepMode)
+{
+  this->slewStepMode = stepMode;
+}
+
+// Distance before the target run in the step mode, in full steps
+void StepperControl::setApproachDistance(unsigned int fullSteps)
+{
+  this->approachDistance = fullSteps > 1 ? fullSteps : 1;
+}
+
+// Replace the bands (SC_MAX_RESONANCE_BANDS entries, the empty ones have
+// a null width), e.g. from the settings
+void StepperControl::setResonanceBands(const ResonanceBand_t *bands)
+{
+  int i;
+
+  this->clearResonanceBands();
+  for (i = 0; i < SC_MAX_RESONANCE_BANDS; i++)
+  {
+    this->addResonanceBand(bands[i].low, bands[i].high);
+  }
+}
+
+// Distance between the end stop and the new zero position
+void StepperControl::setHomingBackoff(long steps)
+{
+  this->homingBackoff = steps;
+}
+
+// The homing fails if no stall is detected over this distance
+void StepperControl::setHomingMaxTravel(long steps)
+{
+  this->homingMaxTravel = steps;
+}
+
 //------------------------------------------------------------------------------------
 // Getters
 long StepperControl::getCurrentPosition()
@@ -182,30 +311,315 @@ unsigned int StepperControl::getSpeed()
   return this->speed;
 }
 
+// Cruise speed of the moves: the speed set by setSpeed() within the limits
+// and out of the resonance bands. getSpeed() returns the speed of the ramp.
+unsigned int StepperControl::getTargetSpeed()
+{
+  return this->targetSpeed;
+}
+
+// Speed set by setSpeed(), before the limits and the resonance bands
+unsigned int StepperControl::getRequestedSpeed()
+{
+  return this->requestedSpeed;
+}
+
+unsigned int StepperControl::getAcceleration()
+{
+  return this->acceleration;
+}
+
+unsigned long StepperControl::getSpeedLimit()
+{
+  return this->speedLimit;
+}
+
+unsigned long StepperControl::getAccelerationLimit()
+{
+  return this->accelerationLimit;
+}
+
 int StepperControl::getTemperatureCompensationCoefficient()
 {
   return this->temperatureCompensationCoefficient;
 }
 
+FocusModel *StepperControl::getFocusModel()
+{
+  return &this->focusModel;
+}
+
+TMC2209 *StepperControl::getDriver()
+{
+  return this->driver;
+}
+
+StallDetector *StepperControl::getStallDetector()
+{
+  return &this->stallDetector;
+}
+
+TelemetryBuffer *StepperControl::getTelemetry()
+{
+  return &this->telemetry;
+}
+
+unsigned long StepperControl::getTelemetryInterval()
+{
+  return this->telemetryInterval;
+}
+
+bool StepperControl::isTelemetryOnChange()
+{
+  return this->telemetryOnChange;
+}
+
+// Time in ms until Manage() records the next telemetry sample,
+// SC_NO_DEADLINE when it waits for a change of the position or of the
+// temperature
+unsigned long StepperControl::getTimeToNextTelemetry()
+{
+  unsigned long elapsedTime;
+
+  if (this->telemetryInterval == 0)
+  {
+    return SC_NO_DEADLINE;
+  }
+  elapsedTime = millis() - this->telemetryTimestamp;
+  if (elapsedTime < this->telemetryInterval)
+  {
+    return this->telemetryInterval - elapsedTime;
+  }
+  if (this->telemetryOnChange && this->telemetryPosition == this->currentPosition &&
+      this->telemetryTemperature == this->getTelemetryTemperature())
+  {
+    return SC_NO_DEADLINE;
+  }
+  return 0;
+}
+
+int StepperControl::getSlewStepMode()
+{
+  return this->slewStepMode;
+}
+
+unsigned int StepperControl::getApproachDistance()
+{
+  return this->approachDistance;
+}
+
+bool StepperControl::isSlewing()
+{
+  return this->stepRatio > 1;
+}
+
+// The SC_MAX_RESONANCE_BANDS entries, the unused ones are null
+const ResonanceBand_t *StepperControl::getResonanceBands()
+{
+  return this->resonanceBands;
+}
+
+int StepperControl::getResonanceBandCount()
+{
+  return this->resonanceBandCount;
+}
+
+// True if the speed, in steps per second of the step mode, is strictly
+// inside a band. The bottom and the top of a band can be used.
+bool StepperControl::isInResonanceBand(unsigned long speed)
+{
+  unsigned long microsteps = getMicrosteps(this->stepMode);
+  int i;
+
+  for (i = 0; i < this->resonanceBandCount; i++)
+  {
+    if (speed > this->resonanceBands[i].low * microsteps &&
+        speed < this->resonanceBands[i].high * microsteps)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+int StepperControl::getStepPin()
+{
+  return this->stepPin;
+}
+
+// Delay of the last step compared to its ideal timing in us
+unsigned long StepperControl::getStepLateness()
+{
+  return this->stepLateness;
+}
+
+// Highest delay of a step at cruise speed since the last reset
+unsigned long StepperControl::getMaxStepLateness()
+{
+  return this->maxStepLateness;
+}
+
+// Predicted time to the end of the current move in ms, from the speed of
+// the ramp. Same model as predictMoveTime().
+unsigned long StepperControl::getRemainingMoveTime()
+{
+  long remainingSteps = abs(this->targetPosition - this->currentPosition);
+  long approachSteps = (long)this->approachDistance * getMicrosteps(this->stepMode);
+  unsigned long approachSpeed;
+  float cruiseSpeed;
+
+  if (!this->inMove || remainingSteps == 0)
+  {
+    return 0;
+  }
+  if (this->moveMode != SC_MOVEMODE_SMOOTH)
+  {
+    return this->predictMoveTime(remainingSteps);
+  }
+  if ((this->isSlewing() || this->canSlew(remainingSteps)) && remainingSteps > approachSteps)
+  {
+    approachSpeed = this->getApproachSpeed();
+    return (unsigned long)((this->predictSegment(remainingSteps - approachSteps, this->speed,
+                                                 this->getSlewSpeed(), approachSpeed) +
+                            this->predictSegment(approachSteps, approachSpeed, approachSpeed, 0)) * 1000);
+  }
+  // After a slew the approach continues at the speed it started with
+  cruiseSpeed = this->targetSpeedReached ? this->speed : this->targetSpeed;
+  return (unsigned long)(this->predictSegment(remainingSteps, this->speed, cruiseSpeed, 0) * 1000);
+}
+
+long StepperControl::getRemainingMoveDistance()
+{
+  return this->inMove ? abs(this->targetPosition - this->currentPosition) : 0;
+}
+
+void StepperControl::resetMaxStepLateness()
+{
+  this->maxStepLateness = 0;
+}
+
+// SC_HOMING_LOST while the position is not valid and no homing runs
+int StepperControl::getHomingState()
+{
+  if (!this->positionIsValid && !this->isHoming())
+  {
+    return SC_HOMING_LOST;
+  }
+  return this->homingState;
+}
+
+// Waypoints not reached yet
+int StepperControl::getQueueCount()
+{
+  return this->queueCount;
+}
+
+// Waypoints reached since the start, the host compares it to the number of
+// waypoints it queued
+unsigned long StepperControl::getReachedWaypointCount()
+{
+  return this->reachedWaypointCount;
+}
+
+unsigned int StepperControl::getMicrosteps(int stepMode)
+{
+  switch (stepMode)
+  {
+    case SC_16TH_STEP:
+      return 16;
+    case SC_32TH_STEP:
+      return 32;
+    case SC_64TH_STEP:
+      return 64;
+    case SC_128TH_STEP:
+      return 128;
+    case SC_256TH_STEP:
+      return 256;
+    default:
+      return 8;
+  }
+}
+
+// Highest step rate of a step mode in steps per second
+unsigned long StepperControl::getMaxSpeed(int stepMode)
+{
+  switch (stepMode)
+  {
+    case SC_16TH_STEP:
+      return SC_MAX_SPEED_16TH_STEP;
+    case SC_32TH_STEP:
+      return SC_MAX_SPEED_32TH_STEP;
+    case SC_64TH_STEP:
+      return SC_MAX_SPEED_64TH_STEP;
+    case SC_128TH_STEP:
+      return SC_MAX_SPEED_128TH_STEP;
+    case SC_256TH_STEP:
+      return SC_MAX_SPEED_256TH_STEP;
+    case SC_8TH_STEP:
+      return SC_MAX_SPEED_8TH_STEP;
+    default:
+      return SC_MAX_SPEED;
+  }
+}
+
 //------------------------------------------------------------------------------------
 // Other public members
 void StepperControl::Manage()
 {
+  if (this->Manage(micros()))
+  {
+    delayMicroseconds(SC_DIRECTION_SETUP_TIME);
+    this->pulseStep();
+  }
+}
+
+// Same as Manage() but the step pulse is left to the caller, so several
+// axes can share a time base and pulse their steps together.
+// Return true if a step is due: the direction pin is already set.
+bool StepperControl::Manage(unsigned long now)
+{
+  bool stepIsDue = false;
+
+  this->recordTelemetry();
+
   if (this->inMove)
   {
-    this->moveMotor();
+    stepIsDue = this->moveMotor(now);
   }
-  else if (this->temperatureCompensationIsEnabled)
+  if (this->isHoming())
+  {
+    this->manageHoming();
+  }
+  if (this->isQueueRunning())
+  {
+    this->manageQueue();
+  }
+  if (this->inMove)
+  {
+    return stepIsDue;
+  }
+
+  this->learnSettledPosition();
+
+  if (this->temperatureCompensationIsEnabled)
   {
   }
   else
   {
     // disable motor by timeout
-    if((micros() - this->lastMovementTimestamp) >= 1000000)
+    if((now - this->lastMovementTimestamp) >= 1000000)
     {
-      digitalWrite(this->enablePin, HIGH);
+      this->writePin(this->enablePin, HIGH);
     }
   }
+  return stepIsDue;
+}
+
+void StepperControl::pulseStep()
+{
+  digitalWrite(this->stepPin, HIGH);
+  delayMicroseconds(SC_STEP_PULSE_WIDTH);
+  digitalWrite(this->stepPin, LOW);
 }
 
 void StepperControl::goToTargetPosition()
@@ -223,16 +637,43 @@ void StepperControl::goToTargetPosition()
       this->speed = this->targetSpeed;
     }
     this->startPosition = this->currentPosition;
-    digitalWrite(this->enablePin, LOW);
+    if (this->driver != NULL)
+    {
+      // Send the pending configuration before the first step
+      this->driver->flush();
+    }
+    this->writePin(this->enablePin, LOW);
     this->inMove = true;
+    this->userMoveIsRunning = false;
+    // A move which starts on a full step can slew from its first step
+    this->updateStepResolution();
   }
 }
 
+// Move to the target chosen by the user (FG, the knob): its end position
+// is learned as a focus position once settled. The other moves (queue,
+// sweep, compensation...) are not.
+void StepperControl::startUserMove()
+{
+  this->goToTargetPosition();
+  this->userMoveIsRunning = this->inMove;
+}
+
+// Move started by the firmware itself (compensation, homing, tuning)
+void StepperControl::startAutomaticMove(long position)
+{
+  this->setTargetPosition(position);
+  this->goToTargetPosition();
+}
+
 void StepperControl::stopMovement()
 {
-  this->inMove = false;
-  this->speed = 0;
-  this->positionTargetSpeedReached = 0;
+  if (this->isHoming())
+  {
+    this->endHoming(SC_HOMING_FAILED);
+  }
+  this->clearQueue();
+  this->finishMovement();
 }
 
 int StepperControl::isInMove()
@@ -240,28 +681,215 @@ int StepperControl::isInMove()
   return this->inMove;
 }
 
+// Drive toward the end stop until the driver detects a stall, then back off
+// and take this position as zero. Only possible with the TMC2209 UART.
+bool StepperControl::startHoming(int direction)
+{
+  if (this->driver == NULL || this->isHoming())
+  {
+    return false;
+  }
+  if (this->inMove)
+  {
+    this->finishMovement();
+  }
+
+  this->savedTargetSpeed = this->targetSpeed;
+  this->savedMoveMode = this->moveMode;
+  this->homingDirection = direction;
+
+  // StallGuard is only active above the CoolStep threshold
+  this->driver->setStallGuardThreshold(this->stallDetector.getThreshold());
+  this->driver->setCoolStepMinSpeed(this->homingSpeed / 2 / getMicrosteps(this->stepMode));
+  this->stallDetector.reset();
+  this->stallGuardTimestamp = this->driver->getStatusTimestamp(TMC2209_STATUS_SG_RESULT);
+  this->homingPollTimestamp = millis();
+
+  // Constant speed, the readings are not valid while accelerating
+  this->moveMode = SC_MOVEMODE_PER_STEP;
+  this->targetSpeed = this->homingSpeed;
+  this->homingState = SC_HOMING_SEEK;
+  this->startAutomaticMove(this->currentPosition +
+    (direction == SC_HOMING_INWARD ? -this->homingMaxTravel : this->homingMaxTravel));
+  return true;
+}
+
+bool StepperControl::isHoming()
+{
+  return this->homingState == SC_HOMING_SEEK || this->homingState == SC_HOMING_BACKOFF;
+}
+
+// The position counter no longer matches the mechanics (e.g. after a stall
+// of the auto-tuning), until the next homing or SP
+void StepperControl::invalidatePosition()
+{
+  this->positionIsValid = false;
+}
+
+bool StepperControl::isPositionValid()
+{
+  return this->positionIsValid;
+}
+
+// Add a waypoint at the end of the queue. The queue starts on the next
+// Manage() if the motor is idle. Return false if the queue is full.
+bool StepperControl::queueMove(long position, unsigned long dwellTime)
+{
+  Waypoint_t *waypoint;
+
+  if (this->queueCount >= SC_QUEUE_SIZE)
+  {
+    return false;
+  }
+  waypoint = &this->queue[(this->queueHead + this->queueCount) % SC_QUEUE_SIZE];
+  waypoint->position = position;
+  waypoint->dwellTime = dwellTime;
+  this->queueCount++;
+  return true;
+}
+
+// The real position was measured (e.g. by an encoder) after a step loss.
+// A running move continues to its target from there, an idle motor moves
+// back to the position it should have. Unlike setCurrentPosition(), the
+// focus model keeps its positions: they were right.
+void StepperControl::correctPosition(long position)
+{
+  long commandedPosition = this->currentPosition;
+
+  if (this->isSlewing())
+  {
+    // The measured position may be off the slew steps
+    this->endSlew();
+  }
+  this->currentPosition = position;
+  if (!this->inMove)
+  {
+    this->startAutomaticMove(commandedPosition);
+  }
+}
+
+// Add a band in full steps per second. Return false if the table is full
+// or the band is empty.
+bool StepperControl::addResonanceBand(unsigned long low, unsigned long high)
+{
+  if (high <= low || this->resonanceBandCount >= SC_MAX_RESONANCE_BANDS)
+  {
+    return false;
+  }
+  this->resonanceBands[this->resonanceBandCount].low = low;
+  this->resonanceBands[this->resonanceBandCount].high = high;
+  this->resonanceBandCount++;
+  this->setSpeed(this->requestedSpeed);
+  return true;
+}
+
+void StepperControl::clearResonanceBands()
+{
+  int i;
+
+  for (i = 0; i < SC_MAX_RESONANCE_BANDS; i++)
+  {
+    this->resonanceBands[i].low = 0;
+    this->resonanceBands[i].high = 0;
+  }
+  this->resonanceBandCount = 0;
+  this->setSpeed(this->requestedSpeed);
+}
+
+// Drop the waypoints not reached yet. A running move continues to its
+// target, use stopMovement() to stop it too.
+void StepperControl::clearQueue()
+{
+  this->queueHead = 0;
+  this->queueCount = 0;
+  this->queueBlendCount = 0;
+  this->dwellIsRunning = false;
+}
+
+bool StepperControl::isQueueRunning()
+{
+  return this->queueCount > 0 || this->dwellIsRunning;
+}
+
+// Predicted time in ms of a move of distance steps from standstill with
+// the speed, acceleration and slew settings in use
+unsigned long StepperControl::predictMoveTime(long distance)
+{
+  long approachSteps = (long)this->approachDistance * getMicrosteps(this->stepMode);
+  unsigned long approachSpeed;
+
+  distance = abs(distance);
+  if (distance == 0 || this->targetSpeed == 0)
+  {
+    return 0;
+  }
+  if (this->moveMode != SC_MOVEMODE_SMOOTH)
+  {
+    return (unsigned long)((float)distance * 1000 / this->targetSpeed);
+  }
+  if (this->canSlew(distance))
+  {
+    // The slew ramps down to the speed of the approach, which is run at
+    // this speed in the step mode
+    approachSpeed = this->getApproachSpeed();
+    return (unsigned long)((this->predictSegment(distance - approachSteps, 0, this->getSlewSpeed(), approachSpeed) +
+                            this->predictSegment(approachSteps, approachSpeed, approachSpeed, 0)) * 1000);
+  }
+  return (unsigned long)(this->predictSegment(distance, 0, this->targetSpeed, 0) * 1000);
+}
+
+void StepperControl::finishMovement()
+{
+  if (this->isSlewing())
+  {
+    this->endSlew();
+  }
+  if (this->inMove)
+  {
+    // Only the positions chosen by the user or an autofocus are learned.
+    // The compensation continues from the new position right away.
+    if (this->userMoveIsRunning)
+    {
+      this->settledPositionIsPending = true;
+      if (this->currentTemperatureIsKnown)
+      {
+        this->focusModel.setReference(this->currentTemperature, this->currentPosition);
+      }
+    }
+    this->moveEndTimestamp = millis();
+  }
+  this->inMove = false;
+  this->userMoveIsRunning = false;
+  this->speed = 0;
+  this->positionTargetSpeedReached = 0;
+}
+
+// Should be called regularly while the temperature compensation is enabled.
+// The model decides when a (small) correction is needed.
 void StepperControl::compensateTemperature()
 {
   long correction = 0;
 
-  if (this->temperatureCompensationIsInit && !this->inMove)
+  if (this->temperatureCompensationIsInit && !this->inMove && !this->isQueueRunning())
   {
-    correction = (long)(1.0 * (this->lastCompensatedTemperature - this->currentTemperature) * (float)this->temperatureCompensationCoefficient);
+    correction = this->focusModel.getCorrection(this->currentTemperature, this->currentPosition, millis());
 
     if (correction)
     {
-      this->lastCompensatedTemperature = this->currentTemperature;
-      this->dbg_correction = this->getCurrentPosition() + (long)correction;
-      this->setTargetPosition(this->getCurrentPosition() + (long)correction);
-      this->goToTargetPosition();
+      this->dbg_correction = this->getCurrentPosition() + correction;
+      this->startAutomaticMove(this->getCurrentPosition() + correction);
     }
   }
 }
 
 //------------------------------------------------------------------------------------
 // Privates
-void StepperControl::moveMotor()
+// Return true if a step is due
+bool StepperControl::moveMotor(unsigned long now)
 {
+  unsigned long stepPeriod;
+  unsigned long cruiseSpeed;
+
   if (this->moveMode == SC_MOVEMODE_SMOOTH)
   {
     this->calculateSpeed();
@@ -269,8 +897,21 @@ void StepperControl::moveMotor()
 
   if ((this->targetPosition != this->currentPosition))
   {
-    if ((this->speed != 0) && (micros() - this->lastMovementTimestamp) >= ((unsigned long)((1 / ((float)this->speed + 1)) * 1000000)))
+    if (!this->isStepModeReady(now))
     {
+      return false;
+    }
+    // The speed is in positions per second, a slew step covers stepRatio positions
+    stepPeriod = (unsigned long)((1 / ((float)this->speed + 1)) * 1000000) * this->stepRatio;
+    if ((this->speed != 0) && (now - this->lastMovementTimestamp) >= stepPeriod)
+    {
+      // Delay of this step compared to the ideal timing
+      this->stepLateness = now - this->lastMovementTimestamp - stepPeriod;
+      if (this->stepLateness > this->maxStepLateness && this->targetSpeedReached)
+      {
+        this->maxStepLateness = this->stepLateness;
+      }
+
       if ((this->targetPosition - this->currentPosition) > 0)
       {
         if (this->direction == SC_CLOCKWISE)
@@ -281,7 +922,7 @@ void StepperControl::moveMotor()
         {
           digitalWrite(this->directionPin, HIGH);
         }
-        this->currentPosition++;
+        this->currentPosition += this->stepRatio;
       }
       else
       {
@@ -293,15 +934,12 @@ void StepperControl::moveMotor()
         {
           digitalWrite(this->directionPin, LOW);
         }
-        this->currentPosition--;
+        this->currentPosition -= this->stepRatio;
       }
-      digitalWrite(this->enablePin, LOW);
-      delayMicroseconds(5);
-      digitalWrite(this->stepPin, HIGH);
-      delayMicroseconds(5);
-      digitalWrite(this->stepPin, LOW);
+      this->writePin(this->enablePin, LOW);
 
-      if (this->speed >= this->targetSpeed)
+      cruiseSpeed = this->isSlewing() ? this->getSlewSpeed() : this->targetSpeed;
+      if (this->speed >= cruiseSpeed)
       {
         if (!this->targetSpeedReached)
         {
@@ -311,21 +949,337 @@ void StepperControl::moveMotor()
             this->positionTargetSpeedReached *= -1;
           }
         }
-        this->speed = this->targetSpeed;
+        this->speed = cruiseSpeed;
         this->targetSpeedReached = true;
       }
-      this->lastMovementTimestamp = micros();
+      this->lastMovementTimestamp = now;
+      this->updateStepResolution();
+      return true;
     }
   }
   else
   {
-    this->stopMovement();
+    this->finishMovement();
+  }
+  return false;
+}
+
+// Time in s to run distance steps from startSpeed to endSpeed, cruising at
+// cruiseSpeed at most. Continuous approximation of the ramp of
+// calculateSpeed(): a short segment turns back before the cruise speed.
+float StepperControl::predictSegment(float distance, float startSpeed, float cruiseSpeed, float endSpeed)
+{
+  float rate = this->getAccelerationRate();
+  float rampUpSteps;
+  float rampDownSteps;
+  float peakSpeed;
+
+  if (distance <= 0 || cruiseSpeed <= 0)
+  {
+    return 0;
+  }
+  startSpeed = min(startSpeed, cruiseSpeed);
+  endSpeed = min(endSpeed, cruiseSpeed);
+  rampUpSteps = (cruiseSpeed * cruiseSpeed - startSpeed * startSpeed) / (2 * rate);
+  rampDownSteps = (cruiseSpeed * cruiseSpeed - endSpeed * endSpeed) / (2 * rate);
+  if (rampUpSteps + rampDownSteps <= distance)
+  {
+    return (cruiseSpeed - startSpeed) / rate + (cruiseSpeed - endSpeed) / rate +
+           (distance - rampUpSteps - rampDownSteps) / cruiseSpeed;
+  }
+  peakSpeed = sqrt((2 * rate * distance + startSpeed * startSpeed + endSpeed * endSpeed) / 2);
+  if (peakSpeed < max(startSpeed, endSpeed))
+  {
+    // Too short to reach the end speed: a single linear change
+    return 2 * distance / (startSpeed + endSpeed);
+  }
+  return (peakSpeed - startSpeed) / rate + (peakSpeed - endSpeed) / rate;
+}
+
+// Add a sample every telemetryInterval. In on change mode the sample is
+// only added if the position or the temperature changed.
+void StepperControl::recordTelemetry()
+{
+  int temperature;
+
+  if (this->telemetryInterval == 0 || (millis() - this->telemetryTimestamp) < this->telemetryInterval)
+  {
+    return;
+  }
+  temperature = this->getTelemetryTemperature();
+  if (this->telemetryOnChange && this->telemetryPosition == this->currentPosition &&
+      this->telemetryTemperature == temperature)
+  {
+    return;
+  }
+  this->telemetryTimestamp = millis();
+  this->telemetryPosition = this->currentPosition;
+  this->telemetryTemperature = temperature;
+  this->telemetry.add(this->telemetryTimestamp, this->currentPosition, temperature);
+}
+
+// Temperature of the samples in hundredths of degree
+int StepperControl::getTelemetryTemperature()
+{
+  return this->currentTemperatureIsKnown ? (int)lround(this->currentTemperature * 100) : TB_NO_TEMPERATURE;
+}
+
+// Switch between the slew and the step mode on the position just reached,
+// before the next step is due
+void StepperControl::updateStepResolution()
+{
+  long fullStep = getMicrosteps(this->stepMode);
+  long remainingSteps = abs(this->targetPosition - this->currentPosition);
+  long approachSteps = (long)this->approachDistance * fullStep;
+
+  if (this->isSlewing())
+  {
+    // Back to the step mode once the ramp down reached the speed of the
+    // approach. Leaving the slew is exact on any slew step, and it is
+    // forced before a slew step would overshoot a target changed during
+    // the move.
+    if (remainingSteps < this->stepRatio ||
+        (remainingSteps <= approachSteps && this->speed <= this->getApproachSpeed() &&
+         this->isStepModeSwitchReady()))
+    {
+      this->endSlew();
+    }
+  }
+  else if ((this->currentPosition % fullStep) == 0 && this->canSlew(remainingSteps) &&
+           this->isStepModeSwitchReady())
+  {
+    this->startSlew();
+  }
+}
+
+// Return false while the next step would still use the previous
+// resolution: the write is not sent yet or still on the wire
+bool StepperControl::isStepModeReady(unsigned long now)
+{
+  if (this->stepModeIsPending)
+  {
+    this->driver->flush();
+    if (this->driver->isPresent() && this->driver->isDirty())
+    {
+      return false;
+    }
+    this->stepModeIsPending = false;
+    this->stepModeIsSending = true;
+    this->stepModeTimestamp = this->driver->getTransmitEndTimestamp() + SC_STEP_MODE_SETUP_TIME;
+  }
+  if (this->stepModeIsSending)
+  {
+    if ((long)(now - this->stepModeTimestamp) < 0)
+    {
+      return false;
+    }
+    this->stepModeIsSending = false;
+  }
+  return true;
+}
+
+// The resolution datagram can be sent alone right away, so the step train
+// is at most delayed by its transmission
+bool StepperControl::isStepModeSwitchReady()
+{
+  return this->driver == NULL || (this->driver->isBusIdle() && !this->driver->isDirty());
+}
+
+// A slew needs a smooth move long enough for the approach and a driver
+// which can change its resolution
+bool StepperControl::canSlew(long remainingSteps)
+{
+  long fullStep = getMicrosteps(this->stepMode);
+
+  return this->slewStepMode != SC_NO_STEP_MODE && this->moveMode == SC_MOVEMODE_SMOOTH &&
+         !this->isHoming() && getMicrosteps(this->slewStepMode) < getMicrosteps(this->stepMode) &&
+         remainingSteps >= (long)this->approachDistance * fullStep + fullStep &&
+         (this->driver == NULL || this->driver->isPresent());
+}
+
+// The ramp continues in the slew mode up to the slew speed
+void StepperControl::startSlew()
+{
+  this->stepRatio = getMicrosteps(this->stepMode) / getMicrosteps(this->slewStepMode);
+  this->targetSpeedReached = false;
+  this->applyStepMode(this->slewStepMode);
+}
+
+// The approach continues at the speed reached by the ramp down of the slew
+// and brakes from it
+void StepperControl::endSlew()
+{
+  this->stepRatio = 1;
+  this->targetSpeedReached = true;
+  this->positionTargetSpeedReached = (long)((float)this->speed * this->speed / (2 * this->getAccelerationRate()));
+  this->applyStepMode(this->stepMode);
+}
+
+// Set the resolution of the driver, the step mode in use is not changed
+void StepperControl::applyStepMode(int stepMode)
+{
+  if (this->driver != NULL)
+  {
+    // The mode pins select the UART address, the resolution is set by
+    // register. It is sent right away, the next step waits for it.
+    this->driver->setMicrosteps(getMicrosteps(stepMode));
+    this->driver->flush();
+    this->stepModeIsPending = true;
+  }
+  else
+  {
+    this->writePin(stepModePin1, stepMode & 0x04);
+    this->writePin(stepModePin2, stepMode & 0x02);
+    this->writePin(stepModePin3, stepMode & 0x01);
+  }
+}
+
+// Ramp of a slew: it ends at the speed of the approach where the approach
+// starts. The speed is only updated every SC_ACCEL_INTERVAL, so each speed
+// is checked with the distance it runs until the next update.
+void StepperControl::calculateSlewSpeed(unsigned int increment)
+{
+  long remainingSteps = abs(this->targetPosition - this->currentPosition) -
+                        (long)this->approachDistance * getMicrosteps(this->stepMode);
+  unsigned long approachSpeed = this->getApproachSpeed();
+
+  if (remainingSteps < this->getSlewBrakingSteps(this->speed, approachSpeed))
+  {
+    if (this->speed > approachSpeed + increment)
+    {
+      this->speed -= increment;
+    }
+    else if (this->speed > approachSpeed)
+    {
+      this->speed = approachSpeed;
+    }
+  }
+  else if (!this->targetSpeedReached &&
+           remainingSteps >= this->getSlewBrakingSteps(this->speed + increment, approachSpeed))
+  {
+    this->speed += increment;
+  }
+}
+
+// Steps run at this speed until the next update of the ramp and then to
+// brake down to endSpeed
+float StepperControl::getSlewBrakingSteps(unsigned long speed, unsigned long endSpeed)
+{
+  float brakingSteps = (float)speed * SC_ACCEL_INTERVAL / 1000;
+
+  if (speed > endSpeed)
+  {
+    brakingSteps += ((float)speed * speed - (float)endSpeed * endSpeed) / (2 * this->getAccelerationRate());
+  }
+  return brakingSteps;
+}
+
+// Cruise speed of the slew in positions per second: the speed of the step
+// mode multiplied by the step ratio, within the step rate of the slew mode
+// and the speed limit of the mechanics. It follows the speed settings.
+unsigned long StepperControl::getSlewSpeed()
+{
+  unsigned long stepRatio = getMicrosteps(this->stepMode) / getMicrosteps(this->slewStepMode);
+  unsigned long slewSpeed = (unsigned long)this->targetSpeed * stepRatio;
+
+  if (slewSpeed > getMaxSpeed(this->slewStepMode) * stepRatio)
+  {
+    slewSpeed = getMaxSpeed(this->slewStepMode) * stepRatio;
+  }
+  if (this->speedLimit != 0 && slewSpeed > this->speedLimit * getMicrosteps(this->stepMode))
+  {
+    slewSpeed = this->speedLimit * getMicrosteps(this->stepMode);
+  }
+  slewSpeed = this->avoidResonance(slewSpeed);
+  return max(slewSpeed, (unsigned long)this->targetSpeed);
+}
+
+// Speed at the start of the approach: the target speed if the approach is
+// long enough to brake from it
+unsigned long StepperControl::getApproachSpeed()
+{
+  long approachSteps = (long)this->approachDistance * getMicrosteps(this->stepMode);
+  unsigned long approachSpeed = (unsigned long)sqrt(2 * this->getAccelerationRate() * approachSteps);
+
+  if (approachSpeed >= this->targetSpeed)
+  {
+    return this->targetSpeed;
+  }
+  approachSpeed = this->avoidResonance(approachSpeed);
+  return max(approachSpeed, (unsigned long)this->acceleration);
+}
+
+// Acceleration of the ramps in positions per second squared
+float StepperControl::getAccelerationRate()
+{
+  return (float)this->acceleration * 1000 / SC_ACCEL_INTERVAL;
+}
+
+// Cruise speed at the bottom of the band which contains the speed (in
+// steps per second of the step mode). The bands may overlap.
+unsigned long StepperControl::avoidResonance(unsigned long speed)
+{
+  unsigned long microsteps = getMicrosteps(this->stepMode);
+  int i;
+
+  for (i = this->resonanceBandCount - 1; i >= 0; i--)
+  {
+    if (speed > this->resonanceBands[i].low * microsteps &&
+        speed < this->resonanceBands[i].high * microsteps)
+    {
+      speed = this->resonanceBands[i].low * microsteps;
+      // The bottom of this band may be inside another one
+      i = this->resonanceBandCount;
+    }
+  }
+  return speed;
+}
+
+void StepperControl::setupPin(int pin)
+{
+  if (pin != SC_NO_PIN)
+  {
+    pinMode(pin, OUTPUT);
+  }
+}
+
+void StepperControl::writePin(int pin, int value)
+{
+  if (pin != SC_NO_PIN)
+  {
+    digitalWrite(pin, value);
   }
 }
 
 void StepperControl::calculateSpeed()
 {
-  if ((millis() - this->accelTimestamp) >= 50)
+  unsigned long interval = SC_ACCEL_INTERVAL;
+  unsigned int increment = this->acceleration;
+  unsigned long bandAcceleration = this->acceleration;
+
+  // Inside a resonance band the ramp runs at the limit of the mechanics when
+  // it is known, in smaller and more frequent increments, so no speed of
+  // the band is held for long
+  if (this->isInResonanceBand(this->speed))
+  {
+    if (this->accelerationLimit != 0)
+    {
+      bandAcceleration = this->accelerationLimit * getMicrosteps(this->stepMode);
+    }
+    interval = SC_BAND_ACCEL_INTERVAL;
+    increment = bandAcceleration * SC_BAND_ACCEL_INTERVAL / SC_ACCEL_INTERVAL;
+    if (increment == 0)
+    {
+      increment = 1;
+    }
+  }
+
+  if ((millis() - this->accelTimestamp) >= interval && this->isSlewing())
+  {
+    this->calculateSlewSpeed(increment);
+    this->accelTimestamp = millis();
+  }
+  else if ((millis() - this->accelTimestamp) >= interval)
   {
     long midway = (this->targetPosition - this->startPosition);
     // avoid miday == 0 in case of movement of only one step
@@ -341,16 +1295,16 @@ void StepperControl::calculateSpeed()
       midway += this->startPosition;
       if (!this->targetSpeedReached && (this->currentPosition < midway))
       {
-        this->speed += this->acceleration;
+        this->speed += increment;
       }
       else
       {
         if ((!this->targetSpeedReached && (this->currentPosition > midway)) || (this->currentPosition >= (this->targetPosition - this->positionTargetSpeedReached)))
         {
 
-          if ((this->targetPosition != this->currentPosition) && (this->speed > this->acceleration))
+          if ((this->targetPosition != this->currentPosition) && (this->speed > increment))
           {
-            this->speed -= this->acceleration;
+            this->speed -= increment;
           }
           else
           {
@@ -364,16 +1318,16 @@ void StepperControl::calculateSpeed()
       midway = this->startPosition - -1 * midway;
       if (!this->targetSpeedReached && (this->currentPosition > midway))
       {
-        this->speed += this->acceleration;
+        this->speed += increment;
       }
       else
       {
         if ((!this->targetSpeedReached && (this->currentPosition < midway)) || (this->currentPosition <= (this->positionTargetSpeedReached + this->targetPosition)))
         {
 
-          if ((this->targetPosition != this->currentPosition) && (this->speed > this->acceleration))
+          if ((this->targetPosition != this->currentPosition) && (this->speed > increment))
           {
-            this->speed -= this->acceleration;
+            this->speed -= increment;
           }
           else
           {
@@ -386,6 +1340,138 @@ void StepperControl::calculateSpeed()
   }
 }
 
+// A position is learned by the focus model once the focuser stayed on it
+// long enough: the knob or the autofocus may still be searching before.
+void StepperControl::learnSettledPosition()
+{
+  if (this->settledPositionIsPending && this->currentTemperatureIsKnown &&
+      (millis() - this->moveEndTimestamp) >= SC_SETTLE_TIME)
+  {
+    this->focusModel.addSample(this->currentTemperature, this->currentPosition);
+    this->settledPositionIsPending = false;
+  }
+}
+
+void StepperControl::manageHoming()
+{
+  long stepsSinceStart;
+
+  switch (this->homingState)
+  {
+    case SC_HOMING_SEEK:
+      if (!this->inMove)
+      {
+        // The whole travel was done without stall
+        this->endHoming(SC_HOMING_FAILED);
+        break;
+      }
+      if (this->driver->getStatusTimestamp(TMC2209_STATUS_SG_RESULT) != this->stallGuardTimestamp)
+      {
+        this->stallGuardTimestamp = this->driver->getStatusTimestamp(TMC2209_STATUS_SG_RESULT);
+        stepsSinceStart = abs(this->currentPosition - this->startPosition);
+        if (this->stallDetector.update(this->driver->getStatusRegister(TMC2209_STATUS_SG_RESULT), stepsSinceStart))
+        {
+          this->finishMovement();
+          this->homingState = SC_HOMING_BACKOFF;
+          this->startAutomaticMove(this->currentPosition +
+            (this->homingDirection == SC_HOMING_INWARD ? this->homingBackoff : -this->homingBackoff));
+          break;
+        }
+      }
+      if (this->driver->isBusIdle() && (millis() - this->homingPollTimestamp) >= SC_HOMING_POLL_INTERVAL)
+      {
+        this->driver->requestRead(TMC2209_REG_SG_RESULT);
+        this->homingPollTimestamp = millis();
+      }
+      break;
+    case SC_HOMING_BACKOFF:
+      if (!this->inMove)
+      {
+        this->setCurrentPosition(0);
+        this->targetPosition = 0;
+        this->endHoming(SC_HOMING_DONE);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void StepperControl::endHoming(int state)
+{
+  this->targetSpeed = this->savedTargetSpeed;
+  this->moveMode = this->savedMoveMode;
+  this->homingState = state;
+}
+
+void StepperControl::manageQueue()
+{
+  Waypoint_t *waypoint;
+  long segmentTarget;
+  long distance;
+  int direction;
+
+  // Waypoints passed by the running move. They are reached once the
+  // position is on them or beyond in the direction of the move.
+  while (this->queueBlendCount > 0)
+  {
+    waypoint = &this->queue[this->queueHead];
+    if (this->inMove && (this->currentPosition - waypoint->position) * this->queueDirection < 0)
+    {
+      break;
+    }
+    this->queueHead = (this->queueHead + 1) % SC_QUEUE_SIZE;
+    this->queueCount--;
+    this->queueBlendCount--;
+    this->reachedWaypointCount++;
+    if (this->queueBlendCount == 0 && waypoint->dwellTime > 0)
+    {
+      this->dwellIsRunning = true;
+      this->dwellEndTimestamp = millis() + waypoint->dwellTime;
+    }
+  }
+  if (this->queueBlendCount > 0 || this->inMove || this->isHoming())
+  {
+    return;
+  }
+  if (this->dwellIsRunning)
+  {
+    if ((long)(millis() - this->dwellEndTimestamp) < 0)
+    {
+      return;
+    }
+    this->dwellIsRunning = false;
+  }
+  if (this->queueCount == 0)
+  {
+    return;
+  }
+
+  // The next move covers the following waypoints as long as they continue
+  // in the same direction. It stops on a waypoint with a dwell time.
+  segmentTarget = this->currentPosition;
+  this->queueDirection = 0;
+  while (this->queueBlendCount < this->queueCount)
+  {
+    waypoint = &this->queue[(this->queueHead + this->queueBlendCount) % SC_QUEUE_SIZE];
+    distance = waypoint->position - segmentTarget;
+    direction = distance > 0 ? 1 : (distance < 0 ? -1 : 0);
+    if (this->queueBlendCount > 0 && direction != this->queueDirection)
+    {
+      break;
+    }
+    this->queueDirection = direction;
+    segmentTarget = waypoint->position;
+    this->queueBlendCount++;
+    if (waypoint->dwellTime > 0 || direction == 0)
+    {
+      break;
+    }
+  }
+  this->setTargetPosition(segmentTarget);
+  this->goToTargetPosition();
+}
+
 bool StepperControl::isTemperatureCompensationEnabled()
 {
   return this->temperatureCompensationIsEnabled;
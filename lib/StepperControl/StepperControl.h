@@ -34,6 +34,16 @@ along with StepperControl library.  If not, see <http://www.gnu.org/licenses/>.
 #include <Arduino.h>
 #endif
 
+#include "FocusModel.h"
+#include "TMC2209.h"
+#include "StallDetector.h"
+#include "TelemetryBuffer.h"
+
+#define SC_NO_PIN -1 // For the optional pins which are not connected
+
+#define SC_DIRECTION_SETUP_TIME 5 // us between the direction and the step
+#define SC_STEP_PULSE_WIDTH 5     // us
+
 #define SC_CLOCKWISE 0
 #define SC_COUNTER_CLOCKWISE 1
 
@@ -42,20 +52,81 @@ along with StepperControl library.  If not, see <http://www.gnu.org/licenses/>.
 #define SC_16TH_STEP 2
 #define SC_32TH_STEP 1
 #define SC_64TH_STEP 3
+// Only available with the UART interface of the TMC2209
+#define SC_128TH_STEP 4
+#define SC_256TH_STEP 5
 
 #define SC_MAX_SPEED 1000000
 #define SC_MAX_SPEED_8TH_STEP 30000
 #define SC_MAX_SPEED_16TH_STEP 50000
 #define SC_MAX_SPEED_32TH_STEP 100000
 #define SC_MAX_SPEED_64TH_STEP 200000
+#define SC_MAX_SPEED_128TH_STEP 400000
+#define SC_MAX_SPEED_256TH_STEP 800000
+
+// Slew: the long smooth moves run in a coarser step mode and switch back to
+// the step mode for the final approach. The positions stay in the units of
+// the step mode, each slew step moves by several of them. The switches to
+// the slew mode are done on full step boundaries. The ramp down of the slew
+// ends at the speed of the approach, so the speed is continuous across the
+// switch. With the TMC2209 the resolution is written right after the step
+// which reaches the boundary, the next step waits until the datagram is sent.
+#define SC_NO_STEP_MODE -1      // No slew mode
+#define SC_DEFAULT_APPROACH 16  // Full steps of the final approach
+#define SC_STEP_MODE_SETUP_TIME 20 // us between the resolution write and the next step
 
 #define SC_MOVEMODE_PER_STEP 0
 #define SC_MOVEMODE_SMOOTH 1
 
 #define SC_DEFAULT_ACCEL 1000
+#define SC_ACCEL_INTERVAL 50 // ms between two speed increments of the ramp
 
 #define SC_DEFAULT_SPEED 1000
 
+// Resonance bands: speed ranges in full steps per second where the motor
+// loses steps or gets loud. No move cruises inside a band (the cruise speed
+// is lowered to the bottom of the band) and the ramps cross them with
+// smaller and more frequent speed increments instead of dwelling a whole
+// SC_ACCEL_INTERVAL on one speed.
+#define SC_MAX_RESONANCE_BANDS 4
+#define SC_BAND_ACCEL_INTERVAL 5 // ms between two speed increments inside a band
+
+typedef struct ResonanceBand_s
+{
+  uint32_t low;  // full steps per second
+  uint32_t high; // full steps per second
+} ResonanceBand_t;
+
+#define SC_SETTLE_TIME 10000 // ms without move before a position is learned as in focus
+#define SC_NO_DEADLINE 0xFFFFFFFF
+
+// Sensorless homing (TMC2209 UART only)
+#define SC_HOMING_IDLE 0
+#define SC_HOMING_SEEK 1
+#define SC_HOMING_BACKOFF 2
+#define SC_HOMING_DONE 3
+#define SC_HOMING_FAILED 4
+#define SC_HOMING_LOST 5 // The position was lost (stall), the focuser should be homed
+
+#define SC_HOMING_INWARD 0  // Toward the decreasing positions
+#define SC_HOMING_OUTWARD 1
+
+#define SC_HOMING_DEFAULT_SPEED 2000
+#define SC_HOMING_DEFAULT_BACKOFF 200
+#define SC_HOMING_DEFAULT_MAX_TRAVEL 200000
+#define SC_HOMING_POLL_INTERVAL 2 // ms between two StallGuard readings
+
+// Move queue: the waypoints are run one after the other without waiting
+// for the host. Consecutive waypoints in the same direction and without
+// dwell time are blended in one move, so the focuser does not stop on them.
+#define SC_QUEUE_SIZE 16
+
+typedef struct
+{
+  long position;
+  unsigned long dwellTime; // ms spent on the waypoint before the next move
+} Waypoint_t;
+
 class StepperControl
 {
  public:
@@ -80,6 +151,18 @@ class StepperControl
   void setSpeed(unsigned int speed);
   void setTemperatureCompensationCoefficient(int coef);
   void setCurrentTemperature(float temperature);
+  void setDriver(TMC2209 *driver);
+  void setHomingSpeed(unsigned int speed);
+  void setHomingBackoff(long steps);
+  void setHomingMaxTravel(long steps);
+  void setAcceleration(unsigned int acceleration);
+  void setSpeedLimit(unsigned long fullStepsPerSecond);
+  void setAccelerationLimit(unsigned long fullStepsPerSecond);
+  void setTelemetryInterval(unsigned long interval);
+  void setTelemetryOnChange(bool onChange);
+  void setSlewStepMode(int stepMode);
+  void setApproachDistance(unsigned int fullSteps);
+  void setResonanceBands(const ResonanceBand_t *bands);
 
   // Getters
   long getCurrentPosition();
@@ -88,17 +171,62 @@ class StepperControl
   int getStepMode();
   int getMoveMode();
   unsigned int getSpeed();
+  unsigned int getTargetSpeed();
+  unsigned int getRequestedSpeed();
+  unsigned int getAcceleration();
+  unsigned long getSpeedLimit();
+  unsigned long getAccelerationLimit();
   int getTemperatureCompensationCoefficient();
+  FocusModel *getFocusModel();
+  TMC2209 *getDriver();
+  StallDetector *getStallDetector();
+  TelemetryBuffer *getTelemetry();
+  unsigned long getTelemetryInterval();
+  bool isTelemetryOnChange();
+  unsigned long getTimeToNextTelemetry();
+  int getSlewStepMode();
+  unsigned int getApproachDistance();
+  bool isSlewing();
+  const ResonanceBand_t *getResonanceBands();
+  int getResonanceBandCount();
+  bool isInResonanceBand(unsigned long speed);
+  int getHomingState();
+  int getQueueCount();
+  unsigned long getReachedWaypointCount();
+  int getStepPin();
+  unsigned long getStepLateness();
+  unsigned long getMaxStepLateness();
+  unsigned long getRemainingMoveTime();
+  long getRemainingMoveDistance();
+  void resetMaxStepLateness();
 
   // Other public members
   void Manage();
+  bool Manage(unsigned long now);
+  void pulseStep();
   void goToTargetPosition();
+  void startUserMove();
+  void startAutomaticMove(long position);
   void stopMovement();
   int isInMove();
   void compensateTemperature();  
   bool isTemperatureCompensationEnabled();
   void enableTemperatureCompensation();
   void disableTemperatureCompensation();
+  bool startHoming(int direction);
+  bool isHoming();
+  void invalidatePosition();
+  bool isPositionValid();
+  bool queueMove(long position, unsigned long dwellTime);
+  void correctPosition(long position);
+  bool addResonanceBand(unsigned long low, unsigned long high);
+  void clearResonanceBands();
+  void clearQueue();
+  bool isQueueRunning();
+  unsigned long predictMoveTime(long distance);
+
+  static unsigned int getMicrosteps(int stepMode);
+  static unsigned long getMaxSpeed(int stepMode);
 
  private:
   int direction;
@@ -112,15 +240,38 @@ class StepperControl
   long targetPosition;
   unsigned int speed;  // Speed in ticks per seconds
   bool targetSpeedReached;
-  unsigned int targetSpeed;
+  unsigned int targetSpeed;    // Cruise speed of the moves
+  unsigned int requestedSpeed; // Set by setSpeed()
+  unsigned long speedLimit; // full steps per second, 0 if none
+  unsigned long accelerationLimit; // full steps per second every 50ms, 0 if none
+  int slewStepMode;
+  unsigned int approachDistance; // full steps
+  long stepRatio;                // positions per step, 1 out of the slew
+  bool stepModeIsPending;        // The resolution write is not sent yet
+  bool stepModeIsSending;        // The resolution write is on the wire
+  unsigned long stepModeTimestamp; // micros() when the new resolution is in force
+  ResonanceBand_t resonanceBands[SC_MAX_RESONANCE_BANDS];
+  int resonanceBandCount;
   long positionTargetSpeedReached;
   bool temperatureCompensationIsEnabled;
   int temperatureCompensationCoefficient;
-  float lastCompensatedTemperature;
   bool temperatureCompensationIsInit;
+  bool userMoveIsRunning;
   float currentTemperature;
+  bool currentTemperatureIsKnown;
+  TelemetryBuffer telemetry;
+  unsigned long telemetryInterval; // ms, 0 when off
+  bool telemetryOnChange;
+  unsigned long telemetryTimestamp;
+  long telemetryPosition;
+  int telemetryTemperature;
+  FocusModel focusModel;
+  bool settledPositionIsPending;
+  unsigned long moveEndTimestamp;
 
   unsigned long lastMovementTimestamp;
+  unsigned long stepLateness;
+  unsigned long maxStepLateness;
   unsigned long accelTimestamp;
 
   int stepPin;
@@ -131,9 +282,54 @@ class StepperControl
   int enablePin;
   int sleepPin;
   int resetPin;
+  TMC2209 *driver;
+
+  StallDetector stallDetector;
+  int homingState;
+  bool positionIsValid;
+  int homingDirection;
+  unsigned int homingSpeed;
+  long homingBackoff;
+  long homingMaxTravel;
+  unsigned int savedTargetSpeed;
+  int savedMoveMode;
+  unsigned long homingPollTimestamp;
+  unsigned long stallGuardTimestamp;
+
+  Waypoint_t queue[SC_QUEUE_SIZE];
+  int queueHead;
+  int queueCount;
+  int queueBlendCount;  // Waypoints of the queue covered by the running move
+  int queueDirection;   // 1 or -1, 0 if the running move has no length
+  bool dwellIsRunning;
+  unsigned long dwellEndTimestamp;
+  unsigned long reachedWaypointCount;
 
-  void moveMotor();
+  bool moveMotor(unsigned long now);
   void calculateSpeed();
+  void finishMovement();
+  void learnSettledPosition();
+  void manageHoming();
+  void endHoming(int state);
+  void manageQueue();
+  void updateStepResolution();
+  bool isStepModeReady(unsigned long now);
+  bool isStepModeSwitchReady();
+  bool canSlew(long remainingSteps);
+  void startSlew();
+  void endSlew();
+  void applyStepMode(int stepMode);
+  void calculateSlewSpeed(unsigned int increment);
+  float getSlewBrakingSteps(unsigned long speed, unsigned long endSpeed);
+  unsigned long getSlewSpeed();
+  unsigned long getApproachSpeed();
+  float getAccelerationRate();
+  unsigned long avoidResonance(unsigned long speed);
+  float predictSegment(float distance, float startSpeed, float cruiseSpeed, float endSpeed);
+  void recordTelemetry();
+  int getTelemetryTemperature();
+  void setupPin(int pin);
+  void writePin(int pin, int value);
 };
 
 #endif //stepperControl_A4988_h
@@ -0,0 +1,93 @@
+/*
+TelemetryBuffer.cpp - - Ring buffer of position and temperature samples - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the StepperControl library.
+
+StepperControl library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StepperControl library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StepperControl library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "TelemetryBuffer.h"
+
+//-----------------------------------------------------------------------------
+// Constructors
+
+TelemetryBuffer::TelemetryBuffer()
+{
+  this->clear();
+}
+
+//-----------------------------------------------------------------------------
+// Getters
+
+// Number of samples not read yet
+int TelemetryBuffer::getCount()
+{
+  return this->count;
+}
+
+// Number of samples overwritten before they were read
+unsigned long TelemetryBuffer::getLostCount()
+{
+  return this->lostCount;
+}
+
+//-----------------------------------------------------------------------------
+// Other public members
+
+void TelemetryBuffer::add(unsigned long timestamp, long position, int temperature)
+{
+  TelemetrySample_t *sample = &this->samples[this->head];
+
+  sample->timestamp = timestamp;
+  sample->position = position;
+  sample->temperature = temperature;
+
+  this->head = (this->head + 1) % TB_SIZE;
+  if (this->count < TB_SIZE)
+  {
+    this->count++;
+  }
+  else
+  {
+    // The oldest sample was overwritten
+    this->lostCount++;
+  }
+}
+
+// Take the oldest sample. Return false if the buffer is empty.
+bool TelemetryBuffer::read(TelemetrySample_t *sample)
+{
+  int tail;
+
+  if (this->count == 0)
+  {
+    return false;
+  }
+  tail = (this->head - this->count + TB_SIZE) % TB_SIZE;
+  *sample = this->samples[tail];
+  this->count--;
+  return true;
+}
+
+void TelemetryBuffer::clear()
+{
+  this->head = 0;
+  this->count = 0;
+  this->lostCount = 0;
+}
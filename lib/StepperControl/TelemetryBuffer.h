@@ -0,0 +1,72 @@
+/*
+TelemetryBuffer.h - - Ring buffer of position and temperature samples - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+The samples (time, position, temperature) are stored in a fixed ring of
+TB_SIZE entries: nothing is allocated and adding or reading a sample is
+a constant time copy. When the ring is full the oldest sample is
+overwritten and counted as lost, so the recording can stay on during a
+whole imaging session and the host reads the samples when it wants.
+
+This file is part of the StepperControl library.
+
+StepperControl library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+StepperControl library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with StepperControl library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef TelemetryBuffer_h
+#define TelemetryBuffer_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#define TB_SIZE 256
+#define TB_NO_TEMPERATURE -32768
+
+typedef struct TelemetrySample_s
+{
+  uint32_t timestamp; // ms
+  int32_t position;
+  int16_t temperature; // 1/100 C, TB_NO_TEMPERATURE if unknown
+} TelemetrySample_t;
+
+class TelemetryBuffer
+{
+ public:
+  // Constructors:
+  TelemetryBuffer();
+
+  // Getters:
+  int getCount();
+  unsigned long getLostCount();
+
+  // Other public members
+  void add(unsigned long timestamp, long position, int temperature);
+  bool read(TelemetrySample_t *sample);
+  void clear();
+
+ private:
+  TelemetrySample_t samples[TB_SIZE];
+  int head;  // Next sample written
+  int count;
+  unsigned long lostCount;
+};
+
+#endif //TelemetryBuffer_h
@@ -0,0 +1,124 @@
+/*
+StallDetector.cpp - - Stall detection from the TMC2209 StallGuard result - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the TMC2209 library.
+
+TMC2209 library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+TMC2209 library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with TMC2209 library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "StallDetector.h"
+
+//------------------------------------------------------------------------------
+// Constructors
+StallDetector::StallDetector()
+{
+  this->threshold = SD_DEFAULT_THRESHOLD;
+  this->blankingSteps = SD_DEFAULT_BLANKING_STEPS;
+  this->confirmationCount = SD_DEFAULT_CONFIRMATION_COUNT;
+  this->reset();
+}
+
+//------------------------------------------------------------------------------
+// Setters
+
+// Same unit as the SGTHRS register of the TMC2209
+void StallDetector::setThreshold(uint8_t threshold)
+{
+  this->threshold = threshold;
+}
+
+// Number of steps ignored at the beginning of a move
+void StallDetector::setBlankingSteps(long blankingSteps)
+{
+  this->blankingSteps = blankingSteps;
+}
+
+// Number of consecutive low readings before a stall is reported
+void StallDetector::setConfirmationCount(int confirmationCount)
+{
+  this->confirmationCount = confirmationCount > 1 ? confirmationCount : 1;
+}
+
+//------------------------------------------------------------------------------
+// Getters
+
+uint8_t StallDetector::getThreshold()
+{
+  return this->threshold;
+}
+
+// Lowest reading since reset(), SD_NO_RESULT if none
+uint16_t StallDetector::getMinimumResult()
+{
+  return this->minimumResult;
+}
+
+// Distance between the lowest reading and the stall level
+int StallDetector::getMargin()
+{
+  if (this->minimumResult == SD_NO_RESULT)
+  {
+    return SD_NO_RESULT;
+  }
+  return (int)this->minimumResult - 2 * (int)this->threshold;
+}
+
+//------------------------------------------------------------------------------
+// Other public members
+
+// Should be called at the beginning of each move
+void StallDetector::reset()
+{
+  this->lowResultCount = 0;
+  this->minimumResult = SD_NO_RESULT;
+  this->stallIsDetected = false;
+}
+
+// Return true once a stall is detected
+bool StallDetector::update(uint16_t stallGuardResult, long stepsSinceStart)
+{
+  if (stepsSinceStart < this->blankingSteps || this->stallIsDetected)
+  {
+    return this->stallIsDetected;
+  }
+
+  if (stallGuardResult < this->minimumResult)
+  {
+    this->minimumResult = stallGuardResult;
+  }
+
+  if (stallGuardResult <= 2 * (uint16_t)this->threshold)
+  {
+    this->lowResultCount++;
+    if (this->lowResultCount >= this->confirmationCount)
+    {
+      this->stallIsDetected = true;
+    }
+  }
+  else
+  {
+    this->lowResultCount = 0;
+  }
+  return this->stallIsDetected;
+}
+
+bool StallDetector::isStalled()
+{
+  return this->stallIsDetected;
+}
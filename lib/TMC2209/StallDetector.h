@@ -0,0 +1,76 @@
+/*
+StallDetector.h - - Stall detection from the TMC2209 StallGuard result - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+The TMC2209 signals a stall when SG_RESULT falls below 2 * SGTHRS. The
+readings are not meaningful while the motor accelerates, so the first
+steps of a move are ignored, and a stall is only reported after several
+consecutive low readings to filter the noise of the load.
+
+The lowest reading seen gives the stall margin of the move.
+
+This file is part of the TMC2209 library.
+
+TMC2209 library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+TMC2209 library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with TMC2209 library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef StallDetector_h
+#define StallDetector_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#define SD_DEFAULT_THRESHOLD 50
+#define SD_DEFAULT_BLANKING_STEPS 200
+#define SD_DEFAULT_CONFIRMATION_COUNT 3
+#define SD_NO_RESULT 0xFFFF
+
+class StallDetector
+{
+ public:
+  // Constructors:
+  StallDetector();
+
+  // Setters:
+  void setThreshold(uint8_t threshold);
+  void setBlankingSteps(long blankingSteps);
+  void setConfirmationCount(int confirmationCount);
+
+  // Getters:
+  uint8_t getThreshold();
+  uint16_t getMinimumResult();
+  int getMargin();
+
+  // Other public members
+  void reset();
+  bool update(uint16_t stallGuardResult, long stepsSinceStart);
+  bool isStalled();
+
+ private:
+  uint8_t threshold;
+  long blankingSteps;
+  int confirmationCount;
+  int lowResultCount;
+  uint16_t minimumResult;
+  bool stallIsDetected;
+};
+
+#endif //StallDetector_h
@@ -0,0 +1,581 @@
+/*
+TMC2209.cpp - - Driver for the UART interface of the TMC2209 stepper driver - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the TMC2209 library.
+
+TMC2209 library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+TMC2209 library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with TMC2209 library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "TMC2209.h"
+
+const uint8_t TMC2209::ShadowRegisters[TMC2209_SHADOW_COUNT] = {
+  TMC2209_REG_GCONF,
+  TMC2209_REG_IHOLD_IRUN,
+  TMC2209_REG_TPOWERDOWN,
+  TMC2209_REG_TPWMTHRS,
+  TMC2209_REG_TCOOLTHRS,
+  TMC2209_REG_SGTHRS,
+  TMC2209_REG_COOLCONF,
+  TMC2209_REG_CHOPCONF,
+  TMC2209_REG_PWMCONF};
+
+const uint8_t TMC2209::StatusRegisters[TMC2209_STATUS_COUNT] = {
+  TMC2209_REG_GSTAT,
+  TMC2209_REG_IFCNT,
+  TMC2209_REG_TSTEP,
+  TMC2209_REG_SG_RESULT,
+  TMC2209_REG_MSCNT,
+  TMC2209_REG_DRV_STATUS};
+
+//------------------------------------------------------------------------------
+// Constructors
+TMC2209::TMC2209(HardwareSerial *port, uint8_t address)
+{
+  int i;
+
+  this->port = port;
+  this->address = address & 0x03;
+  this->driverIsPresent = false;
+
+  this->shadow[TMC2209_SHADOW_GCONF] = TMC2209_DEFAULT_GCONF
+                                     | TMC2209_GCONF_PDN_DISABLE
+                                     | TMC2209_GCONF_MSTEP_REG_SELECT;
+  this->shadow[TMC2209_SHADOW_IHOLD_IRUN] = TMC2209_DEFAULT_IHOLD_IRUN;
+  this->shadow[TMC2209_SHADOW_TPOWERDOWN] = TMC2209_DEFAULT_TPOWERDOWN;
+  this->shadow[TMC2209_SHADOW_TPWMTHRS] = 0;
+  this->shadow[TMC2209_SHADOW_TCOOLTHRS] = 0;
+  this->shadow[TMC2209_SHADOW_SGTHRS] = 0;
+  this->shadow[TMC2209_SHADOW_COOLCONF] = 0;
+  this->shadow[TMC2209_SHADOW_CHOPCONF] = TMC2209_DEFAULT_CHOPCONF;
+  this->shadow[TMC2209_SHADOW_PWMCONF] = TMC2209_DEFAULT_PWMCONF;
+  for (i = 0; i < TMC2209_SHADOW_COUNT; i++)
+  {
+    this->written[i] = 0;
+    this->writtenIsKnown[i] = false;
+  }
+  for (i = 0; i < TMC2209_STATUS_COUNT; i++)
+  {
+    this->status[i] = 0;
+    this->statusTimestamp[i] = 0;
+  }
+
+  this->runCurrent = 0;
+  this->holdCurrent = 0;
+  this->stealthChopMaxSpeed = 0;
+  this->coolStepMinSpeed = 0;
+
+  this->echoBytesPending = 0;
+  this->readIsPending = false;
+  this->readRegister = 0;
+  this->replyIndex = 0;
+  this->readTimestamp = 0;
+  this->lastReadIsValid = false;
+  this->ifcntCheckIsPending = false;
+  this->expectedIfcntIsKnown = false;
+  this->expectedIfcnt = 0;
+  this->writeCount = 0;
+  this->errorCount = 0;
+  this->byteTime = 1000000UL * TMC2209_BITS_PER_BYTE / TMC2209_DEFAULT_BAUDRATE;
+  this->transmitEndTimestamp = 0;
+}
+
+//------------------------------------------------------------------------------
+// Setters
+
+// 1, 2, 4 ... 256 microsteps per full step
+void TMC2209::setMicrosteps(unsigned int microsteps)
+{
+  uint32_t mres = 8;
+
+  while (microsteps > 1 && mres > 0)
+  {
+    microsteps >>= 1;
+    mres--;
+  }
+  this->setField(TMC2209_SHADOW_CHOPCONF, TMC2209_CHOPCONF_MRES_MASK, mres << TMC2209_CHOPCONF_MRES_SHIFT);
+}
+
+// RMS current of the motor when moving. The internal reference is used
+// from now on instead of the VREF potentiometer.
+void TMC2209::setRunCurrent(unsigned int milliAmps)
+{
+  this->runCurrent = milliAmps;
+  if (this->holdCurrent == 0 || this->holdCurrent > milliAmps)
+  {
+    this->holdCurrent = milliAmps / 2;
+  }
+  this->updateCurrents();
+}
+
+void TMC2209::setHoldCurrent(unsigned int milliAmps)
+{
+  this->holdCurrent = milliAmps;
+  this->updateCurrents();
+}
+
+// Above this speed the driver switches from StealthChop to SpreadCycle.
+// 0 keeps StealthChop at all speeds.
+void TMC2209::setStealthChopMaxSpeed(unsigned long fullStepsPerSecond)
+{
+  this->stealthChopMaxSpeed = fullStepsPerSecond;
+  this->updateSpeedThresholds();
+}
+
+// Force SpreadCycle at all speeds
+void TMC2209::setSpreadCycle(bool enable)
+{
+  this->setField(TMC2209_SHADOW_GCONF, TMC2209_GCONF_EN_SPREADCYCLE,
+                 enable ? TMC2209_GCONF_EN_SPREADCYCLE : 0);
+}
+
+// StallGuard and CoolStep are only active above this speed
+void TMC2209::setCoolStepMinSpeed(unsigned long fullStepsPerSecond)
+{
+  this->coolStepMinSpeed = fullStepsPerSecond;
+  this->updateSpeedThresholds();
+}
+
+// A stall is signaled when SG_RESULT falls below 2 * threshold
+void TMC2209::setStallGuardThreshold(uint8_t threshold)
+{
+  this->setField(TMC2209_SHADOW_SGTHRS, 0xFF, threshold);
+}
+
+void TMC2209::setShaftInverted(bool inverted)
+{
+  this->setField(TMC2209_SHADOW_GCONF, TMC2209_GCONF_SHAFT, inverted ? TMC2209_GCONF_SHAFT : 0);
+}
+
+//------------------------------------------------------------------------------
+// Getters
+
+unsigned int TMC2209::getMicrosteps()
+{
+  uint32_t mres = (this->shadow[TMC2209_SHADOW_CHOPCONF] & TMC2209_CHOPCONF_MRES_MASK) >> TMC2209_CHOPCONF_MRES_SHIFT;
+  return 256 >> (mres > 8 ? 8 : mres);
+}
+
+unsigned int TMC2209::getRunCurrent()
+{
+  return this->runCurrent;
+}
+
+unsigned int TMC2209::getHoldCurrent()
+{
+  return this->holdCurrent;
+}
+
+unsigned long TMC2209::getStealthChopMaxSpeed()
+{
+  return this->stealthChopMaxSpeed;
+}
+
+bool TMC2209::isSpreadCycleEnabled()
+{
+  return this->shadow[TMC2209_SHADOW_GCONF] & TMC2209_GCONF_EN_SPREADCYCLE;
+}
+
+uint8_t TMC2209::getStallGuardThreshold()
+{
+  return this->shadow[TMC2209_SHADOW_SGTHRS] & 0xFF;
+}
+
+uint32_t TMC2209::getShadowRegister(int index)
+{
+  return this->shadow[index];
+}
+
+// Last value read by requestRead()
+uint32_t TMC2209::getStatusRegister(int index)
+{
+  return this->status[index];
+}
+
+// millis() of the last read of the register
+unsigned long TMC2209::getStatusTimestamp(int index)
+{
+  return this->statusTimestamp[index];
+}
+
+unsigned long TMC2209::getWriteCount()
+{
+  return this->writeCount;
+}
+
+unsigned long TMC2209::getErrorCount()
+{
+  return this->errorCount;
+}
+
+// micros() when the datagrams queued so far are sent, the chip takes a
+// written value into account at the end of its datagram
+unsigned long TMC2209::getTransmitEndTimestamp()
+{
+  return this->transmitEndTimestamp;
+}
+
+//------------------------------------------------------------------------------
+// Other public members
+
+// Return false if the driver does not answer, it is then used in standalone mode
+bool TMC2209::init(unsigned long baudRate, int rxPin, int txPin)
+{
+  uint32_t ifcnt;
+
+  this->port->begin(baudRate, SERIAL_8N1, rxPin, txPin);
+  this->byteTime = 1000000UL * TMC2209_BITS_PER_BYTE / baudRate;
+  this->driverIsPresent = this->readRegisterBlocking(TMC2209_REG_IFCNT, &ifcnt);
+  if (!this->driverIsPresent)
+  {
+    return false;
+  }
+  this->flush();
+  return true;
+}
+
+bool TMC2209::isPresent()
+{
+  return this->driverIsPresent;
+}
+
+// No datagram is being sent or received
+bool TMC2209::isBusIdle()
+{
+  return this->echoBytesPending == 0 && !this->readIsPending;
+}
+
+bool TMC2209::isDirty()
+{
+  int i;
+
+  for (i = 0; i < TMC2209_SHADOW_COUNT; i++)
+  {
+    if (!this->writtenIsKnown[i] || this->written[i] != this->shadow[i])
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Send a read request. The answer is available through getStatusRegister().
+bool TMC2209::requestRead(uint8_t reg)
+{
+  uint8_t datagram[TMC2209_READ_REQUEST_SIZE];
+
+  if (!this->driverIsPresent || !this->isBusIdle())
+  {
+    return false;
+  }
+  datagram[0] = TMC2209_SYNC;
+  datagram[1] = this->address;
+  datagram[2] = reg & 0x7F;
+  datagram[3] = computeCrc(datagram, TMC2209_READ_REQUEST_SIZE - 1);
+  this->queueBytes(datagram, TMC2209_READ_REQUEST_SIZE);
+
+  this->echoBytesPending = TMC2209_READ_REQUEST_SIZE;
+  this->readIsPending = true;
+  this->readRegister = reg & 0x7F;
+  this->replyIndex = 0;
+  this->readTimestamp = millis();
+  return true;
+}
+
+// Write all the registers which changed since the last flush.
+// The datagrams are queued in the UART buffer, this does not wait.
+void TMC2209::flush()
+{
+  int i;
+  bool registerWasWritten = false;
+
+  if (!this->driverIsPresent || !this->isBusIdle())
+  {
+    return;
+  }
+  for (i = 0; i < TMC2209_SHADOW_COUNT; i++)
+  {
+    if (!this->writtenIsKnown[i] || this->written[i] != this->shadow[i])
+    {
+      this->writeRegister(i);
+      registerWasWritten = true;
+    }
+  }
+  // Check that the chip received the whole batch
+  this->ifcntCheckIsPending = registerWasWritten;
+}
+
+void TMC2209::Manage()
+{
+  // This procedure should be called regularly.
+  // It skips the echo, collects the read answers and sends the pending writes.
+  while (this->port->available() > 0)
+  {
+    this->receiveByte(this->port->read());
+  }
+
+  if (this->readIsPending && (millis() - this->readTimestamp) >= TMC2209_READ_TIMEOUT)
+  {
+    this->errorCount++;
+    this->readIsPending = false;
+    this->echoBytesPending = 0;
+  }
+  // An echo byte lost on the wire would keep the bus busy for ever. The
+  // write may be lost too: the IFCNT check finds it.
+  if (!this->readIsPending && this->echoBytesPending > 0 &&
+      (long)(micros() - this->transmitEndTimestamp) >= TMC2209_ECHO_TIMEOUT)
+  {
+    this->errorCount++;
+    this->echoBytesPending = 0;
+    this->ifcntCheckIsPending = true;
+  }
+
+  if (this->isBusIdle())
+  {
+    if (this->ifcntCheckIsPending)
+    {
+      this->ifcntCheckIsPending = !this->requestRead(TMC2209_REG_IFCNT);
+    }
+    else
+    {
+      this->flush();
+    }
+  }
+}
+
+// CRC8 (polynomial x^8 + x^2 + x + 1) as given by the datasheet
+uint8_t TMC2209::computeCrc(const uint8_t *datagram, int length)
+{
+  uint8_t crc = 0;
+  uint8_t currentByte;
+  int i;
+  int j;
+
+  for (i = 0; i < length; i++)
+  {
+    currentByte = datagram[i];
+    for (j = 0; j < 8; j++)
+    {
+      if ((crc >> 7) ^ (currentByte & 0x01))
+      {
+        crc = (crc << 1) ^ 0x07;
+      }
+      else
+      {
+        crc = crc << 1;
+      }
+      currentByte = currentByte >> 1;
+    }
+  }
+  return crc;
+}
+
+//------------------------------------------------------------------------------
+// Private
+
+void TMC2209::setField(int index, uint32_t mask, uint32_t value)
+{
+  this->shadow[index] = (this->shadow[index] & ~mask) | (value & mask);
+}
+
+void TMC2209::updateCurrents()
+{
+  float fullScale = 0.325;
+  float scale;
+  long runScale;
+  long holdScale;
+
+  // I_rms = (CS + 1) / 32 * Vfs / (Rsense + 20mOhm) / sqrt(2)
+  scale = 32.0 * 1.41421 * (TMC2209_RSENSE + 0.02) / 1000.0;
+  runScale = (long)(scale * this->runCurrent / fullScale + 0.5) - 1;
+  if (runScale < 16)
+  {
+    // Better resolution for the small motors
+    fullScale = 0.180;
+    runScale = (long)(scale * this->runCurrent / fullScale + 0.5) - 1;
+  }
+  holdScale = (long)(scale * this->holdCurrent / fullScale + 0.5) - 1;
+  runScale = constrain(runScale, 0, 31);
+  holdScale = constrain(holdScale, 0, 31);
+
+  this->setField(TMC2209_SHADOW_CHOPCONF, TMC2209_CHOPCONF_VSENSE,
+                 fullScale < 0.3 ? TMC2209_CHOPCONF_VSENSE : 0);
+  this->setField(TMC2209_SHADOW_IHOLD_IRUN, 0x00001F1F, (runScale << 8) | holdScale);
+  this->setField(TMC2209_SHADOW_GCONF, TMC2209_GCONF_I_SCALE_ANALOG, 0);
+}
+
+void TMC2209::updateSpeedThresholds()
+{
+  this->setField(TMC2209_SHADOW_TPWMTHRS, 0x000FFFFF, this->speedToTstep(this->stealthChopMaxSpeed));
+  this->setField(TMC2209_SHADOW_TCOOLTHRS, 0x000FFFFF, this->speedToTstep(this->coolStepMinSpeed));
+}
+
+// TSTEP is the time between two 1/256 microsteps in clock cycles, whatever
+// the resolution in use: the thresholds do not change with MRES
+uint32_t TMC2209::speedToTstep(unsigned long fullStepsPerSecond)
+{
+  unsigned long microstepRate;
+
+  if (fullStepsPerSecond == 0)
+  {
+    return 0;
+  }
+  microstepRate = fullStepsPerSecond * 256;
+  return min((uint32_t)(TMC2209_CLOCK_FREQUENCY / microstepRate), (uint32_t)0x000FFFFF);
+}
+
+void TMC2209::writeRegister(int index)
+{
+  uint8_t datagram[TMC2209_WRITE_DATAGRAM_SIZE];
+  uint32_t value = this->shadow[index];
+
+  datagram[0] = TMC2209_SYNC;
+  datagram[1] = this->address;
+  datagram[2] = ShadowRegisters[index] | TMC2209_WRITE_BIT;
+  datagram[3] = (value >> 24) & 0xFF;
+  datagram[4] = (value >> 16) & 0xFF;
+  datagram[5] = (value >> 8) & 0xFF;
+  datagram[6] = value & 0xFF;
+  datagram[7] = computeCrc(datagram, TMC2209_WRITE_DATAGRAM_SIZE - 1);
+  this->queueBytes(datagram, TMC2209_WRITE_DATAGRAM_SIZE);
+
+  this->echoBytesPending += TMC2209_WRITE_DATAGRAM_SIZE;
+  this->written[index] = value;
+  this->writtenIsKnown[index] = true;
+  this->expectedIfcnt++;
+  this->writeCount++;
+}
+
+// Write to the UART, the bytes follow the ones still being sent
+void TMC2209::queueBytes(const uint8_t *data, int length)
+{
+  unsigned long now = micros();
+
+  if ((long)(this->transmitEndTimestamp - now) < 0)
+  {
+    this->transmitEndTimestamp = now;
+  }
+  this->transmitEndTimestamp += length * this->byteTime;
+  this->port->write(data, length);
+}
+
+void TMC2209::receiveByte(uint8_t data)
+{
+  if (this->echoBytesPending > 0)
+  {
+    // Our own datagram on the single wire
+    this->echoBytesPending--;
+    return;
+  }
+  if (!this->readIsPending)
+  {
+    return;
+  }
+  // Wait for the sync byte of the answer
+  if (this->replyIndex == 0 && data != TMC2209_SYNC)
+  {
+    return;
+  }
+  this->reply[this->replyIndex++] = data;
+  if (this->replyIndex >= TMC2209_READ_REPLY_SIZE)
+  {
+    this->storeReply();
+    this->readIsPending = false;
+    this->replyIndex = 0;
+  }
+}
+
+void TMC2209::storeReply()
+{
+  uint32_t value;
+  int i;
+
+  this->lastReadIsValid = false;
+  if (this->reply[1] != TMC2209_MASTER_ADDRESS || this->reply[2] != this->readRegister ||
+      computeCrc(this->reply, TMC2209_READ_REPLY_SIZE - 1) != this->reply[TMC2209_READ_REPLY_SIZE - 1])
+  {
+    this->errorCount++;
+    return;
+  }
+  this->lastReadIsValid = true;
+  value = ((uint32_t)this->reply[3] << 24) | ((uint32_t)this->reply[4] << 16) |
+          ((uint32_t)this->reply[5] << 8) | this->reply[6];
+
+  for (i = 0; i < TMC2209_STATUS_COUNT; i++)
+  {
+    if (StatusRegisters[i] == this->readRegister)
+    {
+      this->status[i] = value;
+      this->statusTimestamp[i] = millis();
+    }
+  }
+
+  if (this->readRegister == TMC2209_REG_IFCNT)
+  {
+    if (this->expectedIfcntIsKnown && (value & 0xFF) != this->expectedIfcnt)
+    {
+      // Some writes were lost: write all the registers again
+      this->errorCount++;
+      for (i = 0; i < TMC2209_SHADOW_COUNT; i++)
+      {
+        this->writtenIsKnown[i] = false;
+      }
+    }
+    this->expectedIfcnt = value & 0xFF;
+    this->expectedIfcntIsKnown = true;
+  }
+}
+
+// Only used by init(), the other reads go through requestRead()
+bool TMC2209::readRegisterBlocking(uint8_t reg, uint32_t *value)
+{
+  int index;
+
+  this->driverIsPresent = true;
+  this->lastReadIsValid = false;
+  if (!this->requestRead(reg))
+  {
+    return false;
+  }
+  while (this->readIsPending && (millis() - this->readTimestamp) < TMC2209_READ_TIMEOUT)
+  {
+    while (this->port->available() > 0)
+    {
+      this->receiveByte(this->port->read());
+    }
+  }
+  if (this->readIsPending)
+  {
+    this->readIsPending = false;
+    this->echoBytesPending = 0;
+    return false;
+  }
+  if (!this->lastReadIsValid)
+  {
+    return false;
+  }
+  for (index = 0; index < TMC2209_STATUS_COUNT; index++)
+  {
+    if (StatusRegisters[index] == reg)
+    {
+      *value = this->status[index];
+      return true;
+    }
+  }
+  return false;
+}
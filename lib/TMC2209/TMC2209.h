@@ -0,0 +1,213 @@
+/*
+TMC2209.h - - Driver for the UART interface of the TMC2209 stepper driver - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+The TMC2209 is configured through a single wire UART (PDN_UART pin). The TX
+pin of the ESP32 is connected through a 1k resistor to the RX pin, so every
+byte sent is received back and skipped.
+
+All the configuration registers are kept in a shadow copy: the getters never
+access the bus. The setters only change the shadow, the registers which
+changed are written together by flush() (called by Manage()). The chip
+counts the valid datagrams in IFCNT, it is read back after each batch to
+detect lost or corrupted writes, in which case the registers are written
+again.
+
+The speed thresholds (StealthChop, CoolStep) are given in full steps per
+second, so they stay at the same physical speed when the resolution changes.
+
+getTransmitEndTimestamp() tells when the last datagram queued has left the
+wire: a new resolution is in force from then on.
+
+The status registers (SG_RESULT, DRV_STATUS, TSTEP...) are read
+asynchronously with requestRead(): the answer is stored by Manage() and
+returned by getStatusRegister().
+
+This file is part of the TMC2209 library.
+
+TMC2209 library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+TMC2209 library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with TMC2209 library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef TMC2209_h
+#define TMC2209_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+// Registers
+#define TMC2209_REG_GCONF 0x00
+#define TMC2209_REG_GSTAT 0x01
+#define TMC2209_REG_IFCNT 0x02
+#define TMC2209_REG_IHOLD_IRUN 0x10
+#define TMC2209_REG_TPOWERDOWN 0x11
+#define TMC2209_REG_TSTEP 0x12
+#define TMC2209_REG_TPWMTHRS 0x13
+#define TMC2209_REG_TCOOLTHRS 0x14
+#define TMC2209_REG_SGTHRS 0x40
+#define TMC2209_REG_SG_RESULT 0x41
+#define TMC2209_REG_COOLCONF 0x42
+#define TMC2209_REG_MSCNT 0x6A
+#define TMC2209_REG_CHOPCONF 0x6C
+#define TMC2209_REG_DRV_STATUS 0x6F
+#define TMC2209_REG_PWMCONF 0x70
+
+// Shadowed (written) registers
+#define TMC2209_SHADOW_GCONF 0
+#define TMC2209_SHADOW_IHOLD_IRUN 1
+#define TMC2209_SHADOW_TPOWERDOWN 2
+#define TMC2209_SHADOW_TPWMTHRS 3
+#define TMC2209_SHADOW_TCOOLTHRS 4
+#define TMC2209_SHADOW_SGTHRS 5
+#define TMC2209_SHADOW_COOLCONF 6
+#define TMC2209_SHADOW_CHOPCONF 7
+#define TMC2209_SHADOW_PWMCONF 8
+#define TMC2209_SHADOW_COUNT 9
+
+// Cached status (read) registers
+#define TMC2209_STATUS_GSTAT 0
+#define TMC2209_STATUS_IFCNT 1
+#define TMC2209_STATUS_TSTEP 2
+#define TMC2209_STATUS_SG_RESULT 3
+#define TMC2209_STATUS_MSCNT 4
+#define TMC2209_STATUS_DRV_STATUS 5
+#define TMC2209_STATUS_COUNT 6
+
+// GCONF bits
+#define TMC2209_GCONF_I_SCALE_ANALOG 0x001
+#define TMC2209_GCONF_EN_SPREADCYCLE 0x004
+#define TMC2209_GCONF_SHAFT 0x008
+#define TMC2209_GCONF_PDN_DISABLE 0x040
+#define TMC2209_GCONF_MSTEP_REG_SELECT 0x080
+#define TMC2209_GCONF_MULTISTEP_FILT 0x100
+
+// CHOPCONF fields
+#define TMC2209_CHOPCONF_VSENSE 0x00020000
+#define TMC2209_CHOPCONF_MRES_SHIFT 24
+#define TMC2209_CHOPCONF_MRES_MASK 0x0F000000
+
+// Reset values
+#define TMC2209_DEFAULT_GCONF 0x00000101
+#define TMC2209_DEFAULT_IHOLD_IRUN 0x00011F10
+#define TMC2209_DEFAULT_TPOWERDOWN 0x00000014
+#define TMC2209_DEFAULT_CHOPCONF 0x10000053
+#define TMC2209_DEFAULT_PWMCONF 0xC10D0024
+
+#define TMC2209_SYNC 0x05
+#define TMC2209_MASTER_ADDRESS 0xFF
+#define TMC2209_WRITE_BIT 0x80
+#define TMC2209_WRITE_DATAGRAM_SIZE 8
+#define TMC2209_READ_REQUEST_SIZE 4
+#define TMC2209_READ_REPLY_SIZE 8
+
+#define TMC2209_CLOCK_FREQUENCY 12000000 // Internal clock in Hz
+#define TMC2209_RSENSE 0.11              // Sense resistors of the usual modules
+#define TMC2209_DEFAULT_BAUDRATE 115200
+#define TMC2209_READ_TIMEOUT 5           // ms
+#define TMC2209_ECHO_TIMEOUT 1000        // us after the end of the transmission
+#define TMC2209_BITS_PER_BYTE 10         // Start and stop bits included
+
+class TMC2209
+{
+ public:
+  // Constructors:
+  TMC2209(HardwareSerial *port, uint8_t address);
+
+  // Setters:
+  void setMicrosteps(unsigned int microsteps);
+  void setRunCurrent(unsigned int milliAmps);
+  void setHoldCurrent(unsigned int milliAmps);
+  void setStealthChopMaxSpeed(unsigned long fullStepsPerSecond);
+  void setSpreadCycle(bool enable);
+  void setCoolStepMinSpeed(unsigned long fullStepsPerSecond);
+  void setStallGuardThreshold(uint8_t threshold);
+  void setShaftInverted(bool inverted);
+
+  // Getters:
+  unsigned int getMicrosteps();
+  unsigned int getRunCurrent();
+  unsigned int getHoldCurrent();
+  unsigned long getStealthChopMaxSpeed();
+  bool isSpreadCycleEnabled();
+  uint8_t getStallGuardThreshold();
+  uint32_t getShadowRegister(int index);
+  uint32_t getStatusRegister(int index);
+  unsigned long getStatusTimestamp(int index);
+  unsigned long getWriteCount();
+  unsigned long getErrorCount();
+  unsigned long getTransmitEndTimestamp();
+
+  // Other public members
+  bool init(unsigned long baudRate, int rxPin, int txPin);
+  bool isPresent();
+  bool isBusIdle();
+  bool isDirty();
+  bool requestRead(uint8_t reg);
+  void flush();
+  void Manage();
+
+  static uint8_t computeCrc(const uint8_t *datagram, int length);
+
+ private:
+  HardwareSerial *port;
+  uint8_t address;
+  bool driverIsPresent;
+
+  uint32_t shadow[TMC2209_SHADOW_COUNT];  // Values wanted
+  uint32_t written[TMC2209_SHADOW_COUNT]; // Values on the chip
+  bool writtenIsKnown[TMC2209_SHADOW_COUNT];
+  uint32_t status[TMC2209_STATUS_COUNT];
+  unsigned long statusTimestamp[TMC2209_STATUS_COUNT];
+
+  unsigned int runCurrent;  // mA
+  unsigned int holdCurrent; // mA
+  unsigned long stealthChopMaxSpeed; // full steps per second
+  unsigned long coolStepMinSpeed;    // full steps per second
+
+  int echoBytesPending;
+  bool readIsPending;
+  uint8_t readRegister;
+  uint8_t reply[TMC2209_READ_REPLY_SIZE];
+  int replyIndex;
+  unsigned long readTimestamp;
+  bool lastReadIsValid;
+  bool ifcntCheckIsPending;
+  bool expectedIfcntIsKnown;
+  uint8_t expectedIfcnt;
+  unsigned long writeCount;
+  unsigned long errorCount;
+  unsigned long byteTime;              // us on the wire
+  unsigned long transmitEndTimestamp;  // micros() when the last byte is sent
+
+  static const uint8_t ShadowRegisters[TMC2209_SHADOW_COUNT];
+  static const uint8_t StatusRegisters[TMC2209_STATUS_COUNT];
+
+  void setField(int index, uint32_t mask, uint32_t value);
+  void updateCurrents();
+  void updateSpeedThresholds();
+  uint32_t speedToTstep(unsigned long fullStepsPerSecond);
+  void writeRegister(int index);
+  void queueBytes(const uint8_t *data, int length);
+  void receiveByte(uint8_t data);
+  void storeReply();
+  bool readRegisterBlocking(uint8_t reg, uint32_t *value);
+};
+
+#endif //TMC2209_h
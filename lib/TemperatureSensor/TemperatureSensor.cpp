@@ -0,0 +1,238 @@
+/*
+TemperatureSensor.cpp - - Base class for the focuser temperature sensors - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+This file is part of the TemperatureSensor library.
+
+TemperatureSensor library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+TemperatureSensor library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with TemperatureSensor library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include "TemperatureSensor.h"
+
+//-----------------------------------------------------------------------------
+// Constructors
+
+TemperatureSensor::TemperatureSensor()
+{
+  this->state = TS_STATE_IDLE;
+  this->temperature = TS_NO_TEMPERATURE;
+  this->temperatureIsValid = false;
+  this->temperatureCompensationValue = 0;
+  this->temperatureTimestamp = 0;
+  this->conversionTimestamp = 0;
+  this->conversionInterval = 0;
+  this->conversionTimeout = TS_DEFAULT_CONVERSION_TIMEOUT;
+  this->conversionErrorCount = 0;
+  this->sensorIsPaused = false;
+  this->pauseTimestamp = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Setters
+
+// Set the offset of the temperature in C°
+void TemperatureSensor::setCompensationValue(float compensationValue)
+{
+  if (this->temperatureIsValid)
+  {
+    this->temperature += compensationValue - this->temperatureCompensationValue;
+  }
+  this->temperatureCompensationValue = compensationValue;
+}
+
+// Start a new conversion automatically every interval ms (0 = only on request)
+void TemperatureSensor::setConversionInterval(unsigned long interval)
+{
+  this->conversionInterval = interval;
+}
+
+void TemperatureSensor::setConversionTimeout(unsigned long timeout)
+{
+  this->conversionTimeout = timeout;
+}
+
+// While paused, Manage() does not access the sensor (e.g. a 1-Wire sensor
+// while the motors move). A running conversion continues once resumed and
+// the pause does not count in its timeout.
+void TemperatureSensor::setPaused(bool paused)
+{
+  if (paused && !this->sensorIsPaused)
+  {
+    this->pauseTimestamp = millis();
+  }
+  else if (!paused && this->sensorIsPaused)
+  {
+    this->conversionTimestamp += millis() - this->pauseTimestamp;
+  }
+  this->sensorIsPaused = paused;
+}
+
+//-----------------------------------------------------------------------------
+// Getters
+
+// Get the last completed temperature in C°
+float TemperatureSensor::getTemperature()
+{
+  return this->temperature;
+}
+
+float TemperatureSensor::getCompensationValue()
+{
+  return this->temperatureCompensationValue;
+}
+
+unsigned long TemperatureSensor::getConversionInterval()
+{
+  return this->conversionInterval;
+}
+
+// millis() of the last completed conversion
+unsigned long TemperatureSensor::getTemperatureTimestamp()
+{
+  return this->temperatureTimestamp;
+}
+
+unsigned long TemperatureSensor::getConversionErrorCount()
+{
+  return this->conversionErrorCount;
+}
+
+// Time in ms until Manage() has something to do: 0 during a conversion,
+// TS_NO_DEADLINE without automatic conversions.
+unsigned long TemperatureSensor::getTimeToNextConversion()
+{
+  unsigned long elapsedTime;
+
+  if (this->state == TS_STATE_CONVERTING || !this->temperatureIsValid)
+  {
+    return 0;
+  }
+  if (this->conversionInterval == 0)
+  {
+    return TS_NO_DEADLINE;
+  }
+  elapsedTime = millis() - this->temperatureTimestamp;
+  if (elapsedTime >= this->conversionInterval)
+  {
+    return 0;
+  }
+  return this->conversionInterval - elapsedTime;
+}
+
+int TemperatureSensor::getState()
+{
+  return this->state;
+}
+
+//-----------------------------------------------------------------------------
+// Public Members
+
+void TemperatureSensor::Manage()
+{
+  // This procedure should be called regularly.
+  // It never waits for the sensor: each call only checks if the running
+  // conversion is done.
+  if (this->sensorIsPaused)
+  {
+    return;
+  }
+  this->sample();
+
+  switch (this->state)
+  {
+    case TS_STATE_IDLE:
+      if (this->conversionInterval != 0 &&
+          (!this->temperatureIsValid ||
+           (millis() - this->temperatureTimestamp) >= this->conversionInterval))
+      {
+        this->startConversion();
+      }
+      break;
+    case TS_STATE_CONVERTING:
+      if (this->isConversionDone())
+      {
+        this->completeConversion();
+      }
+      else if ((millis() - this->conversionTimestamp) >= this->conversionTimeout)
+      {
+        // The sensor does not answer. The last reading is kept.
+        this->conversionErrorCount++;
+        this->state = TS_STATE_IDLE;
+        this->temperatureTimestamp = millis();
+      }
+      break;
+    default:
+      this->state = TS_STATE_IDLE;
+      break;
+  }
+}
+
+void TemperatureSensor::startConversion()
+{
+  // A conversion already running is not restarted
+  if (this->state == TS_STATE_CONVERTING)
+  {
+    return;
+  }
+  this->beginConversion();
+  this->conversionTimestamp = millis();
+  this->state = TS_STATE_CONVERTING;
+}
+
+bool TemperatureSensor::isConverting()
+{
+  return this->state == TS_STATE_CONVERTING;
+}
+
+// Return true once a conversion was completed
+bool TemperatureSensor::hasTemperature()
+{
+  return this->temperatureIsValid;
+}
+
+bool TemperatureSensor::isPaused()
+{
+  return this->sensorIsPaused;
+}
+
+//-----------------------------------------------------------------------------
+// Protected
+
+void TemperatureSensor::sample()
+{
+}
+
+//-----------------------------------------------------------------------------
+// Private
+
+void TemperatureSensor::completeConversion()
+{
+  float reading;
+
+  if (this->readConversion(&reading))
+  {
+    this->temperature = reading + this->temperatureCompensationValue;
+    this->temperatureIsValid = true;
+  }
+  else
+  {
+    this->conversionErrorCount++;
+  }
+  this->temperatureTimestamp = millis();
+  this->state = TS_STATE_IDLE;
+}
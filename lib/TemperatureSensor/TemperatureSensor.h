@@ -0,0 +1,102 @@
+/*
+TemperatureSensor.h - - Base class for the focuser temperature sensors - Version 1.0
+
+History:
+Version 1.0
+   First release
+
+A temperature sensor runs its conversions through a non blocking state
+machine: startConversion() only triggers the conversion and Manage() polls
+the sensor until the conversion is done. getTemperature() always returns the
+last completed reading, so a slow sensor never stalls the main loop.
+
+The sensors implement beginConversion(), isConversionDone() and
+readConversion(). sample() is called on every Manage() for the sensors which
+need some background work.
+
+This file is part of the TemperatureSensor library.
+
+TemperatureSensor library is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+TemperatureSensor library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with TemperatureSensor library.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef TemperatureSensor_h
+#define TemperatureSensor_h
+
+#if ARDUINO < 100
+#include <Wprogram.h>
+#else
+#include <Arduino.h>
+#endif
+
+#define TS_STATE_IDLE 0
+#define TS_STATE_CONVERTING 1
+
+#define TS_NO_TEMPERATURE -65535
+#define TS_DEFAULT_CONVERSION_TIMEOUT 2000 // ms
+#define TS_NO_DEADLINE 0xFFFFFFFF
+
+class TemperatureSensor
+{
+ public:
+  // Constructors:
+  TemperatureSensor();
+  virtual ~TemperatureSensor() {}
+
+  // Setters:
+  void setCompensationValue(float compensationValue);
+  void setConversionInterval(unsigned long interval);
+  void setConversionTimeout(unsigned long timeout);
+  void setPaused(bool paused);
+
+  // Getters:
+  float getTemperature();
+  float getCompensationValue();
+  unsigned long getConversionInterval();
+  unsigned long getTemperatureTimestamp();
+  unsigned long getConversionErrorCount();
+  unsigned long getTimeToNextConversion();
+  int getState();
+
+  // Other public members
+  virtual bool init() = 0;
+  void Manage();
+  void startConversion();
+  bool isConverting();
+  bool hasTemperature();
+  bool isPaused();
+
+ protected:
+  virtual void sample();
+  virtual void beginConversion() = 0;
+  virtual bool isConversionDone() = 0;
+  virtual bool readConversion(float *temperature) = 0;
+
+ private:
+  int state;
+  float temperature; // Last completed reading in C°, compensation included
+  bool temperatureIsValid;
+  float temperatureCompensationValue;
+  unsigned long temperatureTimestamp;
+  unsigned long conversionTimestamp;
+  unsigned long conversionInterval;
+  unsigned long conversionTimeout;
+  unsigned long conversionErrorCount;
+  bool sensorIsPaused;
+  unsigned long pauseTimestamp;
+
+  void completeConversion();
+};
+
+#endif //TemperatureSensor_h
@@ -1,11 +1,31 @@
 #include <Arduino.h>
-//#include "LM335.h"
+#ifdef FOCUSER_DS18B20
+#include "DS18B20.h"
+#else
+#include "LM335.h"
+#endif
 #include "Moonlite.h"
+#include "MoonliteArbiter.h"
+#include "MoonliteServer.h"
 #include "StepperControl.h"
+#include "MotionScheduler.h"
+#include "IdleSleep.h"
+#include "CooperativeScheduler.h"
+#include "ProfileRegistry.h"
+#include "FilterTable.h"
+#include "StepLossDetector.h"
+#include "DebugLog.h"
+#include "FocusSweep.h"
+#include "TMC2209.h"
+#include "AutoTuner.h"
+#include "NvsSettingsStorage.h"
+#include "SettingsStore.h"
 #include <ESP32Encoder.h>
 
-//#include <U8x8lib.h>
-//#include <U8g2lib.h>
+#ifdef FOCUSER_DISPLAY
+#include <U8g2lib.h>
+#include "StatusDisplay.h"
+#endif
 
 const int directionPin = 32;
 const int stepPin      = 33;
@@ -16,20 +36,103 @@ const int stepMode2    = 14;
 const int stepMode1    = 12;
 const int enablePin    = 13;
 
+// Single wire UART of the TMC2209 (TX through a 1k resistor)
+const int driverUartRxPin = 18;
+const int driverUartTxPin = 19;
+const unsigned long driverStealthChopMaxSpeed = 150; // full steps per second
+
+#ifdef FOCUSER_AUX_AXIS
+// Second focuser (e.g. a filter wheel or a rotator) on a plain step/dir
+// driver, its microstepping is set by jumpers
+const int auxDirectionPin = 5;
+const int auxStepPin      = 4;
+const int auxEnablePin    = 23;
+#endif
+
 const int encoderPin1  = 2;
 const int encoderPin2  = 15;
 
+// Moonlite over TCP, the network is set by build flags:
+// -DFOCUSER_WIFI_SSID=\"name\" -DFOCUSER_WIFI_PASSWORD=\"password\"
+// Without SSID the WiFi stays off.
+#ifndef FOCUSER_WIFI_SSID
+#define FOCUSER_WIFI_SSID ""
+#endif
+#ifndef FOCUSER_WIFI_PASSWORD
+#define FOCUSER_WIFI_PASSWORD ""
+#endif
+#ifndef FOCUSER_TCP_PORT
+#define FOCUSER_TCP_PORT MLS_DEFAULT_PORT
+#endif
+
+// Light sleep when idle (battery powered rigs): -DFOCUSER_LIGHT_SLEEP=1
+// It can also be switched with :XPE1#. Not available with the WiFi.
+#ifndef FOCUSER_LIGHT_SLEEP
+#define FOCUSER_LIGHT_SLEEP 0
+#endif
+
+// Camera trigger pulsed at each point of a focus sweep: -DFOCUSER_TRIGGER_PIN=<gpio>
+#ifndef FOCUSER_TRIGGER_PIN
+#define FOCUSER_TRIGGER_PIN FS_NO_PIN
+#endif
+
+// Optional encoder on the motor shaft or the drawtube (PCNT), checks that
+// no step is lost: -DFOCUSER_MOTOR_ENCODER_A=<gpio> -DFOCUSER_MOTOR_ENCODER_B=<gpio>
+// -DFOCUSER_MOTOR_ENCODER_COUNTS=<counts per motor turn, negative to invert>
+#ifndef FOCUSER_MOTOR_ENCODER_A
+#define FOCUSER_MOTOR_ENCODER_A -1
+#endif
+#ifndef FOCUSER_MOTOR_ENCODER_B
+#define FOCUSER_MOTOR_ENCODER_B -1
+#endif
+#ifndef FOCUSER_MOTOR_ENCODER_COUNTS
+#define FOCUSER_MOTOR_ENCODER_COUNTS 4000
+#endif
+
+// Divider between the LM335 and its pin, in ohms (see LM335.h). The LM335
+// output goes to GPIO 36 through the top resistor, the bottom resistor
+// goes from GPIO 36 to the ground. Other values:
+// -DFOCUSER_LM335_DIVIDER_TOP=<ohms> -DFOCUSER_LM335_DIVIDER_BOTTOM=<ohms>
+#ifndef FOCUSER_LM335_DIVIDER_TOP
+#define FOCUSER_LM335_DIVIDER_TOP 10000
+#endif
+#ifndef FOCUSER_LM335_DIVIDER_BOTTOM
+#define FOCUSER_LM335_DIVIDER_BOTTOM 10000
+#endif
+#if !defined(FOCUSER_DS18B20) && FOCUSER_LM335_DIVIDER_BOTTOM == 0
+// The sensor output would be above the linear range of the ADC
+#error "The LM335 needs a divider, see FOCUSER_LM335_DIVIDER_BOTTOM"
+#endif
+
+// Binary debug log on Serial2, see tools/decode_log.py: -DFOCUSER_DEBUG_LOG
+
 #define RXD2 16
 #define TXD2 17
 
 const int encoderMotorstepsRelation = 5;
+const long motorFullStepsPerTurn = 200;
+
+// Debug log records sent per run of the log task while a motor moves
+const int logRecordsPerMovingRun = 1;
 
-//const int temperatureSensorPin = 3;
+// Bulk answers are paged to fit the 128 bytes UART FIFO: a write of more
+// blocks the loop until the bytes are sent (1 ms per byte at 9600 bauds).
+// A value takes 9 bytes: 7 sweep points of 2 values, 4 samples of 3 values.
+const int sweepPageSize = 7;
+const int telemetryDownloadSize = 4;
 
-unsigned long timestamp;
-unsigned long displayTimestamp;
+// ADC1 pin, continuous sampling is not available on ADC2
+const int temperatureSensorPin = 36;
+const unsigned long temperatureConversionInterval = 5000;
 
-//LM335 TemperatureSensor(temperatureSensorPin);
+long lastEncoderPosition = 0;
+unsigned long lastStepTimestamp = 0;
+
+#ifdef FOCUSER_DS18B20
+DS18B20 Thermometer(temperatureSensorPin);
+#else
+LM335 Thermometer(temperatureSensorPin);
+#endif
 StepperControl Motor(stepPin,
                            directionPin,
                            stepMode1,
@@ -38,33 +141,152 @@ StepperControl Motor(stepPin,
                            enablePin,
                            sleepPin,
                            resetPin);
+#ifdef FOCUSER_AUX_AXIS
+StepperControl AuxMotor(auxStepPin,
+                           auxDirectionPin,
+                           SC_NO_PIN,
+                           SC_NO_PIN,
+                           SC_NO_PIN,
+                           auxEnablePin,
+                           SC_NO_PIN,
+                           SC_NO_PIN);
+#endif
+MotionScheduler Scheduler;
+
+// State of the focusers for the getters, refreshed once per loop so all the
+// clients polling in the same loop get the same values
+typedef struct AxisSnapshot_s
+{
+  long currentPosition;
+  long targetPosition;
+  bool inMove;
+  int profile;
+  int stepMode;
+  int temperatureCompensationCoefficient;
+  long temperature; // GT value
+  bool statusIsEncoded;
+  char statusFrame[ML_STATUS_FRAME_SIZE]; // XST answer
+} AxisSnapshot_t;
+AxisSnapshot_t Snapshot[MS_MAX_AXES];
+
+// Motion ownership: the client which starts a move owns the focuser until
+// the move ends, the other clients can only read and stop it
+MoonliteArbiter Arbiter;
+TMC2209 Driver(&Serial1, 0);
+AutoTuner Tuner(&Motor);
+FocusSweep Sweep(&Motor);
 Moonlite SerialProtocol;
-ESP32Encoder encoder;
+MoonliteServer NetworkServer(FOCUSER_TCP_PORT);
+IdleSleep PowerManager;
+CooperativeScheduler Tasks;
+ProfileRegistry Profiles;
+FilterTable Filters; // Offsets of the filters of the main focuser
+int activeProfile[MS_MAX_AXES]; // SD code of each focuser
 
-// Declaration of the display
-//U8G2_SSD1306_128X64_NONAME_1_HW_I2C Display(U8G2_R0);
+// Notifications (see ML_NOTIFY_*)
+const int firstNetworkTransport = 1; // The serial port is the transport 0
+unsigned long networkConnectionCounts[MLS_MAX_CLIENTS];
+bool axisWasMoving[MS_MAX_AXES];
+bool axisWasStalled[MS_MAX_AXES];
+unsigned long notifiedWaypointCount[MS_MAX_AXES];
+ESP32Encoder encoder;
+ESP32Encoder MotorEncoder;
+StepLossDetector LossDetector;
+DebugLog Log;
+NvsSettingsStorage SettingsBackend;
+SettingsStore Settings(&SettingsBackend);
 
-float temp = 0;
-long pos = 0;
-bool pageIsRefreshing = false;
+#ifdef FOCUSER_DISPLAY
+// SSD1306 status display on I2C: -DFOCUSER_DISPLAY. Full buffer mode, the
+// fields are sent tile by tile by the display task.
+U8G2_SSD1306_128X64_NONAME_F_HW_I2C Oled(U8G2_R0);
+StatusDisplay Display(&Oled);
+int temperatureField;
+int positionField;
+#endif
 
 hw_timer_t * timer = NULL;
 
+// True while a move of the focuser (homing, tuning, queue, sweep) runs
+bool isDeviceBusy(int device)
+{
+  StepperControl *axis = Scheduler.getAxis(device);
+
+  return axis->isInMove() || axis->isHoming() || axis->isQueueRunning() ||
+         (axis == &Motor && (Tuner.isRunning() || Sweep.isRunning()));
+}
+
+void UpdateSnapshot()
+{
+  StepperControl *axis;
+  AxisSnapshot_t *snapshot;
+  long temperature = (long)(Thermometer.hasTemperature() ? Thermometer.getTemperature() * 2 : 0);
+  int i;
+
+  for (i = 0; i < Scheduler.getAxisCount(); i++)
+  {
+    axis = Scheduler.getAxis(i);
+    snapshot = &Snapshot[i];
+
+    // The status frame is only encoded again when one of its values changes
+    if (!snapshot->statusIsEncoded ||
+        snapshot->currentPosition != axis->getCurrentPosition() ||
+        snapshot->targetPosition != axis->getTargetPosition() ||
+        snapshot->inMove != axis->isInMove() ||
+        snapshot->profile != activeProfile[i] ||
+        snapshot->temperature != temperature)
+    {
+      snapshot->currentPosition = axis->getCurrentPosition();
+      snapshot->targetPosition = axis->getTargetPosition();
+      snapshot->inMove = axis->isInMove();
+      snapshot->profile = activeProfile[i];
+      snapshot->temperature = temperature;
+      SerialProtocol.encodeStatusFrame(snapshot->currentPosition, snapshot->targetPosition,
+                                       snapshot->inMove ? 0x01 : 0x00, snapshot->temperature,
+                                       snapshot->profile, snapshot->statusFrame);
+      snapshot->statusIsEncoded = true;
+    }
+    snapshot->stepMode = axis->getStepMode();
+    snapshot->temperatureCompensationCoefficient = axis->getTemperatureCompensationCoefficient();
+  }
+}
+
 void processCommand()
 {
-  switch (SerialProtocol.getCommand().commandID)
+  MoonliteCommand_t command = SerialProtocol.getCommand();
+  StepperControl *axis = Scheduler.getAxis(command.device);
+  AxisSnapshot_t *snapshot;
+
+  // Commands for a focuser which does not exist are ignored
+  if (axis == NULL)
+  {
+    return;
+  }
+  snapshot = &Snapshot[command.device];
+  PowerManager.notifyActivity();
+  Log.write(DL_EVENT_COMMAND, command.commandID, command.client);
+
+  if (!Arbiter.accept(&command, isDeviceBusy(command.device)))
+  {
+    return;
+  }
+
+  switch (command.commandID)
   {
     case ML_C:
       // Initiate temperature convertion
-      // Not implemented
+      // The result is returned by GT once the conversion is completed
+      Thermometer.startConversion();
       break;
     case ML_FG:
       // Goto target position
-      Motor.goToTargetPosition();
+      axis->startUserMove();
       break;
     case ML_FQ:
       // Motor stop movement
-      Motor.stopMovement();
+      Tuner.abort();
+      Sweep.abort();
+      axis->stopMovement();
       break;
     case ML_GB:
       // Set the Red Led backligth value
@@ -73,52 +295,31 @@ void processCommand()
       break;
     case ML_GC:
       // Return the temperature coefficient
-      SerialProtocol.setAnswer(2, (long)Motor.getTemperatureCompensationCoefficient());
+      SerialProtocol.setAnswer(2, (long)snapshot->temperatureCompensationCoefficient);
       break;
     case ML_GD:
-      // Return the current motor speed
-      switch (Motor.getSpeed())
-      {
-        case 500:
-          SerialProtocol.setAnswer(2, (long)0x20);
-          break;
-        case 1000:
-          SerialProtocol.setAnswer(2, (long)0x10);
-          break;
-        case 3000:
-          SerialProtocol.setAnswer(2, (long)0x8);
-          break;
-        case 5000:
-          SerialProtocol.setAnswer(2, (long)0x4);
-          break;
-        case 7000:
-          SerialProtocol.setAnswer(2, (long)0x2);
-          break;
-        default:
-          SerialProtocol.setAnswer(2, (long)0x20);
-          break;
-      }
+      // Return the code of the profile in use
+      SerialProtocol.setAnswer(2, (long)snapshot->profile);
       break;
     case ML_GH:
       // Return the current stepping mode (half or full step)
-      SerialProtocol.setAnswer(2, (long)(Motor.getStepMode() == SC_32TH_STEP ? 0xFF : 0x00));
+      SerialProtocol.setAnswer(2, (long)(snapshot->stepMode == SC_32TH_STEP ? 0xFF : 0x00));
       break;
     case ML_GI:
       // get if the motor is moving or not
-      SerialProtocol.setAnswer(2, (long)(Motor.isInMove() ? 0x01 : 0x00));
+      SerialProtocol.setAnswer(2, (long)(snapshot->inMove ? 0x01 : 0x00));
       break;
     case ML_GN:
       // Get the target position
-      SerialProtocol.setAnswer(4, (long)(Motor.getTargetPosition()));
+      SerialProtocol.setAnswer(4, (long)(snapshot->targetPosition));
       break;
     case ML_GP:
       // Return the current position
-      SerialProtocol.setAnswer(4, (long)(Motor.getCurrentPosition()));
+      SerialProtocol.setAnswer(4, (long)(snapshot->currentPosition));
       break;
     case ML_GT:
-      // Return the temperature
-      //SerialProtocol.setAnswer(4, (long)((TemperatureSensor.getTemperature() * 2)));
-      SerialProtocol.setAnswer(4, (long)(20 * 2));
+      // Return the last completed temperature reading
+      SerialProtocol.setAnswer(4, (long)(Thermometer.hasTemperature() ? Thermometer.getTemperature() * 2 : 0));
       break;
     case ML_GV:
       // Get the version of the firmware
@@ -126,70 +327,419 @@ void processCommand()
       break;
     case ML_SC:
       // Set the temperature coefficient
-      Motor.setTemperatureCompensationCoefficient(SerialProtocol.getCommand().parameter);
+      axis->setTemperatureCompensationCoefficient(command.parameter);
       break;
     case ML_SD:
-      // Set the motor speed
-      switch (SerialProtocol.getCommand().parameter)
+      // Select the speed profile, the unknown codes are ignored
+      if (Profiles.apply(command.parameter, axis))
       {
-        case 0x02:
-          Motor.setSpeed(7000);
-          break;
-        case 0x04:
-          Motor.setSpeed(5000);
-          break;
-        case 0x08:
-          Motor.setSpeed(3000);
-          break;
-        case 0x10:
-          Motor.setSpeed(1000);
-          break;
-        case 0x20:
-          Motor.setSpeed(500);
-          break;
-        default:
-          break;
+        activeProfile[command.device] = command.parameter;
       }
       break;
     case ML_SF:
       // Set the stepping mode to full step
-      Motor.setStepMode(SC_16TH_STEP);
-      if (Motor.getSpeed() >= 6000)
+      axis->setStepMode(SC_16TH_STEP);
+      if (axis->getTargetSpeed() >= 6000)
       {
-        Motor.setSpeed(6000);
+        axis->setSpeed(6000);
       }
       break;
     case ML_SH:
       // Set the stepping mode to half step
-      Motor.setStepMode(SC_32TH_STEP);
+      axis->setStepMode(SC_32TH_STEP);
       break;
     case ML_SN:
       // Set the target position
-      encoder.setCount(SerialProtocol.getCommand().parameter * encoderMotorstepsRelation);
-      Motor.setTargetPosition(SerialProtocol.getCommand().parameter);
+      axis->setTargetPosition(command.parameter);
       break;
     case ML_SP:
       // Set the current motor position
-      encoder.setCount(SerialProtocol.getCommand().parameter * encoderMotorstepsRelation);
-      Motor.setCurrentPosition(SerialProtocol.getCommand().parameter);
+      axis->setCurrentPosition(command.parameter);
+      if (axis == &Motor)
+      {
+        LossDetector.reset();
+      }
       break;
     case ML_PLUS:
       // Activate temperature compensation focusing
-      Motor.enableTemperatureCompensation();
+      axis->enableTemperatureCompensation();
       break;
     case ML_MINUS:
       // Disable temperature compensation focusing
-      Motor.disableTemperatureCompensation();
+      axis->disableTemperatureCompensation();
       break;
     case ML_PO:
       // Temperature calibration
-      //TemperatureSensor.setCompensationValue(SerialProtocol.getCommand().parameter / 2.0);
+      Thermometer.setCompensationValue(command.parameter / 2.0);
+      break;
+    case ML_XHM:
+      // Start the sensorless homing
+      axis->startHoming(command.parameter ? SC_HOMING_OUTWARD : SC_HOMING_INWARD);
+      break;
+    case ML_XHS:
+      // Return the homing state
+      SerialProtocol.setAnswer(2, (long)axis->getHomingState());
+      break;
+    case ML_XAT:
+      // Start the speed and acceleration auto-tuning of the first focuser
+      if (axis == &Motor)
+      {
+        Tuner.start();
+      }
+      break;
+    case ML_XAS:
+      // Return the auto-tuning state and level
+      {
+        long answers[2] = {Tuner.getState(), Tuner.getLevel()};
+        SerialProtocol.setAnswer(2, answers, 2);
+      }
+      break;
+    case ML_XAR:
+      // Return the limits in use
+      {
+        long answers[2] = {(long)axis->getSpeedLimit(), (long)axis->getAccelerationLimit()};
+        SerialProtocol.setAnswer(8, answers, 2);
+      }
+      break;
+    case ML_XRD:
+      // Define a profile: code, speed, acceleration and step mode.
+      // Without acceleration or step mode the ones in use are kept.
+      if (command.parameterCount >= 2)
+      {
+        Profiles.setProfile(command.parameters[0], command.parameters[1],
+                            command.parameterCount >= 3 ? command.parameters[2] : PR_KEEP_ACCELERATION,
+                            command.parameterCount >= 4 ? command.parameters[3] : PR_KEEP_STEP_MODE);
+      }
+      break;
+    case ML_XRG:
+      // Return the speed, acceleration and step mode of a profile
+      {
+        const MotionProfile_t *profile = Profiles.getProfile(command.parameter);
+        long answers[3] = {0, 0, PR_KEEP_STEP_MODE};
+        if (profile != NULL)
+        {
+          answers[0] = profile->speed;
+          answers[1] = profile->acceleration;
+          answers[2] = profile->stepMode;
+        }
+        SerialProtocol.setAnswer(8, answers, 3);
+      }
+      break;
+    case ML_XRR:
+      // Remove a profile
+      Profiles.removeProfile(command.parameter);
+      break;
+    case ML_XME:
+      // Return the remaining time and distance of the move, the client can
+      // wait that long instead of polling GI
+      {
+        long answers[2] = {(long)axis->getRemainingMoveTime(), axis->getRemainingMoveDistance()};
+        SerialProtocol.setAnswer(8, answers, 2);
+      }
+      break;
+    case ML_XMP:
+      // Return the predicted time and distance of a move to the position
+      {
+        long distance = abs(command.parameter - axis->getCurrentPosition());
+        long answers[2] = {(long)axis->predictMoveTime(distance), distance};
+        SerialProtocol.setAnswer(8, answers, 2);
+      }
+      break;
+    case ML_XNE:
+      // Select the notifications sent to this client
+      SerialProtocol.setNotificationMask(command.client, command.parameter);
+      break;
+    case ML_XNT:
+      // Set the temperature change notified to this client
+      SerialProtocol.setTemperatureThreshold(command.client, command.parameter);
+      break;
+    case ML_XST:
+      // Return GP, GN, GI, GT and GD in one frame
+      SerialProtocol.setAnswer(snapshot->statusFrame, ML_STATUS_FRAME_SIZE);
+      break;
+    case ML_XSW:
+      // Start a focus sweep of the first focuser: start, step, count and
+      // optionally the dwell time in ms
+      if (axis == &Motor && command.parameterCount >= 3)
+      {
+        if (command.parameterCount >= 4)
+        {
+          Sweep.setDwellTime(command.parameters[3]);
+        }
+        Sweep.start(command.parameters[0], command.parameters[1], command.parameters[2]);
+      }
+      break;
+    case ML_XSS:
+      // Return the sweep state and the number of points logged
+      {
+        long answers[2] = {Sweep.getState(), Sweep.getPointCount()};
+        SerialProtocol.setAnswer(2, answers, 2);
+      }
+      break;
+    case ML_XSD:
+      // Return a page of the sweep log: position and time (ms) of each
+      // point from the offset, at most sweepPageSize points
+      {
+        long answers[2 * sweepPageSize];
+        int offset = command.parameterCount >= 1 ? command.parameters[0] : 0;
+        int count = 0;
+        while ((count < command.parameters[1] || command.parameterCount < 2) &&
+               count < sweepPageSize && offset >= 0 && offset + count < Sweep.getPointCount())
+        {
+          answers[2 * count] = Sweep.getPoint(offset + count)->position;
+          answers[2 * count + 1] = (long)Sweep.getPoint(offset + count)->timestamp;
+          count++;
+        }
+        SerialProtocol.setAnswer(8, answers, 2 * count);
+      }
+      break;
+    case ML_XLC:
+      // Set the telemetry interval and mode
+      axis->setTelemetryInterval(command.parameter);
+      axis->setTelemetryOnChange(command.parameterCount >= 2 && command.parameters[1] != 0);
+      break;
+    case ML_XLS:
+      // Return the telemetry status
+      {
+        long answers[3] = {axis->getTelemetry()->getCount(),
+                           (long)axis->getTelemetry()->getLostCount(),
+                           (long)axis->getTelemetryInterval()};
+        SerialProtocol.setAnswer(8, answers, 3);
+      }
+      break;
+    case ML_XLD:
+      // Return the oldest telemetry samples, at most telemetryDownloadSize.
+      // The host reads until the answer is empty.
+      {
+        long answers[3 * telemetryDownloadSize];
+        TelemetrySample_t sample;
+        int count = 0;
+        while ((count < command.parameter || command.parameterCount == 0) &&
+               count < telemetryDownloadSize && axis->getTelemetry()->read(&sample))
+        {
+          answers[3 * count] = (long)sample.timestamp;
+          answers[3 * count + 1] = sample.position;
+          answers[3 * count + 2] = sample.temperature;
+          count++;
+        }
+        SerialProtocol.setAnswer(8, answers, 3 * count);
+      }
+      break;
+    case ML_XQA:
+      // Queue a waypoint, it is dropped if the queue is full
+      axis->queueMove(command.parameter, command.parameterCount >= 2 ? command.parameters[1] : 0);
+      break;
+    case ML_XQC:
+      axis->clearQueue();
+      break;
+    case ML_XQS:
+      // Return the queue status
+      {
+        long answers[2] = {axis->getQueueCount(), (long)axis->getReachedWaypointCount()};
+        SerialProtocol.setAnswer(8, answers, 2);
+      }
+      break;
+    case ML_XFD:
+      // Define a filter: number, offset and slope (1/100 steps per C)
+      if (command.parameterCount >= 2)
+      {
+        Filters.setFilter(command.parameters[0], command.parameters[1],
+                          command.parameterCount >= 3 ? command.parameters[2] / 100.0 : 0);
+      }
+      break;
+    case ML_XFG:
+      // Return the offset and the slope of a filter
+      {
+        const FilterOffset_t *filter = Filters.getFilter(command.parameter);
+        long answers[2] = {0, 0};
+        if (filter != NULL)
+        {
+          answers[0] = filter->offset;
+          answers[1] = lround(filter->slope * 100);
+        }
+        SerialProtocol.setAnswer(8, answers, 2);
+      }
+      break;
+    case ML_XFR:
+      // Remove a filter
+      Filters.removeFilter(command.parameter);
+      break;
+    case ML_XFT:
+      // Set the temperature at which the offsets were measured
+      Filters.setReferenceTemperature(command.parameter / 2.0);
+      break;
+    case ML_XFS:
+      // Offset and temperature correction in one move
+      if (axis == &Motor && !Tuner.isRunning() && !Sweep.isRunning())
+      {
+        Filters.select(command.parameter, Thermometer.hasTemperature() ? Thermometer.getTemperature()
+                                                                       : Filters.getReferenceTemperature(),
+                       &Motor);
+      }
+      break;
+    case ML_XFC:
+      // Return the filter in use and its offset
+      {
+        long answers[2] = {Filters.getCurrentFilter(),
+                           Filters.getOffset(Filters.getCurrentFilter(),
+                                             Thermometer.hasTemperature() ? Thermometer.getTemperature()
+                                                                          : Filters.getReferenceTemperature())};
+        SerialProtocol.setAnswer(8, answers, 2);
+      }
+      break;
+    case ML_XSM:
+      // Set the step mode of the long moves and the length of the approach
+      axis->setSlewStepMode(command.parameter);
+      if (command.parameterCount >= 2)
+      {
+        axis->setApproachDistance(command.parameters[1]);
+      }
+      break;
+    case ML_XSG:
+      // Return the slew step mode and the approach distance
+      {
+        long answers[2] = {axis->getSlewStepMode(), (long)axis->getApproachDistance()};
+        SerialProtocol.setAnswer(8, answers, 2);
+      }
+      break;
+    case ML_XEC:
+      // Set the error accepted by the step loss detection
+      LossDetector.setTolerance(command.parameter);
+      break;
+    case ML_XES:
+      // Return the status of the step loss detection of the main focuser
+      {
+        long answers[4] = {LossDetector.getMeasuredPosition(), LossDetector.getError(),
+                           LossDetector.getMaxError(), (long)LossDetector.getLossCount()};
+        SerialProtocol.setAnswer(8, answers, 4);
+      }
+      break;
+    case ML_XBA:
+      // Add a resonance band in full steps per second
+      if (command.parameterCount >= 2)
+      {
+        axis->addResonanceBand(command.parameters[0], command.parameters[1]);
+      }
+      break;
+    case ML_XBC:
+      axis->clearResonanceBands();
+      break;
+    case ML_XBG:
+      // Return a resonance band, 0,0 if there is none at this index
+      {
+        long answers[2] = {0, 0};
+        if (command.parameter >= 0 && command.parameter < axis->getResonanceBandCount())
+        {
+          answers[0] = axis->getResonanceBands()[command.parameter].low;
+          answers[1] = axis->getResonanceBands()[command.parameter].high;
+        }
+        SerialProtocol.setAnswer(8, answers, 2);
+      }
+      break;
+    case ML_XTS:
+      // Return the statistics of a task of the main loop
+      {
+        long answers[4] = {(long)Tasks.getRunCount(command.parameter),
+                           (long)Tasks.getOverrunCount(command.parameter),
+                           (long)Tasks.getMaxExecutionTime(command.parameter),
+                           (long)Tasks.getMaxLateness(command.parameter)};
+        SerialProtocol.setAnswer(8, answers, 4);
+      }
+      break;
+    case ML_XPE:
+      // Enable the light sleep when idle
+      PowerManager.setEnabled(command.parameter != 0 && strlen(FOCUSER_WIFI_SSID) == 0);
+      break;
+    case ML_XPS:
+      // Return the light sleep statistics
+      {
+        long answers[5] = {(long)PowerManager.getSleepCount(),
+                           (long)PowerManager.getSleepTime(),
+                           (long)millis(),
+                           (long)PowerManager.getLastWakeLatency(),
+                           (long)PowerManager.getMaxWakeLatency()};
+        SerialProtocol.setAnswer(8, answers, 5);
+      }
       break;
     default:
       break;
   }
 }
 
+void CaptureSettings(FocuserSettings_t *settings)
+{
+  settings->currentPosition = Motor.getCurrentPosition();
+  settings->speed = Motor.getRequestedSpeed();
+  settings->stepMode = Motor.getStepMode();
+  settings->temperatureCompensationCoefficient = Motor.getTemperatureCompensationCoefficient();
+  settings->temperatureCompensationIsEnabled = Motor.isTemperatureCompensationEnabled();
+  settings->temperatureCompensationValue = Thermometer.getCompensationValue();
+  settings->speedLimit = Motor.getSpeedLimit();
+  settings->acceleration = Motor.getAcceleration();
+  settings->accelerationLimit = Motor.getAccelerationLimit();
+  memcpy(settings->profiles, Profiles.getProfiles(), sizeof(settings->profiles));
+  settings->profile = activeProfile[0];
+  memcpy(settings->filters, Filters.getFilters(), sizeof(settings->filters));
+  settings->filterReferenceTemperature = Filters.getReferenceTemperature();
+  settings->filter = Filters.getCurrentFilter();
+  settings->slewStepMode = Motor.getSlewStepMode();
+  settings->approachDistance = Motor.getApproachDistance();
+  memcpy(settings->resonanceBands, Motor.getResonanceBands(), sizeof(settings->resonanceBands));
+}
+
+void RestoreSettings(const FocuserSettings_t *settings)
+{
+  Motor.setCurrentPosition(settings->currentPosition);
+  Motor.setTargetPosition(settings->currentPosition);
+  Motor.setStepMode(settings->stepMode);
+  Profiles.setProfiles(settings->profiles);
+  activeProfile[0] = settings->profile;
+  Filters.setFilters(settings->filters);
+  Filters.setReferenceTemperature(settings->filterReferenceTemperature);
+  Filters.setCurrentFilter(settings->filter);
+  Motor.setSlewStepMode(settings->slewStepMode);
+  Motor.setApproachDistance(settings->approachDistance);
+  Motor.setResonanceBands(settings->resonanceBands);
+  Motor.setSpeedLimit(settings->speedLimit);
+  Motor.setAccelerationLimit(settings->accelerationLimit);
+  Motor.setAcceleration(settings->acceleration);
+  Motor.setSpeed(settings->speed);
+  Motor.setTemperatureCompensationCoefficient(settings->temperatureCompensationCoefficient);
+  if (settings->temperatureCompensationIsEnabled)
+  {
+    Motor.enableTemperatureCompensation();
+  }
+  Thermometer.setCompensationValue(settings->temperatureCompensationValue);
+}
+
+void ManageSettings()
+{
+  FocuserSettings_t settings;
+  StepperControl *axis;
+  int i;
+
+  // The settings are only snapshotted and written while nothing moves: the
+  // flash write stops the step timing of all the axes for some milliseconds.
+  // The store coalesces the changes into a few flash writes.
+  for (i = 0; i < Scheduler.getAxisCount(); i++)
+  {
+    axis = Scheduler.getAxis(i);
+    if (axis->isInMove() || axis->isHoming() || axis->isQueueRunning())
+    {
+      return;
+    }
+  }
+  if (Tuner.isRunning() || Sweep.isRunning())
+  {
+    return;
+  }
+
+  memset(&settings, 0, sizeof(settings));
+  CaptureSettings(&settings);
+  Settings.update(&settings);
+  Settings.Manage();
+}
+
 void SetupEncoder()
 {
   delay(1);
@@ -199,85 +749,370 @@ void SetupEncoder()
 	encoder.clearCount();
   // Attach pins for use as encoder pins
 	encoder.attachSingleEdge(encoderPin1, encoderPin2);
+
+  if (FOCUSER_MOTOR_ENCODER_A >= 0 && FOCUSER_MOTOR_ENCODER_B >= 0)
+  {
+    MotorEncoder.attachFullQuad(FOCUSER_MOTOR_ENCODER_A, FOCUSER_MOTOR_ENCODER_B);
+    MotorEncoder.clearCount();
+  }
 }
 
-void setup()
+//-----------------------------------------------------------------------------
+// Tasks of the main loop
+
+void MotionTask()
 {
-  SerialProtocol.init(9600);
-  // Serial2.begin(115200, SERIAL_8N1, RXD2, TXD2);
-  // Serial2.println("Begin debugging");
+  Scheduler.Manage();
+}
 
-  //Display.begin();
-  //Display.setContrast(0);
-  //Display.setFont(u8g2_font_crox4hb_tr);
+void DriverTask()
+{
+  Driver.Manage();
+  Tuner.Manage();
+}
 
-  // Set the motor speed to a valid value for Moonlite
-  Motor.setSpeed(7000);
-  Motor.setStepMode(SC_32TH_STEP);
-  Motor.setMoveMode(SC_MOVEMODE_SMOOTH);
+void TemperatureTask()
+{
+  StepperControl *axis;
+  int i;
 
-  timestamp = millis();
-  //displayTimestamp = millis();
+#ifdef FOCUSER_DS18B20
+  // The 1-Wire bit slots are timed with the interrupts off, they would delay
+  // the steps: the transfers wait until the motors stop
+  Thermometer.setPaused(Scheduler.isInMove());
+#endif
+  Thermometer.Manage();
 
-  SetupEncoder();
+  // All the focusers share the same thermometer
+  for (i = 0; i < Scheduler.getAxisCount(); i++)
+  {
+    axis = Scheduler.getAxis(i);
+    if (Thermometer.hasTemperature())
+    {
+      axis->setCurrentTemperature(Thermometer.getTemperature());
+    }
+    if (!axis->isInMove() && axis->isTemperatureCompensationEnabled() && Thermometer.hasTemperature() &&
+        !(axis == &Motor && Sweep.isRunning()))
+    {
+      // The focus model limits the size and the rate of the corrections
+      axis->compensateTemperature();
+    }
+  }
+}
+
+void CommunicationTask()
+{
+  int device;
+  int i;
+
+  NetworkServer.Manage();
+  // A new TCP client starts with an empty buffer and no notifications
+  for (i = 0; i < MLS_MAX_CLIENTS; i++)
+  {
+    if (NetworkServer.getConnectionCount(i) != networkConnectionCounts[i])
+    {
+      networkConnectionCounts[i] = NetworkServer.getConnectionCount(i);
+      SerialProtocol.resetClient(firstNetworkTransport + i);
+      // The moves of the previous client can be overridden
+      for (device = 0; device < Scheduler.getAxisCount(); device++)
+      {
+        if (Arbiter.getOwner(device) == firstNetworkTransport + i)
+        {
+          Arbiter.release(device);
+        }
+      }
+    }
+  }
+  SerialProtocol.Manage();
+  UpdateSnapshot();
+
+  if (SerialProtocol.isNewCommandAvailable())
+  {
+    processCommand();
+  }
+}
+
+// Light sleep until the next event when nothing runs
+void ManageIdleSleep()
+{
+  StepperControl *axis;
+  unsigned long timeToDeadline; // ms
+  int i;
+
+  if (Scheduler.getLastStepTimestamp() != lastStepTimestamp)
+  {
+    lastStepTimestamp = Scheduler.getLastStepTimestamp();
+    PowerManager.notifyStep(lastStepTimestamp);
+    return;
+  }
+
+  for (i = 0; i < Scheduler.getAxisCount(); i++)
+  {
+    axis = Scheduler.getAxis(i);
+    if (axis->isInMove() || axis->isHoming())
+    {
+      return;
+    }
+  }
+  if (Tuner.isRunning() || Sweep.isRunning() || !Driver.isBusIdle() || Settings.isDirty() ||
+      Serial.available() > 0 || SerialProtocol.isNewCommandAvailable() || Log.getCount() > 0)
+  {
+    return;
+  }
+
+  // Wake up for the next conversion, telemetry sample or one-shot task
+  timeToDeadline = min(Thermometer.getTimeToNextConversion(), Tasks.getTimeToNextOneShotTask() / 1000);
+  for (i = 0; i < Scheduler.getAxisCount(); i++)
+  {
+    timeToDeadline = min(timeToDeadline, Scheduler.getAxis(i)->getTimeToNextTelemetry());
+  }
+  if (PowerManager.sleepUntil(timeToDeadline))
+  {
+    Log.write(DL_EVENT_SLEEP, (int32_t)PowerManager.getLastSleepTime());
+  }
 }
 
 void HandleHandController()
 {
-  long targetPosition = Motor.getTargetPosition();
+  // The knob moves the focuser relatively to its position, so the moves
+  // requested by the serial port or the temperature compensation are kept.
+  // The turns made during a move are applied once the move is done.
   long encoderPosition = encoder.getCount() / encoderMotorstepsRelation;
-  Motor.setTargetPosition(encoderPosition);  
-  if(targetPosition != encoderPosition)
+  if (encoderPosition != lastEncoderPosition && !Motor.isInMove() && !Motor.isQueueRunning() &&
+      !Sweep.isRunning())
   {
-    Motor.goToTargetPosition();
+    Motor.setTargetPosition(Motor.getCurrentPosition() + encoderPosition - lastEncoderPosition);
+    Motor.startUserMove();
+    lastEncoderPosition = encoderPosition;
   }
-  if (!Motor.isInMove())
+}
+
+void SweepTask()
+{
+  Sweep.Manage();
+}
+
+#ifdef FOCUSER_DEBUG_LOG
+// The log never delays a step: while a motor moves only a few records are
+// sent per run, when idle all that the UART buffer accepts
+void LogTask()
+{
+  int i;
+
+  for (i = 0; i < Scheduler.getAxisCount(); i++)
   {
-    Motor.goToTargetPosition();
+    if (Scheduler.getAxis(i)->isInMove())
+    {
+      Log.drain(&Serial2, logRecordsPerMovingRun);
+      return;
+    }
   }
-  while(Motor.isInMove())
+  Log.drain(&Serial2, DL_SIZE);
+}
+#endif
+
+#ifdef FOCUSER_DISPLAY
+// Only the fields which changed are drawn, and only a few tiles are sent
+// per run. The I2C transfers wait for the end of the moves, a tile takes
+// longer than the step interval at high speed.
+void DisplayTask()
+{
+  char text[DSP_MAX_TEXT + 1];
+
+  if (Thermometer.hasTemperature())
+  {
+    snprintf(text, sizeof(text), "T: %.1f C", Thermometer.getTemperature());
+  }
+  else
+  {
+    snprintf(text, sizeof(text), "T: --");
+  }
+  Display.setField(temperatureField, text);
+  snprintf(text, sizeof(text), "Pos: %ld", Motor.getCurrentPosition());
+  Display.setField(positionField, text);
+  if (!Scheduler.isInMove())
   {
-    Motor.Manage();
+    Display.Manage();
   }
 }
+#endif
 
-void loop()
+// Compare the position of the motor encoder to the position counter and
+// correct the counter when steps were lost
+void StepLossTask()
+{
+  long lostSteps;
+
+  // The homing drives into the end stop on purpose
+  if (Motor.isHoming())
+  {
+    LossDetector.reset();
+    return;
+  }
+  // The scale follows the step mode
+  LossDetector.setScale(motorFullStepsPerTurn * StepperControl::getMicrosteps(Motor.getStepMode()),
+                        FOCUSER_MOTOR_ENCODER_COUNTS);
+  if (LossDetector.update(Motor.getCurrentPosition(), (long)MotorEncoder.getCount()))
+  {
+    lostSteps = LossDetector.getError();
+    Motor.correctPosition(LossDetector.getMeasuredPosition());
+    SerialProtocol.notify(ML_NOTIFY_STEP_LOSS, 0, lostSteps);
+    Log.write(DL_EVENT_STEP_LOSS, lostSteps, LossDetector.getMeasuredPosition());
+  }
+}
+
+// Push the events to the clients which selected them
+void NotificationTask()
+{
+  StepperControl *axis;
+  bool isStalled;
+  int i;
+
+  for (i = 0; i < Scheduler.getAxisCount(); i++)
+  {
+    axis = Scheduler.getAxis(i);
+    if (!axisWasMoving[i] && axis->isInMove())
+    {
+      Log.write(DL_EVENT_MOVE_START, i, axis->getTargetPosition());
+    }
+    if (axisWasMoving[i] && !axis->isInMove())
+    {
+      SerialProtocol.notify(ML_NOTIFY_MOVE, i, axis->getCurrentPosition());
+      Log.write(DL_EVENT_MOVE_END, i, axis->getCurrentPosition());
+    }
+    axisWasMoving[i] = axis->isInMove();
+
+    isStalled = axis->getStallDetector()->isStalled();
+    if (isStalled && !axisWasStalled[i])
+    {
+      SerialProtocol.notify(ML_NOTIFY_STALL, i, axis->getCurrentPosition());
+      Log.write(DL_EVENT_STALL, i, axis->getCurrentPosition());
+    }
+    axisWasStalled[i] = isStalled;
+
+    // One notification per waypoint, even if several were passed in between
+    while (notifiedWaypointCount[i] != axis->getReachedWaypointCount())
+    {
+      notifiedWaypointCount[i]++;
+      SerialProtocol.notify(ML_NOTIFY_WAYPOINT, i, (long)notifiedWaypointCount[i]);
+      Log.write(DL_EVENT_WAYPOINT, i, (int32_t)notifiedWaypointCount[i]);
+    }
+  }
+
+  if (Thermometer.hasTemperature())
+  {
+    SerialProtocol.notifyTemperature((long)(Thermometer.getTemperature() * 2));
+  }
+}
+
+// The periods and the budgets are in us. The motion runs first on every
+// pass of the loop, the light sleep last. The task ids (for :XTS#) follow
+// the order of registration: motion is 0.
+void SetupTasks()
 {
-  if (!Motor.isInMove())
+  Tasks.addPeriodicTask("motion", MotionTask, 0, CS_PRIORITY_REALTIME, 50);
+  Tasks.addPeriodicTask("driver", DriverTask, 0, CS_PRIORITY_HIGH, 300);
+  Tasks.addPeriodicTask("communication", CommunicationTask, 0, CS_PRIORITY_NORMAL, 500);
+  Tasks.addPeriodicTask("notification", NotificationTask, 0, CS_PRIORITY_NORMAL, 200);
+  // The LM335 DMA buffer holds 25ms of samples
+  Tasks.addPeriodicTask("temperature", TemperatureTask, 1000, CS_PRIORITY_NORMAL, 300);
+  Tasks.addPeriodicTask("sweep", SweepTask, 1000, CS_PRIORITY_NORMAL, 100);
+  Tasks.addPeriodicTask("handController", HandleHandController, 10000, CS_PRIORITY_NORMAL, 100);
+  // An NVS write takes a few ms
+  Tasks.addPeriodicTask("settings", ManageSettings, 100000, CS_PRIORITY_LOW, 20000);
+  Tasks.addPeriodicTask("idleSleep", ManageIdleSleep, 0, CS_PRIORITY_LOW,
+                        (IS_DEFAULT_MAX_SLEEP_TIME + 10) * 1000UL);
+  // Optional tasks last, the ids of the others do not change
+  if (FOCUSER_MOTOR_ENCODER_A >= 0 && FOCUSER_MOTOR_ENCODER_B >= 0)
+  {
+    Tasks.addPeriodicTask("stepLoss", StepLossTask, 1000, CS_PRIORITY_NORMAL, 100);
+  }
+#ifdef FOCUSER_DISPLAY
+  // The drawing in the buffer comes on top of the tile budget
+  Tasks.addPeriodicTask("display", DisplayTask, 50000, CS_PRIORITY_LOW, DSP_DEFAULT_BUDGET + 500);
+#endif
+#ifdef FOCUSER_DEBUG_LOG
+  Tasks.addPeriodicTask("log", LogTask, 1000, CS_PRIORITY_LOW, 100);
+#endif
+}
+
+void setup()
+{
+  int i;
+
+  SerialProtocol.init(9600);
+  if (strlen(FOCUSER_WIFI_SSID) > 0)
   {
-    //TemperatureSensor.Manage();
-    if (Motor.isTemperatureCompensationEnabled() && ((millis() - timestamp) > 30000))
+    // The network client shares the parser with the serial port
+    NetworkServer.begin(FOCUSER_WIFI_SSID, FOCUSER_WIFI_PASSWORD);
+    for (i = 0; i < MLS_MAX_CLIENTS; i++)
     {
-     // Motor.setCurrentTemperature(TemperatureSensor.getTemperature());
-      Motor.setCurrentTemperature(20);
-      Motor.compensateTemperature();
-      timestamp = millis();
+      SerialProtocol.addTransport(NetworkServer.getClient(i));
     }
   }
+#ifdef FOCUSER_DEBUG_LOG
+  Serial2.begin(115200, SERIAL_8N1, RXD2, TXD2);
+  Log.setEnabled(true);
+  Log.write(DL_EVENT_BOOT);
+#endif
 
+#ifdef FOCUSER_DISPLAY
+  Display.begin(u8g2_font_crox4hb_tr, 0);
+  temperatureField = Display.addField(0, 0, 128, 24);
+  positionField = Display.addField(0, 40, 128, 24);
+#endif
 
-  HandleHandController();
+  Scheduler.addAxis(&Motor);
+  for (i = 0; i < MS_MAX_AXES; i++)
+  {
+    activeProfile[i] = PR_DEFAULT_PROFILE;
+    axisWasMoving[i] = false;
+    axisWasStalled[i] = false;
+    notifiedWaypointCount[i] = 0;
+  }
+#ifdef FOCUSER_AUX_AXIS
+  Scheduler.addAxis(&AuxMotor);
+  Profiles.apply(PR_DEFAULT_PROFILE, &AuxMotor);
+  AuxMotor.setMoveMode(SC_MOVEMODE_SMOOTH);
+#endif
 
-  Motor.Manage();
-  SerialProtocol.Manage();
+  // Without answer of the driver the mode pins are used
+  if (Driver.init(TMC2209_DEFAULT_BAUDRATE, driverUartRxPin, driverUartTxPin))
+  {
+    Driver.setStealthChopMaxSpeed(driverStealthChopMaxSpeed);
+    Motor.setDriver(&Driver);
+  }
 
-  if (SerialProtocol.isNewCommandAvailable())
+  // Set the motor speed to a valid value for Moonlite
+  Motor.setStepMode(SC_32TH_STEP);
+  Profiles.apply(PR_DEFAULT_PROFILE, &Motor);
+  Motor.setMoveMode(SC_MOVEMODE_SMOOTH);
+  // The long moves slew in 8th steps, the approach stays in 32th steps
+  Motor.setSlewStepMode(SC_8TH_STEP);
+
+  // Warm start from the last saved state
+  if (Settings.load())
   {
-    processCommand();
+    RestoreSettings(Settings.getSettings());
   }
 
+#ifndef FOCUSER_DS18B20
+  Thermometer.setDivider(FOCUSER_LM335_DIVIDER_TOP, FOCUSER_LM335_DIVIDER_BOTTOM);
+#endif
+  Thermometer.init();
+  Thermometer.setConversionInterval(temperatureConversionInterval);
+
+  SetupEncoder();
+  SetupTasks();
+  Sweep.setTriggerPin(FOCUSER_TRIGGER_PIN);
 
+  // Wake up on the serial port, the hand controller and the deadlines
+  PowerManager.addWakePin(encoderPin1);
+  PowerManager.addWakePin(encoderPin2);
+  PowerManager.setEnabled(FOCUSER_LIGHT_SLEEP && strlen(FOCUSER_WIFI_SSID) == 0);
+}
 
-//  if ((millis() - displayTimestamp) >= 1000 && !Motor.isInMove())
-//  {
-//    Display.firstPage();
-//    temp = TemperatureSensor.getTemperature();
-//    pos = Motor.getCurrentPosition();
-//    do
-//    {
-//      Display.drawStr(0, 16, ((String("T: ") + String(temp, 1) + " C").c_str()));
-//      Display.drawStr(0, 55, (String("Pos: ") + pos).c_str());
-//    } while (Display.nextPage());
-//    displayTimestamp = millis();
-//  }
+void loop()
+{
+  Tasks.Manage();
 }
@@ -0,0 +1,274 @@
+/*
+Arduino.h - Host replacement of the Arduino core for the native unit tests
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+Only what the host buildable libraries use. The clock is virtual: it only
+moves with delay(), delayMicroseconds() or mock::advanceMicros(), so the
+tests are deterministic and a simulated minute takes no time.
+
+ */
+
+#ifndef MockArduino_h
+#define MockArduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+using std::max;
+using std::min;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define SERIAL_8N1 0x800001c
+#define IRAM_ATTR
+#define BIT(n) (1UL << (n))
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+typedef uint8_t byte;
+
+#define MOCK_PIN_COUNT 64
+
+namespace mock
+{
+  inline unsigned long clockMicros = 0;
+  inline uint8_t pinLevel[MOCK_PIN_COUNT];
+  inline uint8_t pinMode[MOCK_PIN_COUNT];
+  inline unsigned long pinRisingEdges[MOCK_PIN_COUNT];
+  // Called on each digitalWrite(), e.g. by a device model watching a pin
+  inline void (*pinListener)(uint8_t pin, uint8_t value, void *context) = NULL;
+  inline void *pinListenerContext = NULL;
+
+  inline void advanceMicros(unsigned long us)
+  {
+    clockMicros += us;
+  }
+
+  // Back to power on: clock at 0 and all the pins low
+  inline void reset()
+  {
+    clockMicros = 0;
+    memset(pinLevel, 0, sizeof(pinLevel));
+    memset(pinMode, 0, sizeof(pinMode));
+    memset(pinRisingEdges, 0, sizeof(pinRisingEdges));
+    pinListener = NULL;
+    pinListenerContext = NULL;
+  }
+}
+
+inline unsigned long micros()
+{
+  return mock::clockMicros;
+}
+
+inline unsigned long millis()
+{
+  return mock::clockMicros / 1000;
+}
+
+inline void delay(unsigned long ms)
+{
+  mock::clockMicros += ms * 1000;
+}
+
+inline void delayMicroseconds(unsigned int us)
+{
+  mock::clockMicros += us;
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode)
+{
+  mock::pinMode[pin % MOCK_PIN_COUNT] = mode;
+}
+
+// Rising edges are counted: a step pin gives the number of steps
+inline void digitalWrite(uint8_t pin, uint8_t value)
+{
+  pin %= MOCK_PIN_COUNT;
+  if (value && !mock::pinLevel[pin])
+  {
+    mock::pinRisingEdges[pin]++;
+  }
+  mock::pinLevel[pin] = value ? HIGH : LOW;
+  if (mock::pinListener != NULL)
+  {
+    mock::pinListener(pin, mock::pinLevel[pin], mock::pinListenerContext);
+  }
+}
+
+inline int digitalRead(uint8_t pin)
+{
+  return mock::pinLevel[pin % MOCK_PIN_COUNT];
+}
+
+inline void attachInterrupt(uint8_t pin, void (*handler)(void), int mode)
+{
+}
+
+inline void yield()
+{
+}
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t value) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+      this->write(buffer[i]);
+    }
+    return size;
+  }
+  size_t write(const char *text)
+  {
+    return this->write((const uint8_t *)text, strlen(text));
+  }
+  size_t print(const char *text)
+  {
+    return this->write(text);
+  }
+  size_t println(const char *text)
+  {
+    return this->write(text) + this->write("\r\n");
+  }
+  virtual int availableForWrite()
+  {
+    return 0;
+  }
+  virtual void flush()
+  {
+  }
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  void setTimeout(unsigned long timeout)
+  {
+  }
+};
+
+// Serial port with a receive queue filled by the test and a record of the
+// transmitted bytes. A device model can answer each transmitted byte and
+// deliver its answers later (poll, called by available()).
+class HardwareSerial : public Stream
+{
+public:
+  HardwareSerial(int uart)
+  {
+    this->baudRate = 0;
+    this->txSpace = 128;
+    this->device = NULL;
+    this->poll = NULL;
+    this->deviceContext = NULL;
+  }
+  // Back to an unconnected port
+  void reset()
+  {
+    this->rx.clear();
+    this->tx.clear();
+    this->txSpace = 128;
+    this->device = NULL;
+    this->poll = NULL;
+    this->deviceContext = NULL;
+  }
+  void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1)
+  {
+    this->baudRate = baud;
+  }
+  void end()
+  {
+  }
+  using Print::write;
+  size_t write(uint8_t value) override
+  {
+    this->tx.push_back(value);
+    if (this->device != NULL)
+    {
+      this->device(this, value, this->deviceContext);
+    }
+    return 1;
+  }
+  int available() override
+  {
+    if (this->poll != NULL)
+    {
+      this->poll(this, this->deviceContext);
+    }
+    return (int)this->rx.size();
+  }
+  int read() override
+  {
+    int value;
+
+    if (this->rx.empty())
+    {
+      return -1;
+    }
+    value = this->rx.front();
+    this->rx.pop_front();
+    return value;
+  }
+  int peek() override
+  {
+    return this->rx.empty() ? -1 : this->rx.front();
+  }
+  int availableForWrite() override
+  {
+    return this->txSpace;
+  }
+  void inject(const char *text)
+  {
+    while (*text)
+    {
+      this->rx.push_back((uint8_t)*text++);
+    }
+  }
+  unsigned long baudRate;
+  int txSpace;
+  std::deque<uint8_t> rx;
+  std::vector<uint8_t> tx;
+  void (*device)(HardwareSerial *port, uint8_t value, void *context);
+  void (*poll)(HardwareSerial *port, void *context);
+  void *deviceContext;
+};
+
+inline HardwareSerial Serial(0);
+inline HardwareSerial Serial1(1);
+inline HardwareSerial Serial2(2);
+
+#endif
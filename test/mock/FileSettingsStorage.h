@@ -0,0 +1,93 @@
+/*
+FileSettingsStorage.h - Host storage of the focuser settings in a file
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+The blob is kept in a file like the NVS keeps it in the flash, so a test
+can reload it with a new store (a reboot) or damage it. Each write is
+counted and can be made to fail.
+
+ */
+
+#ifndef FileSettingsStorage_h
+#define FileSettingsStorage_h
+
+#include <stdio.h>
+#include "SettingsStorage.h"
+
+class FileSettingsStorage : public SettingsStorage
+{
+ public:
+  FileSettingsStorage(const char *path)
+  {
+    this->path = path;
+    this->writeCount = 0;
+    this->writeFails = false;
+  }
+  bool begin()
+  {
+    return true;
+  }
+  bool read(void *data, size_t size)
+  {
+    FILE *file = fopen(this->path, "rb");
+    size_t length;
+
+    if (file == NULL)
+    {
+      return false;
+    }
+    length = fread(data, 1, size, file);
+    // A blob of exactly this size, like nvs_get_blob()
+    bool isComplete = length == size && fgetc(file) == EOF;
+    fclose(file);
+    return isComplete;
+  }
+  bool write(const void *data, size_t size)
+  {
+    FILE *file;
+
+    this->writeCount++;
+    if (this->writeFails || (file = fopen(this->path, "wb")) == NULL)
+    {
+      return false;
+    }
+    fwrite(data, 1, size, file);
+    fclose(file);
+    return true;
+  }
+  // Flip one bit of the stored blob
+  void corrupt(long offset)
+  {
+    FILE *file = fopen(this->path, "r+b");
+    int value;
+
+    fseek(file, offset, SEEK_SET);
+    value = fgetc(file);
+    fseek(file, offset, SEEK_SET);
+    fputc(value ^ 0x01, file);
+    fclose(file);
+  }
+  void erase()
+  {
+    remove(this->path);
+  }
+  const char *path;
+  int writeCount; // Attempts, failed ones included
+  bool writeFails;
+};
+
+#endif
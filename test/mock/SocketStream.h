@@ -0,0 +1,173 @@
+/*
+SocketStream.h - Host stand-in of a WiFiClient on a POSIX socket
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+The socket is non-blocking like the lwIP one of the ESP32: available()
+and read() never wait. openLoopback() connects a client socket to a
+listening one on 127.0.0.1, so a test talks TCP to the parser.
+
+ */
+
+#ifndef SocketStream_h
+#define SocketStream_h
+
+#include <Arduino.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class SocketStream : public Stream
+{
+ public:
+  SocketStream()
+  {
+    this->socket = -1;
+    this->peeked = -1;
+  }
+  ~SocketStream()
+  {
+    this->stop();
+  }
+  // A new connection in the slot, like WiFiClient::operator=
+  void attach(int socket)
+  {
+    int noDelay = 1;
+
+    this->stop();
+    this->socket = socket;
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+  }
+  void stop()
+  {
+    if (this->socket >= 0)
+    {
+      close(this->socket);
+    }
+    this->socket = -1;
+    this->peeked = -1;
+  }
+  bool connected()
+  {
+    char probe;
+
+    if (this->socket < 0)
+    {
+      return false;
+    }
+    // 0 from recv() is the close of the peer
+    if (this->peeked < 0 && recv(this->socket, &probe, 1, MSG_PEEK) == 0)
+    {
+      this->stop();
+      return false;
+    }
+    return true;
+  }
+  int available() override
+  {
+    int count = 0;
+
+    if (this->socket < 0 || ioctl(this->socket, FIONREAD, &count) < 0)
+    {
+      return 0;
+    }
+    return count + (this->peeked >= 0 ? 1 : 0);
+  }
+  int read() override
+  {
+    uint8_t value;
+    int result;
+
+    if (this->peeked >= 0)
+    {
+      result = this->peeked;
+      this->peeked = -1;
+      return result;
+    }
+    if (this->socket < 0 || recv(this->socket, &value, 1, 0) != 1)
+    {
+      return -1;
+    }
+    return value;
+  }
+  int peek() override
+  {
+    if (this->peeked < 0)
+    {
+      this->peeked = this->read();
+    }
+    return this->peeked;
+  }
+  using Print::write;
+  size_t write(uint8_t value) override
+  {
+    return this->write(&value, 1);
+  }
+  // Each call is one send(), one TCP segment with TCP_NODELAY
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    ssize_t sent;
+
+    if (this->socket < 0)
+    {
+      return 0;
+    }
+    sent = send(this->socket, buffer, size, MSG_NOSIGNAL);
+    this->writeCallCount++;
+    return sent > 0 ? (size_t)sent : 0;
+  }
+
+  int socket;
+  int peeked;
+  unsigned long writeCallCount = 0;
+};
+
+// Connected pair on 127.0.0.1: the server side for the parser, the client
+// side for the test. Return false if the loopback is not available.
+inline bool openLoopback(int *serverSide, int *clientSide)
+{
+  struct sockaddr_in address;
+  socklen_t length = sizeof(address);
+  int listener;
+
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(listener, 1) != 0 || getsockname(listener, (struct sockaddr *)&address, &length) != 0)
+  {
+    return false;
+  }
+  *clientSide = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(*clientSide, (struct sockaddr *)&address, sizeof(address)) != 0)
+  {
+    close(listener);
+    return false;
+  }
+  *serverSide = accept(listener, NULL, NULL);
+  close(listener);
+  return *serverSide >= 0;
+}
+
+#endif
@@ -0,0 +1,272 @@
+/*
+Tmc2209Model.h - Host model of a TMC2209 on its single wire UART
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+Every byte sent is echoed, as on the real single wire. With isTimed the
+echo and the answers are only received once on the wire (Serial available()
+polls the model), otherwise right away (e.g. for the blocking read of
+TMC2209::init(), the virtual clock does not move while it waits). The
+datagrams are
+checked like the chip does (sync, address, CRC): a valid write updates the
+register and IFCNT, a valid read request is answered. A write is only in
+force once its last byte is on the wire, so the steps received during its
+transmission still use the previous resolution. The position is counted in
+1/256 microsteps from the step and direction pins.
+
+ */
+
+#ifndef Tmc2209Model_h
+#define Tmc2209Model_h
+
+#include <Arduino.h>
+#include "TMC2209.h"
+
+class Tmc2209Model
+{
+ public:
+  Tmc2209Model(HardwareSerial *port, uint8_t address, int stepPin, int directionPin)
+  {
+    this->port = port;
+    this->address = address;
+    this->stepPin = stepPin;
+    this->directionPin = directionPin;
+    this->byteTime = 1000000UL * TMC2209_BITS_PER_BYTE / TMC2209_DEFAULT_BAUDRATE;
+    this->wireEndTimestamp = 0;
+    memset(this->registers, 0, sizeof(this->registers));
+    this->registers[TMC2209_REG_CHOPCONF] = TMC2209_DEFAULT_CHOPCONF;
+    this->ifcnt = 0;
+    this->position = 0;
+    this->crcErrorCount = 0;
+    this->dropNextWrite = false;
+    this->corruptNextAnswer = false;
+    this->lostEchoCount = 0;
+    this->isConnected = true;
+    this->isTimed = false;
+    port->device = Tmc2209Model::onByte;
+    port->poll = Tmc2209Model::onPoll;
+    port->deviceContext = this;
+    mock::pinListener = Tmc2209Model::onPin;
+    mock::pinListenerContext = this;
+  }
+
+  unsigned int getMicrosteps()
+  {
+    this->applyLandedWrites(micros());
+    return 256 >> ((this->registers[TMC2209_REG_CHOPCONF] & TMC2209_CHOPCONF_MRES_MASK) >> TMC2209_CHOPCONF_MRES_SHIFT);
+  }
+
+  uint32_t getRegister(uint8_t reg)
+  {
+    this->applyLandedWrites(this->wireEndTimestamp);
+    return this->registers[reg & 0x7F];
+  }
+
+  uint32_t registers[128];
+  uint8_t ifcnt;
+  long position;                 // 1/256 microsteps
+  unsigned long crcErrorCount;
+  bool dropNextWrite;            // Lose the next write datagram on the wire
+  bool corruptNextAnswer;        // Flip a data bit of the next read answer
+  int lostEchoCount;             // Echo of the next bytes lost (the chip gets them)
+  bool isConnected;              // false: no echo and no answer
+  bool isTimed;                  // Received bytes delayed to their wire time
+  std::vector<unsigned long> resolutionSwitchTimestamps;
+
+ private:
+  struct Write
+  {
+    unsigned long timestamp; // micros() when in force
+    uint8_t reg;
+    uint32_t value;
+  };
+
+  HardwareSerial *port;
+  uint8_t address;
+  int stepPin;
+  int directionPin;
+  unsigned long byteTime;
+  unsigned long wireEndTimestamp;
+  std::vector<uint8_t> datagram;
+  std::deque<Write> writes;
+  std::deque<std::pair<unsigned long, uint8_t> > timedRx;
+
+  static void onByte(HardwareSerial *port, uint8_t value, void *context)
+  {
+    ((Tmc2209Model *)context)->receive(value);
+  }
+
+  static void onPoll(HardwareSerial *port, void *context)
+  {
+    Tmc2209Model *model = (Tmc2209Model *)context;
+
+    while (!model->timedRx.empty() && (long)(micros() - model->timedRx.front().first) >= 0)
+    {
+      port->rx.push_back(model->timedRx.front().second);
+      model->timedRx.pop_front();
+    }
+  }
+
+  // Byte on the wire from the end of the last one
+  void send(uint8_t value)
+  {
+    unsigned long now = micros();
+
+    if ((long)(this->wireEndTimestamp - now) < 0)
+    {
+      this->wireEndTimestamp = now;
+    }
+    this->wireEndTimestamp += this->byteTime;
+    if (this->isTimed)
+    {
+      this->timedRx.push_back(std::make_pair(this->wireEndTimestamp, value));
+    }
+    else
+    {
+      this->port->rx.push_back(value);
+    }
+  }
+
+  static void onPin(uint8_t pin, uint8_t value, void *context)
+  {
+    Tmc2209Model *model = (Tmc2209Model *)context;
+
+    if (pin == model->stepPin && value == HIGH)
+    {
+      model->applyLandedWrites(micros());
+      model->position += (digitalRead(model->directionPin) == LOW ? 1 : -1) *
+                         (long)(256 / model->getMicrostepsInForce());
+    }
+  }
+
+  unsigned int getMicrostepsInForce()
+  {
+    return 256 >> ((this->registers[TMC2209_REG_CHOPCONF] & TMC2209_CHOPCONF_MRES_MASK) >> TMC2209_CHOPCONF_MRES_SHIFT);
+  }
+
+  void applyLandedWrites(unsigned long now)
+  {
+    while (!this->writes.empty() && (long)(now - this->writes.front().timestamp) >= 0)
+    {
+      Write *write = &this->writes.front();
+      if (write->reg == TMC2209_REG_CHOPCONF &&
+          ((write->value ^ this->registers[write->reg]) & TMC2209_CHOPCONF_MRES_MASK) != 0)
+      {
+        this->resolutionSwitchTimestamps.push_back(write->timestamp);
+      }
+      this->registers[write->reg] = write->value;
+      this->writes.pop_front();
+    }
+  }
+
+  void receive(uint8_t value)
+  {
+    size_t size;
+
+    if (!this->isConnected)
+    {
+      return;
+    }
+    // The echo
+    if (this->lostEchoCount > 0)
+    {
+      this->lostEchoCount--;
+    }
+    else
+    {
+      this->send(value);
+    }
+
+    if (this->datagram.empty() && (value & 0x0F) != TMC2209_SYNC)
+    {
+      return;
+    }
+    this->datagram.push_back(value);
+    if (this->datagram.size() < 3)
+    {
+      return;
+    }
+    size = (this->datagram[2] & TMC2209_WRITE_BIT) ? TMC2209_WRITE_DATAGRAM_SIZE : TMC2209_READ_REQUEST_SIZE;
+    if (this->datagram.size() < size)
+    {
+      return;
+    }
+    if (TMC2209::computeCrc(this->datagram.data(), size - 1) != this->datagram[size - 1])
+    {
+      this->crcErrorCount++;
+    }
+    else if (this->datagram[1] == this->address)
+    {
+      if (size == TMC2209_WRITE_DATAGRAM_SIZE)
+      {
+        this->write();
+      }
+      else
+      {
+        this->answer(this->datagram[2] & 0x7F);
+      }
+    }
+    this->datagram.clear();
+  }
+
+  void write()
+  {
+    Write write;
+
+    if (this->dropNextWrite)
+    {
+      this->dropNextWrite = false;
+      return;
+    }
+    write.timestamp = this->wireEndTimestamp;
+    write.reg = this->datagram[2] & 0x7F;
+    write.value = ((uint32_t)this->datagram[3] << 24) | ((uint32_t)this->datagram[4] << 16) |
+                  ((uint32_t)this->datagram[5] << 8) | this->datagram[6];
+    this->writes.push_back(write);
+    this->ifcnt++;
+  }
+
+  void answer(uint8_t reg)
+  {
+    uint8_t reply[TMC2209_READ_REPLY_SIZE];
+    uint32_t value;
+    int i;
+
+    this->applyLandedWrites(this->wireEndTimestamp);
+    value = reg == TMC2209_REG_IFCNT ? this->ifcnt : this->registers[reg];
+    reply[0] = TMC2209_SYNC;
+    reply[1] = TMC2209_MASTER_ADDRESS;
+    reply[2] = reg;
+    reply[3] = (value >> 24) & 0xFF;
+    reply[4] = (value >> 16) & 0xFF;
+    reply[5] = (value >> 8) & 0xFF;
+    reply[6] = value & 0xFF;
+    reply[7] = TMC2209::computeCrc(reply, TMC2209_READ_REPLY_SIZE - 1);
+    if (this->corruptNextAnswer)
+    {
+      this->corruptNextAnswer = false;
+      reply[6] ^= 0x01;
+    }
+    // The chip answers after 8 bit times (SENDDELAY)
+    this->wireEndTimestamp += this->byteTime * 8 / TMC2209_BITS_PER_BYTE;
+    for (i = 0; i < TMC2209_READ_REPLY_SIZE; i++)
+    {
+      this->send(reply[i]);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,184 @@
+/*
+test_main.cpp - - Auto-tuning inside the travel range, stall and units
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include "AutoTuner.h"
+#include "StepperControl.h"
+#include "TMC2209.h"
+#include "Tmc2209Model.h"
+
+#define STEP_PIN 2
+#define DIRECTION_PIN 3
+#define MICROSTEPS 16
+#define LOOP_PERIOD 10 // us between two calls of Manage()
+#define TUNING_TIMEOUT 600000000UL // us
+
+static TMC2209 *driver;
+static Tmc2209Model *model;
+static StepperControl *motor;
+static unsigned long stallSpeed; // full steps per second, SG_RESULT 0 above
+static long lowestPosition;      // Physical positions reached, in positions
+static long highestPosition;
+
+// The load rises with the speed: SG_RESULT 400 at rest, 100 (the lowest
+// accepted) at 600 full steps per second
+static uint16_t loadCurve(unsigned int speed)
+{
+  unsigned long fullSteps = speed / MICROSTEPS;
+
+  if (stallSpeed != 0 && fullSteps > stallSpeed)
+  {
+    return 0;
+  }
+  return fullSteps >= 800 ? 0 : 400 - fullSteps / 2;
+}
+
+static void runTuning(AutoTuner *tuner)
+{
+  unsigned long start = micros();
+
+  lowestPosition = motor->getCurrentPosition();
+  highestPosition = motor->getCurrentPosition();
+  TEST_ASSERT_TRUE(tuner->start());
+  while (tuner->isRunning() && (micros() - start) < TUNING_TIMEOUT)
+  {
+    model->registers[TMC2209_REG_SG_RESULT] = loadCurve(motor->getSpeed());
+    driver->Manage();
+    motor->Manage();
+    tuner->Manage();
+    lowestPosition = min(lowestPosition, model->position / (256 / MICROSTEPS));
+    highestPosition = max(highestPosition, model->position / (256 / MICROSTEPS));
+    mock::advanceMicros(LOOP_PERIOD);
+  }
+  TEST_ASSERT_FALSE(tuner->isRunning());
+  TEST_ASSERT_FALSE(motor->isInMove());
+}
+
+void setUp(void)
+{
+  mock::reset();
+  Serial1.reset();
+  stallSpeed = 0;
+  motor = new StepperControl(STEP_PIN, DIRECTION_PIN, SC_NO_PIN, SC_NO_PIN, SC_NO_PIN,
+                             SC_NO_PIN, SC_NO_PIN, SC_NO_PIN);
+  driver = new TMC2209(&Serial1, 0);
+  model = new Tmc2209Model(&Serial1, 0, STEP_PIN, DIRECTION_PIN);
+  TEST_ASSERT_TRUE(driver->init(TMC2209_DEFAULT_BAUDRATE, 16, 17));
+  mock::advanceMicros(driver->getTransmitEndTimestamp() - micros());
+  model->isTimed = true;
+  motor->setDriver(driver);
+  motor->setStepMode(SC_16TH_STEP);
+  motor->setSpeed(2000);
+}
+
+void tearDown(void)
+{
+  delete motor;
+  delete driver;
+  delete model;
+}
+
+// Close to the outer end the test moves go inward, the travel is never left
+void test_moves_stay_in_travel(void)
+{
+  AutoTuner tuner(motor);
+
+  tuner.setTravelRange(0, 20000);
+  motor->setCurrentPosition(15000);
+  model->position = 15000 * (256 / MICROSTEPS);
+  runTuning(&tuner);
+
+  TEST_ASSERT_EQUAL(AT_DONE, tuner.getState());
+  TEST_ASSERT_GREATER_OR_EQUAL(0, lowestPosition);
+  TEST_ASSERT_LESS_OR_EQUAL(20000, highestPosition);
+  TEST_ASSERT_LESS_THAN(15000, lowestPosition);
+  TEST_ASSERT_EQUAL(15000, motor->getCurrentPosition());
+  // 596 full steps per second passed, 745 failed
+  TEST_ASSERT_EQUAL((unsigned long)(596 * AT_SAFETY_FACTOR), tuner.getSpeedLimit());
+}
+
+// A short travel ends the tuning at the last level with enough cruise
+void test_short_travel_ends_tuning(void)
+{
+  AutoTuner tuner(motor);
+
+  tuner.setTravelRange(0, 6000);
+  motor->setCurrentPosition(3000);
+  model->position = 3000 * (256 / MICROSTEPS);
+  runTuning(&tuner);
+
+  TEST_ASSERT_EQUAL(AT_DONE, tuner.getState());
+  TEST_ASSERT_GREATER_OR_EQUAL(0, lowestPosition);
+  TEST_ASSERT_LESS_OR_EQUAL(6000, highestPosition);
+  // 305 full steps per second fit, the ramps and cruise of 381 do not
+  TEST_ASSERT_EQUAL((unsigned long)(305 * AT_SAFETY_FACTOR), tuner.getSpeedLimit());
+  TEST_ASSERT_TRUE(motor->isPositionValid());
+}
+
+// A stall keeps the previous level and marks the position as lost
+void test_stall_invalidates_position(void)
+{
+  AutoTuner tuner(motor);
+
+  stallSpeed = 400;
+  runTuning(&tuner);
+
+  TEST_ASSERT_EQUAL(AT_DONE, tuner.getState());
+  TEST_ASSERT_EQUAL((unsigned long)(381 * AT_SAFETY_FACTOR), tuner.getSpeedLimit());
+  TEST_ASSERT_FALSE(motor->isPositionValid());
+  TEST_ASSERT_EQUAL(SC_HOMING_LOST, motor->getHomingState());
+
+  // SP (or a homing) gives a valid position again
+  motor->setCurrentPosition(0);
+  TEST_ASSERT_TRUE(motor->isPositionValid());
+  TEST_ASSERT_EQUAL(SC_HOMING_IDLE, motor->getHomingState());
+}
+
+// Both limits are in full steps: they hold at another step mode
+void test_limits_in_full_steps(void)
+{
+  AutoTuner tuner(motor);
+  unsigned long accelerationLimit;
+
+  runTuning(&tuner);
+  TEST_ASSERT_EQUAL(AT_DONE, tuner.getState());
+  accelerationLimit = tuner.getAcceleration();
+  // 596 / AT_RAMP_INCREMENTS, reduced by the safety factor
+  TEST_ASSERT_EQUAL((unsigned long)(596 / AT_RAMP_INCREMENTS * AT_SAFETY_FACTOR), accelerationLimit);
+  TEST_ASSERT_EQUAL(accelerationLimit, motor->getAccelerationLimit());
+  TEST_ASSERT_EQUAL(accelerationLimit * MICROSTEPS, motor->getAcceleration());
+
+  motor->setStepMode(SC_32TH_STEP);
+  motor->setAcceleration(100000);
+  motor->setSpeed(100000);
+  TEST_ASSERT_EQUAL(accelerationLimit * 32, motor->getAcceleration());
+  TEST_ASSERT_EQUAL(tuner.getSpeedLimit() * 32, motor->getTargetSpeed());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_moves_stay_in_travel);
+  RUN_TEST(test_short_travel_ends_tuning);
+  RUN_TEST(test_stall_invalidates_position);
+  RUN_TEST(test_limits_in_full_steps);
+  return UNITY_END();
+}
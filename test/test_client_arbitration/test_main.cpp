@@ -0,0 +1,290 @@
+/*
+test_main.cpp - - Motion ownership with several concurrent Moonlite clients
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include <string>
+#include "Moonlite.h"
+#include "MoonliteArbiter.h"
+
+#define CLIENT_COUNT ML_MAX_TRANSPORTS
+#define DEVICE_COUNT 2
+
+static HardwareSerial Serial3(3);
+static HardwareSerial *const Ports[CLIENT_COUNT] = {&Serial, &Serial1, &Serial2, &Serial3};
+
+// Focuser reduced to a position walking one step per tick to its target
+typedef struct
+{
+  long position;
+  long target;
+  bool inMove;
+  int speedCode;
+} FakeAxis_t;
+
+static Moonlite *parser;
+static MoonliteArbiter *arbiter;
+static FakeAxis_t axes[DEVICE_COUNT];
+static int processedCount[CLIENT_COUNT];
+
+// processCommand() of the firmware for a few commands
+static void process(MoonliteCommand_t *command)
+{
+  FakeAxis_t *axis = &axes[command->device];
+
+  if (!arbiter->accept(command, axis->inMove))
+  {
+    return;
+  }
+  processedCount[command->client]++;
+  switch (command->commandID)
+  {
+    case ML_GP:
+      parser->setAnswer(4, axis->position);
+      break;
+    case ML_GI:
+      parser->setAnswer(2, (long)(axis->inMove ? 0x01 : 0x00));
+      break;
+    case ML_SN:
+      axis->target = command->parameter;
+      break;
+    case ML_SP:
+      axis->position = command->parameter;
+      break;
+    case ML_SD:
+      axis->speedCode = command->parameter;
+      break;
+    case ML_FG:
+      axis->inMove = axis->position != axis->target;
+      break;
+    case ML_FQ:
+      axis->inMove = false;
+      axis->target = axis->position;
+      break;
+    case ML_XQC:
+      axis->target = axis->position;
+      break;
+    default:
+      break;
+  }
+}
+
+// One run of the communication and motion tasks
+static void tick()
+{
+  int i;
+
+  parser->Manage();
+  if (parser->isNewCommandAvailable())
+  {
+    MoonliteCommand_t command = parser->getCommand();
+    if (command.device < DEVICE_COUNT)
+    {
+      process(&command);
+    }
+  }
+  for (i = 0; i < DEVICE_COUNT; i++)
+  {
+    if (axes[i].inMove)
+    {
+      axes[i].position += axes[i].target > axes[i].position ? 1 : -1;
+      axes[i].inMove = axes[i].position != axes[i].target;
+    }
+  }
+}
+
+static void run(int ticks)
+{
+  int i;
+
+  for (i = 0; i < ticks; i++)
+  {
+    tick();
+  }
+}
+
+static std::string answer(int client)
+{
+  std::string text(Ports[client]->tx.begin(), Ports[client]->tx.end());
+
+  Ports[client]->tx.clear();
+  return text;
+}
+
+void setUp(void)
+{
+  int i;
+
+  mock::reset();
+  parser = new Moonlite();
+  arbiter = new MoonliteArbiter();
+  parser->init(9600);
+  for (i = 0; i < CLIENT_COUNT; i++)
+  {
+    Ports[i]->reset();
+    if (i > 0)
+    {
+      TEST_ASSERT_TRUE(parser->addTransport(Ports[i]));
+    }
+    processedCount[i] = 0;
+  }
+  memset(axes, 0, sizeof(axes));
+}
+
+void tearDown(void)
+{
+  delete parser;
+  delete arbiter;
+}
+
+// While client 0 moves the focuser the others can read it and stop it,
+// but not change its target, position or speed
+void test_owner_keeps_the_move(void)
+{
+  Serial.inject(":SN0100#:FG#");
+  run(4);
+  TEST_ASSERT_TRUE(axes[0].inMove);
+  TEST_ASSERT_EQUAL(0, arbiter->getOwner(0));
+
+  Serial1.inject(":SN0000#:FG#:SP0500#:SD02#:XQC#");
+  Serial2.inject(":GP#:GI#");
+  run(10);
+  TEST_ASSERT_EQUAL(0x100, axes[0].target);
+  TEST_ASSERT_EQUAL(0, axes[0].speedCode);
+  TEST_ASSERT_TRUE(axes[0].position < 0x100);
+  TEST_ASSERT_EQUAL(0, processedCount[1]);
+  TEST_ASSERT_EQUAL(2, processedCount[2]);
+  TEST_ASSERT_EQUAL(8, answer(2).size()); // GP and GI
+
+  // The owner can change its own move
+  Serial.inject(":SN0080#:FG#");
+  run(200);
+  TEST_ASSERT_FALSE(axes[0].inMove);
+  TEST_ASSERT_EQUAL(0x80, axes[0].position);
+
+  // The move is over: anyone can move
+  Serial1.inject(":SN0010#:FG#");
+  run(4);
+  TEST_ASSERT_EQUAL(1, arbiter->getOwner(0));
+}
+
+// FQ is accepted from every client and ends the ownership
+void test_stop_from_any_client(void)
+{
+  Serial.inject(":SN0100#:FG#");
+  run(4);
+  Serial3.inject(":FQ#");
+  run(2);
+  TEST_ASSERT_FALSE(axes[0].inMove);
+
+  Serial3.inject(":SN0020#:FG#");
+  run(4);
+  TEST_ASSERT_TRUE(axes[0].inMove);
+  TEST_ASSERT_EQUAL(3, arbiter->getOwner(0));
+}
+
+// Each focuser has its own owner
+void test_owner_per_device(void)
+{
+  Serial.inject(":SN0100#:FG#");
+  Serial1.inject(":2SN0200#:2FG#");
+  run(8);
+  TEST_ASSERT_EQUAL(0, arbiter->getOwner(0));
+  TEST_ASSERT_EQUAL(1, arbiter->getOwner(1));
+
+  Serial.inject(":2SN0000#");
+  Serial1.inject(":SN0000#");
+  run(8);
+  TEST_ASSERT_EQUAL(0x100, axes[0].target);
+  TEST_ASSERT_EQUAL(0x200, axes[1].target);
+
+  // A client gone (TCP closed) can be overridden
+  arbiter->release(1);
+  Serial.inject(":2FQ#:2SN0000#:2FG#");
+  run(8);
+  TEST_ASSERT_EQUAL(0, axes[1].target);
+}
+
+// Only the listed getters pass: a command missing from the whitelist, old
+// or new, is protected
+void test_read_only_whitelist(void)
+{
+  const int Protected[] = {ML_FG, ML_SC, ML_SD, ML_SF, ML_SH, ML_SN, ML_SP, ML_PLUS, ML_MINUS, ML_PO,
+                           ML_XHM, ML_XAT, ML_XPE, ML_XRD, ML_XRR, ML_XSW, ML_XLC, ML_XQA, ML_XQC,
+                           ML_XFD, ML_XFR, ML_XFT, ML_XFS, ML_XSM, ML_XEC, ML_XBA, ML_XBC,
+                           ML_XLD, 999};
+  const int ReadOnly[] = {ML_GP, ML_GN, ML_GI, ML_GT, ML_GD, ML_GC, ML_GV, ML_XST, ML_XME, ML_XSS,
+                          ML_XSD, ML_XNE, ML_XNT, ML_XES, ML_XBG};
+  size_t i;
+
+  for (i = 0; i < sizeof(Protected) / sizeof(Protected[0]); i++)
+  {
+    TEST_ASSERT_FALSE(MoonliteArbiter::isReadOnlyCommand(Protected[i]));
+  }
+  for (i = 0; i < sizeof(ReadOnly) / sizeof(ReadOnly[0]); i++)
+  {
+    TEST_ASSERT_TRUE(MoonliteArbiter::isReadOnlyCommand(ReadOnly[i]));
+    TEST_ASSERT_FALSE(MoonliteArbiter::isMoveCommand(ReadOnly[i]));
+  }
+}
+
+// Many clients polling while one moves: every getter is answered on its
+// own port, the clients are served in turn
+void test_many_polling_clients(void)
+{
+  int i;
+  int client;
+
+  Serial.inject(":SN1000#:FG#");
+  run(4);
+  for (i = 0; i < 100; i++)
+  {
+    for (client = 1; client < CLIENT_COUNT; client++)
+    {
+      Ports[client]->inject(client == 2 ? ":GI#" : ":GP#");
+    }
+  }
+  // One command per tick at most: served in turn, no client waits for
+  // another one to be done
+  run(3 * 50);
+  for (client = 1; client < CLIENT_COUNT; client++)
+  {
+    TEST_ASSERT_INT_WITHIN(1, 50, processedCount[client]);
+  }
+  run(3 * 50 + 10);
+  for (client = 1; client < CLIENT_COUNT; client++)
+  {
+    TEST_ASSERT_EQUAL(100, processedCount[client]);
+    TEST_ASSERT_EQUAL(100 * (client == 2 ? 3 : 5), Ports[client]->tx.size());
+  }
+  TEST_ASSERT_EQUAL(0, Serial.tx.size());
+  TEST_ASSERT_EQUAL(0, arbiter->getOwner(0));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_owner_keeps_the_move);
+  RUN_TEST(test_stop_from_any_client);
+  RUN_TEST(test_owner_per_device);
+  RUN_TEST(test_read_only_whitelist);
+  RUN_TEST(test_many_polling_clients);
+  return UNITY_END();
+}
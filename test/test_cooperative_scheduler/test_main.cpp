@@ -0,0 +1,254 @@
+/*
+test_main.cpp - - Deadlines of the CooperativeScheduler on a virtual clock
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include "CooperativeScheduler.h"
+
+#define LOOP_TIME 50 // us spent in loop() outside of the tasks
+#define MOTOR_PERIOD 1000
+#define MOTOR_COST 40
+#define SERIAL_PERIOD 5000
+#define SERIAL_COST 120
+#define COMPENSATION_PERIOD 30000000UL
+#define COMPENSATION_COST 800
+#define MAX_CALLS 16
+
+static CooperativeScheduler *scheduler;
+static unsigned long motorCost;
+static const char *calls[MAX_CALLS]; // Names of the tasks in order of run
+static int callCount;
+
+static void record(const char *name, unsigned long cost)
+{
+  if (callCount < MAX_CALLS)
+  {
+    calls[callCount] = name;
+  }
+  callCount++;
+  mock::advanceMicros(cost);
+}
+
+static void motorTask()
+{
+  record("motor", motorCost);
+}
+
+static void serialTask()
+{
+  record("serial", SERIAL_COST);
+}
+
+static void compensationTask()
+{
+  record("compensation", COMPENSATION_COST);
+}
+
+static void oneShotTask()
+{
+  record("oneshot", 10);
+}
+
+// Run loop() for duration us
+static void runFor(unsigned long duration)
+{
+  unsigned long start = micros();
+
+  while (micros() - start < duration)
+  {
+    scheduler->Manage();
+    mock::advanceMicros(LOOP_TIME);
+  }
+}
+
+void setUp()
+{
+  mock::reset();
+  scheduler = new CooperativeScheduler();
+  motorCost = MOTOR_COST;
+  callCount = 0;
+}
+
+void tearDown()
+{
+  delete scheduler;
+}
+
+void test_periodic_deadlines()
+{
+  int motor = scheduler->addPeriodicTask("motor", motorTask, MOTOR_PERIOD, CS_PRIORITY_REALTIME, 100);
+  int serial = scheduler->addPeriodicTask("serial", serialTask, SERIAL_PERIOD, CS_PRIORITY_NORMAL, 200);
+  int compensation = scheduler->addPeriodicTask("compensation", compensationTask,
+                                                COMPENSATION_PERIOD, CS_PRIORITY_LOW, 1000);
+
+  runFor(90000000UL);
+
+  // The phase is kept: no period is lost or added over 90 s
+  TEST_ASSERT_UINT32_WITHIN(1, 90000, scheduler->getRunCount(motor));
+  TEST_ASSERT_UINT32_WITHIN(1, 18000, scheduler->getRunCount(serial));
+  TEST_ASSERT_EQUAL_UINT32(3, scheduler->getRunCount(compensation));
+
+  // A task waits at most for one loop and for every other task once
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(LOOP_TIME + SERIAL_COST + COMPENSATION_COST,
+                                   scheduler->getMaxLateness(motor));
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(LOOP_TIME + 2 * MOTOR_COST + COMPENSATION_COST,
+                                   scheduler->getMaxLateness(serial));
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(LOOP_TIME + 2 * MOTOR_COST + SERIAL_COST,
+                                   scheduler->getMaxLateness(compensation));
+
+  TEST_ASSERT_EQUAL_UINT32(MOTOR_COST, scheduler->getMaxExecutionTime(motor));
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler->getOverrunCount(motor));
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler->getOverrunCount(serial));
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler->getOverrunCount(compensation));
+}
+
+void test_priority_order()
+{
+  // Added from the lowest priority to the highest
+  scheduler->addPeriodicTask("compensation", compensationTask,
+                             COMPENSATION_PERIOD, CS_PRIORITY_LOW, 1000);
+  scheduler->addPeriodicTask("serial", serialTask, SERIAL_PERIOD, CS_PRIORITY_NORMAL, 200);
+  scheduler->addPeriodicTask("motor", motorTask, MOTOR_PERIOD, CS_PRIORITY_REALTIME, 100);
+
+  // All are due on the first Manage()
+  scheduler->Manage();
+
+  TEST_ASSERT_EQUAL(3, callCount);
+  TEST_ASSERT_EQUAL_STRING("motor", calls[0]);
+  TEST_ASSERT_EQUAL_STRING("serial", calls[1]);
+  TEST_ASSERT_EQUAL_STRING("compensation", calls[2]);
+  // The ids stay in order of insertion
+  TEST_ASSERT_EQUAL_STRING("compensation", scheduler->getTaskName(0));
+  TEST_ASSERT_EQUAL_STRING("motor", scheduler->getTaskName(2));
+}
+
+void test_overrun_is_counted()
+{
+  int motor = scheduler->addPeriodicTask("motor", motorTask, MOTOR_PERIOD, CS_PRIORITY_REALTIME, 100);
+
+  runFor(10000);
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler->getOverrunCount(motor));
+
+  motorCost = 150;
+  runFor(10000);
+
+  TEST_ASSERT_EQUAL_UINT32(10, scheduler->getOverrunCount(motor));
+  TEST_ASSERT_EQUAL_UINT32(150, scheduler->getMaxExecutionTime(motor));
+
+  scheduler->resetStatistics();
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler->getOverrunCount(motor));
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler->getRunCount(motor));
+}
+
+void test_one_shot()
+{
+  int task = scheduler->addOneShotTask("oneshot", oneShotTask, CS_PRIORITY_NORMAL, 100);
+
+  // Not scheduled yet
+  runFor(5000);
+  TEST_ASSERT_EQUAL(0, callCount);
+  TEST_ASSERT_FALSE(scheduler->isScheduled(task));
+
+  scheduler->schedule(task, 2000);
+  TEST_ASSERT_TRUE(scheduler->isScheduled(task));
+  runFor(1950);
+  TEST_ASSERT_EQUAL(0, callCount);
+  runFor(5000);
+  TEST_ASSERT_EQUAL(1, callCount);
+  TEST_ASSERT_FALSE(scheduler->isScheduled(task));
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(LOOP_TIME, scheduler->getMaxLateness(task));
+
+  // Cancelled before its deadline
+  scheduler->schedule(task, 1000);
+  scheduler->cancel(task);
+  runFor(5000);
+  TEST_ASSERT_EQUAL(1, callCount);
+}
+
+// The idle sleep wakes up for the one-shot tasks only
+void test_time_to_next_one_shot()
+{
+  int first = scheduler->addOneShotTask("first", oneShotTask, CS_PRIORITY_NORMAL, 100);
+  int second = scheduler->addOneShotTask("second", oneShotTask, CS_PRIORITY_NORMAL, 100);
+
+  scheduler->addPeriodicTask("serial", serialTask, SERIAL_PERIOD, CS_PRIORITY_NORMAL, 200);
+  TEST_ASSERT_EQUAL_UINT32(CS_NO_DEADLINE, scheduler->getTimeToNextOneShotTask());
+
+  scheduler->schedule(first, 8000);
+  scheduler->schedule(second, 3000);
+  TEST_ASSERT_EQUAL_UINT32(3000, scheduler->getTimeToNextOneShotTask());
+  mock::advanceMicros(4000);
+  TEST_ASSERT_EQUAL_UINT32(0, scheduler->getTimeToNextOneShotTask());
+  scheduler->Manage();
+  TEST_ASSERT_FALSE(scheduler->isScheduled(second));
+  TEST_ASSERT_EQUAL_UINT32(8000 - micros(), scheduler->getTimeToNextOneShotTask());
+
+  scheduler->cancel(first);
+  TEST_ASSERT_EQUAL_UINT32(CS_NO_DEADLINE, scheduler->getTimeToNextOneShotTask());
+}
+
+void test_missed_period_restarts()
+{
+  int serial = scheduler->addPeriodicTask("serial", serialTask, SERIAL_PERIOD, CS_PRIORITY_NORMAL, 200);
+
+  scheduler->Manage();
+  TEST_ASSERT_EQUAL(1, callCount);
+
+  // A light sleep of 12 periods: one run, not 12 in a row
+  mock::advanceMicros(12 * SERIAL_PERIOD);
+  scheduler->Manage();
+  scheduler->Manage();
+  TEST_ASSERT_EQUAL(2, callCount);
+
+  // The next period starts from the wake up
+  runFor(SERIAL_PERIOD - SERIAL_COST - LOOP_TIME);
+  TEST_ASSERT_EQUAL(2, callCount);
+  runFor(2 * LOOP_TIME);
+  TEST_ASSERT_EQUAL(3, callCount);
+  TEST_ASSERT_EQUAL_UINT32(3, scheduler->getRunCount(serial));
+}
+
+void test_table_full()
+{
+  int i;
+
+  for (i = 0; i < CS_MAX_TASKS; i++)
+  {
+    TEST_ASSERT_EQUAL(i, scheduler->addPeriodicTask("motor", motorTask, MOTOR_PERIOD, CS_PRIORITY_NORMAL, 100));
+  }
+  TEST_ASSERT_EQUAL(CS_NO_TASK, scheduler->addPeriodicTask("serial", serialTask, SERIAL_PERIOD, CS_PRIORITY_HIGH, 200));
+  TEST_ASSERT_EQUAL(CS_NO_TASK, scheduler->addOneShotTask("oneshot", NULL, CS_PRIORITY_HIGH, 200));
+  TEST_ASSERT_EQUAL(CS_MAX_TASKS, scheduler->getTaskCount());
+  TEST_ASSERT_NULL(scheduler->getTaskName(CS_MAX_TASKS));
+  TEST_ASSERT_FALSE(scheduler->isScheduled(CS_NO_TASK));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_periodic_deadlines);
+  RUN_TEST(test_priority_order);
+  RUN_TEST(test_overrun_is_counted);
+  RUN_TEST(test_one_shot);
+  RUN_TEST(test_time_to_next_one_shot);
+  RUN_TEST(test_missed_period_restarts);
+  RUN_TEST(test_table_full);
+  return UNITY_END();
+}
@@ -0,0 +1,225 @@
+/*
+test_main.cpp - - Replay of a night log through the focus model
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include "StepperControl.h"
+
+#define STEP_PIN 2
+#define DIRECTION_PIN 3
+#define LOG_INTERVAL 600000UL // ms between two log temperatures
+#define LOG_SUBSTEPS 20       // Temperature updates between two log lines
+#define TRUE_SLOPE -12.5      // steps per C° of the optics of the log
+#define MOONLITE_COEFFICIENT 5 // Wrong on purpose: the model has to learn
+
+// Temperature every 10 minutes of a night, dusk first
+static const float temperatureLog[] = {
+  11.96, 11.49, 11.19, 10.68, 10.4, 10.0, 9.57, 9.3, 8.85, 8.57, 8.15, 7.81, 7.55,
+  7.32, 6.89, 6.65, 6.5, 6.37, 6.13, 5.96, 5.97, 5.71, 5.82, 5.66, 5.6, 5.57, 5.58,
+  5.64, 5.46, 5.47, 5.4, 5.25, 5.17, 4.94, 4.81, 4.71, 4.67, 4.5, 4.37, 4.34, 4.25,
+  4.18, 4.26, 4.25, 4.19, 4.3, 4.34, 4.46, 4.49};
+
+// Autofocus runs: log line and position found in focus
+typedef struct
+{
+  int line;
+  long position;
+} AutofocusRun_t;
+
+static const AutofocusRun_t autofocusLog[] = {
+  {0, 24999}, {6, 25033}, {12, 25053}, {18, 25073}, {24, 25082},
+  {30, 25080}, {36, 25092}, {42, 25094}, {48, 25095}};
+
+#define LOG_LINES (int)(sizeof(temperatureLog) / sizeof(temperatureLog[0]))
+#define AUTOFOCUS_RUNS (int)(sizeof(autofocusLog) / sizeof(autofocusLog[0]))
+
+static StepperControl *motor;
+
+static void createMotor()
+{
+  motor = new StepperControl(STEP_PIN, DIRECTION_PIN, SC_NO_PIN, SC_NO_PIN, SC_NO_PIN,
+                             SC_NO_PIN, SC_NO_PIN, SC_NO_PIN);
+
+  motor->setSpeed(1000);
+  motor->setCurrentPosition(25000);
+  motor->setTemperatureCompensationCoefficient(MOONLITE_COEFFICIENT);
+}
+
+static void runUntilIdle()
+{
+  while (motor->isInMove() || motor->isQueueRunning())
+  {
+    motor->Manage();
+    mock::advanceMicros(20);
+  }
+}
+
+// Idle time: the motor task and the temperature compensation keep running
+static void idle(unsigned long ms)
+{
+  unsigned long end = millis() + ms;
+
+  while (millis() < end)
+  {
+    if (motor->isTemperatureCompensationEnabled())
+    {
+      motor->compensateTemperature();
+    }
+    runUntilIdle();
+    motor->Manage();
+    delay(100);
+  }
+}
+
+// The autofocus of the capture software ends with FG
+static void autofocus(long position)
+{
+  motor->setTargetPosition(position);
+  motor->startUserMove();
+  runUntilIdle();
+  idle(SC_SETTLE_TIME + 1000);
+}
+
+void setUp(void)
+{
+  mock::reset();
+  motor = NULL;
+}
+
+void tearDown(void)
+{
+  delete motor;
+}
+
+void test_replay_learns_the_slope_and_follows_the_focus(void)
+{
+  createMotor();
+  FocusModel *model = motor->getFocusModel();
+  int run = 0;
+  int line;
+  int i;
+  long error;
+  long maxError = 0;
+  char message[80];
+  float temperature;
+
+  motor->setCurrentTemperature(temperatureLog[0]);
+  motor->enableTemperatureCompensation();
+  for (line = 0; line < LOG_LINES; line++)
+  {
+    if (run < AUTOFOCUS_RUNS && autofocusLog[run].line == line)
+    {
+      // Once fitted, the compensation keeps the focus between the runs
+      error = abs(motor->getCurrentPosition() - autofocusLog[run].position);
+      if (model->isFitted())
+      {
+        maxError = max(maxError, error);
+      }
+      autofocus(autofocusLog[run].position);
+      run++;
+    }
+    if (line + 1 == LOG_LINES)
+    {
+      break;
+    }
+    for (i = 1; i <= LOG_SUBSTEPS; i++)
+    {
+      temperature = temperatureLog[line] + (temperatureLog[line + 1] - temperatureLog[line]) * i / LOG_SUBSTEPS;
+      motor->setCurrentTemperature(temperature);
+      idle(LOG_INTERVAL / LOG_SUBSTEPS);
+    }
+  }
+
+  snprintf(message, sizeof(message), "slope %.2f steps/C, largest error %ld steps", model->getSlope(), maxError);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(model->isFitted());
+  TEST_ASSERT_FLOAT_WITHIN(1.5, TRUE_SLOPE, model->getSlope());
+  TEST_ASSERT_LESS_OR_EQUAL(FM_DEFAULT_HYSTERESIS + 2, maxError);
+  // Only the autofocus runs were learned, not the compensation moves
+  TEST_ASSERT_FLOAT_WITHIN(0.01, (1 - pow(FM_DEFAULT_FORGETTING_FACTOR, AUTOFOCUS_RUNS)) /
+                                 (1 - FM_DEFAULT_FORGETTING_FACTOR), model->getSampleWeight());
+}
+
+void test_corrections_are_small_and_spaced(void)
+{
+  createMotor();
+  long position;
+  unsigned long lastMove = 0;
+  int i;
+
+  motor->enableTemperatureCompensation();
+  motor->setCurrentTemperature(10.0);
+  autofocus(25000);
+  // A sudden drop of 5 C°: 25 steps with the default slope
+  motor->setCurrentTemperature(5.0);
+  for (i = 0; i < 100; i++)
+  {
+    position = motor->getCurrentPosition();
+    motor->compensateTemperature();
+    if (motor->isInMove())
+    {
+      TEST_ASSERT_LESS_OR_EQUAL(FM_DEFAULT_MAX_CORRECTION, abs(motor->getTargetPosition() - position));
+      if (lastMove != 0)
+      {
+        TEST_ASSERT_GREATER_OR_EQUAL(FM_DEFAULT_CORRECTION_INTERVAL, millis() - lastMove);
+      }
+      lastMove = millis();
+    }
+    runUntilIdle();
+    delay(100);
+  }
+  TEST_ASSERT_INT_WITHIN(FM_DEFAULT_HYSTERESIS, 25000 + 5 * MOONLITE_COEFFICIENT, motor->getCurrentPosition());
+}
+
+void test_only_user_moves_are_learned(void)
+{
+  createMotor();
+  FocusModel *model = motor->getFocusModel();
+
+  motor->setCurrentTemperature(10.0);
+
+  // Queued waypoints
+  motor->queueMove(25100, 0);
+  motor->queueMove(25050, 500);
+  runUntilIdle();
+  idle(SC_SETTLE_TIME + 1000);
+  TEST_ASSERT_EQUAL(25050, motor->getCurrentPosition());
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0, model->getSampleWeight());
+
+  // Firmware moves (sweep, filter offset, compensation)
+  motor->startAutomaticMove(25200);
+  runUntilIdle();
+  idle(SC_SETTLE_TIME + 1000);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 0, model->getSampleWeight());
+
+  // FG
+  autofocus(25150);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 1, model->getSampleWeight());
+  TEST_ASSERT_EQUAL(25150, model->getFocusPosition(10.0));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_learns_the_slope_and_follows_the_focus);
+  RUN_TEST(test_corrections_are_small_and_spaced);
+  RUN_TEST(test_only_user_moves_are_learned);
+  return UNITY_END();
+}
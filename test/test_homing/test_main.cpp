@@ -0,0 +1,259 @@
+/*
+test_main.cpp - - StallGuard stall detection and homing on a load curve
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include "StallDetector.h"
+#include "StepperControl.h"
+#include "TMC2209.h"
+#include "Tmc2209Model.h"
+
+#define STEP_PIN 2
+#define DIRECTION_PIN 3
+#define LOOP_PERIOD 10 // us between two calls of Manage()
+#define HOMING_TIMEOUT 120000000UL // us
+
+// Load curve of the drawtube: SG_RESULT around FREE_LOAD_RESULT with some
+// noise and rare dips, falling linearly to 0 over the last COMPRESSION
+// full steps before the end stop (the tube is squeezed), 0 beyond
+#define FREE_LOAD_RESULT 300
+#define LOAD_NOISE 60
+#define DIP_RESULT 60
+#define DIP_PERIOD 37 // readings
+#define COMPRESSION 50 // full steps
+
+static StepperControl *motor;
+static TMC2209 *driver;
+static Tmc2209Model *model;
+static long endStop; // full steps, model side
+static int readingCount;
+
+// SG_RESULT at this physical position (full steps)
+static uint16_t loadCurve(long fullSteps, int direction)
+{
+  long distance = (fullSteps - endStop) * direction;
+  long result;
+
+  readingCount++;
+  if (distance <= 0)
+  {
+    return 0;
+  }
+  result = FREE_LOAD_RESULT - LOAD_NOISE + rand() % (2 * LOAD_NOISE);
+  if (readingCount % DIP_PERIOD == 0)
+  {
+    result = DIP_RESULT;
+  }
+  if (distance < COMPRESSION)
+  {
+    result = result * distance / COMPRESSION;
+  }
+  return (uint16_t)result;
+}
+
+static void createMotor()
+{
+  motor = new StepperControl(STEP_PIN, DIRECTION_PIN, SC_NO_PIN, SC_NO_PIN, SC_NO_PIN,
+                             SC_NO_PIN, SC_NO_PIN, SC_NO_PIN);
+
+  driver = new TMC2209(&Serial1, 0);
+  model = new Tmc2209Model(&Serial1, 0, STEP_PIN, DIRECTION_PIN);
+  TEST_ASSERT_TRUE(driver->init(TMC2209_DEFAULT_BAUDRATE, 16, 17));
+  mock::advanceMicros(driver->getTransmitEndTimestamp() - micros());
+  model->isTimed = true;
+  motor->setDriver(driver);
+  motor->setStepMode(SC_16TH_STEP);
+  motor->setMoveMode(SC_MOVEMODE_SMOOTH);
+  motor->setSpeed(4000);
+}
+
+// Run the homing like the motion task, the chip reads the load curve at
+// the physical position. Return the furthest position reached beyond the
+// end stop, in full steps.
+static long runHoming(int direction)
+{
+  int sign = direction == SC_HOMING_INWARD ? 1 : -1;
+  unsigned long start = micros();
+  long overtravel = 0;
+
+  TEST_ASSERT_TRUE(motor->startHoming(direction));
+  while (motor->isHoming() && (micros() - start) < HOMING_TIMEOUT)
+  {
+    model->registers[TMC2209_REG_SG_RESULT] = loadCurve(model->position / 256, sign);
+    overtravel = max(overtravel, (endStop - model->position / 256) * sign);
+    driver->Manage();
+    motor->Manage();
+    mock::advanceMicros(LOOP_PERIOD);
+  }
+  TEST_ASSERT_FALSE(motor->isHoming());
+  return overtravel;
+}
+
+void setUp(void)
+{
+  mock::reset();
+  Serial1.reset();
+  srand(1);
+  readingCount = 0;
+  motor = NULL;
+  driver = NULL;
+  model = NULL;
+}
+
+void tearDown(void)
+{
+  delete motor;
+  delete driver;
+  delete model;
+}
+
+// The free run with its noise and dips is never a stall
+void test_detector_ignores_noise(void)
+{
+  StallDetector detector;
+  long fullSteps;
+
+  endStop = -1000000;
+  detector.setThreshold(50);
+  for (fullSteps = 0; fullSteps < 20000; fullSteps += 2)
+  {
+    TEST_ASSERT_FALSE(detector.update(loadCurve(fullSteps, 1), fullSteps));
+  }
+  TEST_ASSERT_EQUAL(DIP_RESULT, detector.getMinimumResult());
+  TEST_ASSERT_EQUAL(DIP_RESULT - 2 * 50, detector.getMargin());
+}
+
+// The low readings of the acceleration are blanked
+void test_detector_blanks_start(void)
+{
+  StallDetector detector;
+  long steps;
+
+  detector.setThreshold(50);
+  detector.setBlankingSteps(200);
+  for (steps = 0; steps < 200; steps += 5)
+  {
+    TEST_ASSERT_FALSE(detector.update(10, steps));
+  }
+  TEST_ASSERT_EQUAL(SD_NO_RESULT, detector.getMinimumResult());
+  TEST_ASSERT_FALSE(detector.update(10, 200));
+  TEST_ASSERT_FALSE(detector.update(10, 205));
+  TEST_ASSERT_TRUE(detector.update(10, 210));
+  TEST_ASSERT_TRUE(detector.isStalled());
+
+  // A new move starts over
+  detector.reset();
+  TEST_ASSERT_FALSE(detector.isStalled());
+}
+
+// The stall is found on the slope before the end stop
+void test_detector_finds_end_stop(void)
+{
+  StallDetector detector;
+  long fullSteps;
+
+  endStop = 0;
+  detector.setThreshold(50);
+  detector.setBlankingSteps(0);
+  for (fullSteps = 3000; fullSteps > -100; fullSteps--)
+  {
+    if (detector.update(loadCurve(fullSteps, 1), 3000 - fullSteps))
+    {
+      break;
+    }
+  }
+  TEST_ASSERT_TRUE(detector.isStalled());
+  // SG_RESULT <= 100 from 2/3 of the slope at the latest, 3 readings
+  TEST_ASSERT_GREATER_OR_EQUAL(0, fullSteps);
+  TEST_ASSERT_LESS_OR_EQUAL(COMPRESSION, fullSteps);
+}
+
+// Homing inward: zero at the backoff distance from where the stall is
+// found, without pushing against the end stop
+void test_homing_inward(void)
+{
+  createMotor();
+  long overtravel;
+
+  endStop = -3000;
+  motor->setCurrentPosition(12345);
+  motor->setHomingBackoff(200);
+  overtravel = runHoming(SC_HOMING_INWARD);
+
+  TEST_ASSERT_EQUAL(SC_HOMING_DONE, motor->getHomingState());
+  TEST_ASSERT_EQUAL(0, motor->getCurrentPosition());
+  TEST_ASSERT_FALSE(motor->isInMove());
+  TEST_ASSERT_LESS_OR_EQUAL(0, overtravel);
+  // Zero is 200 microsteps (12.5 full steps) off the stall point on the slope
+  TEST_ASSERT_GREATER_OR_EQUAL(endStop * 256 + 200 * 16, model->position);
+  TEST_ASSERT_LESS_OR_EQUAL((endStop + COMPRESSION) * 256 + 200 * 16, model->position);
+  TEST_ASSERT_EQUAL(4000, motor->getTargetSpeed());
+}
+
+// Two homings in a row find the same zero within a few full steps
+void test_homing_is_repeatable(void)
+{
+  createMotor();
+  long firstHome;
+
+  endStop = 2500;
+  runHoming(SC_HOMING_OUTWARD);
+  TEST_ASSERT_EQUAL(SC_HOMING_DONE, motor->getHomingState());
+  firstHome = model->position;
+
+  motor->setTargetPosition(-20000);
+  motor->goToTargetPosition();
+  while (motor->isInMove())
+  {
+    driver->Manage();
+    motor->Manage();
+    mock::advanceMicros(LOOP_PERIOD);
+  }
+  runHoming(SC_HOMING_OUTWARD);
+  TEST_ASSERT_EQUAL(SC_HOMING_DONE, motor->getHomingState());
+  TEST_ASSERT_INT_WITHIN(5 * 256, firstHome, model->position);
+}
+
+// No end stop within the travel: the homing fails and the position is kept
+void test_homing_fails_without_stall(void)
+{
+  createMotor();
+
+  endStop = -1000000;
+  motor->setCurrentPosition(500);
+  motor->setHomingMaxTravel(8000);
+  runHoming(SC_HOMING_INWARD);
+
+  TEST_ASSERT_EQUAL(SC_HOMING_FAILED, motor->getHomingState());
+  TEST_ASSERT_EQUAL(500 - 8000, motor->getCurrentPosition());
+  TEST_ASSERT_EQUAL(4000, motor->getTargetSpeed());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_detector_ignores_noise);
+  RUN_TEST(test_detector_blanks_start);
+  RUN_TEST(test_detector_finds_end_stop);
+  RUN_TEST(test_homing_inward);
+  RUN_TEST(test_homing_is_repeatable);
+  RUN_TEST(test_homing_fails_without_stall);
+  return UNITY_END();
+}
@@ -0,0 +1,220 @@
+/*
+test_main.cpp - - Step timing of several axes sharing the MotionScheduler
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include "MotionScheduler.h"
+#include "StepperControl.h"
+
+#define AXIS_COUNT 3
+#define AXIS_COST 3 // us of CPU per axis and per Manage() call
+#define MOVE_TIMEOUT 60000000UL // us
+
+// A step is at most one Manage() late: the shared direction setup and
+// pulse, and the time to look at every axis
+#define MAX_LATENESS (SC_DIRECTION_SETUP_TIME + SC_STEP_PULSE_WIDTH + AXIS_COUNT * AXIS_COST)
+
+static const int StepPins[AXIS_COUNT] = {2, 4, 6};
+static const int DirectionPins[AXIS_COUNT] = {3, 5, 7};
+static const unsigned int Speeds[AXIS_COUNT] = {8000, 5000, 3000};
+static const long Distances[AXIS_COUNT] = {40000, -25000, 15000};
+
+static StepperControl *axes[AXIS_COUNT];
+static MotionScheduler *scheduler;
+
+typedef struct
+{
+  unsigned long lastEdge;
+  unsigned long edgeCount;
+  unsigned long minInterval; // us, at cruise speed
+  unsigned long maxInterval;
+} PinRecord_t;
+
+static PinRecord_t records[AXIS_COUNT];
+static unsigned long sharedPulseCount; // Pulses of several axes together
+static unsigned long lastPulseTimestamp;
+
+// Step edges timed like a logic analyzer on the step pins would
+static void onPin(uint8_t pin, uint8_t value, void *context)
+{
+  unsigned long interval;
+  int i;
+
+  if (value != HIGH)
+  {
+    return;
+  }
+  for (i = 0; i < AXIS_COUNT; i++)
+  {
+    if (pin != StepPins[i])
+    {
+      continue;
+    }
+    if (records[i].edgeCount > 0 && axes[i]->getSpeed() == axes[i]->getTargetSpeed() &&
+        axes[i]->getRemainingMoveDistance() > 0)
+    {
+      interval = micros() - records[i].lastEdge;
+      records[i].minInterval = min(records[i].minInterval, interval);
+      records[i].maxInterval = max(records[i].maxInterval, interval);
+    }
+    records[i].lastEdge = micros();
+    records[i].edgeCount++;
+    if (micros() == lastPulseTimestamp)
+    {
+      sharedPulseCount++;
+    }
+    lastPulseTimestamp = micros();
+  }
+}
+
+// Run the motion task until all the axes stopped
+static void runAll()
+{
+  unsigned long start = micros();
+
+  while (scheduler->isInMove() && (micros() - start) < MOVE_TIMEOUT)
+  {
+    scheduler->Manage();
+    mock::advanceMicros(scheduler->getAxisCount() * AXIS_COST);
+  }
+  TEST_ASSERT_FALSE(scheduler->isInMove());
+}
+
+static void startAxis(int i)
+{
+  axes[i]->setTargetPosition(axes[i]->getCurrentPosition() + Distances[i]);
+  axes[i]->goToTargetPosition();
+}
+
+void setUp(void)
+{
+  int i;
+
+  mock::reset();
+  mock::pinListener = onPin;
+  scheduler = new MotionScheduler();
+  for (i = 0; i < AXIS_COUNT; i++)
+  {
+    axes[i] = new StepperControl(StepPins[i], DirectionPins[i], SC_NO_PIN, SC_NO_PIN, SC_NO_PIN,
+                                 SC_NO_PIN, SC_NO_PIN, SC_NO_PIN);
+    axes[i]->setMoveMode(SC_MOVEMODE_SMOOTH);
+    axes[i]->setAcceleration(500);
+    axes[i]->setSpeed(Speeds[i]);
+    records[i].lastEdge = 0;
+    records[i].edgeCount = 0;
+    records[i].minInterval = ~0UL;
+    records[i].maxInterval = 0;
+  }
+  sharedPulseCount = 0;
+  lastPulseTimestamp = ~0UL;
+}
+
+void tearDown(void)
+{
+  int i;
+
+  for (i = 0; i < AXIS_COUNT; i++)
+  {
+    delete axes[i];
+  }
+  delete scheduler;
+}
+
+// All the axes at cruise speed together: each step is at most one
+// Manage() late, and no step is lost or added
+void test_all_axes_slew_together(void)
+{
+  unsigned long period;
+  int i;
+
+  for (i = 0; i < AXIS_COUNT; i++)
+  {
+    TEST_ASSERT_TRUE(scheduler->addAxis(axes[i]));
+    startAxis(i);
+  }
+  runAll();
+
+  for (i = 0; i < AXIS_COUNT; i++)
+  {
+    period = (unsigned long)(1000000.0 / (Speeds[i] + 1));
+    TEST_ASSERT_EQUAL(Distances[i], axes[i]->getCurrentPosition());
+    TEST_ASSERT_EQUAL(labs(Distances[i]), records[i].edgeCount);
+    TEST_ASSERT_GREATER_OR_EQUAL(period, records[i].minInterval);
+    TEST_ASSERT_LESS_OR_EQUAL(period + MAX_LATENESS, records[i].maxInterval);
+    TEST_ASSERT_LESS_OR_EQUAL(MAX_LATENESS, scheduler->getMaxLateness(i));
+  }
+  // The pulses of the due axes are shared
+  TEST_ASSERT_GREATER_THAN(0, sharedPulseCount);
+}
+
+// The steps of the other axes delay an axis by one shared pulse at most,
+// not by one pulse per axis
+void test_other_axes_do_not_delay(void)
+{
+  unsigned long aloneMax;
+  int i;
+
+  TEST_ASSERT_TRUE(scheduler->addAxis(axes[0]));
+  startAxis(0);
+  runAll();
+  aloneMax = records[0].maxInterval;
+
+  for (i = 1; i < AXIS_COUNT; i++)
+  {
+    TEST_ASSERT_TRUE(scheduler->addAxis(axes[i]));
+  }
+  for (i = 0; i < AXIS_COUNT; i++)
+  {
+    records[i].edgeCount = 0;
+    records[i].maxInterval = 0;
+    startAxis(i);
+  }
+  scheduler->resetLateness();
+  runAll();
+  TEST_ASSERT_LESS_OR_EQUAL(aloneMax + SC_DIRECTION_SETUP_TIME + SC_STEP_PULSE_WIDTH + (AXIS_COUNT - 1) * AXIS_COST,
+                            records[0].maxInterval);
+  TEST_ASSERT_EQUAL(2 * Distances[0], axes[0]->getCurrentPosition());
+}
+
+// The scheduler takes MS_MAX_AXES axes, an unknown axis reads as none
+void test_axis_count(void)
+{
+  StepperControl extra(8, 9, SC_NO_PIN, SC_NO_PIN, SC_NO_PIN, SC_NO_PIN, SC_NO_PIN, SC_NO_PIN);
+  int i;
+
+  for (i = 0; i < AXIS_COUNT; i++)
+  {
+    TEST_ASSERT_TRUE(scheduler->addAxis(axes[i]));
+  }
+  TEST_ASSERT_FALSE(scheduler->addAxis(&extra));
+  TEST_ASSERT_EQUAL(MS_MAX_AXES, scheduler->getAxisCount());
+  TEST_ASSERT_NULL(scheduler->getAxis(MS_MAX_AXES));
+  TEST_ASSERT_NULL(scheduler->getAxis(-1));
+  TEST_ASSERT_EQUAL(0, scheduler->getMaxLateness(MS_MAX_AXES));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_all_axes_slew_together);
+  RUN_TEST(test_other_axes_do_not_delay);
+  RUN_TEST(test_axis_count);
+  return UNITY_END();
+}
@@ -0,0 +1,282 @@
+/*
+test_main.cpp - - Reaction latency of the notifications against GI polling
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+The loop of the firmware is rebuilt with its scheduler: motion, parser
+and notification tasks, each one costing a fixed time. Serial opts in with
+XNE, Serial1 is a plain Moonlite client polling :GI#. The latency is the
+time between the last step of a move and the first byte telling it.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include <string>
+#include "CooperativeScheduler.h"
+#include "Moonlite.h"
+#include "StepperControl.h"
+
+#define STEP_PIN 2
+#define DIRECTION_PIN 3
+#define MOTION_COST 20 // us of CPU per task run
+#define COMMUNICATION_COST 150
+#define NOTIFICATION_COST 20
+#define LOOP_COST (MOTION_COST + COMMUNICATION_COST + NOTIFICATION_COST)
+#define POLL_INTERVAL 100000UL // us, a typical autofocus client
+#define MOVE_COUNT 20
+#define MOVE_TIMEOUT 60000000UL // us
+
+static CooperativeScheduler *tasks;
+static Moonlite *parser;
+static StepperControl *axis;
+static bool axisWasMoving;
+
+static unsigned long lastStepTimestamp;
+static unsigned long moveEndTimestamp; // 0 while the move runs
+static unsigned long notificationTimestamp;
+static unsigned long pollTimestamp;
+static std::string notifications; // Received on Serial
+static std::string pollAnswer;    // Received on Serial1
+
+static void onPin(uint8_t pin, uint8_t value, void *context)
+{
+  if (pin == STEP_PIN && value == HIGH)
+  {
+    lastStepTimestamp = micros();
+  }
+}
+
+// The first byte of the first notification after the end of the move
+static void onNotificationByte(HardwareSerial *port, uint8_t value, void *context)
+{
+  if (value == '!' && moveEndTimestamp != 0 && notificationTimestamp == 0)
+  {
+    notificationTimestamp = micros();
+  }
+  notifications += (char)value;
+}
+
+// The first GI answer "not moving" after the end of the move
+static void onPollByte(HardwareSerial *port, uint8_t value, void *context)
+{
+  pollAnswer += (char)value;
+  if (value != '#')
+  {
+    return;
+  }
+  if (pollAnswer == "00#" && moveEndTimestamp != 0 && pollTimestamp == 0)
+  {
+    pollTimestamp = micros();
+  }
+  pollAnswer.clear();
+}
+
+static void MotionTask()
+{
+  axis->Manage();
+  if (axisWasMoving && !axis->isInMove())
+  {
+    moveEndTimestamp = lastStepTimestamp;
+  }
+  mock::advanceMicros(MOTION_COST);
+}
+
+// processCommand() of the firmware for the commands used here
+static void CommunicationTask()
+{
+  parser->Manage();
+  if (parser->isNewCommandAvailable())
+  {
+    MoonliteCommand_t command = parser->getCommand();
+    switch (command.commandID)
+    {
+      case ML_GI:
+        parser->setAnswer(2, (long)(axis->isInMove() ? 0x01 : 0x00));
+        break;
+      case ML_XNE:
+        parser->setNotificationMask(command.client, command.parameter);
+        break;
+      case ML_XNT:
+        parser->setTemperatureThreshold(command.client, command.parameter);
+        break;
+      default:
+        break;
+    }
+  }
+  mock::advanceMicros(COMMUNICATION_COST);
+}
+
+// The end of move part of NotificationTask() of the firmware
+static void NotificationTask()
+{
+  if (axisWasMoving && !axis->isInMove())
+  {
+    parser->notify(ML_NOTIFY_MOVE, 0, axis->getCurrentPosition());
+  }
+  axisWasMoving = axis->isInMove();
+  mock::advanceMicros(NOTIFICATION_COST);
+}
+
+// Run the loop until both clients know the move ended. The poller sends
+// :GI# every POLL_INTERVAL, starting at a phase of the move.
+static void runMove(long distance, unsigned long pollPhase)
+{
+  unsigned long start = micros();
+  unsigned long nextPoll = start + pollPhase;
+
+  moveEndTimestamp = 0;
+  notificationTimestamp = 0;
+  pollTimestamp = 0;
+  axis->setTargetPosition(axis->getCurrentPosition() + distance);
+  axis->goToTargetPosition();
+  while ((notificationTimestamp == 0 || pollTimestamp == 0) && micros() - start < MOVE_TIMEOUT)
+  {
+    if ((long)(micros() - nextPoll) >= 0)
+    {
+      Serial1.inject(":GI#");
+      nextPoll += POLL_INTERVAL;
+    }
+    tasks->Manage();
+  }
+  TEST_ASSERT_NOT_EQUAL(0, notificationTimestamp);
+  TEST_ASSERT_NOT_EQUAL(0, pollTimestamp);
+}
+
+void setUp()
+{
+  mock::reset();
+  mock::pinListener = onPin;
+  Serial.reset();
+  Serial1.reset();
+  Serial.device = onNotificationByte;
+  Serial1.device = onPollByte;
+  notifications.clear();
+  pollAnswer.clear();
+  lastStepTimestamp = 0;
+  axisWasMoving = false;
+
+  parser = new Moonlite();
+  parser->init(9600);
+  parser->addTransport(&Serial1);
+  axis = new StepperControl(STEP_PIN, DIRECTION_PIN, SC_NO_PIN, SC_NO_PIN, SC_NO_PIN,
+                            SC_NO_PIN, SC_NO_PIN, SC_NO_PIN);
+  axis->setMoveMode(SC_MOVEMODE_SMOOTH);
+  axis->setAcceleration(500);
+  axis->setSpeed(4000);
+  tasks = new CooperativeScheduler();
+  tasks->addPeriodicTask("motion", MotionTask, 0, CS_PRIORITY_REALTIME, 50);
+  tasks->addPeriodicTask("communication", CommunicationTask, 0, CS_PRIORITY_NORMAL, 500);
+  tasks->addPeriodicTask("notification", NotificationTask, 0, CS_PRIORITY_NORMAL, 200);
+
+  // Serial opts in
+  Serial.inject(":XNE01#");
+  tasks->Manage();
+  TEST_ASSERT_EQUAL(ML_NOTIFY_MOVE, parser->getNotificationMask(0));
+  TEST_ASSERT_EQUAL(0, parser->getNotificationMask(1));
+}
+
+void tearDown()
+{
+  delete tasks;
+  delete axis;
+  delete parser;
+}
+
+// The notification arrives within one pass of the loop, the poller
+// learns it up to a poll interval later
+void test_notification_latency()
+{
+  unsigned long notificationLatency;
+  unsigned long pollLatency;
+  unsigned long maxNotificationLatency = 0;
+  unsigned long totalNotificationLatency = 0;
+  unsigned long totalPollLatency = 0;
+  int i;
+
+  for (i = 0; i < MOVE_COUNT; i++)
+  {
+    runMove((i % 2 == 0 ? 1 : -1) * (300 + 137 * i), (i * 7919UL) % POLL_INTERVAL);
+    notificationLatency = notificationTimestamp - moveEndTimestamp;
+    pollLatency = pollTimestamp - moveEndTimestamp;
+    maxNotificationLatency = max(maxNotificationLatency, notificationLatency);
+    totalNotificationLatency += notificationLatency;
+    totalPollLatency += pollLatency;
+    TEST_ASSERT_LESS_THAN_UINT32(pollLatency, notificationLatency);
+  }
+  printf("notification latency: %lu us average, %lu us max\n",
+         totalNotificationLatency / MOVE_COUNT, maxNotificationLatency);
+  printf("GI polling every %lu ms: %lu us average\n",
+         POLL_INTERVAL / 1000, totalPollLatency / MOVE_COUNT);
+
+  // The axis ends its move on the pass after its last step, the
+  // notification task of that pass sends the frame
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(2 * LOOP_COST, maxNotificationLatency);
+  TEST_ASSERT_GREATER_THAN_UINT32(10 * LOOP_COST, totalPollLatency / MOVE_COUNT);
+}
+
+// One frame per move, with the final position
+void test_notification_frame()
+{
+  runMove(500, 0);
+
+  TEST_ASSERT_EQUAL_STRING("!M000001F4#", notifications.c_str());
+}
+
+// A client which never sent XNE only gets the answers of its commands
+void test_plain_client_unchanged()
+{
+  std::string received;
+
+  runMove(-800, 0);
+  received.assign(Serial1.tx.begin(), Serial1.tx.end());
+
+  TEST_ASSERT_TRUE(received.find('!') == std::string::npos);
+  TEST_ASSERT_TRUE(received.size() > 0 && received.size() % 3 == 0);
+  TEST_ASSERT_EQUAL_STRING("00#", received.substr(received.size() - 3).c_str());
+}
+
+// Each client gets the temperature changes above its own XNT threshold
+void test_temperature_threshold_per_client()
+{
+  std::string received;
+
+  parser->setNotificationMask(0, ML_NOTIFY_TEMPERATURE);
+  parser->setNotificationMask(1, ML_NOTIFY_TEMPERATURE);
+  Serial1.inject(":XNT04#");
+  tasks->Manage();
+  TEST_ASSERT_EQUAL(ML_DEFAULT_TEMPERATURE_THRESHOLD, parser->getTemperatureThreshold(0));
+  TEST_ASSERT_EQUAL(4, parser->getTemperatureThreshold(1));
+
+  parser->notifyTemperature(40);
+  parser->notifyTemperature(41);
+  parser->notifyTemperature(43);
+  parser->notifyTemperature(44);
+
+  TEST_ASSERT_EQUAL_STRING("!T00000028#!T00000029#!T0000002B#!T0000002C#", notifications.c_str());
+  received.assign(Serial1.tx.begin(), Serial1.tx.end());
+  TEST_ASSERT_EQUAL_STRING("!T00000028#!T0000002C#", received.c_str());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_notification_latency);
+  RUN_TEST(test_notification_frame);
+  RUN_TEST(test_plain_client_unchanged);
+  RUN_TEST(test_temperature_threshold_per_client);
+  return UNITY_END();
+}
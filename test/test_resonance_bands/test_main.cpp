@@ -0,0 +1,287 @@
+/*
+test_main.cpp - - No cruise of the StepperControl inside a resonance band
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+The speed is measured on the step pin like a logic analyzer would: the
+rate of each step is the inverse of the time since the previous one. The
+time spent in a band is counted from the first step inside it to the first
+step outside it.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include "StepperControl.h"
+
+#define STEP_PIN 2
+#define DIRECTION_PIN 3
+#define MICROSTEPS 16
+#define ACCELERATION 200    // positions per second per SC_ACCEL_INTERVAL
+#define LOOP_TIME 5         // us
+#define RATE_MARGIN 0.03    // Error of the measured rate (loop time, rounding)
+#define MOVE_TIMEOUT 120000000UL
+#define BAND_COUNT 2
+
+// full steps per second
+static const ResonanceBand_t Bands[BAND_COUNT] = {{300, 400}, {550, 600}};
+
+static StepperControl *axis;
+static unsigned long lastEdge;
+static unsigned long stepCount;
+static int currentBand;           // -1 outside of the bands
+static unsigned long bandEntry;   // us
+static unsigned long maxDwell[BAND_COUNT]; // us
+static float maxRate;             // full steps per second
+
+static int findBand(float rate)
+{
+  int i;
+
+  for (i = 0; i < BAND_COUNT; i++)
+  {
+    if (rate > Bands[i].low * (1 + RATE_MARGIN) && rate < Bands[i].high * (1 - RATE_MARGIN))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void leaveBand(unsigned long now)
+{
+  if (currentBand >= 0)
+  {
+    maxDwell[currentBand] = max(maxDwell[currentBand], now - bandEntry);
+    currentBand = -1;
+  }
+}
+
+static void onPin(uint8_t pin, uint8_t value, void *context)
+{
+  unsigned long now = micros();
+  float rate;
+  int band;
+
+  if (pin != STEP_PIN || value != HIGH)
+  {
+    return;
+  }
+  if (stepCount > 0)
+  {
+    rate = 1000000.0 / (now - lastEdge) / MICROSTEPS;
+    maxRate = max(maxRate, rate);
+    band = findBand(rate);
+    if (band != currentBand)
+    {
+      leaveBand(now);
+      currentBand = band;
+      bandEntry = now;
+    }
+  }
+  lastEdge = now;
+  stepCount++;
+}
+
+static void moveBy(long distance)
+{
+  unsigned long start = micros();
+
+  stepCount = 0;
+  maxRate = 0;
+  axis->setTargetPosition(axis->getCurrentPosition() + distance);
+  axis->goToTargetPosition();
+  while (axis->isInMove() && micros() - start < MOVE_TIMEOUT)
+  {
+    axis->Manage();
+    mock::advanceMicros(LOOP_TIME);
+  }
+  TEST_ASSERT_FALSE(axis->isInMove());
+  leaveBand(micros());
+}
+
+// Time to cross the band at the acceleration of the ramps, with a margin
+// for the last increment and the measure
+static unsigned long crossingTime(int band)
+{
+  float rate = (float)ACCELERATION * 1000 / SC_ACCEL_INTERVAL; // positions/s^2
+  float width = (float)(Bands[band].high - Bands[band].low) * MICROSTEPS;
+
+  return (unsigned long)(width / rate * 1000000 * 1.2) + 2 * SC_BAND_ACCEL_INTERVAL * 1000;
+}
+
+static void addBands()
+{
+  int i;
+
+  for (i = 0; i < BAND_COUNT; i++)
+  {
+    TEST_ASSERT_TRUE(axis->addResonanceBand(Bands[i].low, Bands[i].high));
+  }
+}
+
+static void assertNoCruiseInBands()
+{
+  int i;
+
+  for (i = 0; i < BAND_COUNT; i++)
+  {
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(crossingTime(i), maxDwell[i]);
+  }
+}
+
+void setUp()
+{
+  mock::reset();
+  mock::pinListener = onPin;
+  lastEdge = 0;
+  stepCount = 0;
+  currentBand = -1;
+  maxDwell[0] = 0;
+  maxDwell[1] = 0;
+  axis = new StepperControl(STEP_PIN, DIRECTION_PIN, SC_NO_PIN, SC_NO_PIN, SC_NO_PIN,
+                            SC_NO_PIN, SC_NO_PIN, SC_NO_PIN);
+  axis->setMoveMode(SC_MOVEMODE_SMOOTH);
+  axis->setStepMode(SC_16TH_STEP);
+  axis->setAcceleration(ACCELERATION);
+}
+
+void tearDown()
+{
+  delete axis;
+}
+
+// Without bands the motor cruises at 350 full steps/s: the test sees it
+void test_cruise_without_bands()
+{
+  axis->setSpeed(350 * MICROSTEPS);
+  moveBy(60000);
+
+  TEST_ASSERT_GREATER_THAN_UINT32(5 * crossingTime(0), maxDwell[0]);
+}
+
+// A speed asked inside a band cruises at the bottom of the band
+void test_speed_inside_band()
+{
+  addBands();
+  axis->setSpeed(350 * MICROSTEPS);
+  TEST_ASSERT_EQUAL_UINT32(300 * MICROSTEPS, axis->getTargetSpeed());
+  TEST_ASSERT_FALSE(axis->isInResonanceBand(axis->getTargetSpeed()));
+
+  moveBy(60000);
+  moveBy(-60000);
+
+  TEST_ASSERT_EQUAL_UINT32(0, maxDwell[0]);
+  TEST_ASSERT_LESS_OR_EQUAL(300 * (1 + RATE_MARGIN), maxRate);
+}
+
+// A speed above the bands crosses both of them on the ramps, up and down
+void test_cross_bands()
+{
+  addBands();
+  axis->setSpeed(800 * MICROSTEPS);
+  TEST_ASSERT_EQUAL_UINT32(800 * MICROSTEPS, axis->getTargetSpeed());
+
+  moveBy(200000);
+  TEST_ASSERT_GREATER_THAN(800 * (1 - RATE_MARGIN), maxRate);
+  assertNoCruiseInBands();
+  moveBy(-200000);
+  assertNoCruiseInBands();
+}
+
+// Moves of every length: the ramp turns back below, inside or above a band
+void test_short_moves()
+{
+  long distance;
+
+  addBands();
+  axis->setSpeed(800 * MICROSTEPS);
+  for (distance = 2000; distance <= 40000; distance += 1900)
+  {
+    moveBy(distance % 2 == 0 ? distance : -distance);
+    assertNoCruiseInBands();
+  }
+  TEST_ASSERT_GREATER_THAN_UINT32(0, maxDwell[0]);
+}
+
+// The bottom of a band inside another band is avoided too
+void test_overlapping_bands()
+{
+  TEST_ASSERT_TRUE(axis->addResonanceBand(300, 400));
+  TEST_ASSERT_TRUE(axis->addResonanceBand(250, 320));
+  TEST_ASSERT_FALSE(axis->addResonanceBand(500, 500));
+
+  axis->setSpeed(390 * MICROSTEPS);
+  TEST_ASSERT_EQUAL_UINT32(250 * MICROSTEPS, axis->getTargetSpeed());
+
+  axis->clearResonanceBands();
+  TEST_ASSERT_EQUAL(0, axis->getResonanceBandCount());
+  axis->setSpeed(390 * MICROSTEPS);
+  TEST_ASSERT_EQUAL_UINT32(390 * MICROSTEPS, axis->getTargetSpeed());
+}
+
+// The bands only clamp the cruise speed, the requested one comes back once
+// they are removed
+void test_speed_restored_without_bands()
+{
+  ResonanceBand_t bands[SC_MAX_RESONANCE_BANDS] = {{300, 400}};
+
+  addBands();
+  axis->setSpeed(350 * MICROSTEPS);
+  TEST_ASSERT_EQUAL_UINT32(300 * MICROSTEPS, axis->getTargetSpeed());
+  TEST_ASSERT_EQUAL_UINT32(350 * MICROSTEPS, axis->getRequestedSpeed());
+
+  axis->clearResonanceBands();
+  TEST_ASSERT_EQUAL_UINT32(350 * MICROSTEPS, axis->getTargetSpeed());
+
+  axis->setResonanceBands(bands);
+  TEST_ASSERT_EQUAL_UINT32(300 * MICROSTEPS, axis->getTargetSpeed());
+  bands[0].high = 320;
+  axis->setResonanceBands(bands);
+  TEST_ASSERT_EQUAL_UINT32(350 * MICROSTEPS, axis->getTargetSpeed());
+}
+
+// With an acceleration limit the bands are crossed at the limit
+void test_cross_bands_at_acceleration_limit()
+{
+  int i;
+
+  axis->setAccelerationLimit(4 * ACCELERATION / MICROSTEPS);
+  TEST_ASSERT_EQUAL_UINT32(ACCELERATION, axis->getAcceleration());
+  addBands();
+  axis->setSpeed(800 * MICROSTEPS);
+
+  moveBy(200000);
+  moveBy(-200000);
+  for (i = 0; i < BAND_COUNT; i++)
+  {
+    TEST_ASSERT_GREATER_THAN_UINT32(0, maxDwell[i]);
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(crossingTime(i) / 3, maxDwell[i]);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_cruise_without_bands);
+  RUN_TEST(test_speed_inside_band);
+  RUN_TEST(test_cross_bands);
+  RUN_TEST(test_short_moves);
+  RUN_TEST(test_overlapping_bands);
+  RUN_TEST(test_speed_restored_without_bands);
+  RUN_TEST(test_cross_bands_at_acceleration_limit);
+  return UNITY_END();
+}
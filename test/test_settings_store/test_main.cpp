@@ -0,0 +1,268 @@
+/*
+test_main.cpp - - Checksum and write coalescing of SettingsStore
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include "SettingsStore.h"
+#include "FileSettingsStorage.h"
+
+#define SETTINGS_FILE "test_settings_store.bin"
+#define TASK_PERIOD 100 // ms, like the settings task of the firmware
+
+static FileSettingsStorage storage(SETTINGS_FILE);
+static FocuserSettings_t settings;
+
+// Run the settings task for the given time with the current settings
+static void run(SettingsStore *store, unsigned long ms)
+{
+  unsigned long i;
+
+  for (i = 0; i < ms; i += TASK_PERIOD)
+  {
+    store->update(&settings);
+    store->Manage();
+    delay(TASK_PERIOD);
+  }
+}
+
+void setUp(void)
+{
+  mock::reset();
+  storage.erase();
+  storage.writeCount = 0;
+  storage.writeFails = false;
+  memset(&settings, 0, sizeof(settings));
+  settings.currentPosition = 1000;
+  settings.speed = 200;
+  settings.stepMode = 16;
+  settings.speedLimit = 800;
+  settings.acceleration = 50;
+}
+
+void tearDown(void)
+{
+  storage.erase();
+}
+
+// A reboot reads back what was written
+void test_round_trip(void)
+{
+  SettingsStore store(&storage);
+  SettingsStore rebooted(&storage);
+
+  TEST_ASSERT_FALSE(store.load());
+  store.update(&settings);
+  TEST_ASSERT_TRUE(store.flush());
+
+  TEST_ASSERT_TRUE(rebooted.load());
+  TEST_ASSERT_EQUAL(1000, rebooted.getSettings()->currentPosition);
+  TEST_ASSERT_EQUAL(200, rebooted.getSettings()->speed);
+  TEST_ASSERT_EQUAL(800, rebooted.getSettings()->speedLimit);
+  TEST_ASSERT_FALSE(rebooted.isDirty());
+}
+
+// Any flipped bit, an old version or a short blob keep the defaults
+void test_checksum_rejects_damaged_blob(void)
+{
+  SettingsStore store(&storage);
+  long offset;
+
+  store.load();
+  store.update(&settings);
+  TEST_ASSERT_TRUE(store.flush());
+
+  for (offset = 0; offset < (long)sizeof(FocuserSettings_t); offset += 13)
+  {
+    SettingsStore rebooted(&storage);
+
+    storage.corrupt(offset);
+    TEST_ASSERT_FALSE(rebooted.load());
+    storage.corrupt(offset);
+    TEST_ASSERT_TRUE(rebooted.load());
+  }
+
+  {
+    SettingsStore rebooted(&storage);
+    FocuserSettings_t old = *store.getSettings();
+    FILE *file = fopen(SETTINGS_FILE, "wb");
+
+    // Valid checksum but an older layout
+    old.version = SETTINGS_VERSION - 1;
+    fwrite(&old, 1, sizeof(old), file);
+    fclose(file);
+    TEST_ASSERT_FALSE(rebooted.load());
+
+    file = fopen(SETTINGS_FILE, "wb");
+    fwrite(&old, 1, sizeof(old) / 2, file);
+    fclose(file);
+    TEST_ASSERT_FALSE(rebooted.load());
+  }
+}
+
+// A burst of changes gives a single write once they stop
+void test_debounce(void)
+{
+  SettingsStore store(&storage);
+  int i;
+
+  store.load();
+  for (i = 0; i < 20; i++)
+  {
+    settings.speed = 200 + i;
+    run(&store, 500);
+  }
+  TEST_ASSERT_EQUAL(0, storage.writeCount);
+  TEST_ASSERT_TRUE(store.isDirty());
+
+  // The last change was 500 ms ago
+  run(&store, SETTINGS_DEBOUNCE_TIME - 500 - TASK_PERIOD);
+  TEST_ASSERT_EQUAL(0, storage.writeCount);
+  run(&store, 2 * TASK_PERIOD);
+  TEST_ASSERT_EQUAL(1, storage.writeCount);
+  TEST_ASSERT_FALSE(store.isDirty());
+
+  // The next change waits for the minimum interval
+  settings.speed = 300;
+  run(&store, SETTINGS_DEBOUNCE_TIME + 2 * TASK_PERIOD);
+  TEST_ASSERT_EQUAL(1, storage.writeCount);
+  run(&store, SETTINGS_MIN_WRITE_INTERVAL);
+  TEST_ASSERT_EQUAL(2, storage.writeCount);
+
+  // Nothing changed: nothing written
+  run(&store, 5 * SETTINGS_MIN_WRITE_INTERVAL);
+  TEST_ASSERT_EQUAL(2, storage.writeCount);
+}
+
+// A failed write is retried after the minimum interval
+void test_failed_write_is_retried(void)
+{
+  SettingsStore store(&storage);
+
+  store.load();
+  storage.writeFails = true;
+  settings.speed = 300;
+  run(&store, SETTINGS_DEBOUNCE_TIME + 2 * TASK_PERIOD);
+  TEST_ASSERT_EQUAL(1, storage.writeCount);
+  TEST_ASSERT_TRUE(store.isDirty());
+
+  storage.writeFails = false;
+  run(&store, SETTINGS_MIN_WRITE_INTERVAL - 2 * TASK_PERIOD);
+  TEST_ASSERT_EQUAL(1, storage.writeCount);
+  run(&store, 3 * TASK_PERIOD);
+  TEST_ASSERT_EQUAL(2, storage.writeCount);
+  TEST_ASSERT_FALSE(store.isDirty());
+}
+
+// The position is written shortly after each move: a power cut right
+// after it still restores it
+void test_position_is_written_after_each_move(void)
+{
+  SettingsStore store(&storage);
+  int i;
+
+  store.load();
+  store.update(&settings);
+  store.flush();
+  storage.writeCount = 0;
+
+  // A move every 20 s
+  for (i = 0; i < 10; i++)
+  {
+    SettingsStore rebooted(&storage);
+
+    settings.currentPosition += 5;
+    run(&store, SETTINGS_DEBOUNCE_TIME - TASK_PERIOD);
+    TEST_ASSERT_TRUE(store.isPositionDirty());
+    run(&store, 2 * TASK_PERIOD);
+    TEST_ASSERT_FALSE(store.isPositionDirty());
+    TEST_ASSERT_FALSE(store.isDirty());
+    TEST_ASSERT_TRUE(rebooted.load());
+    TEST_ASSERT_EQUAL(settings.currentPosition, rebooted.getSettings()->currentPosition);
+    run(&store, 20000 - SETTINGS_DEBOUNCE_TIME - TASK_PERIOD);
+  }
+  TEST_ASSERT_EQUAL(10, storage.writeCount);
+}
+
+// The moves of an autofocus run give a single write once they stop
+void test_position_burst_gives_one_write(void)
+{
+  SettingsStore store(&storage);
+  int i;
+
+  store.load();
+  store.update(&settings);
+  store.flush();
+  storage.writeCount = 0;
+
+  for (i = 0; i < 30; i++)
+  {
+    settings.currentPosition += 20;
+    run(&store, 1000);
+  }
+  TEST_ASSERT_EQUAL(0, storage.writeCount);
+  run(&store, SETTINGS_DEBOUNCE_TIME);
+  TEST_ASSERT_EQUAL(1, storage.writeCount);
+
+  // A failed position write is retried after the minimum interval
+  storage.writeFails = true;
+  settings.currentPosition += 20;
+  run(&store, SETTINGS_DEBOUNCE_TIME + TASK_PERIOD);
+  TEST_ASSERT_EQUAL(2, storage.writeCount);
+  storage.writeFails = false;
+  run(&store, SETTINGS_MIN_WRITE_INTERVAL - 2 * TASK_PERIOD);
+  TEST_ASSERT_EQUAL(2, storage.writeCount);
+  run(&store, 3 * TASK_PERIOD);
+  TEST_ASSERT_EQUAL(3, storage.writeCount);
+  TEST_ASSERT_FALSE(store.isPositionDirty());
+}
+
+// Another setting carries the position with it
+void test_position_written_with_settings(void)
+{
+  SettingsStore store(&storage);
+  SettingsStore rebooted(&storage);
+
+  store.load();
+  store.update(&settings);
+  store.flush();
+  storage.writeCount = 0;
+
+  settings.currentPosition = 2500;
+  settings.speedLimit = 900;
+  run(&store, SETTINGS_MIN_WRITE_INTERVAL + 2 * TASK_PERIOD);
+  TEST_ASSERT_EQUAL(1, storage.writeCount);
+  TEST_ASSERT_FALSE(store.isPositionDirty());
+  TEST_ASSERT_TRUE(rebooted.load());
+  TEST_ASSERT_EQUAL(2500, rebooted.getSettings()->currentPosition);
+  TEST_ASSERT_EQUAL(900, rebooted.getSettings()->speedLimit);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_checksum_rejects_damaged_blob);
+  RUN_TEST(test_debounce);
+  RUN_TEST(test_failed_write_is_retried);
+  RUN_TEST(test_position_is_written_after_each_move);
+  RUN_TEST(test_position_burst_gives_one_write);
+  RUN_TEST(test_position_written_with_settings);
+  return UNITY_END();
+}
@@ -0,0 +1,272 @@
+/*
+test_main.cpp - - Slew of StepperControl: speed, position and predicted time
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include "StepperControl.h"
+#include "TMC2209.h"
+#include "Tmc2209Model.h"
+
+#define STEP_PIN 2
+#define DIRECTION_PIN 3
+#define LOOP_PERIOD 2 // us between two calls of Manage()
+#define MOVE_TIMEOUT 60000000UL // us
+
+// Longest pause of the step train at a resolution switch: one write
+// datagram, the setup time and the loop period
+#define MAX_SWITCH_PAUSE (TMC2209_WRITE_DATAGRAM_SIZE * 87 + SC_STEP_MODE_SETUP_TIME + 2 * LOOP_PERIOD)
+
+typedef struct
+{
+  unsigned long duration;     // us
+  unsigned long maxSpeedStep; // Largest change of the ramp speed
+  unsigned long maxPause;     // Longest step interval beyond its neighbours, us
+  unsigned long slewSteps;
+  unsigned int approachMaxSpeed; // Highest speed after the slew
+  long remainingTimeError;    // getRemainingMoveTime() at midway - actual, ms
+} MoveReport_t;
+
+static TMC2209 *driver;
+static Tmc2209Model *model;
+
+static StepperControl *createMotor()
+{
+  StepperControl *motor = new StepperControl(STEP_PIN, DIRECTION_PIN, SC_NO_PIN, SC_NO_PIN, SC_NO_PIN,
+                                             SC_NO_PIN, SC_NO_PIN, SC_NO_PIN);
+
+  driver = new TMC2209(&Serial1, 0);
+  model = new Tmc2209Model(&Serial1, 0, STEP_PIN, DIRECTION_PIN);
+  TEST_ASSERT_TRUE(driver->init(TMC2209_DEFAULT_BAUDRATE, 16, 17));
+  model->isTimed = true;
+  motor->setDriver(driver);
+  motor->setStepMode(SC_32TH_STEP);
+  motor->setSlewStepMode(SC_8TH_STEP);
+  motor->setMoveMode(SC_MOVEMODE_SMOOTH);
+  motor->setAcceleration(1000);
+  motor->setSpeed(8000);
+  // Only the switches of the moves are counted
+  while (!driver->isBusIdle() || driver->isDirty())
+  {
+    driver->Manage();
+    mock::advanceMicros(LOOP_PERIOD);
+  }
+  model->getRegister(TMC2209_REG_CHOPCONF);
+  model->resolutionSwitchTimestamps.clear();
+  return motor;
+}
+
+// Run the move like the motion task, with an optional change at midway
+static MoveReport_t runMove(StepperControl *motor, long target, void (*atMidway)(StepperControl *))
+{
+  MoveReport_t report = {0, 0, 0, 0, 0, 0};
+  unsigned long start;
+  unsigned long lastEdges = mock::pinRisingEdges[STEP_PIN];
+  unsigned long stepTimestamp = 0;
+  unsigned long previousGap = 0;
+  unsigned long pendingGap = 0;
+  unsigned int lastSpeed = 0;
+  unsigned long midwayTimestamp = 0;
+  long midwayPrediction = 0;
+  bool slewWasSeen = false;
+  long startPosition = motor->getCurrentPosition();
+  unsigned long gap;
+
+  motor->setTargetPosition(target);
+  motor->goToTargetPosition();
+  start = micros();
+  while (motor->isInMove() && (micros() - start) < MOVE_TIMEOUT)
+  {
+    driver->Manage();
+    motor->Manage();
+    if (mock::pinRisingEdges[STEP_PIN] != lastEdges)
+    {
+      lastEdges = mock::pinRisingEdges[STEP_PIN];
+      if (stepTimestamp != 0)
+      {
+        gap = micros() - stepTimestamp;
+        // A pause is a gap longer than the ones around it
+        if (pendingGap > previousGap + MAX_SWITCH_PAUSE / 2 && pendingGap > gap + MAX_SWITCH_PAUSE / 2)
+        {
+          report.maxPause = max(report.maxPause, pendingGap - max(previousGap, gap));
+        }
+        previousGap = pendingGap;
+        pendingGap = gap;
+      }
+      stepTimestamp = micros();
+      if (motor->isSlewing())
+      {
+        report.slewSteps++;
+      }
+    }
+    if (motor->isSlewing())
+    {
+      slewWasSeen = true;
+    }
+    else if (slewWasSeen && motor->isInMove())
+    {
+      report.approachMaxSpeed = max(report.approachMaxSpeed, motor->getSpeed());
+    }
+    if (motor->isInMove())
+    {
+      report.maxSpeedStep = max(report.maxSpeedStep, (unsigned long)abs((long)motor->getSpeed() - (long)lastSpeed));
+      lastSpeed = motor->getSpeed();
+    }
+    if (midwayTimestamp == 0 && abs(motor->getCurrentPosition() - startPosition) >= abs(target - startPosition) / 2)
+    {
+      midwayTimestamp = micros();
+      midwayPrediction = motor->getRemainingMoveTime();
+      if (atMidway != NULL)
+      {
+        atMidway(motor);
+      }
+    }
+    mock::advanceMicros(LOOP_PERIOD);
+  }
+  report.duration = micros() - start;
+  report.remainingTimeError = midwayPrediction - (long)((micros() - midwayTimestamp) / 1000);
+  return report;
+}
+
+void setUp(void)
+{
+  mock::reset();
+  Serial1.reset();
+}
+
+void tearDown(void)
+{
+}
+
+void test_slew_keeps_the_physical_position(void)
+{
+  StepperControl *motor = createMotor();
+  MoveReport_t report = runMove(motor, 100000, NULL);
+
+  TEST_ASSERT_FALSE(motor->isInMove());
+  TEST_ASSERT_FALSE(motor->isSlewing());
+  TEST_ASSERT_EQUAL(100000, motor->getCurrentPosition());
+  TEST_ASSERT_GREATER_THAN(10000, report.slewSteps);
+  // In and out of the slew, each switch exactly on a full step
+  TEST_ASSERT_EQUAL(2, model->resolutionSwitchTimestamps.size());
+  TEST_ASSERT_EQUAL(100000 * (256 / 32), model->position);
+  TEST_ASSERT_EQUAL(32, model->getMicrosteps());
+
+  report = runMove(motor, 3, NULL);
+  TEST_ASSERT_EQUAL(3 * (256 / 32), model->position);
+}
+
+void test_speed_is_continuous_across_the_switches(void)
+{
+  StepperControl *motor = createMotor();
+  MoveReport_t report = runMove(motor, 100000, NULL);
+
+  // The ramp only changes by one increment: no jump when the slew ends
+  TEST_ASSERT_LESS_OR_EQUAL(motor->getAcceleration(), report.maxSpeedStep);
+  TEST_ASSERT_GREATER_THAN(0, report.approachMaxSpeed);
+  TEST_ASSERT_LESS_OR_EQUAL(8000, report.approachMaxSpeed);
+}
+
+void test_step_train_does_not_stop_for_the_driver(void)
+{
+  StepperControl *motor = createMotor();
+  MoveReport_t report = runMove(motor, -100000, NULL);
+
+  TEST_ASSERT_EQUAL(-100000 * (256 / 32), model->position);
+  TEST_ASSERT_EQUAL(2, model->resolutionSwitchTimestamps.size());
+  TEST_ASSERT_LESS_OR_EQUAL(MAX_SWITCH_PAUSE, report.maxPause);
+}
+
+static void lowerSpeed(StepperControl *motor)
+{
+  TEST_ASSERT_TRUE(motor->isSlewing());
+  motor->setSpeed(3000);
+}
+
+static void limitSpeed(StepperControl *motor)
+{
+  TEST_ASSERT_TRUE(motor->isSlewing());
+  motor->setSpeedLimit(50); // 1600 steps per second at 1/32
+}
+
+void test_speed_changed_during_the_slew_is_kept(void)
+{
+  StepperControl *motor = createMotor();
+  MoveReport_t report = runMove(motor, 100000, lowerSpeed);
+
+  TEST_ASSERT_EQUAL(3000, motor->getTargetSpeed());
+  TEST_ASSERT_LESS_OR_EQUAL(3000, report.approachMaxSpeed);
+  TEST_ASSERT_EQUAL(100000 * (256 / 32), model->position);
+}
+
+void test_speed_limit_changed_during_the_slew_is_kept(void)
+{
+  StepperControl *motor = createMotor();
+  MoveReport_t report = runMove(motor, 100000, limitSpeed);
+
+  TEST_ASSERT_EQUAL(1600, motor->getTargetSpeed());
+  TEST_ASSERT_LESS_OR_EQUAL(1600, report.approachMaxSpeed);
+}
+
+// Predicted against simulated time, with and without slew
+static void checkPrediction(StepperControl *motor, long distance)
+{
+  unsigned long predicted = motor->predictMoveTime(distance);
+  MoveReport_t report = runMove(motor, motor->getCurrentPosition() + distance, NULL);
+  unsigned long actual = report.duration / 1000;
+  char message[100];
+
+  snprintf(message, sizeof(message), "distance %ld: predicted %lu ms, actual %lu ms, midway error %ld ms",
+           distance, predicted, actual, report.remainingTimeError);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_UINT32_WITHIN(actual / 20 + 50, actual, predicted);
+  TEST_ASSERT_INT_WITHIN((long)actual / 20 + 50, 0, report.remainingTimeError);
+}
+
+void test_predicted_move_time_with_slew(void)
+{
+  StepperControl *motor = createMotor();
+
+  checkPrediction(motor, 100000);
+  checkPrediction(motor, 20000);
+  checkPrediction(motor, -4000);
+}
+
+void test_predicted_move_time_without_slew(void)
+{
+  StepperControl *motor = createMotor();
+
+  motor->setSlewStepMode(SC_NO_STEP_MODE);
+  checkPrediction(motor, 100000);
+  checkPrediction(motor, 20000);
+  checkPrediction(motor, -4000);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_slew_keeps_the_physical_position);
+  RUN_TEST(test_speed_is_continuous_across_the_switches);
+  RUN_TEST(test_step_train_does_not_stop_for_the_driver);
+  RUN_TEST(test_speed_changed_during_the_slew_is_kept);
+  RUN_TEST(test_speed_limit_changed_during_the_slew_is_kept);
+  RUN_TEST(test_predicted_move_time_with_slew);
+  RUN_TEST(test_predicted_move_time_without_slew);
+  return UNITY_END();
+}
@@ -0,0 +1,279 @@
+/*
+test_main.cpp - - Step loss detection with slips injected in a simulated encoder
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+The shaft follows the step pin unless a slip is injected: the next steps
+are then lost (the rotor falls back). The encoder counts the shaft with
+its resolution and a backlash on the reversals, and is read every 1 ms
+like StepLossTask() of the firmware does.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include "StepLossDetector.h"
+#include "StepperControl.h"
+
+#define STEP_PIN 2
+#define DIRECTION_PIN 3
+#define FULL_STEPS_PER_TURN 200
+#define ENCODER_COUNTS 4000 // Per turn
+#define BACKLASH 10         // positions, below the tolerance
+#define CHECK_INTERVAL 1000 // us
+#define LOOP_TIME 10        // us
+#define MOVE_TIMEOUT 60000000UL
+
+static StepperControl *axis;
+static StepLossDetector *detector;
+
+static long shaftPosition;    // Real position of the rotor
+static long encoderPosition;  // Shaft position seen through the backlash
+static long stepsToSlip;      // Next steps lost
+static int encoderSign;       // -1 for an encoder mounted the other way
+static unsigned long lossReports;
+static long lostSteps; // Sum of the corrections
+static unsigned long lastCheck;
+
+static void onPin(uint8_t pin, uint8_t value, void *context)
+{
+  if (pin != STEP_PIN || value != HIGH)
+  {
+    return;
+  }
+  if (stepsToSlip > 0)
+  {
+    stepsToSlip--;
+    return;
+  }
+  // SC_CLOCKWISE: the direction pin is low toward the higher positions
+  shaftPosition += digitalRead(DIRECTION_PIN) == LOW ? 1 : -1;
+  if (shaftPosition > encoderPosition + BACKLASH / 2)
+  {
+    encoderPosition = shaftPosition - BACKLASH / 2;
+  }
+  else if (shaftPosition < encoderPosition - BACKLASH / 2)
+  {
+    encoderPosition = shaftPosition + BACKLASH / 2;
+  }
+}
+
+static long encoderCount()
+{
+  long positionsPerTurn = FULL_STEPS_PER_TURN * StepperControl::getMicrosteps(axis->getStepMode());
+
+  // Whole counts only
+  return encoderSign * (long)((int64_t)encoderPosition * ENCODER_COUNTS / positionsPerTurn);
+}
+
+// StepLossTask() of the firmware
+static void checkSteps()
+{
+  detector->setScale(FULL_STEPS_PER_TURN * StepperControl::getMicrosteps(axis->getStepMode()),
+                     encoderSign * ENCODER_COUNTS);
+  if (detector->update(axis->getCurrentPosition(), encoderCount()))
+  {
+    lossReports++;
+    lostSteps += detector->getError();
+    axis->correctPosition(detector->getMeasuredPosition());
+  }
+}
+
+static void step()
+{
+  axis->Manage();
+  mock::advanceMicros(LOOP_TIME);
+  if (micros() - lastCheck >= CHECK_INTERVAL)
+  {
+    lastCheck = micros();
+    checkSteps();
+  }
+}
+
+static void runFor(unsigned long duration)
+{
+  unsigned long start = micros();
+
+  while (micros() - start < duration)
+  {
+    step();
+  }
+}
+
+static void moveTo(long position)
+{
+  unsigned long start = micros();
+
+  axis->setTargetPosition(position);
+  axis->goToTargetPosition();
+  while (axis->isInMove() && micros() - start < MOVE_TIMEOUT)
+  {
+    step();
+  }
+  TEST_ASSERT_FALSE(axis->isInMove());
+}
+
+// The position counter is right within the backlash and a count, plus
+// the tolerance after a slip (the rest of a slip is not corrected)
+static void assertInStep(long tolerance)
+{
+  TEST_ASSERT_INT_WITHIN(BACKLASH / 2 + 1 + tolerance, shaftPosition, axis->getCurrentPosition());
+}
+
+void setUp()
+{
+  mock::reset();
+  mock::pinListener = onPin;
+  shaftPosition = 0;
+  encoderPosition = 0;
+  stepsToSlip = 0;
+  encoderSign = 1;
+  lossReports = 0;
+  lostSteps = 0;
+  lastCheck = 0;
+  axis = new StepperControl(STEP_PIN, DIRECTION_PIN, SC_NO_PIN, SC_NO_PIN, SC_NO_PIN,
+                            SC_NO_PIN, SC_NO_PIN, SC_NO_PIN);
+  axis->setMoveMode(SC_MOVEMODE_SMOOTH);
+  axis->setStepMode(SC_16TH_STEP);
+  axis->setAcceleration(500);
+  axis->setSpeed(3000);
+  detector = new StepLossDetector();
+  detector->setTolerance(SLD_DEFAULT_TOLERANCE);
+}
+
+void tearDown()
+{
+  delete detector;
+  delete axis;
+}
+
+// Moves back and forth: the backlash and the counts are not a loss
+void test_no_false_loss()
+{
+  int i;
+
+  for (i = 0; i < 10; i++)
+  {
+    moveTo(i % 2 == 0 ? 3000 + 100 * i : 200 * i);
+    runFor(5000);
+    assertInStep(0);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, lossReports);
+  TEST_ASSERT_EQUAL_UINT32(0, detector->getLossCount());
+  TEST_ASSERT_LESS_OR_EQUAL(SLD_DEFAULT_TOLERANCE, detector->getMaxError());
+}
+
+// A slip during the move is corrected, by several reports as the error
+// grows, and the move ends on its target
+void test_slip_during_move()
+{
+  axis->setTargetPosition(8000);
+  axis->goToTargetPosition();
+  runFor(200000);
+  TEST_ASSERT_TRUE(axis->isInMove());
+
+  stepsToSlip = 300;
+  while (axis->isInMove())
+  {
+    step();
+  }
+
+  TEST_ASSERT_GREATER_OR_EQUAL(1, lossReports);
+  TEST_ASSERT_INT_WITHIN(SLD_DEFAULT_TOLERANCE + BACKLASH, -300, lostSteps);
+  assertInStep(SLD_DEFAULT_TOLERANCE);
+  TEST_ASSERT_INT_WITHIN(SLD_DEFAULT_TOLERANCE + BACKLASH, 8000, shaftPosition);
+}
+
+// A slip at rest (e.g. the drawtube pushed) brings the motor back
+void test_slip_at_rest()
+{
+  moveTo(4000);
+  runFor(5000);
+
+  // The load drives the shaft back by 500 positions
+  shaftPosition -= 500;
+  encoderPosition -= 500;
+  runFor(CHECK_INTERVAL * (SLD_DEFAULT_CONFIRMATION_COUNT + 1));
+  TEST_ASSERT_EQUAL_UINT32(1, lossReports);
+  TEST_ASSERT_TRUE(axis->isInMove());
+
+  while (axis->isInMove())
+  {
+    step();
+  }
+  TEST_ASSERT_INT_WITHIN(BACKLASH / 2 + 1, 4000, shaftPosition);
+  TEST_ASSERT_INT_WITHIN(BACKLASH, -500, lostSteps);
+  assertInStep(0);
+}
+
+// Slips shorter than the tolerance, or an error seen on fewer updates than
+// the confirmation count, are not losses
+void test_small_and_short_errors()
+{
+  axis->setTargetPosition(8000);
+  axis->goToTargetPosition();
+  runFor(100000);
+  stepsToSlip = SLD_DEFAULT_TOLERANCE - BACKLASH;
+  runFor(100000);
+  TEST_ASSERT_EQUAL_UINT32(0, lossReports);
+
+  // Two updates off
+  TEST_ASSERT_FALSE(detector->update(axis->getCurrentPosition() + 1000, encoderCount()));
+  TEST_ASSERT_FALSE(detector->update(axis->getCurrentPosition() + 1000, encoderCount()));
+  while (axis->isInMove())
+  {
+    step();
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, lossReports);
+  TEST_ASSERT_EQUAL_UINT32(0, detector->getLossCount());
+}
+
+// The encoder mounted the other way, and the reference taken again after
+// the position counter is set
+void test_inverted_encoder_and_sync()
+{
+  unsigned long reports;
+  long start;
+
+  encoderSign = -1;
+  moveTo(2000);
+  stepsToSlip = 400;
+  moveTo(5000);
+  reports = lossReports;
+  TEST_ASSERT_GREATER_OR_EQUAL(1, reports);
+  TEST_ASSERT_INT_WITHIN(SLD_DEFAULT_TOLERANCE + BACKLASH, -400, lostSteps);
+  TEST_ASSERT_INT_WITHIN(SLD_DEFAULT_TOLERANCE + BACKLASH, 5000, shaftPosition);
+  start = shaftPosition;
+
+  // Sync: the counter jumps, the detector takes a new reference
+  axis->setCurrentPosition(20000);
+  detector->reset();
+  runFor(10 * CHECK_INTERVAL);
+  moveTo(18000);
+  TEST_ASSERT_EQUAL_UINT32(reports, lossReports);
+  TEST_ASSERT_INT_WITHIN(BACKLASH / 2 + 1, start - 2000, shaftPosition);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_no_false_loss);
+  RUN_TEST(test_slip_during_move);
+  RUN_TEST(test_slip_at_rest);
+  RUN_TEST(test_small_and_short_errors);
+  RUN_TEST(test_inverted_encoder_and_sync);
+  return UNITY_END();
+}
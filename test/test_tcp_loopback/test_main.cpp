@@ -0,0 +1,241 @@
+/*
+test_main.cpp - - Moonlite over TCP loopback sockets and the serial port
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include <string>
+#include "Moonlite.h"
+#include "SocketStream.h"
+
+#define EXCHANGE_TIMEOUT 1000 // ms of real time
+#define DEVICE_COUNT 2
+
+static Moonlite *parser;
+static SocketStream *connection; // Server side, like a WiFiClient slot
+static int client;               // Test side of the socket
+static long positions[DEVICE_COUNT];
+static long targets[DEVICE_COUNT];
+
+// The command processing of the firmware, reduced to a few commands
+static void serve()
+{
+  MoonliteCommand_t command;
+
+  parser->Manage();
+  if (!parser->isNewCommandAvailable())
+  {
+    return;
+  }
+  command = parser->getCommand();
+  if (command.device >= DEVICE_COUNT)
+  {
+    return;
+  }
+  switch (command.commandID)
+  {
+    case ML_GP:
+      parser->setAnswer(4, positions[command.device]);
+      break;
+    case ML_GN:
+      parser->setAnswer(4, targets[command.device]);
+      break;
+    case ML_SN:
+      targets[command.device] = command.parameter;
+      break;
+    case ML_GV:
+      parser->setAnswer(2, (long)0x10);
+      break;
+    case ML_XMP:
+      {
+        long answers[2] = {command.parameters[0], command.parameters[1]};
+        parser->setAnswer(8, answers, 2);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static void sendText(int socket, const char *text)
+{
+  TEST_ASSERT_EQUAL(strlen(text), send(socket, text, strlen(text), MSG_NOSIGNAL));
+}
+
+// Serve until the socket received the expected number of caracters
+static std::string receive(int socket, size_t length)
+{
+  std::string text;
+  struct pollfd descriptor = {socket, POLLIN, 0};
+  char buffer[64];
+  ssize_t count;
+  int i;
+
+  for (i = 0; i < EXCHANGE_TIMEOUT && text.size() < length; i++)
+  {
+    serve();
+    if (poll(&descriptor, 1, 1) > 0)
+    {
+      count = recv(socket, buffer, sizeof(buffer), 0);
+      if (count <= 0)
+      {
+        break;
+      }
+      text.append(buffer, count);
+    }
+  }
+  return text;
+}
+
+// Serve for a few ms of real time, the segments sent are received meanwhile
+static void pump(int ms)
+{
+  int i;
+
+  for (i = 0; i < ms; i++)
+  {
+    serve();
+    usleep(1000);
+  }
+}
+
+static std::string serialAnswer()
+{
+  std::string text(Serial.tx.begin(), Serial.tx.end());
+
+  Serial.tx.clear();
+  return text;
+}
+
+void setUp(void)
+{
+  int serverSide;
+
+  mock::reset();
+  Serial.reset();
+  parser = new Moonlite();
+  parser->init(9600);
+  connection = new SocketStream();
+  TEST_ASSERT_TRUE(openLoopback(&serverSide, &client));
+  connection->attach(serverSide);
+  TEST_ASSERT_TRUE(parser->addTransport(connection));
+  positions[0] = 0x1234;
+  positions[1] = 0x0BCD;
+  targets[0] = 0;
+  targets[1] = 0;
+}
+
+void tearDown(void)
+{
+  close(client);
+  delete connection;
+  delete parser;
+}
+
+// A command over TCP is answered over TCP, in one write
+void test_round_trip(void)
+{
+  unsigned long writes = connection->writeCallCount;
+
+  sendText(client, ":GP#");
+  TEST_ASSERT_EQUAL_STRING("1234#", receive(client, 5).c_str());
+  TEST_ASSERT_EQUAL(writes + 1, connection->writeCallCount);
+  TEST_ASSERT_EQUAL(0, Serial.tx.size());
+}
+
+// A command split over several segments is put together
+void test_fragmented_command(void)
+{
+  const char *command = ":SN0F00#";
+  int i;
+
+  for (i = 0; command[i] != 0; i++)
+  {
+    send(client, &command[i], 1, MSG_NOSIGNAL);
+    pump(2);
+  }
+  sendText(client, ":GN#");
+  TEST_ASSERT_EQUAL_STRING("0F00#", receive(client, 5).c_str());
+}
+
+// Several commands in one segment, with device prefixes, are answered in order
+void test_pipelined_commands(void)
+{
+  sendText(client, ":GP#:2GP#:GV#:XMP1A,2B#:2SN0042#:2GN#");
+  TEST_ASSERT_EQUAL_STRING("1234#0BCD#10#0000001A,0000002B#0042#",
+                           receive(client, 36).c_str());
+  TEST_ASSERT_EQUAL(0, targets[0]);
+}
+
+// The serial port and the socket are served together, each answer goes
+// back on its own transport
+void test_serial_and_tcp_interleaved(void)
+{
+  std::string tcp;
+  int i;
+
+  for (i = 0; i < 20; i++)
+  {
+    Serial.inject(":GP#");
+    sendText(client, ":2GP#");
+  }
+  tcp = receive(client, 20 * 5);
+  for (i = 0; i < 100 && Serial.tx.size() < 20 * 5; i++)
+  {
+    serve();
+  }
+  TEST_ASSERT_EQUAL(20 * 5, tcp.size());
+  for (i = 0; i < 20; i++)
+  {
+    TEST_ASSERT_EQUAL_STRING("0BCD#", tcp.substr(5 * i, 5).c_str());
+  }
+  TEST_ASSERT_EQUAL(20 * 5, Serial.tx.size());
+  TEST_ASSERT_EQUAL_STRING("1234#", serialAnswer().substr(0, 5).c_str());
+}
+
+// A client closing in the middle of a command: the next connection in the
+// slot starts with a clean input buffer
+void test_reconnection(void)
+{
+  int serverSide;
+
+  sendText(client, ":SN12");
+  pump(5);
+  close(client);
+  pump(5);
+  TEST_ASSERT_FALSE(connection->connected());
+
+  TEST_ASSERT_TRUE(openLoopback(&serverSide, &client));
+  connection->attach(serverSide);
+  parser->resetClient(1);
+  sendText(client, "34#:GP#");
+  TEST_ASSERT_EQUAL_STRING("1234#", receive(client, 5).c_str());
+  TEST_ASSERT_EQUAL(0, targets[0]);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_fragmented_command);
+  RUN_TEST(test_pipelined_commands);
+  RUN_TEST(test_serial_and_tcp_interleaved);
+  RUN_TEST(test_reconnection);
+  return UNITY_END();
+}
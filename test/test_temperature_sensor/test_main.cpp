@@ -0,0 +1,206 @@
+/*
+test_main.cpp - - Conversion state machine of TemperatureSensor
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include "TemperatureSensor.h"
+
+// Sensor whose conversion takes a configurable time. Like the DS18B20 bus
+// transfers, the conversion only progresses while the sensor is not paused.
+class MockSensor : public TemperatureSensor
+{
+ public:
+  MockSensor(unsigned long conversionDelay)
+  {
+    this->conversionDelay = conversionDelay;
+    this->value = 20.0;
+    this->readFails = false;
+    this->conversionCount = 0;
+    this->start = 0;
+    this->activeTime = 0;
+  }
+  bool init()
+  {
+    return true;
+  }
+  unsigned long conversionDelay; // ms
+  float value;
+  bool readFails;
+  int conversionCount;
+  unsigned long activeTime; // ms run while not paused
+
+ protected:
+  void beginConversion()
+  {
+    this->start = this->activeTime;
+    this->conversionCount++;
+  }
+  bool isConversionDone()
+  {
+    return (this->activeTime - this->start) >= this->conversionDelay;
+  }
+  bool readConversion(float *temperature)
+  {
+    *temperature = this->value;
+    return !this->readFails;
+  }
+
+ private:
+  unsigned long start;
+};
+
+// Call Manage() every millisecond for the given time
+static void run(MockSensor *sensor, unsigned long ms)
+{
+  unsigned long i;
+
+  for (i = 0; i < ms; i++)
+  {
+    sensor->Manage();
+    delay(1);
+    if (!sensor->isPaused())
+    {
+      sensor->activeTime++;
+    }
+  }
+}
+
+void setUp(void)
+{
+  mock::reset();
+}
+
+void tearDown(void)
+{
+}
+
+void test_conversion_completes_after_its_delay(void)
+{
+  MockSensor sensor(750);
+
+  sensor.setCompensationValue(-0.5);
+  sensor.setConversionInterval(5000);
+  sensor.Manage();
+  TEST_ASSERT_TRUE(sensor.isConverting());
+  run(&sensor, 740);
+  TEST_ASSERT_FALSE(sensor.hasTemperature());
+  run(&sensor, 20);
+  TEST_ASSERT_TRUE(sensor.hasTemperature());
+  TEST_ASSERT_FALSE(sensor.isConverting());
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 19.5, sensor.getTemperature());
+  TEST_ASSERT_EQUAL(0, sensor.getConversionErrorCount());
+}
+
+void test_manage_never_waits_for_the_sensor(void)
+{
+  MockSensor sensor(750);
+  unsigned long before;
+
+  sensor.setConversionInterval(1000);
+  before = micros();
+  sensor.Manage();
+  sensor.Manage();
+  TEST_ASSERT_EQUAL(before, micros());
+}
+
+void test_next_conversion_starts_after_the_interval(void)
+{
+  MockSensor sensor(100);
+
+  sensor.setConversionInterval(1000);
+  run(&sensor, 150);
+  TEST_ASSERT_EQUAL(1, sensor.conversionCount);
+  run(&sensor, 900);
+  TEST_ASSERT_EQUAL(1, sensor.conversionCount);
+  run(&sensor, 200);
+  TEST_ASSERT_EQUAL(2, sensor.conversionCount);
+}
+
+void test_slow_sensor_times_out_and_keeps_the_last_reading(void)
+{
+  MockSensor sensor(100);
+
+  sensor.setConversionInterval(1000);
+  sensor.setConversionTimeout(500);
+  run(&sensor, 150);
+  TEST_ASSERT_TRUE(sensor.hasTemperature());
+  sensor.conversionDelay = 5000;
+  sensor.value = 30.0;
+  run(&sensor, 1600);
+  TEST_ASSERT_EQUAL(1, sensor.getConversionErrorCount());
+  TEST_ASSERT_FALSE(sensor.isConverting());
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 20.0, sensor.getTemperature());
+}
+
+void test_failed_read_is_counted(void)
+{
+  MockSensor sensor(100);
+
+  sensor.readFails = true;
+  sensor.setConversionInterval(1000);
+  run(&sensor, 150);
+  TEST_ASSERT_FALSE(sensor.hasTemperature());
+  TEST_ASSERT_EQUAL(1, sensor.getConversionErrorCount());
+}
+
+void test_pause_is_not_counted_in_the_timeout(void)
+{
+  MockSensor sensor(800);
+
+  sensor.setConversionInterval(5000);
+  sensor.setConversionTimeout(1000);
+  run(&sensor, 500);
+  sensor.setPaused(true);
+  run(&sensor, 3000);
+  TEST_ASSERT_TRUE(sensor.isConverting());
+  sensor.setPaused(false);
+  // 500 ms of the conversion done: the 3 s of pause do not time it out
+  run(&sensor, 1);
+  TEST_ASSERT_TRUE(sensor.isConverting());
+  TEST_ASSERT_EQUAL(0, sensor.getConversionErrorCount());
+  run(&sensor, 400);
+  TEST_ASSERT_TRUE(sensor.hasTemperature());
+  TEST_ASSERT_EQUAL(0, sensor.getConversionErrorCount());
+}
+
+void test_time_to_next_conversion(void)
+{
+  MockSensor sensor(100);
+
+  sensor.setConversionInterval(1000);
+  TEST_ASSERT_EQUAL(0, sensor.getTimeToNextConversion());
+  run(&sensor, 200);
+  TEST_ASSERT_UINT32_WITHIN(2, 900, sensor.getTimeToNextConversion());
+  sensor.setConversionInterval(0);
+  TEST_ASSERT_EQUAL(TS_NO_DEADLINE, sensor.getTimeToNextConversion());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_conversion_completes_after_its_delay);
+  RUN_TEST(test_manage_never_waits_for_the_sensor);
+  RUN_TEST(test_next_conversion_starts_after_the_interval);
+  RUN_TEST(test_slow_sensor_times_out_and_keeps_the_last_reading);
+  RUN_TEST(test_failed_read_is_counted);
+  RUN_TEST(test_pause_is_not_counted_in_the_timeout);
+  RUN_TEST(test_time_to_next_conversion);
+  return UNITY_END();
+}
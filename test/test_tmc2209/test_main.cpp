@@ -0,0 +1,309 @@
+/*
+test_main.cpp - - Register writes, CRC and IFCNT check of TMC2209
+
+This file is part of the ESP32 focuser tests.
+
+The tests are free software: you can redistribute them and/or modify
+them under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The tests are distributed in the hope that they will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with the tests.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+#include "TMC2209.h"
+#include "Tmc2209Model.h"
+
+#define STEP_PIN 2
+#define DIRECTION_PIN 3
+#define ADDRESS 1
+#define LOOP_PERIOD 10 // us between two calls of Manage()
+#define SETTLE_TIMEOUT 100000UL // us
+
+static const uint8_t Registers[TMC2209_SHADOW_COUNT] = {
+  TMC2209_REG_GCONF, TMC2209_REG_IHOLD_IRUN, TMC2209_REG_TPOWERDOWN,
+  TMC2209_REG_TPWMTHRS, TMC2209_REG_TCOOLTHRS, TMC2209_REG_SGTHRS,
+  TMC2209_REG_COOLCONF, TMC2209_REG_CHOPCONF, TMC2209_REG_PWMCONF};
+
+static TMC2209 *driver;
+static Tmc2209Model *model;
+
+// Call Manage() until the writes and their IFCNT check are done
+static void settle()
+{
+  unsigned long start = micros();
+
+  do
+  {
+    driver->Manage();
+    mock::advanceMicros(LOOP_PERIOD);
+  } while ((!driver->isBusIdle() || driver->isDirty() || driver->getStatusTimestamp(TMC2209_STATUS_IFCNT) == 0 ||
+            (micros() - start) < 2 * TMC2209_READ_TIMEOUT * 1000UL) &&
+           (micros() - start) < SETTLE_TIMEOUT);
+}
+
+static void assertChipMatchesShadow()
+{
+  int i;
+
+  for (i = 0; i < TMC2209_SHADOW_COUNT; i++)
+  {
+    TEST_ASSERT_EQUAL(driver->getShadowRegister(i), model->getRegister(Registers[i]));
+  }
+}
+
+// init() reads blocking on the untimed model, the clock only moves after:
+// let its batch leave the wire before the answers are timed
+static void initDriver()
+{
+  TEST_ASSERT_TRUE(driver->init(TMC2209_DEFAULT_BAUDRATE, 16, 17));
+  mock::advanceMicros(driver->getTransmitEndTimestamp() - micros());
+  model->isTimed = true;
+}
+
+static void advanceClock(HardwareSerial *port, void *context)
+{
+  mock::advanceMicros(100);
+}
+
+void setUp(void)
+{
+  mock::reset();
+  Serial1.reset();
+  driver = new TMC2209(&Serial1, ADDRESS);
+  model = new Tmc2209Model(&Serial1, ADDRESS, STEP_PIN, DIRECTION_PIN);
+}
+
+void tearDown(void)
+{
+  delete driver;
+  delete model;
+}
+
+// CRC8 with the polynomial 0x07 over the bytes sent LSB first, computed
+// the textbook way on bit reversed bytes
+static uint8_t referenceCrc(const uint8_t *data, int length)
+{
+  uint8_t crc = 0;
+  uint8_t reversed;
+  int i;
+  int j;
+
+  for (i = 0; i < length; i++)
+  {
+    reversed = 0;
+    for (j = 0; j < 8; j++)
+    {
+      reversed |= ((data[i] >> j) & 0x01) << (7 - j);
+    }
+    crc ^= reversed;
+    for (j = 0; j < 8; j++)
+    {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+void test_crc(void)
+{
+  uint8_t datagram[TMC2209_WRITE_DATAGRAM_SIZE - 1];
+  int i;
+  int j;
+
+  srand(1);
+  for (i = 0; i < 1000; i++)
+  {
+    for (j = 0; j < TMC2209_WRITE_DATAGRAM_SIZE - 1; j++)
+    {
+      datagram[j] = rand() & 0xFF;
+    }
+    TEST_ASSERT_EQUAL(referenceCrc(datagram, 3), TMC2209::computeCrc(datagram, 3));
+    TEST_ASSERT_EQUAL(referenceCrc(datagram, 7), TMC2209::computeCrc(datagram, 7));
+  }
+  TEST_ASSERT_EQUAL(0, TMC2209::computeCrc(datagram, 0));
+}
+
+// init() writes every register once in a single batch, then checks IFCNT
+void test_init_writes_all_registers(void)
+{
+  initDriver();
+  TEST_ASSERT_EQUAL(TMC2209_SHADOW_COUNT, driver->getWriteCount());
+  settle();
+
+  TEST_ASSERT_EQUAL(0, model->crcErrorCount);
+  TEST_ASSERT_EQUAL(0, driver->getErrorCount());
+  TEST_ASSERT_EQUAL(TMC2209_SHADOW_COUNT, model->ifcnt);
+  TEST_ASSERT_EQUAL(TMC2209_SHADOW_COUNT, driver->getStatusRegister(TMC2209_STATUS_IFCNT));
+  TEST_ASSERT_FALSE(driver->isDirty());
+  assertChipMatchesShadow();
+}
+
+// The setters do not touch the bus, the next flush writes only the
+// registers which changed, back to back
+void test_setters_are_batched(void)
+{
+  unsigned long start;
+  size_t sent;
+
+  initDriver();
+  settle();
+  sent = Serial1.tx.size();
+
+  driver->setMicrosteps(4);
+  driver->setRunCurrent(600);
+  driver->setStallGuardThreshold(40);
+  driver->setStallGuardThreshold(50);
+  TEST_ASSERT_EQUAL(sent, Serial1.tx.size());
+  TEST_ASSERT_TRUE(driver->isDirty());
+
+  start = micros();
+  driver->flush();
+  // CHOPCONF, IHOLD_IRUN, SGTHRS and GCONF (I_SCALE_ANALOG off)
+  TEST_ASSERT_EQUAL(sent + 4 * TMC2209_WRITE_DATAGRAM_SIZE, Serial1.tx.size());
+  TEST_ASSERT_EQUAL(start + 4 * TMC2209_WRITE_DATAGRAM_SIZE * (1000000UL * TMC2209_BITS_PER_BYTE / TMC2209_DEFAULT_BAUDRATE),
+                    driver->getTransmitEndTimestamp());
+  TEST_ASSERT_FALSE(driver->isBusIdle());
+  settle();
+
+  TEST_ASSERT_EQUAL(TMC2209_SHADOW_COUNT + 4, model->ifcnt);
+  TEST_ASSERT_EQUAL(0, driver->getErrorCount());
+  TEST_ASSERT_EQUAL(4, model->getMicrosteps());
+  TEST_ASSERT_EQUAL(50, model->getRegister(TMC2209_REG_SGTHRS));
+  assertChipMatchesShadow();
+
+  // Nothing changed: nothing sent
+  sent = Serial1.tx.size();
+  driver->setMicrosteps(4);
+  settle();
+  TEST_ASSERT_EQUAL(sent, Serial1.tx.size());
+}
+
+// A write lost on the wire is found by the IFCNT check and rewritten
+void test_lost_write_is_recovered(void)
+{
+  initDriver();
+  settle();
+
+  model->dropNextWrite = true;
+  driver->setMicrosteps(2);
+  driver->setStallGuardThreshold(20);
+  settle();
+  settle();
+
+  TEST_ASSERT_EQUAL(1, driver->getErrorCount());
+  TEST_ASSERT_FALSE(driver->isDirty());
+  TEST_ASSERT_EQUAL(2, model->getMicrosteps());
+  TEST_ASSERT_EQUAL(20, model->getRegister(TMC2209_REG_SGTHRS));
+  assertChipMatchesShadow();
+}
+
+// A lost echo byte does not keep the bus busy: the writes continue and
+// the IFCNT check still runs
+void test_lost_echo_byte(void)
+{
+  initDriver();
+  settle();
+
+  model->lostEchoCount = 1;
+  driver->setMicrosteps(2);
+  settle();
+  TEST_ASSERT_EQUAL(1, driver->getErrorCount());
+  TEST_ASSERT_TRUE(driver->isBusIdle());
+  TEST_ASSERT_FALSE(driver->isDirty());
+  TEST_ASSERT_EQUAL(2, model->getMicrosteps());
+
+  // The next write goes out and is checked
+  model->dropNextWrite = true;
+  driver->setStallGuardThreshold(20);
+  settle();
+  settle();
+  TEST_ASSERT_EQUAL(2, driver->getErrorCount());
+  TEST_ASSERT_EQUAL(20, model->getRegister(TMC2209_REG_SGTHRS));
+  assertChipMatchesShadow();
+}
+
+// A corrupted answer is counted and not stored
+void test_corrupted_answer_is_rejected(void)
+{
+  initDriver();
+  settle();
+
+  model->registers[TMC2209_REG_SG_RESULT] = 123;
+  model->corruptNextAnswer = true;
+  TEST_ASSERT_TRUE(driver->requestRead(TMC2209_REG_SG_RESULT));
+  settle();
+  TEST_ASSERT_EQUAL(1, driver->getErrorCount());
+  TEST_ASSERT_EQUAL(0, driver->getStatusRegister(TMC2209_STATUS_SG_RESULT));
+
+  TEST_ASSERT_TRUE(driver->requestRead(TMC2209_REG_SG_RESULT));
+  settle();
+  TEST_ASSERT_EQUAL(1, driver->getErrorCount());
+  TEST_ASSERT_EQUAL(123, driver->getStatusRegister(TMC2209_STATUS_SG_RESULT));
+}
+
+// TPWMTHRS and TCOOLTHRS are in 1/256 microstep time: the same at any MRES
+void test_thresholds_do_not_depend_on_microsteps(void)
+{
+  unsigned int microsteps;
+  uint32_t tpwmthrs = 0;
+
+  initDriver();
+  driver->setStealthChopMaxSpeed(250);
+  driver->setCoolStepMinSpeed(100);
+  settle();
+  for (microsteps = 1; microsteps <= 256; microsteps *= 2)
+  {
+    driver->setMicrosteps(microsteps);
+    settle();
+    TEST_ASSERT_EQUAL(microsteps, model->getMicrosteps());
+    TEST_ASSERT_EQUAL(TMC2209_CLOCK_FREQUENCY / (250 * 256), model->getRegister(TMC2209_REG_TPWMTHRS));
+    TEST_ASSERT_EQUAL(TMC2209_CLOCK_FREQUENCY / (100 * 256), model->getRegister(TMC2209_REG_TCOOLTHRS));
+    if (microsteps > 1)
+    {
+      TEST_ASSERT_EQUAL(tpwmthrs, model->getRegister(TMC2209_REG_TPWMTHRS));
+    }
+    tpwmthrs = model->getRegister(TMC2209_REG_TPWMTHRS);
+  }
+  TEST_ASSERT_EQUAL(250, driver->getStealthChopMaxSpeed());
+  TEST_ASSERT_EQUAL(0, driver->getErrorCount());
+}
+
+// Another address on the bus: no answer, standalone mode and no writes
+void test_absent_driver(void)
+{
+  model->isConnected = false;
+  Serial1.poll = advanceClock;
+  TEST_ASSERT_FALSE(driver->init(TMC2209_DEFAULT_BAUDRATE, 16, 17));
+  TEST_ASSERT_FALSE(driver->isPresent());
+  TEST_ASSERT_EQUAL(TMC2209_READ_REQUEST_SIZE, Serial1.tx.size());
+
+  driver->setMicrosteps(8);
+  driver->Manage();
+  driver->flush();
+  TEST_ASSERT_EQUAL(TMC2209_READ_REQUEST_SIZE, Serial1.tx.size());
+  TEST_ASSERT_FALSE(driver->requestRead(TMC2209_REG_DRV_STATUS));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_crc);
+  RUN_TEST(test_init_writes_all_registers);
+  RUN_TEST(test_setters_are_batched);
+  RUN_TEST(test_lost_write_is_recovered);
+  RUN_TEST(test_lost_echo_byte);
+  RUN_TEST(test_corrupted_answer_is_rejected);
+  RUN_TEST(test_thresholds_do_not_depend_on_microsteps);
+  RUN_TEST(test_absent_driver);
+  return UNITY_END();
+}
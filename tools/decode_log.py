@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+"""Decode the binary debug log sent by the focuser on Serial2.
+
+Build the firmware with -DFOCUSER_DEBUG_LOG, then either decode a capture:
+
+    decode_log.py capture.bin
+    decode_log.py < capture.bin
+
+or read the UART directly (needs pyserial):
+
+    decode_log.py --port /dev/ttyUSB1
+
+Each 16 bytes frame is: 0xA5, event (u16), timestamp in us (u32),
+argument1 (i32), argument2 (i32), sum of bytes 1 to 14. All little endian.
+The event ids mirror lib/DebugLog/DebugLog.h.
+"""
+
+import argparse
+import struct
+import sys
+
+FRAME_SIZE = 16
+FRAME_SYNC = 0xA5
+
+EVENTS = {
+    1: ("BOOT", ""),
+    2: ("LOST", "records={0}"),
+    3: ("COMMAND", "id={0} client={1}"),
+    4: ("MOVE_START", "device={0} target={1}"),
+    5: ("MOVE_END", "device={0} position={1}"),
+    6: ("STALL", "device={0} position={1}"),
+    7: ("STEP_LOSS", "error={0} measured={1}"),
+    8: ("WAYPOINT", "device={0} reached={1}"),
+    9: ("SLEEP", "time={0}ms"),
+}
+
+
+def decode_frame(frame):
+    """Return (timestamp, event, argument1, argument2) or None if corrupt."""
+    if frame[0] != FRAME_SYNC or (sum(frame[1:FRAME_SIZE - 1]) & 0xFF) != frame[FRAME_SIZE - 1]:
+        return None
+    event, timestamp, argument1, argument2 = struct.unpack("<HIii", frame[1:FRAME_SIZE - 1])
+    return timestamp, event, argument1, argument2
+
+
+def format_record(timestamp, event, argument1, argument2):
+    name, arguments = EVENTS.get(event, ("EVENT_%d" % event, "{0} {1}"))
+    return "%12.6f %-10s %s" % (timestamp / 1e6, name, arguments.format(argument1, argument2))
+
+
+def decode_stream(read, out):
+    """Decode frames from read(n) until it returns nothing.
+
+    After a corrupt frame the decoder resyncs on the next 0xA5 byte.
+    """
+    buffer = bytearray()
+    skipped = 0
+    while True:
+        data = read(256)
+        if not data:
+            break
+        buffer += data
+        while len(buffer) >= FRAME_SIZE:
+            record = decode_frame(buffer[:FRAME_SIZE])
+            if record is None:
+                del buffer[0]
+                skipped += 1
+                continue
+            if skipped:
+                out.write("%12s %-10s bytes=%d\n" % ("", "RESYNC", skipped))
+                skipped = 0
+            out.write(format_record(*record) + "\n")
+            del buffer[:FRAME_SIZE]
+        out.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file", nargs="?", help="binary capture (default: stdin)")
+    parser.add_argument("--port", help="serial port to read instead of a file")
+    parser.add_argument("--baud", type=int, default=115200)
+    args = parser.parse_args()
+
+    if args.port:
+        import serial  # pyserial, only needed for live decoding
+        port = serial.Serial(args.port, args.baud, timeout=None)
+        try:
+            decode_stream(lambda n: port.read(max(1, min(n, port.in_waiting))), sys.stdout)
+        except KeyboardInterrupt:
+            pass
+    elif args.file:
+        with open(args.file, "rb") as capture:
+            decode_stream(capture.read, sys.stdout)
+    else:
+        decode_stream(sys.stdin.buffer.read, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()